@@ -0,0 +1,231 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "audio_thread.h"
+#include "../thread.h"
+#include "../fifo_buffer.h"
+#include <stdlib.h>
+
+// Samples are always moved in whole stereo frames.
+#define FRAME_SIZE (2 * sizeof(int16_t))
+
+struct audio_thread
+{
+   // The emulation thread is the only producer, and the audio thread the only consumer.
+   fifo_buffer_t *buffer;
+   size_t buffer_size;
+
+   sthread_t *thread;
+   slock_t *lock;
+   scond_t *cond;
+
+   int16_t *chunk;
+   size_t chunk_size;
+   audio_thread_process_t process;
+
+   // Protected by lock.
+   bool alive;
+   bool failed;
+   unsigned locked;
+   bool busy;
+
+   // Only touched by the emulation thread.
+   bool nonblock;
+};
+
+static void audio_thread_loop(void *data)
+{
+   audio_thread_t *thr = (audio_thread_t*)data;
+
+   slock_lock(thr->lock);
+   for (;;)
+   {
+      while (thr->alive && (thr->locked || fifo_read_avail(thr->buffer) < FRAME_SIZE))
+         scond_wait(thr->cond, thr->lock);
+
+      if (!thr->alive)
+         break;
+
+      size_t avail = fifo_read_avail(thr->buffer);
+      if (avail > thr->chunk_size)
+         avail = thr->chunk_size;
+      avail -= avail % FRAME_SIZE;
+
+      fifo_read(thr->buffer, thr->chunk, avail);
+      thr->busy = true;
+
+      // Space was freed up for a blocked writer.
+      scond_signal(thr->cond);
+      slock_unlock(thr->lock);
+
+      bool ret = thr->process(thr->chunk, avail / sizeof(int16_t));
+
+      slock_lock(thr->lock);
+      thr->busy = false;
+      scond_signal(thr->cond);
+
+      if (!ret)
+      {
+         thr->failed = true;
+         break;
+      }
+   }
+   slock_unlock(thr->lock);
+}
+
+audio_thread_t *audio_thread_new(size_t buffer_samples, size_t chunk_samples,
+      audio_thread_process_t process)
+{
+   audio_thread_t *thr = (audio_thread_t*)calloc(1, sizeof(*thr));
+   if (!thr)
+      return NULL;
+
+   thr->buffer_size = buffer_samples * sizeof(int16_t);
+   thr->buffer_size -= thr->buffer_size % FRAME_SIZE;
+   thr->chunk_size  = chunk_samples * sizeof(int16_t);
+   thr->chunk_size -= thr->chunk_size % FRAME_SIZE;
+   thr->process     = process;
+
+   if (!thr->buffer_size || !thr->chunk_size)
+      goto error;
+
+   thr->buffer = fifo_new(thr->buffer_size);
+   thr->chunk  = (int16_t*)malloc(thr->chunk_size);
+   thr->lock   = slock_new();
+   thr->cond   = scond_new();
+   if (!thr->buffer || !thr->chunk || !thr->lock || !thr->cond)
+      goto error;
+
+   thr->alive  = true;
+   thr->thread = sthread_create(audio_thread_loop, thr);
+   if (!thr->thread)
+      goto error;
+
+   return thr;
+
+error:
+   thr->alive = false;
+   audio_thread_free(thr);
+   return NULL;
+}
+
+void audio_thread_free(audio_thread_t *thr)
+{
+   if (!thr)
+      return;
+
+   if (thr->thread)
+   {
+      slock_lock(thr->lock);
+      thr->alive = false;
+      scond_signal(thr->cond);
+      slock_unlock(thr->lock);
+
+      sthread_join(thr->thread);
+   }
+
+   if (thr->lock)
+      slock_free(thr->lock);
+   if (thr->cond)
+      scond_free(thr->cond);
+   if (thr->buffer)
+      fifo_free(thr->buffer);
+   free(thr->chunk);
+   free(thr);
+}
+
+bool audio_thread_write(audio_thread_t *thr, const int16_t *data, size_t samples)
+{
+   const uint8_t *buf = (const uint8_t*)data;
+   size_t size = samples * sizeof(int16_t);
+   bool ret = true;
+
+   while (size)
+   {
+      size_t avail = fifo_write_avail(thr->buffer);
+      avail -= avail % FRAME_SIZE;
+
+      if (!avail)
+      {
+         if (thr->nonblock)
+            break;
+
+         slock_lock(thr->lock);
+         while (!thr->failed && fifo_write_avail(thr->buffer) < FRAME_SIZE)
+            scond_wait(thr->cond, thr->lock);
+         ret = !thr->failed;
+         slock_unlock(thr->lock);
+
+         if (!ret)
+            return false;
+         continue;
+      }
+
+      if (avail > size)
+         avail = size;
+
+      fifo_write(thr->buffer, buf, avail);
+      buf  += avail;
+      size -= avail;
+
+      // Let the audio thread start on this while we copy the rest.
+      if (size)
+      {
+         slock_lock(thr->lock);
+         scond_signal(thr->cond);
+         slock_unlock(thr->lock);
+      }
+   }
+
+   slock_lock(thr->lock);
+   scond_signal(thr->cond);
+   ret = !thr->failed;
+   slock_unlock(thr->lock);
+
+   return ret;
+}
+
+void audio_thread_set_nonblock_state(audio_thread_t *thr, bool state)
+{
+   thr->nonblock = state;
+}
+
+void audio_thread_lock(audio_thread_t *thr)
+{
+   slock_lock(thr->lock);
+   thr->locked++;
+   while (thr->busy)
+      scond_wait(thr->cond, thr->lock);
+   slock_unlock(thr->lock);
+}
+
+void audio_thread_unlock(audio_thread_t *thr)
+{
+   slock_lock(thr->lock);
+   if (thr->locked && --thr->locked == 0)
+      scond_signal(thr->cond);
+   slock_unlock(thr->lock);
+}
+
+size_t audio_thread_write_avail(audio_thread_t *thr)
+{
+   return thr->buffer_size - fifo_read_avail(thr->buffer);
+}
+
+size_t audio_thread_buffer_size(audio_thread_t *thr)
+{
+   return thr->buffer_size;
+}
+
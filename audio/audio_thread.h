@@ -0,0 +1,55 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_THREAD_H
+#define AUDIO_THREAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../boolean.h"
+
+// Moves audio processing and the (blocking) audio driver write off the emulation thread.
+// The emulation thread copies interleaved stereo samples into a lock-free ring,
+// and the audio thread hands them to a process callback in chunks.
+
+typedef struct audio_thread audio_thread_t;
+
+// Called on the audio thread. Returns false if the audio driver failed,
+// which stops the audio thread.
+typedef bool (*audio_thread_process_t)(const int16_t *data, size_t samples);
+
+// buffer_samples is the size of the ring, chunk_samples the most samples passed to process at once.
+audio_thread_t *audio_thread_new(size_t buffer_samples, size_t chunk_samples,
+      audio_thread_process_t process);
+void audio_thread_free(audio_thread_t *thr);
+
+// Copies samples into the ring. Blocks while the ring is full,
+// unless in non-blocking state, where samples which don't fit are dropped.
+// Returns false if the audio thread has failed.
+bool audio_thread_write(audio_thread_t *thr, const int16_t *data, size_t samples);
+void audio_thread_set_nonblock_state(audio_thread_t *thr, bool state);
+
+// Waits for the audio thread to finish the chunk it is processing, and holds it off until
+// the matching audio_thread_unlock(). In between, the audio driver can be called from the
+// emulation thread. Locks nest.
+void audio_thread_lock(audio_thread_t *thr);
+void audio_thread_unlock(audio_thread_t *thr);
+
+// Free space in the ring, in bytes. Used for rate control from within the process callback.
+size_t audio_thread_write_avail(audio_thread_t *thr);
+size_t audio_thread_buffer_size(audio_thread_t *thr);
+
+#endif
+
@@ -19,7 +19,12 @@
 #include <stdlib.h>
 #include <math.h>
 #include "../boolean.h"
+
+#ifndef RESAMPLER_TEST
 #include "../general.h"
+#else
+#define RARCH_LOG(...)
+#endif
 
 #ifdef HAVE_CONFIG_H
 #include "../config.h"
@@ -51,8 +56,9 @@ static inline float hermite_kernel(float mu1, float a, float b, float c, float d
    return (a0 * b) + (a1 * m0) + (a2 * m1) + (a3 * c);
 }
 
-rarch_resampler_t *resampler_new(void)
+rarch_resampler_t *resampler_new(enum resampler_quality quality)
 {
+   (void)quality;
    RARCH_LOG("Hermite resampler [C]\n");
    return (rarch_resampler_t*)calloc(1, sizeof(rarch_resampler_t));
 }
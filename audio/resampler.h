@@ -44,7 +44,18 @@ struct resampler_data
    double ratio;
 };
 
-rarch_resampler_t *resampler_new(void);
+enum resampler_quality
+{
+   RESAMPLER_QUALITY_LOW = 0,
+   RESAMPLER_QUALITY_NORMAL,
+   RESAMPLER_QUALITY_HIGH,
+   RESAMPLER_QUALITY_ULTRA,
+
+   RESAMPLER_QUALITY_LAST
+};
+
+// Quality is a hint. Resamplers with only one mode ignore it.
+rarch_resampler_t *resampler_new(enum resampler_quality quality);
 void resampler_process(rarch_resampler_t *re, struct resampler_data *data);
 void resampler_free(rarch_resampler_t *re);
 
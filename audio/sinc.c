@@ -1,6 +1,6 @@
 /*  RetroArch - A frontend for libretro.
  *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
- * 
+ *
  *  RetroArch is free software: you can redistribute it and/or modify it under the terms
  *  of the GNU General Public License as published by the Free Software Found-
  *  ation, either version 3 of the License, or (at your option) any later version.
@@ -13,10 +13,21 @@
  *  If not, see <http://www.gnu.org/licenses/>.
  */
 
-// Bog-standard windowed SINC implementation.
-// Only suitable as an upsampler, as there is no low-pass filter stage.
+// Polyphase Kaiser-windowed SINC resampler.
+//
+// The filter is stored as a table of phases, with a delta to the next phase for every tap,
+// so that coefficients can be linearly interpolated between phases.
+// This keeps the table small enough to stay in cache, even for long filters.
+//
+// When upsampling, the filter is applied directly from the table.
+// When downsampling, the cutoff is lowered to the output Nyquist frequency, which stretches the
+// filter over more input samples. A second phase table is built for the stretched filter
+// whenever the bandwidth changes, so both directions run the same interpolated path.
+// The filter is always centered at the same point in the history buffer, so switching between
+// the two (e.g. when rate control hovers around 1.0) doesn't cause discontinuities.
 
 #include "resampler.h"
+#include "../boolean.h"
 #include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -24,6 +35,7 @@
 
 #ifndef RESAMPLER_TEST
 #include "../general.h"
+#include "../performance.h"
 #else
 #define RARCH_LOG(...)
 #endif
@@ -32,29 +44,68 @@
 #include <xmmintrin.h>
 #endif
 
-// For the little amount of taps we're using,
-// SSE1 is faster than AVX for some reason.
-// AVX code is kept here though as by increasing number
-// of sinc taps, the AVX code is clearly faster than SSE1.
-#define ENABLE_AVX 0
-
-#if defined(__AVX__) && ENABLE_AVX
+// AVX is selected at runtime, so default x86 builds will use it when the CPU has it.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SINC_HAVE_AVX
+#define SINC_AVX __attribute__((target("avx")))
 #include <immintrin.h>
 #endif
 
-#define PHASE_BITS 16
-#define SUBPHASE_BITS 10
-#define PHASES (1 << (PHASE_BITS + SUBPHASE_BITS))
+// Time is tracked in fixed point. Upper bits select the phase, lower bits interpolate between phases.
+#define TIME_BITS 26
+#define PHASES (1 << TIME_BITS)
+
+// Lowest cutoff used when downsampling, relative to input Nyquist.
+// Below this, some aliasing is let through rather than growing the filter further.
+#define MIN_BANDWIDTH 0.25
+
+// Rate control keeps the ratio within a fraction of a percent of 1.0.
+// Every quality rolls off well before input Nyquist, so this needs no extra filtering.
+#define DOWNSAMPLE_THRESHOLD 0.99
+
+// Bandwidth of the stretched table is rounded down to this step, and the table is kept
+// while the requested bandwidth stays within two steps above it.
+// Rate control then never forces a rebuild, at the cost of a slightly lower cutoff.
+#define DOWNSAMPLE_BANDWIDTH_STEP (1.0 / 128.0)
+
+static const struct sinc_quality
+{
+   const char *ident;
+   unsigned sidelobes; // Filter covers 2 * sidelobes input samples when upsampling.
+   unsigned phase_bits;
+   double cutoff;      // Relative to input Nyquist.
+   double beta;        // Kaiser window parameter, trades stopband attenuation for transition width.
+} sinc_qualities[RESAMPLER_QUALITY_LAST] = {
+   { "low",     8, 8, 0.80,  5.0 },
+   { "normal", 16, 8, 0.87,  6.5 },
+   { "high",   32, 8, 0.91,  9.0 },
+   { "ultra",  64, 8, 0.945, 10.5 },
+};
 
-#define SIDELOBES 8
-#define TAPS (SIDELOBES * 2)
-#define CUTOFF 0.98
+typedef void (*process_sinc_func_t)(float *out, const float *buffer_l, const float *buffer_r,
+      const float *coeff, const float *delta, float frac, unsigned taps);
 
 struct rarch_resampler
 {
-   sample_t phase_table[1 << PHASE_BITS][TAPS];
-   sample_t buffer_l[2 * TAPS];
-   sample_t buffer_r[2 * TAPS];
+   unsigned taps;       // Filter length when upsampling.
+   unsigned max_taps;   // Filter length at MIN_BANDWIDTH, and size of history.
+   unsigned phase_bits;
+   unsigned subphase_bits;
+   float subphase_mod;
+
+   // For every phase, taps coefficients followed by taps deltas to the next phase.
+   float *phase_table;
+
+   // History is written twice, so any window into it is contiguous.
+   float *buffer_l;
+   float *buffer_r;
+
+   // Same layout as phase_table, for the stretched filter used when downsampling.
+   float *down_table;
+   unsigned down_taps;
+   double down_bandwidth;
+
+   process_sinc_func_t process;
 
    unsigned ptr;
    uint32_t time;
@@ -68,23 +119,59 @@ static inline double sinc(double val)
       return sin(val) / val;
 }
 
-static inline double lanzcos(double index)
+// Modified Bessel function of the first kind, order zero.
+// Series converges fast enough for the beta values used here.
+static double besseli0(double x)
 {
-   return sinc(index);
+   double sum  = 0.0;
+   double term = 1.0;
+   double half = 0.5 * x;
+
+   for (unsigned i = 1; i < 32; i++)
+   {
+      sum  += term * term;
+      term *= half / i;
+   }
+
+   return sum;
 }
 
-static void init_sinc_table(rarch_resampler_t *resamp)
+static inline double kaiser_window(double index, double beta)
 {
+   return besseli0(beta * sqrt(1.0 - index * index));
+}
+
+static double filter_response(const struct sinc_quality *q, double t)
+{
+   double window_mod = 1.0 / besseli0(q->beta);
+   double x = t / q->sidelobes;
+   if (fabs(x) >= 1.0)
+      return 0.0;
+
+   return q->cutoff * sinc(M_PI * q->cutoff * t) * kaiser_window(x, q->beta) * window_mod;
+}
+
+static void init_sinc_table(rarch_resampler_t *resamp, const struct sinc_quality *q)
+{
+   unsigned phases = 1 << resamp->phase_bits;
+   unsigned taps   = resamp->taps;
+   int sidelobes   = q->sidelobes;
+
    // Sinc phases: [..., p + 3, p + 2, p + 1, p + 0, p - 1, p - 2, p - 3, p - 4, ...]
-   for (int i = 0; i < (1 << PHASE_BITS); i++)
+   for (unsigned i = 0; i < phases; i++)
    {
-      for (int j = 0; j < TAPS; j++)
+      float *coeff = resamp->phase_table + i * 2 * taps;
+      float *delta = coeff + taps;
+
+      for (unsigned j = 0; j < taps; j++)
       {
-         double p = (double)i / (1 << PHASE_BITS);
-         double sinc_phase = M_PI * (p + (SIDELOBES - 1 - j));
+         double p      = (double)i / phases;
+         double p_next = (double)(i + 1) / phases;
+         double val      = filter_response(q, p + (sidelobes - 1 - (int)j));
+         double val_next = filter_response(q, p_next + (sidelobes - 1 - (int)j));
 
-         float val = CUTOFF * sinc(CUTOFF * sinc_phase) * lanzcos(sinc_phase / SIDELOBES);
-         resamp->phase_table[i][j] = val;
+         coeff[j] = val;
+         delta[j] = val_next - val;
       }
    }
 }
@@ -105,53 +192,51 @@ static void *aligned_alloc__(size_t boundary, size_t size)
 
 static void aligned_free__(void *ptr)
 {
+   if (!ptr)
+      return;
+
    void **p = (void**)ptr;
    free(p[-1]);
 }
 
-rarch_resampler_t *resampler_new(void)
+#ifndef __SSE__
+// Plain ol' C99
+static void process_sinc_c(float *out, const float *buffer_l, const float *buffer_r,
+      const float *coeff, const float *delta, float frac, unsigned taps)
 {
-   rarch_resampler_t *re = (rarch_resampler_t*)aligned_alloc__(1024, sizeof(*re));
-   if (!re)
-      return NULL;
-
-   memset(re, 0, sizeof(*re));
-
-   init_sinc_table(re);
+   float sum_l = 0.0f;
+   float sum_r = 0.0f;
 
-#if defined(__AVX__) && ENABLE_AVX
-   RARCH_LOG("Sinc resampler [AVX]\n");
-#elif defined(__SSE__)
-   RARCH_LOG("Sinc resampler [SSE]\n");
-#elif defined(HAVE_NEON)
-   RARCH_LOG("Sinc resampler [NEON]\n");
-#else
-   RARCH_LOG("Sinc resampler [C]\n");
-#endif
+   for (unsigned i = 0; i < taps; i++)
+   {
+      float sinc_val = coeff[i] + delta[i] * frac;
+      sum_l         += buffer_l[i] * sinc_val;
+      sum_r         += buffer_r[i] * sinc_val;
+   }
 
-   return re;
+   out[0] = sum_l;
+   out[1] = sum_r;
 }
+#endif
 
-#if defined(__AVX__) && ENABLE_AVX
-static void process_sinc(rarch_resampler_t *resamp, float *out_buffer)
+#ifdef SINC_HAVE_AVX
+static SINC_AVX void process_sinc_avx(float *out, const float *buffer_l, const float *buffer_r,
+      const float *coeff, const float *delta, float frac, unsigned taps)
 {
-   __m256 sum_l = _mm256_setzero_ps();
-   __m256 sum_r = _mm256_setzero_ps();
-
-   const float *buffer_l = resamp->buffer_l + resamp->ptr;
-   const float *buffer_r = resamp->buffer_r + resamp->ptr;
+   __m256 sum_l  = _mm256_setzero_ps();
+   __m256 sum_r  = _mm256_setzero_ps();
+   __m256 frac_v = _mm256_set1_ps(frac);
 
-   unsigned phase = resamp->time >> SUBPHASE_BITS;
-   const float *phase_table = resamp->phase_table[phase];
-
-   for (unsigned i = 0; i < TAPS; i += 8)
+   for (unsigned i = 0; i < taps; i += 8)
    {
       __m256 buf_l = _mm256_loadu_ps(buffer_l + i);
       __m256 buf_r = _mm256_loadu_ps(buffer_r + i);
 
-      __m256 sinc = _mm256_load_ps(phase_table + i);
-      sum_l       = _mm256_add_ps(sum_l, _mm256_mul_ps(buf_l, sinc));
-      sum_r       = _mm256_add_ps(sum_r, _mm256_mul_ps(buf_r, sinc));
+      __m256 sinc = _mm256_add_ps(_mm256_load_ps(coeff + i),
+            _mm256_mul_ps(_mm256_load_ps(delta + i), frac_v));
+
+      sum_l = _mm256_add_ps(sum_l, _mm256_mul_ps(buf_l, sinc));
+      sum_r = _mm256_add_ps(sum_r, _mm256_mul_ps(buf_r, sinc));
    }
 
    // hadd on AVX is weird, and acts on low-lanes and high-lanes separately.
@@ -164,29 +249,29 @@ static void process_sinc(rarch_resampler_t *resamp, float *out_buffer)
 
    // This is optimized to mov %xmmN, [mem].
    // There doesn't seem to be any _mm256_store_ss intrinsic.
-   _mm_store_ss(out_buffer + 0, _mm256_extractf128_ps(res_l, 0));
-   _mm_store_ss(out_buffer + 1, _mm256_extractf128_ps(res_r, 0));
+   _mm_store_ss(out + 0, _mm256_extractf128_ps(res_l, 0));
+   _mm_store_ss(out + 1, _mm256_extractf128_ps(res_r, 0));
 }
-#elif defined(__SSE__)
-static void process_sinc(rarch_resampler_t *resamp, float *out_buffer)
-{
-   __m128 sum_l = _mm_setzero_ps();
-   __m128 sum_r = _mm_setzero_ps();
-
-   const float *buffer_l = resamp->buffer_l + resamp->ptr;
-   const float *buffer_r = resamp->buffer_r + resamp->ptr;
+#endif
 
-   unsigned phase = resamp->time >> SUBPHASE_BITS;
-   const float *phase_table = resamp->phase_table[phase];
+#if defined(__SSE__)
+static void process_sinc_sse(float *out, const float *buffer_l, const float *buffer_r,
+      const float *coeff, const float *delta, float frac, unsigned taps)
+{
+   __m128 sum_l  = _mm_setzero_ps();
+   __m128 sum_r  = _mm_setzero_ps();
+   __m128 frac_v = _mm_set1_ps(frac);
 
-   for (unsigned i = 0; i < TAPS; i += 4)
+   for (unsigned i = 0; i < taps; i += 4)
    {
       __m128 buf_l = _mm_loadu_ps(buffer_l + i);
       __m128 buf_r = _mm_loadu_ps(buffer_r + i);
 
-      __m128 sinc = _mm_load_ps(phase_table + i);
-      sum_l       = _mm_add_ps(sum_l, _mm_mul_ps(buf_l, sinc));
-      sum_r       = _mm_add_ps(sum_r, _mm_mul_ps(buf_r, sinc));
+      __m128 sinc = _mm_add_ps(_mm_load_ps(coeff + i),
+            _mm_mul_ps(_mm_load_ps(delta + i), frac_v));
+
+      sum_l = _mm_add_ps(sum_l, _mm_mul_ps(buf_l, sinc));
+      sum_r = _mm_add_ps(sum_r, _mm_mul_ps(buf_r, sinc));
    }
 
    // Them annoying shuffles :V
@@ -202,56 +287,200 @@ static void process_sinc(rarch_resampler_t *resamp, float *out_buffer)
    sum = _mm_add_ps(_mm_shuffle_ps(sum, sum, _MM_SHUFFLE(3, 3, 1, 1)), sum);
 
    // sum   = {R1, R1, L1, L1 } + { R1, R0, L1, L0 }
-   // sum   = { X,  R,  X,  L } 
+   // sum   = { X,  R,  X,  L }
 
    // Store L
-   _mm_store_ss(out_buffer + 0, sum);
+   _mm_store_ss(out + 0, sum);
 
    // movehl { X, R, X, L } == { X, R, X, R }
-   _mm_store_ss(out_buffer + 1, _mm_movehl_ps(sum, sum));
+   _mm_store_ss(out + 1, _mm_movehl_ps(sum, sum));
 }
 #elif defined(HAVE_NEON)
-void process_sinc_neon_asm(float *out, const float *left, const float *right, const float *coeff);
-static void process_sinc(rarch_resampler_t *resamp, float *out_buffer)
+// frac is passed by pointer, so the call is the same for softfp and hardfp ABIs.
+void process_sinc_neon_asm(float *out, const float *left, const float *right,
+      const float *coeff, unsigned taps, const float *frac);
+
+static void process_sinc_neon(float *out, const float *buffer_l, const float *buffer_r,
+      const float *coeff, const float *delta, float frac, unsigned taps)
 {
-   const float *buffer_l = resamp->buffer_l + resamp->ptr;
-   const float *buffer_r = resamp->buffer_r + resamp->ptr;
+   // The asm expects deltas right after the coefficients.
+   if (delta == coeff + taps)
+      process_sinc_neon_asm(out, buffer_l, buffer_r, coeff, taps, &frac);
+   else
+      process_sinc_c(out, buffer_l, buffer_r, coeff, delta, frac, taps);
+}
+#endif
 
-   unsigned phase = resamp->time >> SUBPHASE_BITS;
-   const float *phase_table = resamp->phase_table[phase];
+static const char *select_process_sinc(rarch_resampler_t *re)
+{
+#ifdef SINC_HAVE_AVX
+#ifdef RESAMPLER_TEST
+   bool have_avx = __builtin_cpu_supports("avx");
+#else
+   struct rarch_cpu_features cpu;
+   rarch_get_cpu_features(&cpu);
+   bool have_avx = cpu.simd & RARCH_SIMD_AVX;
+#endif
+
+   if (have_avx)
+   {
+      re->process = process_sinc_avx;
+      return "AVX";
+   }
+#endif
 
-   process_sinc_neon_asm(out_buffer, buffer_l, buffer_r, phase_table);
+#if defined(__SSE__)
+   re->process = process_sinc_sse;
+   return "SSE";
+#elif defined(HAVE_NEON)
+   re->process = process_sinc_neon;
+   return "NEON";
+#else
+   re->process = process_sinc_c;
+   return "C";
+#endif
 }
-#else // Plain ol' C99
-static void process_sinc(rarch_resampler_t *resamp, float *out_buffer)
+
+void resampler_free(rarch_resampler_t *re)
 {
-   float sum_l = 0.0f;
-   float sum_r = 0.0f;
-   const float *buffer_l = resamp->buffer_l + resamp->ptr;
-   const float *buffer_r = resamp->buffer_r + resamp->ptr;
+   if (!re)
+      return;
+
+   aligned_free__(re->phase_table);
+   aligned_free__(re->buffer_l);
+   aligned_free__(re->buffer_r);
+   aligned_free__(re->down_table);
+   free(re);
+}
+
+rarch_resampler_t *resampler_new(enum resampler_quality quality)
+{
+   if (quality >= RESAMPLER_QUALITY_LAST)
+      quality = RESAMPLER_QUALITY_NORMAL;
+
+   const struct sinc_quality *q = &sinc_qualities[quality];
+
+   rarch_resampler_t *re = (rarch_resampler_t*)calloc(1, sizeof(*re));
+   if (!re)
+      return NULL;
+
+   re->taps          = q->sidelobes * 2;
+   re->max_taps      = (unsigned)(re->taps / MIN_BANDWIDTH);
+   re->phase_bits    = q->phase_bits;
+   re->subphase_bits = TIME_BITS - q->phase_bits;
+   re->subphase_mod  = 1.0f / (1 << re->subphase_bits);
+
+   size_t table_size = (size_t)(1 << re->phase_bits) * 2 * re->taps * sizeof(float);
+
+   re->phase_table = (float*)aligned_alloc__(32, table_size);
+   re->buffer_l    = (float*)aligned_alloc__(32, 2 * re->max_taps * sizeof(float));
+   re->buffer_r    = (float*)aligned_alloc__(32, 2 * re->max_taps * sizeof(float));
+   re->down_table  = (float*)aligned_alloc__(32,
+         (size_t)(1 << re->phase_bits) * 2 * re->max_taps * sizeof(float));
 
-   unsigned phase = resamp->time >> SUBPHASE_BITS;
-   const float *phase_table = resamp->phase_table[phase];
+   if (!re->phase_table || !re->buffer_l || !re->buffer_r || !re->down_table)
+      goto error;
 
-   for (unsigned i = 0; i < TAPS; i++)
+   memset(re->buffer_l, 0, 2 * re->max_taps * sizeof(float));
+   memset(re->buffer_r, 0, 2 * re->max_taps * sizeof(float));
+
+   init_sinc_table(re, q);
+
+   const char *simd = select_process_sinc(re);
+   (void)simd;
+   RARCH_LOG("Sinc resampler [%s], quality: %s, %u taps, %u KiB table.\n",
+         simd, q->ident, re->taps, (unsigned)(table_size >> 10));
+
+   return re;
+
+error:
+   resampler_free(re);
+   return NULL;
+}
+
+// Builds the filter for a lowered cutoff. Coefficients are looked up in the phase table
+// at bandwidth times the distance from the filter center, and scaled by bandwidth for unity gain.
+static void build_downsample_kernel(rarch_resampler_t *re, float *kernel,
+      unsigned taps, double bandwidth, double frac)
+{
+   unsigned phases = 1 << re->phase_bits;
+   int end         = (int)(re->taps << re->phase_bits);
+
+   // Position in the table, in phases, counted from the start of the filter.
+   double pos  = (bandwidth * (frac + taps / 2 - 1) + re->taps / 2) * phases;
+   double step = bandwidth * phases;
+
+   for (unsigned j = 0; j < taps; j++, pos -= step)
    {
-      float sinc_val = phase_table[i];
-      sum_l         += buffer_l[i] * sinc_val;
-      sum_r         += buffer_r[i] * sinc_val;
+      int index = (int)floor(pos);
+      if (index < 0 || index >= end)
+      {
+         kernel[j] = 0.0f;
+         continue;
+      }
+
+      unsigned tap   = re->taps - 1 - (index >> re->phase_bits);
+      unsigned phase = index & (phases - 1);
+      float phase_frac = pos - index;
+
+      const float *coeff = re->phase_table + phase * 2 * re->taps;
+      kernel[j] = bandwidth * (coeff[tap] + coeff[re->taps + tap] * phase_frac);
    }
+}
+
+// Samples the stretched filter at every phase, with deltas to the next one.
+static void init_downsample_table(rarch_resampler_t *re, unsigned taps, double bandwidth)
+{
+   unsigned phases = 1 << re->phase_bits;
 
-   out_buffer[0] = sum_l;
-   out_buffer[1] = sum_r;
+   for (unsigned i = 0; i < phases; i++)
+   {
+      float *coeff = re->down_table + i * 2 * taps;
+      float *delta = coeff + taps;
+
+      build_downsample_kernel(re, coeff, taps, bandwidth, (double)i / phases);
+      build_downsample_kernel(re, delta, taps, bandwidth, (double)(i + 1) / phases);
+      for (unsigned j = 0; j < taps; j++)
+         delta[j] -= coeff[j];
+   }
+
+   re->down_taps      = taps;
+   re->down_bandwidth = bandwidth;
 }
-#endif
 
 void resampler_process(rarch_resampler_t *re, struct resampler_data *data)
 {
-   // If data->ratio is < 1, we are downsampling.
-   // The sinc table is not set up for this, as it always assumes upsampling.
-   // Downsampling will work, but with some added noise due to aliasing might be present.
    uint32_t ratio = PHASES / data->ratio;
 
+   // If data->ratio is < 1, we are downsampling, and need to lower the cutoff.
+   double bandwidth = data->ratio < DOWNSAMPLE_THRESHOLD ? data->ratio : 1.0;
+   if (bandwidth < MIN_BANDWIDTH)
+      bandwidth = MIN_BANDWIDTH;
+
+   unsigned taps      = re->taps;
+   const float *table = re->phase_table;
+   if (bandwidth < 1.0)
+   {
+      if (bandwidth < re->down_bandwidth ||
+            bandwidth >= re->down_bandwidth + 2.0 * DOWNSAMPLE_BANDWIDTH_STEP)
+      {
+         bandwidth = floor(bandwidth / DOWNSAMPLE_BANDWIDTH_STEP) * DOWNSAMPLE_BANDWIDTH_STEP;
+
+         // Filter length is kept a multiple of 8 for SIMD.
+         unsigned down_taps = ((unsigned)ceil(re->taps / bandwidth) + 7) & ~7;
+         if (down_taps > re->max_taps)
+            down_taps = re->max_taps;
+
+         init_downsample_table(re, down_taps, bandwidth);
+      }
+
+      taps  = re->down_taps;
+      table = re->down_table;
+   }
+
+   // Window into history is centered at the middle of it regardless of filter length.
+   unsigned window = (re->max_taps - taps) / 2;
+
    const sample_t *input = data->data_in;
    sample_t *output      = data->data_out;
    size_t frames         = data->input_frames;
@@ -261,9 +490,9 @@ void resampler_process(rarch_resampler_t *re, struct resampler_data *data)
    {
       while (frames && re->time >= PHASES)
       {
-         re->buffer_l[re->ptr + TAPS] = re->buffer_l[re->ptr] = *input++;
-         re->buffer_r[re->ptr + TAPS] = re->buffer_r[re->ptr] = *input++;
-         re->ptr = (re->ptr + 1) & (TAPS - 1);
+         re->buffer_l[re->ptr + re->max_taps] = re->buffer_l[re->ptr] = *input++;
+         re->buffer_r[re->ptr + re->max_taps] = re->buffer_r[re->ptr] = *input++;
+         re->ptr = (re->ptr + 1) & (re->max_taps - 1);
 
          re->time -= PHASES;
          frames--;
@@ -271,7 +500,15 @@ void resampler_process(rarch_resampler_t *re, struct resampler_data *data)
 
       while (re->time < PHASES)
       {
-         process_sinc(re, output);
+         const float *buffer_l = re->buffer_l + re->ptr + window;
+         const float *buffer_r = re->buffer_r + re->ptr + window;
+
+         unsigned phase = re->time >> re->subphase_bits;
+         float frac     = (re->time & ((1 << re->subphase_bits) - 1)) * re->subphase_mod;
+
+         const float *coeff = table + phase * 2 * taps;
+         re->process(output, buffer_l, buffer_r, coeff, coeff + taps, frac, taps);
+
          output += 2;
          out_frames++;
          re->time += ratio;
@@ -281,8 +518,3 @@ void resampler_process(rarch_resampler_t *re, struct resampler_data *data)
    data->output_frames = out_frames;
 }
 
-void resampler_free(rarch_resampler_t *re)
-{
-   aligned_free__(re);
-}
-
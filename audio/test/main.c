@@ -29,9 +29,9 @@ int main(int argc, char *argv[])
    float input_f[1024];
    float output_f[1024 * 8];
 
-   if (argc != 3)
+   if (argc != 3 && argc != 4)
    {
-      fprintf(stderr, "Usage: %s <in-rate> <out-rate> (max ratio: 8.0)\n", argv[0]);
+      fprintf(stderr, "Usage: %s <in-rate> <out-rate> [quality] (max ratio: 8.0)\n", argv[0]);
       return 1;
    }
 
@@ -45,7 +45,10 @@ int main(int argc, char *argv[])
       return 1;
    }
 
-   rarch_resampler_t *resamp = resampler_new();
+   enum resampler_quality quality = argc == 4 ?
+      (enum resampler_quality)strtoul(argv[3], NULL, 0) : RESAMPLER_QUALITY_NORMAL;
+
+   rarch_resampler_t *resamp = resampler_new(quality);
    if (!resamp)
    {
       fprintf(stderr, "Failed to allocate resampler ...\n");
@@ -22,6 +22,7 @@
 #include <string.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <time.h>
 
 static void gen_signal(float *out, double omega, double bias_samples, size_t samples)
 {
@@ -232,52 +233,75 @@ static void calculate_snr(struct snr_result *res,
       res->alias_power[i] = 10.0 * log10(res->alias_power[i]);
 }
 
-int main(int argc, char *argv[])
+// Total power left in the output, for tones the resampler should have filtered out.
+static double calculate_residual(const float *resamp, complex double *butterfly_buf,
+      unsigned max_rate, size_t samples)
 {
-   if (argc != 2)
-   {
-      fprintf(stderr, "Usage: %s <ratio> (out-rate is fixed for FFT).\n", argv[0]);
-      return 1;
-   }
+   samples >>= 1;
+   calculate_fft(resamp, butterfly_buf, samples);
+   calculate_fft_adjust(butterfly_buf, 1.0 / samples, true, samples);
 
-   double ratio = strtod(argv[1], NULL);
+   double power = 0.0;
+   for (unsigned i = 0; i <= max_rate; i++)
+      power += cabs(butterfly_buf[i] * butterfly_buf[i]);
 
-   const unsigned fft_samples = 1024 * 128;
-   unsigned out_rate = fft_samples / 2;
-   unsigned in_rate = out_rate / ratio;
-   ratio = (double)out_rate / in_rate;
+   return 10.0 * log10(power + 1e-30);
+}
 
-   if (ratio <= 1.0)
-   {
-      fprintf(stderr, "Ratio too low ...\n");
-      return 1;
-   }
+static double get_time(void)
+{
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return tv.tv_sec + tv.tv_nsec / 1000000000.0;
+}
 
-   static const float freq_list[] = {
-      0.001, 0.002, 0.003, 0.004, 0.005, 0.006, 0.007, 0.008, 0.009,
-      0.010, 0.015, 0.020, 0.025, 0.030, 0.035, 0.040, 0.045, 0.050,
-      0.060, 0.070, 0.080, 0.090,
-      0.10, 0.15, 0.20, 0.25, 0.30, 0.35,
-      0.40, 0.41, 0.42, 0.43, 0.44, 0.45,
-      0.46, 0.47, 0.48, 0.49,
-      0.495, 0.496, 0.497, 0.498, 0.499,
-   };
+static const float freq_list[] = {
+   0.001, 0.002, 0.003, 0.004, 0.005, 0.006, 0.007, 0.008, 0.009,
+   0.010, 0.015, 0.020, 0.025, 0.030, 0.035, 0.040, 0.045, 0.050,
+   0.060, 0.070, 0.080, 0.090,
+   0.10, 0.15, 0.20, 0.25, 0.30, 0.35,
+   0.40, 0.41, 0.42, 0.43, 0.44, 0.45,
+   0.46, 0.47, 0.48, 0.49,
+   0.495, 0.496, 0.497, 0.498, 0.499,
+};
+
+static const char *quality_names[RESAMPLER_QUALITY_LAST] = {
+   "low", "normal", "high", "ultra",
+};
+
+struct quality_result
+{
+   double worst_snr;      // In passband, i.e. below 40% of the lowest sampling rate.
+   double worst_residual; // Worst stopband leakage when downsampling.
+   double frames_per_sec;
+};
 
+static void test_quality(struct quality_result *result, enum resampler_quality quality,
+      unsigned in_rate, unsigned out_rate, double ratio, bool verbose)
+{
+   const unsigned fft_samples = out_rate * 2;
    unsigned samples = in_rate * 4;
    float *input = calloc(sizeof(float), samples);
-   float *output = calloc(sizeof(float), (fft_samples + 1) * 2);
+   // A few extra frames, as output length depends on resampler state.
+   float *output = calloc(sizeof(float), (fft_samples + 64) * 2);
    complex double *butterfly_buf = calloc(sizeof(complex double), fft_samples / 2);
    assert(input);
    assert(output);
+   assert(butterfly_buf);
 
-   rarch_resampler_t *re = resampler_new();
-   assert(re);
+   unsigned nyquist = (in_rate < out_rate ? in_rate : out_rate) / 2;
 
-   test_fft();
+   result->worst_snr = 1000.0;
+   result->worst_residual = -1000.0;
+
+   double process_time = 0.0;
+   size_t processed = 0;
 
-   printf("Omega,SNR,Gain\n");
    for (unsigned i = 0; i < sizeof(freq_list) / sizeof(freq_list[0]); i++)
    {
+      rarch_resampler_t *re = resampler_new(quality);
+      assert(re);
+
       unsigned freq = freq_list[i] * in_rate;
       double omega = 2.0 * M_PI * freq / in_rate;
       gen_signal(input, omega, 0, samples);
@@ -289,27 +313,106 @@ int main(int argc, char *argv[])
          .ratio = ratio,
       };
 
+      double start = get_time();
       resampler_process(re, &data);
+      process_time += get_time() - start;
+      processed += data.input_frames;
+
+      resampler_free(re);
 
       unsigned out_samples = data.output_frames * 2;
       assert(out_samples >= fft_samples * 2);
 
       // We generate 2 seconds worth of audio, however, only the last second is considered so phase has stabilized.
-      struct snr_result res;
-      calculate_snr(&res, freq, in_rate / 2, output + fft_samples, butterfly_buf, fft_samples);
+      if (freq < nyquist)
+      {
+         struct snr_result res;
+         calculate_snr(&res, freq, nyquist, output + fft_samples, butterfly_buf, fft_samples);
+
+         if (freq < 0.8 * nyquist && res.snr < result->worst_snr)
+            result->worst_snr = res.snr;
+
+         if (verbose)
+         {
+            printf("SNR @ w = %5.3f : %6.2lf dB, Gain: %6.1lf dB\n",
+                  freq_list[i], res.snr, res.gain);
+
+            printf("\tAliases: #1 (w = %5.3f, %6.2lf dB), #2 (w = %5.3f, %6.2lf dB), #3 (w = %5.3f, %6.2lf dB)\n",
+                  res.alias_freq[0] / (float)in_rate, res.alias_power[0],
+                  res.alias_freq[1] / (float)in_rate, res.alias_power[1],
+                  res.alias_freq[2] / (float)in_rate, res.alias_power[2]);
+         }
+      }
+      else
+      {
+         // Tone is above output Nyquist, everything left in the output is aliasing.
+         double residual = calculate_residual(output + fft_samples, butterfly_buf, nyquist, fft_samples);
 
-      printf("SNR @ w = %5.3f : %6.2lf dB, Gain: %6.1lf dB\n",
-            freq_list[i], res.snr, res.gain);
+         if (freq > 1.2 * nyquist && residual > result->worst_residual)
+            result->worst_residual = residual;
 
-      printf("\tAliases: #1 (w = %5.3f, %6.2lf dB), #2 (w = %5.3f, %6.2lf dB), #3 (w = %5.3f, %6.2lf dB)\n",
-            res.alias_freq[0] / (float)in_rate, res.alias_power[0],
-            res.alias_freq[1] / (float)in_rate, res.alias_power[1],
-            res.alias_freq[2] / (float)in_rate, res.alias_power[2]);
+         if (verbose)
+            printf("Stopband @ w = %5.3f : %6.2lf dB\n", freq_list[i], residual);
+      }
    }
 
-   resampler_free(re);
+   result->frames_per_sec = processed / process_time;
+
    free(input);
    free(output);
    free(butterfly_buf);
 }
 
+int main(int argc, char *argv[])
+{
+   if (argc != 2 && argc != 3)
+   {
+      fprintf(stderr, "Usage: %s <ratio> [quality] (out-rate is fixed for FFT).\n", argv[0]);
+      fprintf(stderr, "Without quality (0 - %d), all qualities are compared.\n", RESAMPLER_QUALITY_LAST - 1);
+      return 1;
+   }
+
+   double ratio = strtod(argv[1], NULL);
+
+   const unsigned fft_samples = 1024 * 128;
+   unsigned out_rate = fft_samples / 2;
+   unsigned in_rate = out_rate / ratio;
+   ratio = (double)out_rate / in_rate;
+
+   if (ratio < 0.25 || ratio > 8.0)
+   {
+      fprintf(stderr, "Ratio must be within [0.25, 8.0] ...\n");
+      return 1;
+   }
+
+   test_fft();
+
+   if (argc == 3)
+   {
+      unsigned quality = strtoul(argv[2], NULL, 0);
+      if (quality >= RESAMPLER_QUALITY_LAST)
+      {
+         fprintf(stderr, "Invalid quality.\n");
+         return 1;
+      }
+
+      struct quality_result res;
+      test_quality(&res, quality, in_rate, out_rate, ratio, true);
+      printf("Throughput: %.2f Mframes/s\n", res.frames_per_sec / 1000000.0);
+      return 0;
+   }
+
+   printf("Ratio %.4f, passband is below 0.8 * Nyquist, stopband above 1.2 * Nyquist.\n", ratio);
+   for (unsigned i = 0; i < RESAMPLER_QUALITY_LAST; i++)
+   {
+      struct quality_result res;
+      test_quality(&res, i, in_rate, out_rate, ratio, false);
+
+      printf("%-6s: worst passband SNR: %6.2f dB", quality_names[i], res.worst_snr);
+      if (res.worst_residual > -1000.0)
+         printf(", worst stopband: %7.2f dB", res.worst_residual);
+      printf(", throughput: %6.2f Mframes/s\n", res.frames_per_sec / 1000000.0);
+   }
+
+   return 0;
+}
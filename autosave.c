@@ -21,65 +21,179 @@
 #include <stdio.h>
 #include "general.h"
 
+// SRAM is tracked in blocks of this size. Only blocks which changed are copied out and written.
+#define AUTOSAVE_BLOCK_SIZE 4096
+
 struct autosave
 {
    volatile bool quit;
-   slock_t *lock;
+   volatile bool request; // Set by the thread when it wants the dirty blocks copied out.
 
-   slock_t *cond_lock;
+   slock_t *lock;
    scond_t *cond;
    sthread_t *thread;
 
-   void *buffer;
+   // Only touched by the main thread while request is set, otherwise only by the autosave thread.
+   uint8_t *buffer;
+   bool *dirty;
+
    const void *retro_buffer;
    const char *path;
    size_t bufsize;
    unsigned interval;
+   size_t num_blocks;
+
+   bool synced; // The file on disk was written completely by us, so writing single blocks is enough.
+   bool retry; // Last write failed.
 };
 
+static size_t block_size(const autosave_t *save, size_t block)
+{
+   size_t offset = block * AUTOSAVE_BLOCK_SIZE;
+   size_t size = save->bufsize - offset;
+   return size < AUTOSAVE_BLOCK_SIZE ? size : AUTOSAVE_BLOCK_SIZE;
+}
+
+// Compares SRAM against the last copy, and marks blocks which changed.
+// Runs on the autosave thread while the core might write SRAM. A block changed while it
+// is compared is either copied out now, or found on the next interval.
+static size_t find_dirty_blocks(autosave_t *save)
+{
+   const uint8_t *retro_buffer = (const uint8_t*)save->retro_buffer;
+
+   size_t count = 0;
+   for (size_t i = 0; i < save->num_blocks; i++)
+   {
+      size_t offset = i * AUTOSAVE_BLOCK_SIZE;
+      save->dirty[i] = memcmp(save->buffer + offset, retro_buffer + offset, block_size(save, i)) != 0;
+      count += save->dirty[i];
+   }
+
+   return count;
+}
+
+// Called between frames, so the copied blocks are consistent with each other.
+static void copy_dirty_blocks(autosave_t *save)
+{
+   const uint8_t *retro_buffer = (const uint8_t*)save->retro_buffer;
+
+   for (size_t i = 0; i < save->num_blocks; )
+   {
+      if (!save->dirty[i])
+      {
+         i++;
+         continue;
+      }
+
+      size_t start = i;
+      size_t size = 0;
+      for (; i < save->num_blocks && save->dirty[i]; i++)
+         size += block_size(save, i);
+
+      size_t offset = start * AUTOSAVE_BLOCK_SIZE;
+      memcpy(save->buffer + offset, retro_buffer + offset, size);
+   }
+}
+
+static bool write_full(const autosave_t *save)
+{
+   FILE *file = fopen(save->path, "wb");
+   if (!file)
+      return false;
+
+   bool failed = false;
+   failed |= fwrite(save->buffer, 1, save->bufsize, file) != save->bufsize;
+   failed |= fflush(file) != 0;
+   failed |= fclose(file) != 0;
+   return !failed;
+}
+
+// Writes each run of dirty blocks in place.
+static bool write_dirty(const autosave_t *save)
+{
+   FILE *file = fopen(save->path, "r+b");
+   if (!file)
+      return false;
+
+   bool failed = false;
+   for (size_t i = 0; i < save->num_blocks && !failed; )
+   {
+      if (!save->dirty[i])
+      {
+         i++;
+         continue;
+      }
+
+      size_t start = i;
+      size_t size = 0;
+      for (; i < save->num_blocks && save->dirty[i]; i++)
+         size += block_size(save, i);
+
+      size_t offset = start * AUTOSAVE_BLOCK_SIZE;
+      failed |= fseek(file, offset, SEEK_SET) != 0;
+      failed |= fwrite(save->buffer + offset, 1, size, file) != size;
+   }
+
+   failed |= fflush(file) != 0;
+   failed |= fclose(file) != 0;
+   return !failed;
+}
+
+static void autosave_save(autosave_t *save, size_t count, bool *first_log)
+{
+   // Avoid spamming down stderr ... :)
+   if (*first_log)
+   {
+      RARCH_LOG("Autosaving SRAM to \"%s\", will continue to check every %u seconds ...\n", save->path, save->interval);
+      *first_log = false;
+   }
+   else
+      RARCH_LOG("SRAM changed ... autosaving %u of %u blocks ...\n", (unsigned)count, (unsigned)save->num_blocks);
+
+   // The first save rewrites the file, as we cannot know if it matches what was loaded.
+   bool ok = save->synced && !save->retry ? write_dirty(save) : write_full(save);
+
+   save->synced = ok;
+   save->retry = !ok;
+   if (!ok)
+      RARCH_WARN("Failed to autosave SRAM. Disk might be full.\n");
+}
+
 static void autosave_thread(void *data)
 {
    autosave_t *save = (autosave_t*)data;
 
    bool first_log = true;
 
+   slock_lock(save->lock);
    while (!save->quit)
    {
-      autosave_lock(save);
-      bool differ = memcmp(save->buffer, save->retro_buffer, save->bufsize) != 0;
-      if (differ)
-         memcpy(save->buffer, save->retro_buffer, save->bufsize);
-      autosave_unlock(save);
+      scond_wait_timeout(save->cond, save->lock, save->interval * 1000);
+      if (save->quit)
+         break;
+
+      slock_unlock(save->lock);
+      size_t count = find_dirty_blocks(save);
+      slock_lock(save->lock);
 
-      if (differ)
+      if (!count && !save->retry)
+         continue;
+
+      // Dirty blocks are copied out by the main thread between frames, so running a frame never waits on us.
+      if (count)
       {
-         // Should probably deal with this more elegantly.
-         FILE *file = fopen(save->path, "wb");
-         if (file)
-         {
-            // Avoid spamming down stderr ... :)
-            if (first_log)
-            {
-               RARCH_LOG("Autosaving SRAM to \"%s\", will continue to check every %u seconds ...\n", save->path, save->interval);
-               first_log = false;
-            }
-            else
-               RARCH_LOG("SRAM changed ... autosaving ...\n");
-
-            bool failed = false;
-            failed |= fwrite(save->buffer, 1, save->bufsize, file) != save->bufsize;
-            failed |= fflush(file) != 0;
-            failed |= fclose(file) != 0;
-            if (failed)
-               RARCH_WARN("Failed to autosave SRAM. Disk might be full.\n");
-         }
+         save->request = true;
+         while (save->request && !save->quit)
+            scond_wait(save->cond, save->lock);
+         if (save->request)
+            break;
       }
 
-      slock_lock(save->cond_lock);
-      if (!save->quit)
-         scond_wait_timeout(save->cond, save->cond_lock, save->interval * 1000);
-      slock_unlock(save->cond_lock);
+      slock_unlock(save->lock);
+      autosave_save(save, count, &first_log);
+      slock_lock(save->lock);
    }
+   slock_unlock(save->lock);
 }
 
 autosave_t *autosave_new(const char *path, const void *data, size_t size, unsigned interval)
@@ -91,18 +205,21 @@ autosave_t *autosave_new(const char *path, const void *data, size_t size, unsign
    handle->bufsize = size;
    handle->interval = interval;
    handle->path = path;
-   handle->buffer = malloc(size);
+   handle->buffer = (uint8_t*)malloc(size);
    handle->retro_buffer = data;
+   handle->num_blocks = (size + AUTOSAVE_BLOCK_SIZE - 1) / AUTOSAVE_BLOCK_SIZE;
+   handle->dirty = (bool*)calloc(handle->num_blocks, sizeof(bool));
 
-   if (!handle->buffer)
+   if (!handle->buffer || !handle->dirty)
    {
+      free(handle->buffer);
+      free(handle->dirty);
       free(handle);
       return NULL;
    }
    memcpy(handle->buffer, handle->retro_buffer, handle->bufsize);
 
    handle->lock = slock_new();
-   handle->cond_lock = slock_new();
    handle->cond = scond_new();
 
    handle->thread = sthread_create(autosave_thread, handle);
@@ -110,48 +227,42 @@ autosave_t *autosave_new(const char *path, const void *data, size_t size, unsign
    return handle;
 }
 
-void autosave_lock(autosave_t *handle)
+void autosave_update(autosave_t *handle)
 {
-   slock_lock(handle->lock);
-}
+   if (!handle->request)
+      return;
 
-void autosave_unlock(autosave_t *handle)
-{
+   slock_lock(handle->lock);
+   if (handle->request)
+   {
+      copy_dirty_blocks(handle);
+      handle->request = false;
+      scond_signal(handle->cond);
+   }
    slock_unlock(handle->lock);
 }
 
 void autosave_free(autosave_t *handle)
 {
-   slock_lock(handle->cond_lock);
+   slock_lock(handle->lock);
    handle->quit = true;
-   slock_unlock(handle->cond_lock);
    scond_signal(handle->cond);
+   slock_unlock(handle->lock);
    sthread_join(handle->thread);
 
    slock_free(handle->lock);
-   slock_free(handle->cond_lock);
    scond_free(handle->cond);
 
    free(handle->buffer);
+   free(handle->dirty);
    free(handle);
 }
 
-void lock_autosave(void)
-{
-   for (unsigned i = 0; i < sizeof(g_extern.autosave)/sizeof(g_extern.autosave[0]); i++)
-   {
-      if (g_extern.autosave[i])
-         autosave_lock(g_extern.autosave[i]);
-   }
-}
-
-void unlock_autosave(void)
+void update_autosave(void)
 {
    for (unsigned i = 0; i < sizeof(g_extern.autosave)/sizeof(g_extern.autosave[0]); i++)
    {
       if (g_extern.autosave[i])
-         autosave_unlock(g_extern.autosave[i]);
+         autosave_update(g_extern.autosave[i]);
    }
 }
-
-
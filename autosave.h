@@ -1,6 +1,6 @@
 /*  RetroArch - A frontend for libretro.
  *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
- * 
+ *
  *  RetroArch is free software: you can redistribute it and/or modify it under the terms
  *  of the GNU General Public License as published by the Free Software Found-
  *  ation, either version 3 of the License, or (at your option) any later version.
@@ -21,11 +21,11 @@
 typedef struct autosave autosave_t;
 
 autosave_t *autosave_new(const char *path, const void *data, size_t size, unsigned interval);
-void autosave_lock(autosave_t *handle);
-void autosave_unlock(autosave_t *handle);
 void autosave_free(autosave_t *handle);
 
-void lock_autosave(void);
-void unlock_autosave(void);
+// Called between frames, when the core is not touching SRAM.
+// Copies out the blocks the autosave thread found changed. Does nothing while SRAM is unchanged.
+void autosave_update(autosave_t *handle);
+void update_autosave(void);
 
 #endif
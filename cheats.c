@@ -17,6 +17,7 @@
 #include "hash.h"
 #include "dynamic.h"
 #include "general.h"
+#include "file.h"
 #include "compat/strl.h"
 #include "compat/posix_string.h"
 
@@ -240,6 +241,9 @@ cheat_manager_t *cheat_manager_new(const char *path)
 
    pretro_cheat_reset();
 
+   // Cheats are looked up by the ROM's SHA-256.
+   rom_hash_wait();
+
    xmlParserCtxtPtr ctx = NULL;
    xmlDocPtr doc = NULL;
    cheat_manager_t *handle = (cheat_manager_t*)calloc(1, sizeof(struct cheat_manager));
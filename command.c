@@ -22,9 +22,11 @@
 
 #include "driver.h"
 #include "general.h"
+#include "performance.h"
 #include "compat/strl.h"
 #include "compat/posix_string.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #ifndef _WIN32
@@ -232,8 +234,43 @@ static bool cmd_set_shader(const char *arg)
    return video_set_shader_func(type, arg);
 }
 
+static bool cmd_rewind_seek(const char *arg)
+{
+   return rarch_rewind_seek(strtod(arg, NULL));
+}
+
+// Without a path, only percentiles are written to the log.
+static bool cmd_frame_stats(const char *arg)
+{
+   if (!*arg)
+   {
+      rarch_frame_stats_dump(LOG_FILE, false);
+#ifdef HAVE_NETPLAY
+      if (g_extern.netplay)
+         netplay_print_stats(g_extern.netplay, LOG_FILE);
+#endif
+      return true;
+   }
+
+   FILE *file = fopen(arg, "w");
+   if (!file)
+      return false;
+
+   rarch_frame_stats_dump(file, true);
+#ifdef HAVE_NETPLAY
+   if (g_extern.netplay)
+      netplay_print_stats(g_extern.netplay, file);
+#endif
+   fclose(file);
+   RARCH_LOG("Wrote frame stats to \"%s\".\n", arg);
+   return true;
+}
+
+// Arguments in brackets are optional.
 static const struct cmd_action_map action_map[] = {
    { "SET_SHADER", cmd_set_shader, "<shader path>" },
+   { "REWIND_SEEK", cmd_rewind_seek, "<seconds>" },
+   { "FRAME_STATS", cmd_frame_stats, "[path]" },
 };
 
 static bool command_get_arg(const char *tok, const char **arg, unsigned *index)
@@ -258,10 +295,15 @@ static bool command_get_arg(const char *tok, const char **arg, unsigned *index)
       if (str == tok)
       {
          const char *argument = str + strlen(action_map[i].str);
-         if (*argument != ' ')
+         bool optional = action_map[i].arg_desc[0] == '[';
+         if (optional && *argument == '\0')
+         {
+            if (arg)
+               *arg = argument;
+         }
+         else if (*argument != ' ')
             return false;
-
-         if (arg)
+         else if (arg)
             *arg = argument + 1;
 
          if (index)
@@ -49,7 +49,9 @@ struct config_entry_list
    bool readonly; // If we got this from an #include, do not allow write.
    char *key;
    char *value;
+   uint32_t hash; // Of key.
    struct config_entry_list *next;
+   struct config_entry_list *next_dup; // Next entry in the list with the same key.
 };
 
 struct include_list
@@ -66,10 +68,107 @@ struct config_file
    unsigned include_depth;
 
    struct include_list *includes;
+
+   // Open addressing hash index of the entry list, so lookups don't have to walk it.
+   // A slot points to the first entry in the list with its key, which is the one lookups return.
+   // Later entries with the same key are chained from it through next_dup.
+   struct config_entry_list **index;
+   size_t index_size; // Power of two.
+   size_t index_count;
 };
 
 static config_file_t *config_file_new_internal(const char *path, unsigned depth);
 
+static uint32_t hash_key(const char *key)
+{
+   uint32_t hash = 5381;
+   while (*key)
+      hash = (hash * 33) ^ (uint8_t)*key++;
+   return hash;
+}
+
+// Returns the slot holding the first entry with key, or the empty slot where it would go.
+static struct config_entry_list **index_slot(config_file_t *conf, const char *key, uint32_t hash)
+{
+   size_t mask = conf->index_size - 1;
+   for (size_t i = hash & mask; ; i = (i + 1) & mask)
+   {
+      struct config_entry_list *entry = conf->index[i];
+      if (!entry || (entry->hash == hash && strcmp(entry->key, key) == 0))
+         return &conf->index[i];
+   }
+}
+
+static bool index_resize(config_file_t *conf, size_t size)
+{
+   struct config_entry_list **index = (struct config_entry_list**)calloc(size, sizeof(*index));
+   if (!index)
+      return false;
+
+   struct config_entry_list **old_index = conf->index;
+   size_t old_size = conf->index_size;
+
+   conf->index = index;
+   conf->index_size = size;
+   for (size_t i = 0; i < old_size; i++)
+   {
+      struct config_entry_list *entry = old_index[i];
+      if (entry)
+         *index_slot(conf, entry->key, entry->hash) = entry;
+   }
+
+   free(old_index);
+   return true;
+}
+
+// Indexes entry. If an entry earlier in the list already has its key, it is chained after that one.
+// Entries must be added in list order.
+static void index_add(config_file_t *conf, struct config_entry_list *entry)
+{
+   entry->next_dup = NULL;
+
+   // Keep the table at most half full so probe sequences stay short.
+   if (2 * (conf->index_count + 1) > conf->index_size &&
+         !index_resize(conf, conf->index_size ? 2 * conf->index_size : 64))
+      return;
+
+   struct config_entry_list **slot = index_slot(conf, entry->key, entry->hash);
+   if (*slot)
+   {
+      struct config_entry_list *dup = *slot;
+      while (dup->next_dup)
+         dup = dup->next_dup;
+      dup->next_dup = entry;
+   }
+   else
+   {
+      *slot = entry;
+      conf->index_count++;
+   }
+}
+
+static void index_rebuild(config_file_t *conf)
+{
+   free(conf->index);
+   conf->index = NULL;
+   conf->index_size = 0;
+   conf->index_count = 0;
+
+   for (struct config_entry_list *list = conf->entries; list; list = list->next)
+   {
+      list->hash = hash_key(list->key);
+      index_add(conf, list);
+   }
+}
+
+static struct config_entry_list *config_find(config_file_t *conf, const char *key)
+{
+   if (!conf->index)
+      return NULL;
+
+   return *index_slot(conf, key, hash_key(key));
+}
+
 static char *getaline(FILE *file)
 {
    char *newline = (char*)malloc(9);
@@ -144,33 +243,19 @@ static void set_list_readonly(struct config_entry_list *list)
 // Move semantics? :)
 static void add_child_list(config_file_t *parent, config_file_t *child)
 {
-   if (parent->entries)
-   {
-      struct config_entry_list *head = parent->entries;
-      while (head->next)
-         head = head->next;
+   if (!child->entries)
+      return;
 
-      set_list_readonly(child->entries);
-      head->next = child->entries;
-   }
+   set_list_readonly(child->entries);
+
+   if (parent->entries)
+      parent->tail->next = child->entries;
    else
-   {
-      set_list_readonly(child->entries);
       parent->entries = child->entries;
-   }
 
+   parent->tail = child->tail;
    child->entries = NULL;
-
-   // Rebase tail.
-   if (parent->entries)
-   {
-      struct config_entry_list *head = parent->entries;
-      while (head->next)
-         head = head->next;
-      parent->tail = head;
-   }
-   else
-      parent->tail = NULL;
+   child->tail = NULL;
 }
 
 static void add_include_list(config_file_t *conf, const char *path)
@@ -288,8 +373,13 @@ bool config_append_file(config_file_t *conf, const char *path)
    if (new_conf->tail)
    {
       new_conf->tail->next = conf->entries;
+      if (!conf->entries)
+         conf->tail = new_conf->tail;
       conf->entries        = new_conf->entries; // Pilfer.
       new_conf->entries    = NULL;
+
+      // New entries take priority, so they have to replace what is indexed.
+      index_rebuild(conf);
    }
 
    config_file_free(new_conf);
@@ -356,7 +446,10 @@ static config_file_t *config_file_new_internal(const char *path, unsigned depth)
 
 config_file_t *config_file_new(const char *path)
 {
-   return config_file_new_internal(path, 0);
+   config_file_t *conf = config_file_new_internal(path, 0);
+   if (conf)
+      index_rebuild(conf);
+   return conf;
 }
 
 void config_file_free(config_file_t *conf)
@@ -383,181 +476,122 @@ void config_file_free(config_file_t *conf)
       free(hold);
    }
 
+   free(conf->index);
    free(conf->path);
    free(conf);
 }
 
 bool config_get_double(config_file_t *conf, const char *key, double *in)
 {
-   struct config_entry_list *list = conf->entries;
+   const struct config_entry_list *list = config_find(conf, key);
+   if (!list)
+      return false;
 
-   while (list)
-   {
-      if (strcmp(key, list->key) == 0)
-      {
-         *in = strtod(list->value, NULL);
-         return true;
-      }
-      list = list->next;
-   }
-   return false;
+   *in = strtod(list->value, NULL);
+   return true;
 }
 
 bool config_get_float(config_file_t *conf, const char *key, float *in)
 {
-   struct config_entry_list *list = conf->entries;
+   const struct config_entry_list *list = config_find(conf, key);
+   if (!list)
+      return false;
 
-   while (list)
-   {
-      if (strcmp(key, list->key) == 0)
-      {
-         // strtof() is C99/POSIX. Just use the more portable kind.
-         *in = (float)strtod(list->value, NULL);
-         return true;
-      }
-      list = list->next;
-   }
-   return false;
+   // strtof() is C99/POSIX. Just use the more portable kind.
+   *in = (float)strtod(list->value, NULL);
+   return true;
 }
 
 bool config_get_int(config_file_t *conf, const char *key, int *in)
 {
-   struct config_entry_list *list = conf->entries;
+   const struct config_entry_list *list = config_find(conf, key);
+   if (!list)
+      return false;
 
-   while (list)
-   {
-      if (strcmp(key, list->key) == 0)
-      {
-         errno = 0;
-         int val = strtol(list->value, NULL, 0);
-         if (errno == 0)
-         {
-            *in = val;
-            return true;
-         }
-         else
-            return false;
-      }
-      list = list->next;
-   }
-   return false;
+   errno = 0;
+   int val = strtol(list->value, NULL, 0);
+   if (errno != 0)
+      return false;
+
+   *in = val;
+   return true;
 }
 
 bool config_get_uint64(config_file_t *conf, const char *key, uint64_t *in)
 {
-   struct config_entry_list *list = conf->entries;
+   const struct config_entry_list *list = config_find(conf, key);
+   if (!list)
+      return false;
 
-   while (list)
-   {
-      if (strcmp(key, list->key) == 0)
-      {
-         errno = 0;
-         uint64_t val = strtoull(list->value, NULL, 0);
-         if (errno == 0)
-         {
-            *in = val;
-            return true;
-         }
-         else
-            return false;
-      }
-      list = list->next;
-   }
-   return false;
+   errno = 0;
+   uint64_t val = strtoull(list->value, NULL, 0);
+   if (errno != 0)
+      return false;
+
+   *in = val;
+   return true;
 }
 
 bool config_get_uint(config_file_t *conf, const char *key, unsigned *in)
 {
-   struct config_entry_list *list = conf->entries;
+   const struct config_entry_list *list = config_find(conf, key);
+   if (!list)
+      return false;
 
-   while (list != NULL)
-   {
-      if (strcmp(key, list->key) == 0)
-      {
-         errno = 0;
-         unsigned val = strtoul(list->value, NULL, 0);
-         if (errno == 0)
-         {
-            *in = val;
-            return true;
-         }
-         else
-            return false;
-      }
-      list = list->next;
-   }
+   errno = 0;
+   unsigned val = strtoul(list->value, NULL, 0);
+   if (errno != 0)
+      return false;
 
-   return false;
+   *in = val;
+   return true;
 }
 
 bool config_get_hex(config_file_t *conf, const char *key, unsigned *in)
 {
-   struct config_entry_list *list = conf->entries;
+   const struct config_entry_list *list = config_find(conf, key);
+   if (!list)
+      return false;
 
-   while (list)
-   {
-      if (strcmp(key, list->key) == 0)
-      {
-         errno = 0;
-         unsigned val = strtoul(list->value, NULL, 16);
-         if (errno == 0)
-         {
-            *in = val;
-            return true;
-         }
-         else
-            return false;
-      }
-      list = list->next;
-   }
-   return false;
+   errno = 0;
+   unsigned val = strtoul(list->value, NULL, 16);
+   if (errno != 0)
+      return false;
+
+   *in = val;
+   return true;
 }
 
 bool config_get_char(config_file_t *conf, const char *key, char *in)
 {
-   struct config_entry_list *list = conf->entries;
+   const struct config_entry_list *list = config_find(conf, key);
+   if (!list)
+      return false;
 
-   while (list)
-   {
-      if (strcmp(key, list->key) == 0)
-      {
-         if (list->value[0] && list->value[1])
-            return false;
-         *in = *list->value;
-         return true;
-      }
-      list = list->next;
-   }
-   return false;
+   if (list->value[0] && list->value[1])
+      return false;
+
+   *in = *list->value;
+   return true;
 }
 
 bool config_get_string(config_file_t *conf, const char *key, char **str)
 {
-   struct config_entry_list *list = conf->entries;
+   const struct config_entry_list *list = config_find(conf, key);
+   if (!list)
+      return false;
 
-   while (list)
-   {
-      if (strcmp(key, list->key) == 0)
-      {
-         *str = strdup(list->value);
-         return true;
-      }
-      list = list->next;
-   }
-   return false;
+   *str = strdup(list->value);
+   return true;
 }
 
 bool config_get_array(config_file_t *conf, const char *key, char *buf, size_t size)
 {
-   struct config_entry_list *list = conf->entries;
+   const struct config_entry_list *list = config_find(conf, key);
+   if (!list)
+      return false;
 
-   while (list)
-   {
-      if (strcmp(key, list->key) == 0)
-         return strlcpy(buf, list->value, size) < size;
-      list = list->next;
-   }
-   return false;
+   return strlcpy(buf, list->value, size) < size;
 }
 
 bool config_get_path(config_file_t *conf, const char *key, char *buf, size_t size)
@@ -565,87 +599,76 @@ bool config_get_path(config_file_t *conf, const char *key, char *buf, size_t siz
 #if defined(_WIN32) || defined(RARCH_CONSOLE)
    return config_get_array(conf, key, buf, size);
 #else
-   struct config_entry_list *list = conf->entries;
+   const struct config_entry_list *list = config_find(conf, key);
+   if (!list)
+      return false;
 
-   while (list)
+   const char *value = list->value;
+   if (*value == '~')
    {
-      if (strcmp(key, list->key) == 0)
+      const char *home = getenv("HOME");
+      if (home)
       {
-         const char *value = list->value;
-         if (*value == '~')
-         {
-            const char *home = getenv("HOME");
-            if (home)
-            {
-               size_t src_size = strlcpy(buf, home, size);
-               if (src_size >= size)
-                  return false;
-
-               buf  += src_size;
-               size -= src_size;
-               value++;
-            }
-         }
+         size_t src_size = strlcpy(buf, home, size);
+         if (src_size >= size)
+            return false;
 
-         return strlcpy(buf, value, size) < size;
+         buf  += src_size;
+         size -= src_size;
+         value++;
       }
-      list = list->next;
    }
-   return false;
+
+   return strlcpy(buf, value, size) < size;
 #endif
 }
 
 bool config_get_bool(config_file_t *conf, const char *key, bool *in)
 {
-   struct config_entry_list *list = conf->entries;
+   const struct config_entry_list *list = config_find(conf, key);
+   if (!list)
+      return false;
 
-   while (list)
-   {
-      if (strcmp(key, list->key) == 0)
-      {
-         if (strcasecmp(list->value, "true") == 0)
-            *in = true;
-         else if (strcasecmp(list->value, "1") == 0)
-            *in = true;
-         else if (strcasecmp(list->value, "false") == 0)
-            *in = false;
-         else if (strcasecmp(list->value, "0") == 0)
-            *in = false;
-         else
-            return false;
+   if (strcasecmp(list->value, "true") == 0)
+      *in = true;
+   else if (strcasecmp(list->value, "1") == 0)
+      *in = true;
+   else if (strcasecmp(list->value, "false") == 0)
+      *in = false;
+   else if (strcasecmp(list->value, "0") == 0)
+      *in = false;
+   else
+      return false;
 
-         return true;
-      }
-      list = list->next;
-   }
-   return false;
+   return true;
 }
 
 void config_set_string(config_file_t *conf, const char *key, const char *val)
 {
-   struct config_entry_list *list = conf->entries;
-   struct config_entry_list *last = list;
-   while (list)
-   {
-      if (!list->readonly && (strcmp(key, list->key) == 0))
-      {
-         free(list->value);
-         list->value = strdup(val);
-         return;
-      }
+   // Entries from an #include cannot be written to, so we might need a later entry with the same key.
+   struct config_entry_list *list = config_find(conf, key);
+   while (list && list->readonly)
+      list = list->next_dup;
 
-      last = list;
-      list = list->next;
+   if (list)
+   {
+      free(list->value);
+      list->value = strdup(val);
+      return;
    }
 
    struct config_entry_list *elem = (struct config_entry_list*)calloc(1, sizeof(*elem));
    elem->key = strdup(key);
    elem->value = strdup(val);
+   elem->hash = hash_key(key);
 
-   if (last)
-      last->next = elem;
+   if (conf->entries)
+      conf->tail->next = elem;
    else
       conf->entries = elem;
+   conf->tail = elem;
+
+   index_add(conf, elem);
 }
 
 void config_set_double(config_file_t *conf, const char *key, double val)
@@ -754,16 +777,7 @@ void config_file_dump_all(config_file_t *conf, FILE *file)
 
 bool config_entry_exists(config_file_t *conf, const char *entry)
 {
-   struct config_entry_list *list = conf->entries;
-
-   while (list)
-   {
-      if (strcmp(entry, list->key) == 0)
-         return true;
-      list = list->next;
-   }
-
-   return false;
+   return config_find(conf, entry) != NULL;
 }
 
 bool config_get_entry_list_head(config_file_t *conf, struct config_file_entry *entry)
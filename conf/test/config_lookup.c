@@ -0,0 +1,364 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Benchmarks config lookups on a 2000 key config spread over a few #includes,
+// against walking the entry list like lookups used to.
+// Verifies that every lookup finds the same entry as the walk, also after setting values,
+// and that writing the config back out keeps entry order.
+
+#include "../config_file.c"
+#include "../../general.h"
+#include <time.h>
+#include <unistd.h>
+
+struct global g_extern;
+struct settings g_settings;
+
+#define NUM_KEYS 2000
+#define LOOKUP_ROUNDS 200
+#define PARSE_ROUNDS 20
+
+static double get_time(void)
+{
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return tv.tv_sec + tv.tv_nsec / 1000000000.0;
+}
+
+static void key_name(char *buf, size_t size, unsigned i)
+{
+   snprintf(buf, size, "section_%u_setting_%04u", i % 7, i);
+}
+
+// Main config: keys 0-999, include A, keys 1000-1499, include B.
+// A has keys 1500-1999, and redefines 1000-1049, which it shadows.
+// B redefines 0-99, which are shadowed by the main config instead.
+static bool write_configs(const char *dir, char *main_path, size_t size)
+{
+   char path[PATH_MAX];
+   char key[64];
+
+   snprintf(path, sizeof(path), "%s/a.cfg", dir);
+   FILE *file = fopen(path, "w");
+   if (!file)
+      return false;
+   for (unsigned i = 1500; i < NUM_KEYS; i++)
+   {
+      key_name(key, sizeof(key), i);
+      fprintf(file, "%s = \"include a %u\"\n", key, i);
+   }
+   for (unsigned i = 1000; i < 1050; i++)
+   {
+      key_name(key, sizeof(key), i);
+      fprintf(file, "%s = %u\n", key, i + 100000);
+   }
+   fclose(file);
+
+   snprintf(path, sizeof(path), "%s/b.cfg", dir);
+   file = fopen(path, "w");
+   if (!file)
+      return false;
+   for (unsigned i = 0; i < 100; i++)
+   {
+      key_name(key, sizeof(key), i);
+      fprintf(file, "%s = false # Never seen.\n", key);
+   }
+   fclose(file);
+
+   snprintf(main_path, size, "%s/main.cfg", dir);
+   file = fopen(main_path, "w");
+   if (!file)
+      return false;
+   fprintf(file, "# Generated by test-config-lookup.\n");
+   for (unsigned i = 0; i < 1000; i++)
+   {
+      key_name(key, sizeof(key), i);
+      fprintf(file, "%s = %u\n", key, i);
+   }
+   fprintf(file, "#include \"a.cfg\"\n");
+   for (unsigned i = 1000; i < 1500; i++)
+   {
+      key_name(key, sizeof(key), i);
+      fprintf(file, "%s = \"value with spaces %u\"\n", key, i);
+   }
+   fprintf(file, "#include \"b.cfg\"\n");
+   fclose(file);
+
+   return true;
+}
+
+// How lookups were done before there was an index.
+static const char *find_linear(config_file_t *conf, const char *key)
+{
+   for (const struct config_entry_list *list = conf->entries; list; list = list->next)
+   {
+      if (strcmp(key, list->key) == 0)
+         return list->value;
+   }
+
+   return NULL;
+}
+
+// Every key, hit or miss, must resolve to the same value as walking the list.
+static bool verify_lookups(config_file_t *conf, unsigned num_keys)
+{
+   char key[64];
+   char value[256];
+
+   for (unsigned i = 0; i < num_keys + 100; i++)
+   {
+      key_name(key, sizeof(key), i);
+      const char *expected = find_linear(conf, key);
+      bool found = config_get_array(conf, key, value, sizeof(value));
+
+      if (found != (expected != NULL) || (found && strcmp(value, expected) != 0))
+      {
+         fprintf(stderr, "Lookup of %s gave \"%s\", expected \"%s\".\n",
+               key, found ? value : "(none)", expected ? expected : "(none)");
+         return false;
+      }
+
+      if (found != config_entry_exists(conf, key))
+      {
+         fprintf(stderr, "config_entry_exists() disagrees for %s.\n", key);
+         return false;
+      }
+   }
+
+   return true;
+}
+
+static bool verify_file(config_file_t *conf, unsigned num_keys)
+{
+   char key[64];
+   int val;
+
+   // Spot checks of which definition wins.
+   key_name(key, sizeof(key), 10);
+   if (!config_get_int(conf, key, &val) || val != 10)
+      return false;
+   key_name(key, sizeof(key), 1010);
+   if (!config_get_int(conf, key, &val) || val != 101010)
+      return false;
+   key_name(key, sizeof(key), 1600);
+   char *str = NULL;
+   if (!config_get_string(conf, key, &str) || strcmp(str, "include a 1600") != 0)
+      return false;
+   free(str);
+
+   return verify_lookups(conf, num_keys);
+}
+
+static bool write_and_compare(config_file_t *conf, const char *path, char **out, long *out_size)
+{
+   if (!config_file_write(conf, path))
+      return false;
+
+   FILE *file = fopen(path, "rb");
+   if (!file)
+      return false;
+
+   fseek(file, 0, SEEK_END);
+   long size = ftell(file);
+   rewind(file);
+
+   char *buf = (char*)malloc(size + 1);
+   if (!buf || fread(buf, 1, size, file) != (size_t)size)
+   {
+      fclose(file);
+      free(buf);
+      return false;
+   }
+   buf[size] = '\0';
+   fclose(file);
+
+   // Writable entries come out in list order.
+   char expected[256];
+   const char *ptr = buf;
+   while (*ptr == '#')
+      ptr = strchr(ptr, '\n') + 1;
+
+   unsigned index = 0;
+   for (const struct config_entry_list *list = conf->entries; list; list = list->next)
+   {
+      if (list->readonly)
+         continue;
+
+      snprintf(expected, sizeof(expected), "%s = \"%s\"\n", list->key, list->value);
+      if (strncmp(ptr, expected, strlen(expected)) != 0)
+      {
+         fprintf(stderr, "Entry #%u was not written in order.\n", index);
+         free(buf);
+         return false;
+      }
+      ptr += strlen(expected);
+      index++;
+   }
+
+   if (*ptr)
+   {
+      fprintf(stderr, "Unexpected trailing data in written config.\n");
+      free(buf);
+      return false;
+   }
+
+   *out = buf;
+   *out_size = size;
+   return true;
+}
+
+int main(void)
+{
+   char dir[] = "/tmp/rarch-config-XXXXXX";
+   if (!mkdtemp(dir))
+   {
+      fprintf(stderr, "Failed to create temporary directory.\n");
+      return 1;
+   }
+
+   char main_path[PATH_MAX];
+   char out_path[PATH_MAX];
+   snprintf(out_path, sizeof(out_path), "%s/out.cfg", dir);
+
+   bool ret = false;
+   config_file_t *conf = NULL;
+   char *first_write = NULL;
+   char *second_write = NULL;
+
+   if (!write_configs(dir, main_path, sizeof(main_path)))
+   {
+      fprintf(stderr, "Failed to write test configs.\n");
+      goto end;
+   }
+
+   double start = get_time();
+   for (unsigned i = 0; i < PARSE_ROUNDS; i++)
+   {
+      config_file_t *tmp = config_file_new(main_path);
+      if (!tmp)
+      {
+         fprintf(stderr, "Failed to parse config.\n");
+         goto end;
+      }
+      config_file_free(tmp);
+   }
+   double parse_time = (get_time() - start) / PARSE_ROUNDS;
+
+   conf = config_file_new(main_path);
+   if (!conf || !verify_file(conf, NUM_KEYS))
+   {
+      fprintf(stderr, "Parsed config gives wrong values.\n");
+      goto end;
+   }
+
+   // Look up every key once per round, plus as many misses, like settings.c does for unset options.
+   char keys[NUM_KEYS][64];
+   char misses[NUM_KEYS][64];
+   for (unsigned i = 0; i < NUM_KEYS; i++)
+   {
+      key_name(keys[i], sizeof(keys[i]), i);
+      snprintf(misses[i], sizeof(misses[i]), "missing_setting_%04u", i);
+   }
+
+   unsigned found = 0;
+   start = get_time();
+   for (unsigned round = 0; round < LOOKUP_ROUNDS; round++)
+   {
+      for (unsigned i = 0; i < NUM_KEYS; i++)
+      {
+         int val;
+         found += config_get_int(conf, keys[i], &val);
+         found += config_get_int(conf, misses[i], &val);
+      }
+   }
+   double index_time = get_time() - start;
+
+   unsigned found_linear = 0;
+   start = get_time();
+   for (unsigned round = 0; round < LOOKUP_ROUNDS / 20; round++)
+   {
+      for (unsigned i = 0; i < NUM_KEYS; i++)
+      {
+         found_linear += find_linear(conf, keys[i]) != NULL;
+         found_linear += find_linear(conf, misses[i]) != NULL;
+      }
+   }
+   double linear_time = (get_time() - start) * 20;
+
+   if (found != NUM_KEYS * LOOKUP_ROUNDS || found_linear != NUM_KEYS * (LOOKUP_ROUNDS / 20))
+   {
+      fprintf(stderr, "Unexpected number of keys found.\n");
+      goto end;
+   }
+
+   double lookups = 2.0 * NUM_KEYS * LOOKUP_ROUNDS;
+   printf("Parse: %.3f ms for %u keys with includes.\n", 1000.0 * parse_time, NUM_KEYS);
+   printf("Lookup: %.1f ns indexed, %.1f ns walking the list (%.1fx).\n",
+         1e9 * index_time / lookups, 1e9 * linear_time / lookups, linear_time / index_time);
+
+   // Overwrite existing keys, try to overwrite included keys, and add new ones.
+   start = get_time();
+   for (unsigned i = 0; i < NUM_KEYS + 100; i++)
+   {
+      char key[64];
+      key_name(key, sizeof(key), i);
+      config_set_int(conf, key, i * 2);
+   }
+   double set_time = get_time() - start;
+   printf("Set: %.1f ns per key.\n", 1e9 * set_time / (NUM_KEYS + 100));
+
+   if (!verify_lookups(conf, NUM_KEYS + 100))
+   {
+      fprintf(stderr, "Lookups are wrong after setting values.\n");
+      goto end;
+   }
+
+   // Writing must be stable: writing, reloading and writing again gives identical output.
+   long first_size = 0, second_size = 0;
+   if (!write_and_compare(conf, out_path, &first_write, &first_size))
+   {
+      fprintf(stderr, "Written config is out of order.\n");
+      goto end;
+   }
+
+   config_file_free(conf);
+   conf = config_file_new(out_path);
+   if (!conf || !write_and_compare(conf, out_path, &second_write, &second_size) ||
+         first_size != second_size || memcmp(first_write, second_write, first_size) != 0)
+   {
+      fprintf(stderr, "Rewriting config is not stable.\n");
+      goto end;
+   }
+
+   ret = true;
+
+end:
+   printf("%s\n", ret ? "OK" : "FAILED");
+
+   config_file_free(conf);
+   free(first_write);
+   free(second_write);
+
+   char path[PATH_MAX];
+   const char *files[] = { "main.cfg", "a.cfg", "b.cfg", "out.cfg" };
+   for (unsigned i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+   {
+      snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+      unlink(path);
+   }
+   rmdir(dir);
+
+   return ret ? 0 : 1;
+}
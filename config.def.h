@@ -183,6 +183,14 @@ static const bool disable_composition = false;
 // Video VSYNC (recommended)
 static const bool vsync = true;
 
+// Runs the video driver on its own thread, so the next frame can be emulated while waiting for VSYNC.
+// Adds up to a frame of latency.
+static const bool video_threaded = false;
+
+// Threads used by software scalers: CPU filter input, 0RGB1555 conversion and recording.
+// 0 or 1 scales on the emulation thread.
+static const unsigned video_scaler_threads = 1;
+
 // Smooths picture
 static const bool video_smooth = true;
 
@@ -283,6 +291,18 @@ static const float rate_control_delta = 0.005;
 // Default audio volume in dB. (0.0 dB == unity gain).
 static const float audio_volume = 0.0;
 
+// Quality of the SINC resampler. Higher quality uses a longer filter, and more CPU.
+// 0 = low, 1 = normal, 2 = high, 3 = ultra.
+#if defined(RARCH_CONSOLE) || defined(ANDROID)
+static const unsigned audio_resampler_quality = 0;
+#else
+static const unsigned audio_resampler_quality = 1;
+#endif
+
+// Converts, resamples and writes audio on a separate thread, so a blocking audio driver
+// doesn't stall the emulation thread.
+static const bool audio_threaded = false;
+
 //////////////
 // Misc
 //////////////
@@ -297,6 +317,21 @@ static const unsigned rewind_buffer_size = 20 << 20; // 20MiB
 // How many frames to rewind at a time.
 static const unsigned rewind_granularity = 1;
 
+// Generates rewind deltas on a separate thread, so it does not add to frame time.
+static const bool rewind_threaded = false;
+
+// Stores a full save state every N rewind states, so seeking far back is fast. 0 disables keyframes.
+static const unsigned rewind_keyframe_interval = 0;
+
+// Runs the core this many frames ahead of the displayed frame to hide lag built into the game.
+// Every frame is run N + 1 times, and requires save state support. 0 disables run-ahead.
+static const unsigned run_ahead_frames = 0;
+
+// Runs ahead on a second instance of the core instead of rolling back the main one every frame.
+// Only resyncs the second instance when input changes, at the cost of twice the memory.
+// Only supported with dynamically loaded cores.
+static const bool run_ahead_secondary_instance = false;
+
 // Pause gameplay when gameplay loses focus.
 static const bool pause_nonactive = false;
 
@@ -306,6 +341,14 @@ static const unsigned autosave_interval = 0;
 // When being client over netplay, use keybinds for player 1 rather than player 2.
 static const bool netplay_client_swap_input = true;
 
+// Upper limit for netplay input delay. Input delay is picked from measured round-trip time and jitter,
+// so that input reaches the other side before it is needed there, and fewer frames have to be rolled back.
+// Each frame of delay adds a frame of input lag. 0 disables input delay.
+static const unsigned netplay_input_delay_max = 4;
+
+// Number of players the netplay host waits for before starting, itself included. At most 4.
+static const unsigned netplay_players = 2;
+
 // On save state load, block SRAM from being overwritten.
 // This could potentially lead to buggy games.
 static const bool block_sram_overwrite = false;
@@ -319,6 +362,9 @@ static const bool savestate_auto_index = false;
 // RetroArch will automatically load any savestate with this path on startup.
 static const bool savestate_auto_save = false;
 
+// Compresses savestates when writing them. Both compressed and uncompressed savestates can be loaded.
+static const bool savestate_compression = true;
+
 // Slowmotion ratio.
 static const float slowmotion_ratio = 3.0;
 
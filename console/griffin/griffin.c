@@ -66,6 +66,7 @@ default_paths_t default_paths;
 #endif
 
 #ifdef HAVE_ZLIB
+#include "../../zlib_util.c"
 #include "../rarch_console_rzlib.c"
 #endif
 
@@ -351,6 +352,11 @@ REWIND
 ============================================================ */
 #include "../../rewind.c"
 
+/*============================================================
+STATE IO
+============================================================ */
+#include "../../state_io.c"
+
 /*============================================================
 MAIN
 ============================================================ */
@@ -390,6 +396,7 @@ NETPLAY
 ============================================================ */
 #ifdef HAVE_NETPLAY
 #include "../../netplay.c"
+#include "../../netplay_broadcast.c"
 #endif
 
 /*============================================================
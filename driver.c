@@ -26,6 +26,10 @@
 #include "gfx/context/x11_common.h"
 #endif
 
+#ifdef HAVE_THREADS
+#include "gfx/thread_wrapper.h"
+#endif
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
@@ -330,6 +334,27 @@ static void deinit_dsp_plugin(void)
 }
 #endif
 
+#ifdef HAVE_THREADS
+static void init_audio_thread(void)
+{
+   // Buffer half the desired latency on top of what the driver buffers.
+   size_t buffer_samples = (size_t)(g_settings.audio.in_rate * g_settings.audio.latency / 1000.0f);
+   if (buffer_samples < AUDIO_CHUNK_SIZE_BLOCKING)
+      buffer_samples = AUDIO_CHUNK_SIZE_BLOCKING;
+
+   g_extern.audio_data.thread = audio_thread_new(buffer_samples,
+         AUDIO_CHUNK_SIZE_BLOCKING, rarch_audio_process);
+
+   if (g_extern.audio_data.thread)
+   {
+      audio_thread_set_nonblock_state(g_extern.audio_data.thread, !g_settings.audio.sync);
+      RARCH_LOG("Threaded audio started with a %u sample buffer.\n", (unsigned)buffer_samples);
+   }
+   else
+      RARCH_ERR("Failed to start audio thread. Will write audio on the main thread.\n");
+}
+#endif
+
 void init_audio(void)
 {
    // Accomodate rewind since at some point we might have two full buffers.
@@ -371,7 +396,7 @@ void init_audio(void)
       g_extern.audio_data.chunk_size = g_extern.audio_data.nonblock_chunk_size;
    }
 
-   g_extern.audio_data.source = resampler_new();
+   g_extern.audio_data.source = resampler_new((enum resampler_quality)g_settings.audio.resampler_quality);
    if (!g_extern.audio_data.source)
       g_extern.audio_active = false;
 
@@ -381,13 +406,28 @@ void init_audio(void)
 
    rarch_assert(g_settings.audio.out_rate < g_settings.audio.in_rate * AUDIO_MAX_RATIO);
    rarch_assert(g_extern.audio_data.outsamples = (sample_t*)malloc(outsamples_max * sizeof(sample_t)));
+   rarch_assert(g_extern.audio_data.s16_outsamples = (int16_t*)malloc(outsamples_max * sizeof(int16_t)));
 
    g_extern.audio_data.orig_src_ratio =
       g_extern.audio_data.src_ratio =
       (double)g_settings.audio.out_rate / g_settings.audio.in_rate;
 
+#ifdef HAVE_THREADS
+   if (g_extern.audio_active && g_settings.audio.threaded)
+      init_audio_thread();
+#endif
+
    if (g_extern.audio_active && g_settings.audio.rate_control)
    {
+#ifdef HAVE_THREADS
+      // Rate control keeps the audio thread's buffer half full instead.
+      if (g_extern.audio_data.thread)
+      {
+         g_extern.audio_data.driver_buffer_size = audio_thread_buffer_size(g_extern.audio_data.thread);
+         g_extern.audio_data.rate_control = true;
+      }
+      else
+#endif
       if (driver.audio->buffer_size && driver.audio->write_avail)
       {
          g_extern.audio_data.driver_buffer_size = audio_buffer_size_func();
@@ -420,6 +460,12 @@ void uninit_audio(void)
       return;
    }
 
+#ifdef HAVE_THREADS
+   // The thread is in the middle of using the driver and resampler.
+   audio_thread_free(g_extern.audio_data.thread);
+   g_extern.audio_data.thread = NULL;
+#endif
+
    if (driver.audio_data && driver.audio)
       driver.audio->free(driver.audio_data);
 
@@ -432,6 +478,9 @@ void uninit_audio(void)
    free(g_extern.audio_data.outsamples);
    g_extern.audio_data.outsamples = NULL;
 
+   free(g_extern.audio_data.s16_outsamples);
+   g_extern.audio_data.s16_outsamples = NULL;
+
 #ifdef HAVE_DYLIB
    deinit_dsp_plugin();
 #endif
@@ -531,6 +580,7 @@ static void init_filter(bool rgb32)
    g_extern.filter.scaler.scaler_type = SCALER_TYPE_POINT;
    g_extern.filter.scaler.in_fmt      = rgb32 ? SCALER_FMT_ARGB8888 : SCALER_FMT_RGB565;
    g_extern.filter.scaler.out_fmt     = SCALER_FMT_0RGB1555;
+   g_extern.filter.scaler.threads     = g_settings.video.scaler_threads;
 
    if (!scaler_ctx_gen_filter(&g_extern.filter.scaler))
       goto error;
@@ -594,6 +644,7 @@ static bool init_video_pixel_converter(unsigned size)
 
       // TODO: Pick either ARGB8888 or RGB565 depending on driver ...
       driver.scaler.out_fmt     = SCALER_FMT_RGB565;
+      driver.scaler.threads     = g_settings.video.scaler_threads;
 
       if (!scaler_ctx_gen_filter(&driver.scaler))
          return false;
@@ -679,7 +730,45 @@ void init_video_input(void)
    video.rgb32 = g_extern.filter.active || (g_extern.system.pix_fmt == RETRO_PIXEL_FORMAT_XRGB8888);
 
    const input_driver_t *tmp = driver.input;
-   driver.video_data = video_init_func(&video, &driver.input, &driver.input_data);
+#ifdef HAVE_THREADS
+   if (g_settings.video.threaded)
+   {
+#ifdef HAVE_X11
+      // The X11 input driver polls the Display of the video driver from the emulation thread,
+      // while the render thread uses it. Has to come before any other Xlib call.
+      XInitThreads();
+#endif
+
+      RARCH_LOG("Starting threaded video driver ...\n");
+      if (!rarch_threaded_video_init(&driver.video, &driver.video_data,
+               &driver.input, &driver.input_data,
+               driver.video, &video))
+      {
+         RARCH_ERR("Cannot open threaded video driver ... Exiting ...\n");
+         rarch_fail(1, "init_video_input()");
+      }
+
+#ifdef HAVE_SDL
+      // SDL events can only be pumped on the thread which owns the window, which is the render thread now.
+      if (driver.input == &input_sdl)
+      {
+         RARCH_WARN("SDL input does not work with threaded video. Restarting video driver without threading ...\n");
+         if (driver.input_data)
+            input_free_func();
+         video_free_func();
+
+         driver.input      = tmp;
+         driver.input_data = NULL;
+         g_settings.video.threaded = false;
+         find_video_driver();
+
+         driver.video_data = video_init_func(&video, &driver.input, &driver.input_data);
+      }
+#endif
+   }
+   else
+#endif
+      driver.video_data = video_init_func(&video, &driver.input, &driver.input_data);
 
    if (driver.video_data == NULL)
    {
@@ -728,6 +817,12 @@ void uninit_video_input(void)
    if (driver.video_data && driver.video)
       video_free_func();
 
+#ifdef HAVE_THREADS
+   // The threaded wrapper stands in for the actual driver, which has to be picked again on reinit.
+   if (g_settings.video.threaded)
+      find_video_driver();
+#endif
+
    deinit_pixel_converter();
 
 #ifdef HAVE_DYLIB
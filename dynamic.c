@@ -39,6 +39,11 @@
 #endif
 #endif
 
+#if defined(HAVE_DYNAMIC) && !defined(_WIN32)
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
 #ifdef HAVE_DYNAMIC
 #define SYM(x) do { \
    function_t func = dylib_proc(lib_handle, #x); \
@@ -47,6 +52,7 @@
 } while (0)
 
 static dylib_t lib_handle = NULL;
+static char lib_path[PATH_MAX];
 #else
 #define SYM(x) p##x = x
 #endif
@@ -187,6 +193,8 @@ static void load_symbols(void)
       RARCH_ERR("Failed to open dynamic library: \"%s\"\n", libretro_path);
       rarch_fail(1, "load_dynamic()");
    }
+
+   strlcpy(lib_path, libretro_path, sizeof(lib_path));
 #endif
 
    SYM(retro_init);
@@ -263,6 +271,153 @@ void uninit_libretro_sym(void)
 #endif
 }
 
+#ifdef HAVE_DYNAMIC
+#define INSTANCE_SYM(x) do { \
+   function_t func = dylib_proc(inst->lib, "retro_" #x); \
+   memcpy(&inst->x, &func, sizeof(func)); \
+   if (inst->x == NULL) { RARCH_ERR("Failed to load symbol: \"retro_%s\"\n", #x); goto error; } \
+} while (0)
+
+static bool environment_cb(unsigned cmd, void *data);
+
+// Only the main instance gets to talk to the frontend.
+static bool environment_instance_cb(unsigned cmd, void *data)
+{
+   switch (cmd)
+   {
+      case RETRO_ENVIRONMENT_SET_MESSAGE:
+      case RETRO_ENVIRONMENT_SHUTDOWN:
+      case RETRO_ENVIRONMENT_SET_PERFORMANCE_LEVEL:
+      case RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS:
+      case RETRO_ENVIRONMENT_SET_KEYBOARD_CALLBACK:
+         return true;
+
+      default:
+         return environment_cb(cmd, data);
+   }
+}
+
+// Loading the same path twice would just give us the same handle again, so load from a copy.
+static char *copy_libretro_tmp(const char *path)
+{
+   void *buf = NULL;
+   ssize_t len = read_file(path, &buf);
+   if (len < 0)
+   {
+      RARCH_ERR("Failed to read dynamic library: \"%s\"\n", path);
+      return NULL;
+   }
+
+   char tmp_path[PATH_MAX];
+   FILE *file = NULL;
+
+#ifdef _WIN32
+   char tmp_dir[PATH_MAX];
+   if (GetTempPath(sizeof(tmp_dir), tmp_dir) && GetTempFileName(tmp_dir, "rarch", 0, tmp_path))
+      file = fopen(tmp_path, "wb");
+#else
+   const char *tmp_dir = getenv("TMPDIR");
+   snprintf(tmp_path, sizeof(tmp_path), "%s/retroarch-core-XXXXXX",
+         tmp_dir && *tmp_dir ? tmp_dir : "/tmp");
+
+   int fd = mkstemp(tmp_path);
+   if (fd >= 0 && !(file = fdopen(fd, "wb")))
+      close(fd);
+#endif
+
+   if (!file)
+   {
+      RARCH_ERR("Failed to create temporary copy of dynamic library.\n");
+      free(buf);
+      return NULL;
+   }
+
+   bool ret = fwrite(buf, 1, len, file) == (size_t)len;
+   ret = fclose(file) == 0 && ret;
+   free(buf);
+
+   if (!ret)
+   {
+      RARCH_ERR("Failed to write temporary copy of dynamic library.\n");
+      remove(tmp_path);
+      return NULL;
+   }
+
+   return strdup(tmp_path);
+}
+
+struct retro_instance *libretro_instance_new(void)
+{
+   struct retro_instance *inst = (struct retro_instance*)calloc(1, sizeof(*inst));
+   if (!inst)
+      return NULL;
+
+   inst->path = copy_libretro_tmp(lib_path);
+   if (!inst->path)
+      goto error;
+
+   RARCH_LOG("Loading second libretro instance from: \"%s\"\n", inst->path);
+   inst->lib = dylib_load(inst->path);
+   if (!inst->lib)
+      goto error;
+
+   INSTANCE_SYM(init);
+   INSTANCE_SYM(deinit);
+
+   INSTANCE_SYM(set_environment);
+   INSTANCE_SYM(set_video_refresh);
+   INSTANCE_SYM(set_audio_sample);
+   INSTANCE_SYM(set_audio_sample_batch);
+   INSTANCE_SYM(set_input_poll);
+   INSTANCE_SYM(set_input_state);
+
+   INSTANCE_SYM(set_controller_port_device);
+
+   INSTANCE_SYM(run);
+
+   INSTANCE_SYM(serialize_size);
+   INSTANCE_SYM(serialize);
+   INSTANCE_SYM(unserialize);
+
+   INSTANCE_SYM(load_game);
+   INSTANCE_SYM(load_game_special);
+   INSTANCE_SYM(unload_game);
+
+   inst->set_environment(environment_instance_cb);
+   inst->init();
+   return inst;
+
+error:
+   // The instance was never initialized, so it must not be deinitialized either.
+   if (inst->lib)
+      dylib_close(inst->lib);
+   inst->lib = NULL;
+   libretro_instance_free(inst);
+   return NULL;
+}
+
+void libretro_instance_free(struct retro_instance *inst)
+{
+   if (!inst)
+      return;
+
+   if (inst->game_loaded)
+      inst->unload_game();
+   if (inst->lib)
+   {
+      inst->deinit();
+      dylib_close(inst->lib);
+   }
+
+   if (inst->path)
+   {
+      remove(inst->path);
+      free(inst->path);
+   }
+   free(inst);
+}
+#endif
+
 #ifdef NEED_DYNAMIC
 // Platform independent dylib loading.
 dylib_t dylib_load(const char *path)
@@ -78,5 +78,43 @@ extern unsigned (*pretro_get_region)(void);
 extern void *(*pretro_get_memory_data)(unsigned);
 extern size_t (*pretro_get_memory_size)(unsigned);
 
+#ifdef HAVE_DYNAMIC
+// A second instance of the libretro core, loaded from a temporary copy of the library
+// so that it does not share any global state with the main instance.
+// Only the parts of the API needed to run it next to the main instance are loaded.
+struct retro_instance
+{
+   dylib_t lib;
+   char *path; // The temporary copy, removed again when the instance is freed.
+   bool game_loaded;
+
+   void (*init)(void);
+   void (*deinit)(void);
+
+   void (*set_environment)(retro_environment_t);
+   void (*set_video_refresh)(retro_video_refresh_t);
+   void (*set_audio_sample)(retro_audio_sample_t);
+   void (*set_audio_sample_batch)(retro_audio_sample_batch_t);
+   void (*set_input_poll)(retro_input_poll_t);
+   void (*set_input_state)(retro_input_state_t);
+
+   void (*set_controller_port_device)(unsigned, unsigned);
+
+   void (*run)(void);
+
+   size_t (*serialize_size)(void);
+   bool (*serialize)(void*, size_t);
+   bool (*unserialize)(const void*, size_t);
+
+   bool (*load_game)(const struct retro_game_info*);
+   bool (*load_game_special)(unsigned, const struct retro_game_info*, size_t);
+   void (*unload_game)(void);
+};
+
+// Must be called after init_libretro_sym(). The instance is initialized, but has no game loaded.
+struct retro_instance *libretro_instance_new(void);
+void libretro_instance_free(struct retro_instance *inst);
+#endif
+
 #endif
 
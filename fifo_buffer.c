@@ -16,12 +16,47 @@
 #include "fifo_buffer.h"
 #include <stdint.h>
 
+#if defined(_WIN32) && !defined(_XBOX)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(_XBOX)
+#include <xtl.h>
+#endif
+
+// Only the producer writes end, and only the consumer writes first.
+// Publishing an index with release semantics after touching the buffer,
+// and reading the other side's index with acquire semantics is all we need for SPSC.
+#if defined(__clang__) || (defined(__GNUC__) && ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7)))
+#define FIFO_LOAD_ACQUIRE(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define FIFO_STORE_RELEASE(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+#elif defined(_WIN32)
+static inline size_t FIFO_LOAD_ACQUIRE(volatile size_t *ptr)
+{
+   size_t val = *ptr;
+   MemoryBarrier();
+   return val;
+}
+#define FIFO_STORE_RELEASE(ptr, val) do { MemoryBarrier(); *(ptr) = (val); } while(0)
+#elif defined(__GNUC__)
+static inline size_t FIFO_LOAD_ACQUIRE(volatile size_t *ptr)
+{
+   size_t val = *ptr;
+   __sync_synchronize();
+   return val;
+}
+#define FIFO_STORE_RELEASE(ptr, val) do { __sync_synchronize(); *(ptr) = (val); } while(0)
+#else
+// No known barriers. Users sharing the FIFO across threads must lock around it.
+#define FIFO_LOAD_ACQUIRE(ptr) (*(ptr))
+#define FIFO_STORE_RELEASE(ptr, val) (*(ptr) = (val))
+#endif
+
 struct fifo_buffer
 {
    uint8_t *buffer;
    size_t bufsize;
-   size_t first;
-   size_t end;
+   volatile size_t first;
+   volatile size_t end;
 };
 
 fifo_buffer_t *fifo_new(size_t size)
@@ -50,7 +85,7 @@ void fifo_free(fifo_buffer_t *buffer)
 size_t fifo_read_avail(fifo_buffer_t *buffer)
 {
    size_t first = buffer->first;
-   size_t end = buffer->end;
+   size_t end = FIFO_LOAD_ACQUIRE(&buffer->end);
    if (end < first)
       end += buffer->bufsize;
    return end - first;
@@ -58,7 +93,7 @@ size_t fifo_read_avail(fifo_buffer_t *buffer)
 
 size_t fifo_write_avail(fifo_buffer_t *buffer)
 {
-   size_t first = buffer->first;
+   size_t first = FIFO_LOAD_ACQUIRE(&buffer->first);
    size_t end = buffer->end;
    if (end < first)
       end += buffer->bufsize;
@@ -68,34 +103,65 @@ size_t fifo_write_avail(fifo_buffer_t *buffer)
 
 void fifo_write(fifo_buffer_t *buffer, const void *in_buf, size_t size)
 {
+   size_t end = buffer->end;
    size_t first_write = size;
    size_t rest_write = 0;
-   if (buffer->end + size > buffer->bufsize)
+   if (end + size > buffer->bufsize)
    {
-      first_write = buffer->bufsize - buffer->end;
+      first_write = buffer->bufsize - end;
       rest_write = size - first_write;
    }
 
-   memcpy(buffer->buffer + buffer->end, in_buf, first_write);
+   memcpy(buffer->buffer + end, in_buf, first_write);
    memcpy(buffer->buffer, (const uint8_t*)in_buf + first_write, rest_write);
 
-   buffer->end = (buffer->end + size) % buffer->bufsize;
+   FIFO_STORE_RELEASE(&buffer->end, (end + size) % buffer->bufsize);
 }
 
-
 void fifo_read(fifo_buffer_t *buffer, void *in_buf, size_t size)
 {
+   size_t first = buffer->first;
    size_t first_read = size;
    size_t rest_read = 0;
-   if (buffer->first + size > buffer->bufsize)
+   if (first + size > buffer->bufsize)
    {
-      first_read = buffer->bufsize - buffer->first;
+      first_read = buffer->bufsize - first;
       rest_read = size - first_read;
    }
 
-   memcpy(in_buf, (const uint8_t*)buffer->buffer + buffer->first, first_read);
+   memcpy(in_buf, (const uint8_t*)buffer->buffer + first, first_read);
    memcpy((uint8_t*)in_buf + first_read, buffer->buffer, rest_read);
 
-   buffer->first = (buffer->first + size) % buffer->bufsize;
+   FIFO_STORE_RELEASE(&buffer->first, (first + size) % buffer->bufsize);
+}
+
+void *fifo_write_reserve(fifo_buffer_t *buffer, size_t *size)
+{
+   size_t end = buffer->end;
+   size_t avail = fifo_write_avail(buffer);
+   size_t contiguous = buffer->bufsize - end;
+
+   *size = avail < contiguous ? avail : contiguous;
+   return buffer->buffer + end;
+}
+
+void fifo_write_commit(fifo_buffer_t *buffer, size_t size)
+{
+   FIFO_STORE_RELEASE(&buffer->end, (buffer->end + size) % buffer->bufsize);
+}
+
+const void *fifo_read_peek(fifo_buffer_t *buffer, size_t *size)
+{
+   size_t first = buffer->first;
+   size_t avail = fifo_read_avail(buffer);
+   size_t contiguous = buffer->bufsize - first;
+
+   *size = avail < contiguous ? avail : contiguous;
+   return buffer->buffer + first;
+}
+
+void fifo_read_consume(fifo_buffer_t *buffer, size_t size)
+{
+   FIFO_STORE_RELEASE(&buffer->first, (buffer->first + size) % buffer->bufsize);
 }
 
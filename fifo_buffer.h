@@ -25,6 +25,11 @@
 typedef struct fifo_buffer fifo_buffer_t;
 #endif
 
+// The FIFO is lock-free for a single producer and a single consumer.
+// The producer may only call write functions and fifo_write_avail(),
+// the consumer may only call read functions and fifo_read_avail().
+// Any other sharing of the FIFO between threads must be locked externally.
+
 fifo_buffer_t *fifo_new(size_t size);
 void fifo_write(fifo_buffer_t *buffer, const void *in_buf, size_t size);
 void fifo_read(fifo_buffer_t *buffer, void *in_buf, size_t size);
@@ -32,4 +37,17 @@ void fifo_free(fifo_buffer_t *buffer);
 size_t fifo_read_avail(fifo_buffer_t *buffer);
 size_t fifo_write_avail(fifo_buffer_t *buffer);
 
+// Zero-copy producer interface.
+// Returns a pointer to contiguous free space, and sets *size to how many bytes can be written there.
+// This can be less than fifo_write_avail() when the free space wraps around the end of the buffer.
+// Data is made visible to the consumer with fifo_write_commit().
+void *fifo_write_reserve(fifo_buffer_t *buffer, size_t *size);
+void fifo_write_commit(fifo_buffer_t *buffer, size_t size);
+
+// Zero-copy consumer interface.
+// Returns a pointer to contiguous readable data, and sets *size to how many bytes can be read there.
+// The data stays valid until it is released with fifo_read_consume().
+const void *fifo_read_peek(fifo_buffer_t *buffer, size_t *size);
+void fifo_read_consume(fifo_buffer_t *buffer, size_t size);
+
 #endif
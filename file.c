@@ -26,6 +26,15 @@
 #include "compat/strl.h"
 #include "hash.h"
 
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_THREADS
+#include "thread.h"
+#endif
+
 #if defined(_WIN32) && !defined(_XBOX)
 #include <io.h>
 #include <fcntl.h>
@@ -118,96 +127,121 @@ error:
    return false;
 }
 
-static void patch_rom(uint8_t **buf, ssize_t *size)
+// Applies the first patch found to the ROM. Returns a newly allocated, patched ROM, or NULL.
+// The ROM itself is only read from, so it can be a read-only mapping.
+static uint8_t *patch_rom(const uint8_t *rom, size_t rom_size, size_t *patched_size)
 {
-   uint8_t *ret_buf = *buf;
-   ssize_t ret_size = *size;
-
    const char *patch_desc = NULL;
    const char *patch_path = NULL;
-   patch_error_t err = PATCH_UNKNOWN;
-   patch_func_t func = NULL;
-
-   ssize_t patch_size = 0;
-   void *patch_data = NULL;
-   bool success = false;
+   patch_t *patch = NULL;
 
    if (g_extern.ups_pref + g_extern.bps_pref + g_extern.ips_pref > 1)
    {
       RARCH_WARN("Several patches are explicitly defined, ignoring all ...\n");
-      return;
+      return NULL;
    }
 
    bool allow_bps = !g_extern.ups_pref && !g_extern.ips_pref;
    bool allow_ups = !g_extern.bps_pref && !g_extern.ips_pref;
    bool allow_ips = !g_extern.ups_pref && !g_extern.bps_pref;
 
-   if (allow_ups && *g_extern.ups_name && (patch_size = read_file(g_extern.ups_name, &patch_data)) >= 0)
+   if (allow_ups && *g_extern.ups_name && (patch = patch_open(g_extern.ups_name, PATCH_TYPE_UPS)))
    {
       patch_desc = "UPS";
       patch_path = g_extern.ups_name;
-      func = ups_apply_patch;
    }
-   else if (allow_bps && *g_extern.bps_name && (patch_size = read_file(g_extern.bps_name, &patch_data)) >= 0)
+   else if (allow_bps && *g_extern.bps_name && (patch = patch_open(g_extern.bps_name, PATCH_TYPE_BPS)))
    {
       patch_desc = "BPS";
       patch_path = g_extern.bps_name;
-      func = bps_apply_patch;
    }
-   else if (allow_ips && *g_extern.ips_name && (patch_size = read_file(g_extern.ips_name, &patch_data)) >= 0)
+   else if (allow_ips && *g_extern.ips_name && (patch = patch_open(g_extern.ips_name, PATCH_TYPE_IPS)))
    {
       patch_desc = "IPS";
       patch_path = g_extern.ips_name;
-      func = ips_apply_patch;
    }
    else
    {
       RARCH_LOG("Did not find a valid ROM patch.\n");
-      return;
+      return NULL;
    }
 
    RARCH_LOG("Found %s file in \"%s\", attempting to patch ...\n", patch_desc, patch_path);
 
-   size_t target_size = ret_size * 4; // Just to be sure ...
-   uint8_t *patched_rom = (uint8_t*)malloc(target_size);
-   if (!patched_rom)
-   {
-      RARCH_ERR("Failed to allocate memory for patched ROM ...\n");
-      goto error;
-   }
+   uint8_t *patched_rom = NULL;
+   size_t target_size = 0;
+   patch_error_t err = patch_prepare(patch, rom_size, &target_size);
 
-   err = func((const uint8_t*)patch_data, patch_size, ret_buf, ret_size, patched_rom, &target_size);
    if (err == PATCH_SUCCESS)
    {
-      RARCH_LOG("ROM patched successfully (%s).\n", patch_desc);
-      success = true;
+      patched_rom = (uint8_t*)malloc(target_size ? target_size : 1);
+      if (!patched_rom)
+      {
+         RARCH_ERR("Failed to allocate memory for patched ROM ...\n");
+         patch_close(patch);
+         return NULL;
+      }
+
+      err = patch_apply(patch, rom, patched_rom);
    }
-   else
-      RARCH_ERR("Failed to patch %s: Error #%u\n", patch_desc, (unsigned)err);
 
-   if (success)
+   patch_close(patch);
+
+   if (err != PATCH_SUCCESS)
    {
-      free(ret_buf);
-      *buf = patched_rom;
-      *size = target_size;
+      RARCH_ERR("Failed to patch %s: Error #%u\n", patch_desc, (unsigned)err);
+      free(patched_rom);
+      return NULL;
    }
 
-   if (patch_data)
-      free(patch_data);
+   RARCH_LOG("ROM patched successfully (%s).\n", patch_desc);
+   *patched_size = target_size;
+   return patched_rom;
+}
 
-   return;
+// The main ROM as handed to the core.
+struct rom_data
+{
+   uint8_t *data;
+   size_t size;
+   bool mapped; // Read-only mapping of the ROM file.
+};
 
-error:
-   *buf = ret_buf;
-   *size = ret_size;
-   if (patch_data)
-      free(patch_data);
+static void rom_data_free(struct rom_data *rom)
+{
+#ifdef HAVE_MMAP
+   if (rom->mapped)
+      munmap(rom->data, rom->size);
+   else
+#endif
+      free(rom->data);
+
+   memset(rom, 0, sizeof(*rom));
 }
 
-static ssize_t read_rom_file(FILE *file, void **buf)
+#ifdef HAVE_MMAP
+// Maps a ROM file read-only. Nothing is read until the core (or a patch) touches it.
+static bool map_rom_file(FILE *file, struct rom_data *rom)
 {
-   ssize_t ret = 0;
-   uint8_t *ret_buf = NULL;
+   struct stat st;
+   int fd = fileno(file);
+   if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+      return false;
+
+   void *ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   if (ptr == MAP_FAILED)
+      return false;
+
+   rom->data = (uint8_t*)ptr;
+   rom->size = st.st_size;
+   rom->mapped = true;
+   return true;
+}
+#endif
+
+static bool read_rom_file(FILE *file, struct rom_data *rom)
+{
+   memset(rom, 0, sizeof(*rom));
 
    if (file == NULL) // stdin
    {
@@ -222,7 +256,7 @@ static ssize_t read_rom_file(FILE *file, void **buf)
       if (rom_buf == NULL)
       {
          RARCH_ERR("Couldn't allocate memory.\n");
-         return -1;
+         return false;
       }
 
       for (;;)
@@ -238,51 +272,104 @@ static ssize_t read_rom_file(FILE *file, void **buf)
          if (rom_buf == NULL)
          {
             RARCH_ERR("Couldn't allocate memory.\n");
-            return -1;
+            return false;
          }
 
          buf_size *= 2;
       }
 
-      ret_buf = rom_buf;
-      ret = buf_ptr;
+      rom->data = rom_buf;
+      rom->size = buf_ptr;
    }
+#ifdef HAVE_MMAP
+   else if (map_rom_file(file, rom))
+      RARCH_LOG("Mapped ROM file.\n");
+#endif
    else
    {
       fseek(file, 0, SEEK_END);
-      ret = ftell(file);
+      long size = ftell(file);
       rewind(file);
 
-      void *rom_buf = malloc(ret);
+      void *rom_buf = malloc(size);
       if (rom_buf == NULL)
       {
          RARCH_ERR("Couldn't allocate memory.\n");
-         return -1;
+         return false;
       }
 
-      if (fread(rom_buf, 1, ret, file) < (size_t)ret)
+      if (fread(rom_buf, 1, size, file) < (size_t)size)
       {
          RARCH_ERR("Didn't read whole file.\n");
          free(rom_buf);
-         return -1;
+         return false;
       }
 
-      ret_buf = (uint8_t*)rom_buf;
+      rom->data = (uint8_t*)rom_buf;
+      rom->size = size;
    }
 
    if (!g_extern.block_patch)
    {
       // Attempt to apply a patch.
-      patch_rom(&ret_buf, &ret);
+      size_t patched_size = 0;
+      uint8_t *patched = patch_rom(rom->data, rom->size, &patched_size);
+      if (patched)
+      {
+         rom_data_free(rom);
+         rom->data = patched;
+         rom->size = patched_size;
+      }
    }
-   
-   g_extern.cart_crc = crc32_calculate(ret_buf, ret);
+
+   return true;
+}
+
+// CRC32 and SHA-256 are only needed by some (cheats, movies, netplay),
+// so they are computed after the game is loaded, in the background if possible.
+// The hasher takes over the ROM and frees it when done.
+static struct rom_data rom_hash_data;
+#ifdef HAVE_THREADS
+static sthread_t *rom_hash_thread;
+#endif
+
+static void rom_hash(void *data)
+{
+   struct rom_data *rom = (struct rom_data*)data;
+
+   g_extern.cart_crc = crc32_calculate(rom->data, rom->size);
 #ifdef HAVE_XML
-   sha256_hash(g_extern.sha256, ret_buf, ret);
+   sha256_hash(g_extern.sha256, rom->data, rom->size);
    RARCH_LOG("SHA256 sum: %s\n", g_extern.sha256);
 #endif
-   *buf = ret_buf;
-   return ret;
+
+   rom_data_free(rom);
+}
+
+static void rom_hash_start(struct rom_data *rom)
+{
+   rom_hash_wait();
+   rom_hash_data = *rom;
+   memset(rom, 0, sizeof(*rom));
+
+#ifdef HAVE_THREADS
+   rom_hash_thread = sthread_create(rom_hash, &rom_hash_data);
+   if (rom_hash_thread)
+      return;
+#endif
+
+   rom_hash(&rom_hash_data);
+}
+
+void rom_hash_wait(void)
+{
+#ifdef HAVE_THREADS
+   if (rom_hash_thread)
+   {
+      sthread_join(rom_hash_thread);
+      rom_hash_thread = NULL;
+   }
+#endif
 }
 
 
@@ -368,32 +455,26 @@ bool save_state(const char *path)
    if (size == 0)
       return false;
 
-   void *data = malloc(size);
-   if (!data)
-   {
-      RARCH_ERR("Failed to allocate memory for save state buffer.\n");
+   if (!g_extern.state_io)
       return false;
-   }
 
    RARCH_LOG("State size: %d bytes.\n", (int)size);
-   bool ret = pretro_serialize(data, size);
-   if (ret)
-      ret = dump_to_file(path, data, size);
+   // Written in the background. Failures to write it are reported by state_io_get_error().
+   bool ret = state_io_write(g_extern.state_io, path, size, pretro_serialize);
 
    if (!ret)
       RARCH_ERR("Failed to save state to \"%s\".\n", path);
 
-   free(data);
    return ret;
 }
 
 bool load_state(const char *path)
 {
    RARCH_LOG("Loading state: \"%s\".\n", path);
-   void *buf = NULL;
-   ssize_t size = read_file(path, &buf);
+   size_t size = 0;
+   const void *buf = g_extern.state_io ? state_io_read(g_extern.state_io, path, &size) : NULL;
 
-   if (size < 0)
+   if (!buf)
    {
       RARCH_ERR("Failed to load state from \"%s\".\n", path);
       return false;
@@ -454,6 +535,7 @@ bool load_state(const char *path)
    }
 
    ret = pretro_unserialize(buf, size);
+   g_extern.run_ahead.need_sync = true;
 
    // Flush back :D
    for (unsigned i = 0; i < 2 && ret; i++)
@@ -470,7 +552,6 @@ bool load_state(const char *path)
       if (block_buf[i])
          free(block_buf[i]);
 
-   free(buf);
    return ret;
 }
 
@@ -532,22 +613,26 @@ static bool load_roms(unsigned rom_type, const char **rom_paths, size_t roms)
    if (roms > MAX_ROMS)
       return false;
 
+   struct rom_data rom = {0};
    void *rom_buf[MAX_ROMS] = {NULL};
    ssize_t rom_len[MAX_ROMS] = {0};
    struct retro_game_info info[MAX_ROMS] = {{NULL}};
 
-   if (!g_extern.system.info.need_fullpath)
+   if (g_extern.benchmark.frames && !g_extern.rom_file)
+      RARCH_LOG("No ROM given for benchmark, loading game without data.\n");
+   else if (!g_extern.system.info.need_fullpath)
    {
-      if ((rom_len[0] = read_rom_file(g_extern.rom_file, &rom_buf[0])) == -1)
+      if (!read_rom_file(g_extern.rom_file, &rom))
       {
          RARCH_ERR("Could not read ROM file.\n");
          return false;
       }
 
+      // A mapping stays valid after the file is closed.
       if (g_extern.rom_file)
          fclose(g_extern.rom_file);
 
-      RARCH_LOG("ROM size: %u bytes.\n", (unsigned)rom_len[0]);
+      RARCH_LOG("ROM size: %u bytes.\n", (unsigned)rom.size);
    }
    else
    {
@@ -564,8 +649,8 @@ static bool load_roms(unsigned rom_type, const char **rom_paths, size_t roms)
    char *xml_buf = load_xml_map(g_extern.xml_name);
 
    info[0].path = rom_paths[0];
-   info[0].data = rom_buf[0];
-   info[0].size = rom_len[0];
+   info[0].data = rom.data;
+   info[0].size = rom.size;
    info[0].meta = xml_buf;
 
    for (size_t i = 1; i < roms; i++)
@@ -592,7 +677,27 @@ static bool load_roms(unsigned rom_type, const char **rom_paths, size_t roms)
    if (!ret)
       RARCH_ERR("Failed to load game.\n");
 
+#ifdef HAVE_DYNAMIC
+   // The run-ahead instance needs the same game, and the ROM data is only around for now.
+   if (ret && g_extern.run_ahead.instance)
+   {
+      struct retro_instance *inst = g_extern.run_ahead.instance;
+      if (rom_type == 0)
+         inst->game_loaded = inst->load_game(&info[0]);
+      else
+         inst->game_loaded = inst->load_game_special(rom_type, info, roms);
+
+      if (!inst->game_loaded)
+         RARCH_WARN("Second libretro instance failed to load game.\n");
+   }
+#endif
+
 end:
+   if (ret && rom.data)
+      rom_hash_start(&rom);
+   else
+      rom_data_free(&rom);
+
    for (unsigned i = 0; i < MAX_ROMS; i++)
       free(rom_buf[i]);
    free(xml_buf);
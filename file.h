@@ -36,6 +36,10 @@ void save_ram_file(const char *path, int type);
 
 bool init_rom_file(enum rarch_game_type type);
 
+// The ROM is hashed in the background once loaded.
+// Blocks until g_extern.cart_crc and g_extern.sha256 are valid.
+void rom_hash_wait(void);
+
 // Yep, this is C alright ;)
 union string_list_elem_attr
 {
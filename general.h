@@ -27,6 +27,7 @@
 #include "rewind.h"
 #include "movie.h"
 #include "autosave.h"
+#include "state_io.h"
 #include "dynamic.h"
 #include "cheats.h"
 #include "audio/ext/rarch_dsp.h"
@@ -90,6 +91,10 @@
 
 #include "audio/resampler.h"
 
+#ifdef HAVE_THREADS
+#include "audio/audio_thread.h"
+#endif
+
 #define MAX_PLAYERS 8
 
 // All config related settings go here.
@@ -106,6 +111,8 @@ struct settings
       unsigned fullscreen_x;
       unsigned fullscreen_y;
       bool vsync;
+      bool threaded;
+      unsigned scaler_threads;
       bool smooth;
       bool force_aspect;
       bool crop_overscan;
@@ -167,6 +174,8 @@ struct settings
       bool rate_control;
       float rate_control_delta;
       float volume; // dB scale
+      unsigned resampler_quality;
+      bool threaded;
    } audio;
 
    struct
@@ -197,19 +206,30 @@ struct settings
    bool rewind_enable;
    size_t rewind_buffer_size;
    unsigned rewind_granularity;
+   bool rewind_threaded;
+   unsigned rewind_keyframe_interval;
+
+   unsigned run_ahead_frames;
+   bool run_ahead_secondary_instance;
 
    float slowmotion_ratio;
 
    bool pause_nonactive;
    unsigned autosave_interval;
 
+   unsigned netplay_input_delay_max;
+   unsigned netplay_players;
+
    bool block_sram_overwrite;
    bool savestate_auto_index;
    bool savestate_auto_save;
+   bool savestate_compression;
 
    bool network_cmd_enable;
    uint16_t network_cmd_port;
    bool stdin_cmd_enable;
+
+   char frame_stats_path[PATH_MAX];
 };
 
 enum rarch_game_type
@@ -339,6 +359,7 @@ struct global
 
       sample_t *outsamples;
       int16_t *conv_outsamples;
+      int16_t *s16_outsamples;
 
       int16_t *rewind_buf;
       size_t rewind_ptr;
@@ -354,6 +375,10 @@ struct global
 
       float volume_db;
       float volume_gain;
+
+#ifdef HAVE_THREADS
+      audio_thread_t *thread;
+#endif
    } audio_data;
 
    struct
@@ -379,9 +404,28 @@ struct global
    // Rewind support.
    state_manager_t *state_manager;
    void *state_buf;
+   void *state_buf_back; // Used by threaded rewind. The state manager owns state_buf until the next push.
    size_t state_size;
    bool frame_is_reverse;
 
+   // Run-ahead support.
+   struct
+   {
+      void *state;
+      size_t state_size;
+      // Set while running frames which will be thrown away.
+      bool skip_video;
+      bool skip_audio;
+      bool skip_input_poll;
+
+#ifdef HAVE_DYNAMIC
+      // Runs ahead of the main instance, which then never has to roll back.
+      struct retro_instance *instance;
+#endif
+      // Set when the main instance state changed outside of running a frame.
+      bool need_sync;
+   } run_ahead;
+
 #ifdef HAVE_BSV_MOVIE
    // Movie playback/recording support.
    struct
@@ -406,6 +450,7 @@ struct global
    bool is_paused;
    bool is_oneshot;
    bool is_slowmotion;
+   bool is_fast_forward;
 
    // Turbo support
    bool turbo_frame_enable[MAX_PLAYERS];
@@ -415,6 +460,9 @@ struct global
    // Autosave support.
    autosave_t *autosave[2];
 
+   // Save state I/O.
+   state_io_t *state_io;
+
    // Netplay.
 #ifdef HAVE_NETPLAY
    netplay_t *netplay;
@@ -423,6 +471,7 @@ struct global
    bool netplay_is_client;
    bool netplay_is_spectate;
    unsigned netplay_sync_frames;
+   bool has_set_netplay_sync_frames;
    uint16_t netplay_port;
    char netplay_nick[32];
 #endif
@@ -436,7 +485,7 @@ struct global
    unsigned record_width;
    unsigned record_height;
 
-   uint8_t *record_gpu_buffer;
+   bool record_gpu;
    size_t record_gpu_width;
    size_t record_gpu_height;
 #endif
@@ -452,6 +501,13 @@ struct global
    unsigned frame_count;
    char title_buf[64];
 
+   // Headless benchmark (--benchmark-frames).
+   struct
+   {
+      unsigned frames;
+      uint64_t start_usec;
+   } benchmark;
+
    struct
    {
       struct string_list *list;
@@ -612,6 +668,7 @@ int rarch_main_init(int argc, char *argv[]);
 bool rarch_main_iterate(void);
 void rarch_main_deinit(void);
 void rarch_render_cached_frame(void);
+bool rarch_audio_process(const int16_t *data, size_t samples);
 void rarch_init_msg_queue(void);
 void rarch_deinit_msg_queue(void);
 
@@ -619,6 +676,7 @@ void rarch_load_state(void);
 void rarch_save_state(void);
 void rarch_state_slot_increase(void);
 void rarch_state_slot_decrease(void);
+bool rarch_rewind_seek(float seconds);
 /////////
 
 // Public data structures
@@ -694,7 +694,7 @@ static void gl_set_rotation(void *data, unsigned rotation)
 {
    struct gl_ortho ortho = {0, 1, 0, 1, -1, 1};
 
-   gl_t *gl = (gl_t*)driver.video_data;
+   gl_t *gl = (gl_t*)data;
    gl->rotation = 90 * rotation;
    gl_set_projection(gl, &ortho, true);
 }
@@ -1193,6 +1193,7 @@ static bool gl_frame(void *data, const void *frame, unsigned width, unsigned hei
 
    RARCH_PERFORMANCE_STOP(frame_run);
 
+   rarch_usec_t swap_start = rarch_get_time_usec();
 #ifdef HAVE_RMENU
    if (g_extern.draw_menu)
       context_rmenu_frame_func(gl);
@@ -1200,6 +1201,10 @@ static bool gl_frame(void *data, const void *frame, unsigned width, unsigned hei
 #endif
       context_swap_buffers_func();
 
+   // Frame stats belong to the emulation thread, which we aren't on if the threaded video wrapper is used.
+   if (driver.video_data == gl)
+      rarch_frame_stats_add(RARCH_FRAME_STAGE_SWAP, swap_start);
+
 #if !defined(HAVE_OPENGLES) && defined(HAVE_FFMPEG)
    if (gl->pbo_readback_enable)
       gl_pbo_async_readback(gl);
@@ -14,6 +14,7 @@
  */
 
 #include "pixconv.h"
+#include "../../performance.h"
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,37 +22,31 @@
 
 #ifdef SCALER_NO_SIMD
 #undef __SSE2__
+#undef __ARM_NEON__
 #endif
 
-#if defined(__SSE2__)
-#include <emmintrin.h>
+// x86 kernels are always built, and picked at runtime in conv_select_simd().
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(SCALER_NO_SIMD)
+#define PIXCONV_HAVE_X86
+#define PIXCONV_SSE2 __attribute__((target("sse2")))
+#define PIXCONV_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
 #endif
 
-#if defined(__SSE2_)
-void conv_rgb565_0rgb1555(void *output_, const void *input_,
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+static void conv_rgb565_0rgb1555_c(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
    const uint16_t *input = (const uint16_t*)input_;
    uint16_t *output = (uint16_t*)output_;
 
-   int max_width = width - 7;
-
-   const __m128i hi_mask   = _mm_set1_epi16(0x7fe0);
-   const __m128i lo_mask   = _mm_set1_epi16(0x1f);
-
    for (int h = 0; h < height; h++, output += out_stride >> 1, input += in_stride >> 1)
    {
-      int w;
-      for (w = 0; w < max_width; w += 8)
-      {
-         const __m128i in = _mm_loadu_si128((const __m128i*)(input + w));
-         __m128i hi = _mm_and_si128(_mm_slli_epi16(in, 1), hi_mask);
-         __m128i lo = _mm_and_si128(in, lo_mask);
-         _mm_storeu_si128((__m128i*)(output + w), _mm_or_si128(hi, lo));
-      }
-
-      for (; w < width; w++)
+      for (int w = 0; w < width; w++)
       {
          uint16_t col = input[w];
          uint16_t hi = (col >> 1) & 0x7fe0;
@@ -60,8 +55,8 @@ void conv_rgb565_0rgb1555(void *output_, const void *input_,
       }
    }
 }
-#else
-void conv_rgb565_0rgb1555(void *output_, const void *input_,
+
+static void conv_0rgb1555_rgb565_c(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
@@ -73,17 +68,178 @@ void conv_rgb565_0rgb1555(void *output_, const void *input_,
       for (int w = 0; w < width; w++)
       {
          uint16_t col = input[w];
-         uint16_t hi = (col >> 1) & 0x7fe0;
-         uint16_t lo = col & 0x1f;
-         output[w] = hi | lo;
+         uint16_t rg = (col << 1) & ((0x1f << 11) | (0x1f << 6));
+         uint16_t b = col & 0x1f;
+         uint16_t glow = (col >> 4) & (1 << 5);
+         output[w] = rg | b | glow;
       }
    }
 }
 
-#endif
+static void conv_0rgb1555_argb8888_c(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint16_t *input = (const uint16_t*)input_;
+   uint32_t *output      = (uint32_t*)output_;
+
+   for (int h = 0; h < height; h++, output += out_stride >> 2, input += in_stride >> 1)
+   {
+      for (int w = 0; w < width; w++)
+      {
+         uint32_t col = input[w];
+         uint32_t r = (col >> 10) & 0x1f;
+         uint32_t g = (col >>  5) & 0x1f;
+         uint32_t b = (col >>  0) & 0x1f;
+         r = (r << 3) | (r >> 2);
+         g = (g << 3) | (g >> 2);
+         b = (b << 3) | (b >> 2);
+
+         output[w] = (0xffu << 24) | (r << 16) | (g << 8) | (b << 0);
+      }
+   }
+}
+
+static void conv_rgb565_argb8888_c(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint16_t *input = (const uint16_t*)input_;
+   uint32_t *output      = (uint32_t*)output_;
+
+   for (int h = 0; h < height; h++, output += out_stride >> 2, input += in_stride >> 1)
+   {
+      for (int w = 0; w < width; w++)
+      {
+         uint32_t col = input[w];
+         uint32_t r = (col >> 11) & 0x1f;
+         uint32_t g = (col >>  5) & 0x3f;
+         uint32_t b = (col >>  0) & 0x1f;
+         r = (r << 3) | (r >> 2);
+         g = (g << 2) | (g >> 4);
+         b = (b << 3) | (b >> 2);
+
+         output[w] = (0xffu << 24) | (r << 16) | (g << 8) | (b << 0);
+      }
+   }
+}
+
+static void conv_0rgb1555_bgr24_c(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint16_t *input = (const uint16_t*)input_;
+   uint8_t *output       = (uint8_t*)output_;
+
+   for (int h = 0; h < height; h++, output += out_stride, input += in_stride >> 1)
+   {
+      uint8_t *out = output;
+      for (int w = 0; w < width; w++)
+      {
+         uint32_t col = input[w];
+         uint32_t b = (col >>  0) & 0x1f;
+         uint32_t g = (col >>  5) & 0x1f;
+         uint32_t r = (col >> 10) & 0x1f;
+         b = (b << 3) | (b >> 2);
+         g = (g << 3) | (g >> 2);
+         r = (r << 3) | (r >> 2);
+
+         *out++ = b;
+         *out++ = g;
+         *out++ = r;
+      }
+   }
+}
+
+static void conv_rgb565_bgr24_c(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint16_t *input = (const uint16_t*)input_;
+   uint8_t *output       = (uint8_t*)output_;
+
+   for (int h = 0; h < height; h++, output += out_stride, input += in_stride >> 1)
+   {
+      uint8_t *out = output;
+      for (int w = 0; w < width; w++)
+      {
+         uint32_t col = input[w];
+         uint32_t b = (col >>  0) & 0x1f;
+         uint32_t g = (col >>  5) & 0x3f;
+         uint32_t r = (col >> 11) & 0x1f;
+         b = (b << 3) | (b >> 2);
+         g = (g << 2) | (g >> 4);
+         r = (r << 3) | (r >> 2);
+
+         *out++ = b;
+         *out++ = g;
+         *out++ = r;
+      }
+   }
+}
+
+static void conv_bgr24_argb8888_c(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint8_t *input = (const uint8_t*)input_;
+   uint32_t *output     = (uint32_t*)output_;
+
+   for (int h = 0; h < height; h++, output += out_stride >> 2, input += in_stride)
+   {
+      const uint8_t *inp = input;
+      for (int w = 0; w < width; w++)
+      {
+         uint32_t b = *inp++;
+         uint32_t g = *inp++;
+         uint32_t r = *inp++;
+         output[w] = (0xffu << 24) | (r << 16) | (g << 8) | (b << 0);
+      }
+   }
+}
+
+static void conv_argb8888_0rgb1555_c(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint32_t *input = (const uint32_t*)input_;
+   uint16_t *output      = (uint16_t*)output_;
+
+   for (int h = 0; h < height; h++, output += out_stride >> 1, input += in_stride >> 2)
+   {
+      for (int w = 0; w < width; w++)
+      {
+         uint32_t col = input[w];
+         uint16_t r = (col >> 19) & 0x1f;
+         uint16_t g = (col >> 11) & 0x1f;
+         uint16_t b = (col >>  3) & 0x1f;
+         output[w] = (r << 10) | (g << 5) | (b << 0);
+      }
+   }
+}
+
+static void conv_argb8888_bgr24_c(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint32_t *input = (const uint32_t*)input_;
+   uint8_t *output       = (uint8_t*)output_;
+
+   for (int h = 0; h < height; h++, output += out_stride, input += in_stride >> 2)
+   {
+      uint8_t *out = output;
+      for (int w = 0; w < width; w++)
+      {
+         uint32_t col = input[w];
+         *out++ = (uint8_t)(col >>  0);
+         *out++ = (uint8_t)(col >>  8);
+         *out++ = (uint8_t)(col >> 16);
+      }
+   }
+}
 
-#if defined(__SSE2__)
-void conv_0rgb1555_rgb565(void *output_, const void *input_,
+#if defined(PIXCONV_HAVE_X86)
+static PIXCONV_SSE2 void conv_rgb565_0rgb1555_sse2(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
@@ -92,9 +248,8 @@ void conv_0rgb1555_rgb565(void *output_, const void *input_,
 
    int max_width = width - 7;
 
-   const __m128i hi_mask   = _mm_set1_epi16((int16_t)((0x1f << 11) | (0x1f << 6)));
+   const __m128i hi_mask   = _mm_set1_epi16(0x7fe0);
    const __m128i lo_mask   = _mm_set1_epi16(0x1f);
-   const __m128i glow_mask = _mm_set1_epi16(1 << 5);
 
    for (int h = 0; h < height; h++, output += out_stride >> 1, input += in_stride >> 1)
    {
@@ -102,33 +257,46 @@ void conv_0rgb1555_rgb565(void *output_, const void *input_,
       for (w = 0; w < max_width; w += 8)
       {
          const __m128i in = _mm_loadu_si128((const __m128i*)(input + w));
-         __m128i rg   = _mm_and_si128(_mm_slli_epi16(in, 1), hi_mask);
-         __m128i b    = _mm_and_si128(in, lo_mask);
-         __m128i glow = _mm_and_si128(_mm_srli_epi16(in, 4), glow_mask);
-         _mm_storeu_si128((__m128i*)(output + w), _mm_or_si128(rg, _mm_or_si128(b, glow)));
+         __m128i hi = _mm_and_si128(_mm_srli_epi16(in, 1), hi_mask);
+         __m128i lo = _mm_and_si128(in, lo_mask);
+         _mm_storeu_si128((__m128i*)(output + w), _mm_or_si128(hi, lo));
       }
 
       for (; w < width; w++)
       {
          uint16_t col = input[w];
-         uint16_t rg = (col << 1) & ((0x1f << 11) | (0x1f << 6));
-         uint16_t b = col & 0x1f;
-         uint16_t glow = (col >> 4) & (1 << 5);
-         output[w] = rg | b | glow;
+         uint16_t hi = (col >> 1) & 0x7fe0;
+         uint16_t lo = col & 0x1f;
+         output[w] = hi | lo;
       }
    }
 }
-#else
-void conv_0rgb1555_rgb565(void *output_, const void *input_,
+static PIXCONV_SSE2 void conv_0rgb1555_rgb565_sse2(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
    const uint16_t *input = (const uint16_t*)input_;
    uint16_t *output = (uint16_t*)output_;
 
+   int max_width = width - 7;
+
+   const __m128i hi_mask   = _mm_set1_epi16((int16_t)((0x1f << 11) | (0x1f << 6)));
+   const __m128i lo_mask   = _mm_set1_epi16(0x1f);
+   const __m128i glow_mask = _mm_set1_epi16(1 << 5);
+
    for (int h = 0; h < height; h++, output += out_stride >> 1, input += in_stride >> 1)
    {
-      for (int w = 0; w < width; w++)
+      int w;
+      for (w = 0; w < max_width; w += 8)
+      {
+         const __m128i in = _mm_loadu_si128((const __m128i*)(input + w));
+         __m128i rg   = _mm_and_si128(_mm_slli_epi16(in, 1), hi_mask);
+         __m128i b    = _mm_and_si128(in, lo_mask);
+         __m128i glow = _mm_and_si128(_mm_srli_epi16(in, 4), glow_mask);
+         _mm_storeu_si128((__m128i*)(output + w), _mm_or_si128(rg, _mm_or_si128(b, glow)));
+      }
+
+      for (; w < width; w++)
       {
          uint16_t col = input[w];
          uint16_t rg = (col << 1) & ((0x1f << 11) | (0x1f << 6));
@@ -138,10 +306,7 @@ void conv_0rgb1555_rgb565(void *output_, const void *input_,
       }
    }
 }
-#endif
-
-#if defined(__SSE2__)
-void conv_0rgb1555_argb8888(void *output_, const void *input_,
+static PIXCONV_SSE2 void conv_0rgb1555_argb8888_sse2(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
@@ -196,34 +361,7 @@ void conv_0rgb1555_argb8888(void *output_, const void *input_,
       }
    }
 }
-#else
-void conv_0rgb1555_argb8888(void *output_, const void *input_,
-      int width, int height,
-      int out_stride, int in_stride)
-{
-   const uint16_t *input = (const uint16_t*)input_;
-   uint32_t *output      = (uint32_t*)output_;
-
-   for (int h = 0; h < height; h++, output += out_stride >> 2, input += in_stride >> 1)
-   {
-      for (int w = 0; w < width; w++)
-      {
-         uint32_t col = input[w];
-         uint32_t r = (col >> 10) & 0x1f;
-         uint32_t g = (col >>  5) & 0x1f;
-         uint32_t b = (col >>  0) & 0x1f;
-         r = (r << 3) | (r >> 2);
-         g = (g << 3) | (g >> 2);
-         b = (b << 3) | (b >> 2);
-
-         output[w] = (0xffu << 24) | (r << 16) | (g << 8) | (b << 0);
-      }
-   }
-}
-#endif
-
-#if defined(__SSE2__)
-void conv_rgb565_argb8888(void *output_, const void *input_,
+static PIXCONV_SSE2 void conv_rgb565_argb8888_sse2(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
@@ -280,40 +418,13 @@ void conv_rgb565_argb8888(void *output_, const void *input_,
       }
    }
 }
-#else
-void conv_rgb565_argb8888(void *output_, const void *input_,
-      int width, int height,
-      int out_stride, int in_stride)
+// :( TODO: Make this saner.
+static inline PIXCONV_SSE2 void store_bgr24_sse2(void *output, __m128i a, __m128i b, __m128i c, __m128i d)
 {
-   const uint16_t *input = (const uint16_t*)input_;
-   uint32_t *output      = (uint32_t*)output_;
-
-   for (int h = 0; h < height; h++, output += out_stride >> 2, input += in_stride >> 1)
-   {
-      for (int w = 0; w < width; w++)
-      {
-         uint32_t col = input[w];
-         uint32_t r = (col >> 11) & 0x1f;
-         uint32_t g = (col >>  5) & 0x3f;
-         uint32_t b = (col >>  0) & 0x1f;
-         r = (r << 3) | (r >> 2);
-         g = (g << 2) | (g >> 4);
-         b = (b << 3) | (b >> 2);
-
-         output[w] = (0xffu << 24) | (r << 16) | (g << 8) | (b << 0);
-      }
-   }
-}
-#endif
-
-#if defined(__SSE2__)
-// :( TODO: Make this saner.
-static inline void store_bgr24_sse2(void *output, __m128i a, __m128i b, __m128i c, __m128i d)
-{
-   const __m128i mask_0 = _mm_set_epi32(0, 0, 0, 0x00ffffff);
-   const __m128i mask_1 = _mm_set_epi32(0, 0, 0x00ffffff, 0);
-   const __m128i mask_2 = _mm_set_epi32(0, 0x00ffffff, 0, 0);
-   const __m128i mask_3 = _mm_set_epi32(0x00ffffff, 0, 0, 0);
+   const __m128i mask_0 = _mm_set_epi32(0, 0, 0, 0x00ffffff);
+   const __m128i mask_1 = _mm_set_epi32(0, 0, 0x00ffffff, 0);
+   const __m128i mask_2 = _mm_set_epi32(0, 0x00ffffff, 0, 0);
+   const __m128i mask_3 = _mm_set_epi32(0x00ffffff, 0, 0, 0);
 
    __m128i a0 = _mm_and_si128(a, mask_0);
    __m128i a1 = _mm_srli_si128(_mm_and_si128(a, mask_1),  1);
@@ -348,7 +459,7 @@ static inline void store_bgr24_sse2(void *output, __m128i a, __m128i b, __m128i
          _mm_or_si128(c0, _mm_or_si128(c1, _mm_or_si128(c2, _mm_or_si128(c3, _mm_or_si128(c4, c5))))));
 }
 
-void conv_0rgb1555_bgr24(void *output_, const void *input_,
+static PIXCONV_SSE2 void conv_0rgb1555_bgr24_sse2(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
@@ -421,7 +532,7 @@ void conv_0rgb1555_bgr24(void *output_, const void *input_,
    }
 }
 
-void conv_rgb565_bgr24(void *output_, const void *input_,
+static PIXCONV_SSE2 void conv_rgb565_bgr24_sse2(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
@@ -494,157 +605,692 @@ void conv_rgb565_bgr24(void *output_, const void *input_,
       }
    }
 }
-#else
-void conv_0rgb1555_bgr24(void *output_, const void *input_,
+static PIXCONV_SSE2 void conv_argb8888_bgr24_sse2(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
-   const uint16_t *input = (const uint16_t*)input_;
+   const uint32_t *input = (const uint32_t*)input_;
    uint8_t *output       = (uint8_t*)output_;
 
-   for (int h = 0; h < height; h++, output += out_stride, input += in_stride >> 1)
+   int max_width = width - 15;
+
+   for (int h = 0; h < height; h++, output += out_stride, input += in_stride >> 2)
    {
       uint8_t *out = output;
-      for (int w = 0; w < width; w++)
+      int w;
+
+      for (w = 0; w < max_width; w += 16, out += 48)
+      {
+         store_bgr24_sse2(out,
+               _mm_loadu_si128((const __m128i*)(input + w +  0)),
+               _mm_loadu_si128((const __m128i*)(input + w +  4)),
+               _mm_loadu_si128((const __m128i*)(input + w +  8)),
+               _mm_loadu_si128((const __m128i*)(input + w + 12)));
+      }
+
+      for (; w < width; w++)
       {
          uint32_t col = input[w];
-         uint32_t b = (col >>  0) & 0x1f;
-         uint32_t g = (col >>  5) & 0x1f;
-         uint32_t r = (col >> 10) & 0x1f;
-         b = (b << 3) | (b >> 2);
-         g = (g << 3) | (g >> 2);
-         r = (r << 3) | (r >> 2);
+         *out++ = (uint8_t)(col >>  0);
+         *out++ = (uint8_t)(col >>  8);
+         *out++ = (uint8_t)(col >> 16);
+      }
+   }
+}
 
-         *out++ = b;
-         *out++ = g;
-         *out++ = r;
+// AVX2 kernels only handle whole vectors. The remaining columns of every row
+// are converted afterwards with the C kernels in a single pass.
+
+static inline PIXCONV_AVX2 __m256i expand_rgb16_avx2(__m256i r, __m256i g, __m256i b, __m256i *hi)
+{
+   const __m256i a = _mm256_set1_epi16(0x00ff);
+
+   __m256i res_lo_bg = _mm256_unpacklo_epi8(b, g);
+   __m256i res_hi_bg = _mm256_unpackhi_epi8(b, g);
+   __m256i res_lo_ra = _mm256_unpacklo_epi8(r, a);
+   __m256i res_hi_ra = _mm256_unpackhi_epi8(r, a);
+
+   __m256i res_lo = _mm256_or_si256(res_lo_bg, _mm256_slli_si256(res_lo_ra, 2));
+   __m256i res_hi = _mm256_or_si256(res_hi_bg, _mm256_slli_si256(res_hi_ra, 2));
+
+   // Unpacks work within 128-bit lanes, so put the pixels back in order.
+   *hi = _mm256_permute2x128_si256(res_lo, res_hi, 0x31);
+   return _mm256_permute2x128_si256(res_lo, res_hi, 0x20);
+}
+
+// Converts 16 pixels. Returns the first 8 as ARGB8888, and the last 8 in hi.
+static inline PIXCONV_AVX2 __m256i load_0rgb1555_avx2(const uint16_t *input, __m256i *hi)
+{
+   const __m256i pix_mask_r  = _mm256_set1_epi16(0x1f << 10);
+   const __m256i pix_mask_gb = _mm256_set1_epi16(0x1f <<  5);
+   const __m256i mul15_mid   = _mm256_set1_epi16(0x4200);
+   const __m256i mul15_hi    = _mm256_set1_epi16(0x0210);
+
+   const __m256i in = _mm256_loadu_si256((const __m256i*)input);
+   __m256i r = _mm256_and_si256(in, pix_mask_r);
+   __m256i g = _mm256_and_si256(in, pix_mask_gb);
+   __m256i b = _mm256_and_si256(_mm256_slli_epi16(in, 5), pix_mask_gb);
+
+   r = _mm256_mulhi_epi16(r, mul15_hi);
+   g = _mm256_mulhi_epi16(g, mul15_mid);
+   b = _mm256_mulhi_epi16(b, mul15_mid);
+
+   return expand_rgb16_avx2(r, g, b, hi);
+}
+
+static inline PIXCONV_AVX2 __m256i load_rgb565_avx2(const uint16_t *input, __m256i *hi)
+{
+   const __m256i pix_mask_r = _mm256_set1_epi16(0x1f << 10);
+   const __m256i pix_mask_g = _mm256_set1_epi16(0x3f <<  5);
+   const __m256i pix_mask_b = _mm256_set1_epi16(0x1f <<  5);
+   const __m256i mul16_r    = _mm256_set1_epi16(0x0210);
+   const __m256i mul16_g    = _mm256_set1_epi16(0x2080);
+   const __m256i mul16_b    = _mm256_set1_epi16(0x4200);
+
+   const __m256i in = _mm256_loadu_si256((const __m256i*)input);
+   __m256i r = _mm256_and_si256(_mm256_srli_epi16(in, 1), pix_mask_r);
+   __m256i g = _mm256_and_si256(in, pix_mask_g);
+   __m256i b = _mm256_and_si256(_mm256_slli_epi16(in, 5), pix_mask_b);
+
+   r = _mm256_mulhi_epi16(r, mul16_r);
+   g = _mm256_mulhi_epi16(g, mul16_g);
+   b = _mm256_mulhi_epi16(b, mul16_b);
+
+   return expand_rgb16_avx2(r, g, b, hi);
+}
+
+// Packs 8 ARGB8888 pixels into 24 bytes of BGR24.
+// 4 bytes past the end are clobbered, so there must be at least 2 more pixels left in the row.
+static inline PIXCONV_AVX2 void store_bgr24_avx2(uint8_t *out, __m256i argb)
+{
+   const __m256i shuf = _mm256_setr_epi8(
+         0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+         0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+   __m256i packed = _mm256_shuffle_epi8(argb, shuf);
+   _mm_storeu_si128((__m128i*)(out +  0), _mm256_castsi256_si128(packed));
+   _mm_storeu_si128((__m128i*)(out + 12), _mm256_extracti128_si256(packed, 1));
+}
+
+static PIXCONV_AVX2 void conv_rgb565_0rgb1555_avx2(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint16_t *input = (const uint16_t*)input_;
+   uint16_t *output = (uint16_t*)output_;
+
+   int vec_width = width & ~15;
+
+   const __m256i hi_mask = _mm256_set1_epi16(0x7fe0);
+   const __m256i lo_mask = _mm256_set1_epi16(0x1f);
+
+   for (int h = 0; h < height; h++, output += out_stride >> 1, input += in_stride >> 1)
+   {
+      for (int w = 0; w < vec_width; w += 16)
+      {
+         const __m256i in = _mm256_loadu_si256((const __m256i*)(input + w));
+         __m256i hi = _mm256_and_si256(_mm256_srli_epi16(in, 1), hi_mask);
+         __m256i lo = _mm256_and_si256(in, lo_mask);
+         _mm256_storeu_si256((__m256i*)(output + w), _mm256_or_si256(hi, lo));
       }
    }
+
+   conv_rgb565_0rgb1555_c((uint16_t*)output_ + vec_width, (const uint16_t*)input_ + vec_width,
+         width - vec_width, height, out_stride, in_stride);
+}
+
+static PIXCONV_AVX2 void conv_0rgb1555_rgb565_avx2(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint16_t *input = (const uint16_t*)input_;
+   uint16_t *output = (uint16_t*)output_;
+
+   int vec_width = width & ~15;
+
+   const __m256i hi_mask   = _mm256_set1_epi16((int16_t)((0x1f << 11) | (0x1f << 6)));
+   const __m256i lo_mask   = _mm256_set1_epi16(0x1f);
+   const __m256i glow_mask = _mm256_set1_epi16(1 << 5);
+
+   for (int h = 0; h < height; h++, output += out_stride >> 1, input += in_stride >> 1)
+   {
+      for (int w = 0; w < vec_width; w += 16)
+      {
+         const __m256i in = _mm256_loadu_si256((const __m256i*)(input + w));
+         __m256i rg   = _mm256_and_si256(_mm256_slli_epi16(in, 1), hi_mask);
+         __m256i b    = _mm256_and_si256(in, lo_mask);
+         __m256i glow = _mm256_and_si256(_mm256_srli_epi16(in, 4), glow_mask);
+         _mm256_storeu_si256((__m256i*)(output + w), _mm256_or_si256(rg, _mm256_or_si256(b, glow)));
+      }
+   }
+
+   conv_0rgb1555_rgb565_c((uint16_t*)output_ + vec_width, (const uint16_t*)input_ + vec_width,
+         width - vec_width, height, out_stride, in_stride);
+}
+
+static PIXCONV_AVX2 void conv_0rgb1555_argb8888_avx2(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint16_t *input = (const uint16_t*)input_;
+   uint32_t *output      = (uint32_t*)output_;
+
+   int vec_width = width & ~15;
+
+   for (int h = 0; h < height; h++, output += out_stride >> 2, input += in_stride >> 1)
+   {
+      for (int w = 0; w < vec_width; w += 16)
+      {
+         __m256i hi;
+         __m256i lo = load_0rgb1555_avx2(input + w, &hi);
+         _mm256_storeu_si256((__m256i*)(output + w + 0), lo);
+         _mm256_storeu_si256((__m256i*)(output + w + 8), hi);
+      }
+   }
+
+   conv_0rgb1555_argb8888_c((uint32_t*)output_ + vec_width, (const uint16_t*)input_ + vec_width,
+         width - vec_width, height, out_stride, in_stride);
+}
+
+static PIXCONV_AVX2 void conv_rgb565_argb8888_avx2(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint16_t *input = (const uint16_t*)input_;
+   uint32_t *output      = (uint32_t*)output_;
+
+   int vec_width = width & ~15;
+
+   for (int h = 0; h < height; h++, output += out_stride >> 2, input += in_stride >> 1)
+   {
+      for (int w = 0; w < vec_width; w += 16)
+      {
+         __m256i hi;
+         __m256i lo = load_rgb565_avx2(input + w, &hi);
+         _mm256_storeu_si256((__m256i*)(output + w + 0), lo);
+         _mm256_storeu_si256((__m256i*)(output + w + 8), hi);
+      }
+   }
+
+   conv_rgb565_argb8888_c((uint32_t*)output_ + vec_width, (const uint16_t*)input_ + vec_width,
+         width - vec_width, height, out_stride, in_stride);
 }
 
-void conv_rgb565_bgr24(void *output_, const void *input_,
+static PIXCONV_AVX2 void conv_0rgb1555_bgr24_avx2(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
    const uint16_t *input = (const uint16_t*)input_;
    uint8_t *output       = (uint8_t*)output_;
 
+   // Leave room for the bytes clobbered by store_bgr24_avx2().
+   int vec_width = width >= 2 ? (width - 2) & ~15 : 0;
+
    for (int h = 0; h < height; h++, output += out_stride, input += in_stride >> 1)
    {
       uint8_t *out = output;
-      for (int w = 0; w < width; w++)
+      for (int w = 0; w < vec_width; w += 16, out += 48)
       {
-         uint32_t col = input[w];
-         uint32_t b = (col >>  0) & 0x1f;
-         uint32_t g = (col >>  5) & 0x3f;
-         uint32_t r = (col >> 11) & 0x1f;
-         b = (b << 3) | (b >> 2);
-         g = (g << 2) | (g >> 4);
-         r = (r << 3) | (r >> 2);
+         __m256i hi;
+         __m256i lo = load_0rgb1555_avx2(input + w, &hi);
+         store_bgr24_avx2(out +  0, lo);
+         store_bgr24_avx2(out + 24, hi);
+      }
+   }
 
-         *out++ = b;
-         *out++ = g;
-         *out++ = r;
+   conv_0rgb1555_bgr24_c((uint8_t*)output_ + 3 * vec_width, (const uint16_t*)input_ + vec_width,
+         width - vec_width, height, out_stride, in_stride);
+}
+
+static PIXCONV_AVX2 void conv_rgb565_bgr24_avx2(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint16_t *input = (const uint16_t*)input_;
+   uint8_t *output       = (uint8_t*)output_;
+
+   int vec_width = width >= 2 ? (width - 2) & ~15 : 0;
+
+   for (int h = 0; h < height; h++, output += out_stride, input += in_stride >> 1)
+   {
+      uint8_t *out = output;
+      for (int w = 0; w < vec_width; w += 16, out += 48)
+      {
+         __m256i hi;
+         __m256i lo = load_rgb565_avx2(input + w, &hi);
+         store_bgr24_avx2(out +  0, lo);
+         store_bgr24_avx2(out + 24, hi);
       }
    }
+
+   conv_rgb565_bgr24_c((uint8_t*)output_ + 3 * vec_width, (const uint16_t*)input_ + vec_width,
+         width - vec_width, height, out_stride, in_stride);
 }
-#endif
 
-void conv_bgr24_argb8888(void *output_, const void *input_,
+static PIXCONV_AVX2 void conv_bgr24_argb8888_avx2(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
    const uint8_t *input = (const uint8_t*)input_;
    uint32_t *output     = (uint32_t*)output_;
 
+   // Every 8 pixels read 4 bytes past their end, so keep 2 pixels to spare.
+   int vec_width = width >= 2 ? (width - 2) & ~7 : 0;
+
+   const __m256i shuf = _mm256_setr_epi8(
+         0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+         0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+   const __m256i alpha = _mm256_set1_epi32((int)0xff000000u);
+
    for (int h = 0; h < height; h++, output += out_stride >> 2, input += in_stride)
    {
       const uint8_t *inp = input;
-      for (int w = 0; w < width; w++)
+      for (int w = 0; w < vec_width; w += 8, inp += 24)
       {
-         uint32_t b = *inp++;
-         uint32_t g = *inp++;
-         uint32_t r = *inp++;
-         output[w] = (0xffu << 24) | (r << 16) | (g << 8) | (b << 0);
+         __m256i in = _mm256_inserti128_si256(
+               _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(inp + 0))),
+               _mm_loadu_si128((const __m128i*)(inp + 12)), 1);
+
+         _mm256_storeu_si256((__m256i*)(output + w), _mm256_or_si256(_mm256_shuffle_epi8(in, shuf), alpha));
       }
    }
+
+   conv_bgr24_argb8888_c((uint32_t*)output_ + vec_width, (const uint8_t*)input_ + 3 * vec_width,
+         width - vec_width, height, out_stride, in_stride);
 }
 
-void conv_argb8888_0rgb1555(void *output_, const void *input_,
+static PIXCONV_AVX2 void conv_argb8888_0rgb1555_avx2(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
    const uint32_t *input = (const uint32_t*)input_;
    uint16_t *output      = (uint16_t*)output_;
 
+   int vec_width = width & ~15;
+
+   const __m256i mask_r = _mm256_set1_epi32(0x1f << 10);
+   const __m256i mask_g = _mm256_set1_epi32(0x1f <<  5);
+   const __m256i mask_b = _mm256_set1_epi32(0x1f <<  0);
+
    for (int h = 0; h < height; h++, output += out_stride >> 1, input += in_stride >> 2)
    {
-      for (int w = 0; w < width; w++)
+      for (int w = 0; w < vec_width; w += 16)
       {
-         uint32_t col = input[w];
-         uint16_t r = (col >> 19) & 0x1f;
-         uint16_t g = (col >> 11) & 0x1f;
-         uint16_t b = (col >>  3) & 0x1f;
-         output[w] = (r << 10) | (g << 5) | (b << 0);
+         const __m256i in0 = _mm256_loadu_si256((const __m256i*)(input + w + 0));
+         const __m256i in1 = _mm256_loadu_si256((const __m256i*)(input + w + 8));
+
+         __m256i res0 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(in0, 9), mask_r),
+               _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(in0, 6), mask_g),
+                  _mm256_and_si256(_mm256_srli_epi32(in0, 3), mask_b)));
+         __m256i res1 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(in1, 9), mask_r),
+               _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(in1, 6), mask_g),
+                  _mm256_and_si256(_mm256_srli_epi32(in1, 3), mask_b)));
+
+         // Packing is done per 128-bit lane, so reorder 64-bit blocks afterwards.
+         __m256i res = _mm256_permute4x64_epi64(_mm256_packus_epi32(res0, res1), 0xd8);
+         _mm256_storeu_si256((__m256i*)(output + w), res);
       }
    }
+
+   conv_argb8888_0rgb1555_c((uint16_t*)output_ + vec_width, (const uint32_t*)input_ + vec_width,
+         width - vec_width, height, out_stride, in_stride);
 }
 
-#if defined(__SSE2__)
-void conv_argb8888_bgr24(void *output_, const void *input_,
+static PIXCONV_AVX2 void conv_argb8888_bgr24_avx2(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
    const uint32_t *input = (const uint32_t*)input_;
    uint8_t *output       = (uint8_t*)output_;
 
-   int max_width = width - 15;
+   int vec_width = width >= 2 ? (width - 2) & ~15 : 0;
 
    for (int h = 0; h < height; h++, output += out_stride, input += in_stride >> 2)
    {
       uint8_t *out = output;
-      int w;
+      for (int w = 0; w < vec_width; w += 16, out += 48)
+      {
+         store_bgr24_avx2(out +  0, _mm256_loadu_si256((const __m256i*)(input + w + 0)));
+         store_bgr24_avx2(out + 24, _mm256_loadu_si256((const __m256i*)(input + w + 8)));
+      }
+   }
 
-      for (w = 0; w < max_width; w += 16, out += 48)
+   conv_argb8888_bgr24_c((uint8_t*)output_ + 3 * vec_width, (const uint32_t*)input_ + vec_width,
+         width - vec_width, height, out_stride, in_stride);
+}
+#endif
+
+#if defined(__ARM_NEON__)
+// NEON kernels only handle whole vectors, like the AVX2 ones.
+
+static inline uint8x8_t expand5_neon(uint16x8_t col)
+{
+   uint8x8_t c = vmovn_u16(vandq_u16(col, vdupq_n_u16(0x1f)));
+   return vorr_u8(vshl_n_u8(c, 3), vshr_n_u8(c, 2));
+}
+
+static inline uint8x8_t expand6_neon(uint16x8_t col)
+{
+   uint8x8_t c = vmovn_u16(vandq_u16(col, vdupq_n_u16(0x3f)));
+   return vorr_u8(vshl_n_u8(c, 2), vshr_n_u8(c, 4));
+}
+
+static void conv_rgb565_0rgb1555_neon(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint16_t *input = (const uint16_t*)input_;
+   uint16_t *output = (uint16_t*)output_;
+
+   int vec_width = width & ~7;
+
+   for (int h = 0; h < height; h++, output += out_stride >> 1, input += in_stride >> 1)
+   {
+      for (int w = 0; w < vec_width; w += 8)
       {
-         store_bgr24_sse2(out,
-               _mm_loadu_si128((const __m128i*)(input + w +  0)),
-               _mm_loadu_si128((const __m128i*)(input + w +  4)),
-               _mm_loadu_si128((const __m128i*)(input + w +  8)),
-               _mm_loadu_si128((const __m128i*)(input + w + 12)));
+         uint16x8_t in = vld1q_u16(input + w);
+         uint16x8_t hi = vandq_u16(vshrq_n_u16(in, 1), vdupq_n_u16(0x7fe0));
+         uint16x8_t lo = vandq_u16(in, vdupq_n_u16(0x1f));
+         vst1q_u16(output + w, vorrq_u16(hi, lo));
       }
+   }
 
-      for (; w < width; w++)
+   conv_rgb565_0rgb1555_c((uint16_t*)output_ + vec_width, (const uint16_t*)input_ + vec_width,
+         width - vec_width, height, out_stride, in_stride);
+}
+
+static void conv_0rgb1555_rgb565_neon(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint16_t *input = (const uint16_t*)input_;
+   uint16_t *output = (uint16_t*)output_;
+
+   int vec_width = width & ~7;
+
+   for (int h = 0; h < height; h++, output += out_stride >> 1, input += in_stride >> 1)
+   {
+      for (int w = 0; w < vec_width; w += 8)
       {
-         uint32_t col = input[w];
-         *out++ = (uint8_t)(col >>  0);
-         *out++ = (uint8_t)(col >>  8);
-         *out++ = (uint8_t)(col >> 16);
+         uint16x8_t in   = vld1q_u16(input + w);
+         uint16x8_t rg   = vandq_u16(vshlq_n_u16(in, 1), vdupq_n_u16((0x1f << 11) | (0x1f << 6)));
+         uint16x8_t b    = vandq_u16(in, vdupq_n_u16(0x1f));
+         uint16x8_t glow = vandq_u16(vshrq_n_u16(in, 4), vdupq_n_u16(1 << 5));
+         vst1q_u16(output + w, vorrq_u16(rg, vorrq_u16(b, glow)));
       }
    }
+
+   conv_0rgb1555_rgb565_c((uint16_t*)output_ + vec_width, (const uint16_t*)input_ + vec_width,
+         width - vec_width, height, out_stride, in_stride);
 }
-#else
-void conv_argb8888_bgr24(void *output_, const void *input_,
+
+static void conv_0rgb1555_argb8888_neon(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint16_t *input = (const uint16_t*)input_;
+   uint32_t *output      = (uint32_t*)output_;
+
+   int vec_width = width & ~7;
+
+   for (int h = 0; h < height; h++, output += out_stride >> 2, input += in_stride >> 1)
+   {
+      for (int w = 0; w < vec_width; w += 8)
+      {
+         uint16x8_t in = vld1q_u16(input + w);
+
+         uint8x8x4_t res;
+         res.val[0] = expand5_neon(in);
+         res.val[1] = expand5_neon(vshrq_n_u16(in, 5));
+         res.val[2] = expand5_neon(vshrq_n_u16(in, 10));
+         res.val[3] = vdup_n_u8(0xff);
+         vst4_u8((uint8_t*)(output + w), res);
+      }
+   }
+
+   conv_0rgb1555_argb8888_c((uint32_t*)output_ + vec_width, (const uint16_t*)input_ + vec_width,
+         width - vec_width, height, out_stride, in_stride);
+}
+
+static void conv_rgb565_argb8888_neon(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint16_t *input = (const uint16_t*)input_;
+   uint32_t *output      = (uint32_t*)output_;
+
+   int vec_width = width & ~7;
+
+   for (int h = 0; h < height; h++, output += out_stride >> 2, input += in_stride >> 1)
+   {
+      for (int w = 0; w < vec_width; w += 8)
+      {
+         uint16x8_t in = vld1q_u16(input + w);
+
+         uint8x8x4_t res;
+         res.val[0] = expand5_neon(in);
+         res.val[1] = expand6_neon(vshrq_n_u16(in, 5));
+         res.val[2] = expand5_neon(vshrq_n_u16(in, 11));
+         res.val[3] = vdup_n_u8(0xff);
+         vst4_u8((uint8_t*)(output + w), res);
+      }
+   }
+
+   conv_rgb565_argb8888_c((uint32_t*)output_ + vec_width, (const uint16_t*)input_ + vec_width,
+         width - vec_width, height, out_stride, in_stride);
+}
+
+static void conv_0rgb1555_bgr24_neon(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint16_t *input = (const uint16_t*)input_;
+   uint8_t *output       = (uint8_t*)output_;
+
+   int vec_width = width & ~7;
+
+   for (int h = 0; h < height; h++, output += out_stride, input += in_stride >> 1)
+   {
+      for (int w = 0; w < vec_width; w += 8)
+      {
+         uint16x8_t in = vld1q_u16(input + w);
+
+         uint8x8x3_t res;
+         res.val[0] = expand5_neon(in);
+         res.val[1] = expand5_neon(vshrq_n_u16(in, 5));
+         res.val[2] = expand5_neon(vshrq_n_u16(in, 10));
+         vst3_u8(output + 3 * w, res);
+      }
+   }
+
+   conv_0rgb1555_bgr24_c((uint8_t*)output_ + 3 * vec_width, (const uint16_t*)input_ + vec_width,
+         width - vec_width, height, out_stride, in_stride);
+}
+
+static void conv_rgb565_bgr24_neon(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint16_t *input = (const uint16_t*)input_;
+   uint8_t *output       = (uint8_t*)output_;
+
+   int vec_width = width & ~7;
+
+   for (int h = 0; h < height; h++, output += out_stride, input += in_stride >> 1)
+   {
+      for (int w = 0; w < vec_width; w += 8)
+      {
+         uint16x8_t in = vld1q_u16(input + w);
+
+         uint8x8x3_t res;
+         res.val[0] = expand5_neon(in);
+         res.val[1] = expand6_neon(vshrq_n_u16(in, 5));
+         res.val[2] = expand5_neon(vshrq_n_u16(in, 11));
+         vst3_u8(output + 3 * w, res);
+      }
+   }
+
+   conv_rgb565_bgr24_c((uint8_t*)output_ + 3 * vec_width, (const uint16_t*)input_ + vec_width,
+         width - vec_width, height, out_stride, in_stride);
+}
+
+static void conv_bgr24_argb8888_neon(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint8_t *input = (const uint8_t*)input_;
+   uint32_t *output     = (uint32_t*)output_;
+
+   int vec_width = width & ~7;
+
+   for (int h = 0; h < height; h++, output += out_stride >> 2, input += in_stride)
+   {
+      for (int w = 0; w < vec_width; w += 8)
+      {
+         uint8x8x3_t in = vld3_u8(input + 3 * w);
+
+         uint8x8x4_t res;
+         res.val[0] = in.val[0];
+         res.val[1] = in.val[1];
+         res.val[2] = in.val[2];
+         res.val[3] = vdup_n_u8(0xff);
+         vst4_u8((uint8_t*)(output + w), res);
+      }
+   }
+
+   conv_bgr24_argb8888_c((uint32_t*)output_ + vec_width, (const uint8_t*)input_ + 3 * vec_width,
+         width - vec_width, height, out_stride, in_stride);
+}
+
+static void conv_argb8888_0rgb1555_neon(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   const uint32_t *input = (const uint32_t*)input_;
+   uint16_t *output      = (uint16_t*)output_;
+
+   int vec_width = width & ~7;
+
+   for (int h = 0; h < height; h++, output += out_stride >> 1, input += in_stride >> 2)
+   {
+      for (int w = 0; w < vec_width; w += 8)
+      {
+         uint8x8x4_t in = vld4_u8((const uint8_t*)(input + w));
+
+         uint16x8_t b = vmovl_u8(vshr_n_u8(in.val[0], 3));
+         uint16x8_t g = vshlq_n_u16(vmovl_u8(vshr_n_u8(in.val[1], 3)),  5);
+         uint16x8_t r = vshlq_n_u16(vmovl_u8(vshr_n_u8(in.val[2], 3)), 10);
+         vst1q_u16(output + w, vorrq_u16(r, vorrq_u16(g, b)));
+      }
+   }
+
+   conv_argb8888_0rgb1555_c((uint16_t*)output_ + vec_width, (const uint32_t*)input_ + vec_width,
+         width - vec_width, height, out_stride, in_stride);
+}
+
+static void conv_argb8888_bgr24_neon(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
    const uint32_t *input = (const uint32_t*)input_;
    uint8_t *output       = (uint8_t*)output_;
 
+   int vec_width = width & ~7;
+
    for (int h = 0; h < height; h++, output += out_stride, input += in_stride >> 2)
    {
-      uint8_t *out = output;
-      for (int w = 0; w < width; w++)
+      for (int w = 0; w < vec_width; w += 8)
       {
-         uint32_t col = input[w];
-         *out++ = (uint8_t)(col >>  0);
-         *out++ = (uint8_t)(col >>  8);
-         *out++ = (uint8_t)(col >> 16);
+         uint8x8x4_t in = vld4_u8((const uint8_t*)(input + w));
+
+         uint8x8x3_t res;
+         res.val[0] = in.val[0];
+         res.val[1] = in.val[1];
+         res.val[2] = in.val[2];
+         vst3_u8(output + 3 * w, res);
       }
    }
+
+   conv_argb8888_bgr24_c((uint8_t*)output_ + 3 * vec_width, (const uint32_t*)input_ + vec_width,
+         width - vec_width, height, out_stride, in_stride);
 }
 #endif
 
+#if defined(PIXCONV_HAVE_X86) && defined(__SSE2__)
+#define CONV_DEFAULT(name) conv_##name##_sse2
+#elif defined(__ARM_NEON__)
+#define CONV_DEFAULT(name) conv_##name##_neon
+#else
+#define CONV_DEFAULT(name) conv_##name##_c
+#endif
+
+#if defined(__ARM_NEON__)
+#define CONV_DEFAULT_NO_SSE2(name) conv_##name##_neon
+#else
+#define CONV_DEFAULT_NO_SSE2(name) conv_##name##_c
+#endif
+
+// Until conv_select_simd() is called, use whatever we were compiled for.
+conv_func_t conv_rgb565_0rgb1555   = CONV_DEFAULT(rgb565_0rgb1555);
+conv_func_t conv_0rgb1555_rgb565   = CONV_DEFAULT(0rgb1555_rgb565);
+conv_func_t conv_0rgb1555_argb8888 = CONV_DEFAULT(0rgb1555_argb8888);
+conv_func_t conv_rgb565_argb8888   = CONV_DEFAULT(rgb565_argb8888);
+conv_func_t conv_0rgb1555_bgr24    = CONV_DEFAULT(0rgb1555_bgr24);
+conv_func_t conv_rgb565_bgr24      = CONV_DEFAULT(rgb565_bgr24);
+conv_func_t conv_argb8888_bgr24    = CONV_DEFAULT(argb8888_bgr24);
+conv_func_t conv_bgr24_argb8888    = CONV_DEFAULT_NO_SSE2(bgr24_argb8888);
+conv_func_t conv_argb8888_0rgb1555 = CONV_DEFAULT_NO_SSE2(argb8888_0rgb1555);
+
+const char *conv_select_simd(unsigned simd)
+{
+#if defined(PIXCONV_HAVE_X86)
+   if (simd & RARCH_SIMD_AVX2)
+   {
+      conv_rgb565_0rgb1555   = conv_rgb565_0rgb1555_avx2;
+      conv_0rgb1555_rgb565   = conv_0rgb1555_rgb565_avx2;
+      conv_0rgb1555_argb8888 = conv_0rgb1555_argb8888_avx2;
+      conv_rgb565_argb8888   = conv_rgb565_argb8888_avx2;
+      conv_0rgb1555_bgr24    = conv_0rgb1555_bgr24_avx2;
+      conv_rgb565_bgr24      = conv_rgb565_bgr24_avx2;
+      conv_argb8888_bgr24    = conv_argb8888_bgr24_avx2;
+      conv_bgr24_argb8888    = conv_bgr24_argb8888_avx2;
+      conv_argb8888_0rgb1555 = conv_argb8888_0rgb1555_avx2;
+      return "AVX2";
+   }
+
+   conv_bgr24_argb8888    = conv_bgr24_argb8888_c;
+   conv_argb8888_0rgb1555 = conv_argb8888_0rgb1555_c;
+
+   if (simd & RARCH_SIMD_SSE2)
+   {
+      conv_rgb565_0rgb1555   = conv_rgb565_0rgb1555_sse2;
+      conv_0rgb1555_rgb565   = conv_0rgb1555_rgb565_sse2;
+      conv_0rgb1555_argb8888 = conv_0rgb1555_argb8888_sse2;
+      conv_rgb565_argb8888   = conv_rgb565_argb8888_sse2;
+      conv_0rgb1555_bgr24    = conv_0rgb1555_bgr24_sse2;
+      conv_rgb565_bgr24      = conv_rgb565_bgr24_sse2;
+      conv_argb8888_bgr24    = conv_argb8888_bgr24_sse2;
+      return "SSE2";
+   }
+
+   conv_rgb565_0rgb1555   = conv_rgb565_0rgb1555_c;
+   conv_0rgb1555_rgb565   = conv_0rgb1555_rgb565_c;
+   conv_0rgb1555_argb8888 = conv_0rgb1555_argb8888_c;
+   conv_rgb565_argb8888   = conv_rgb565_argb8888_c;
+   conv_0rgb1555_bgr24    = conv_0rgb1555_bgr24_c;
+   conv_rgb565_bgr24      = conv_rgb565_bgr24_c;
+   conv_argb8888_bgr24    = conv_argb8888_bgr24_c;
+   return "C";
+#elif defined(__ARM_NEON__)
+   // If we're compiled with NEON, the compiler might use it anywhere already.
+   (void)simd;
+   return "NEON";
+#else
+   (void)simd;
+   return "C";
+#endif
+}
+
 void conv_copy(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
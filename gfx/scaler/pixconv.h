@@ -16,45 +16,24 @@
 #ifndef PIXCONV_H__
 #define PIXCONV_H__
 
-void conv_0rgb1555_argb8888(void *output, const void *input,
+typedef void (*conv_func_t)(void *output, const void *input,
       int width, int height,
       int out_stride, int in_stride);
 
-void conv_0rgb1555_rgb565(void *output, const void *input,
-      int width, int height,
-      int out_stride, int in_stride);
+// Converters point to the fastest implementation available.
+// Before conv_select_simd() is called, they use what the compiler targets by default.
+extern conv_func_t conv_0rgb1555_argb8888;
+extern conv_func_t conv_0rgb1555_rgb565;
+extern conv_func_t conv_rgb565_0rgb1555;
+extern conv_func_t conv_rgb565_argb8888;
+extern conv_func_t conv_bgr24_argb8888;
+extern conv_func_t conv_argb8888_0rgb1555;
+extern conv_func_t conv_argb8888_bgr24;
+extern conv_func_t conv_0rgb1555_bgr24;
+extern conv_func_t conv_rgb565_bgr24;
 
-void conv_rgb565_0rgb1555(void *output, const void *input,
-      int width, int height,
-      int out_stride, int in_stride);
-
-void conv_rgb565_argb8888(void *output, const void *input,
-      int width, int height,
-      int out_stride, int in_stride);
-
-void conv_bgr24_argb8888(void *output, const void *input,
-      int width, int height,
-      int out_stride, int in_stride);
-
-void conv_argb8888_0rgb1555(void *output, const void *input,
-      int width, int height,
-      int out_stride, int in_stride);
-
-void conv_argb8888_rgb565(void *output, const void *input,
-      int width, int height,
-      int out_stride, int in_stride);
-
-void conv_argb8888_bgr24(void *output, const void *input,
-      int width, int height,
-      int out_stride, int in_stride);
-
-void conv_0rgb1555_bgr24(void *output, const void *input,
-      int width, int height,
-      int out_stride, int in_stride);
-
-void conv_rgb565_bgr24(void *output, const void *input,
-      int width, int height,
-      int out_stride, int in_stride);
+// Selects converters from RARCH_SIMD_* flags. Returns name of the instruction set used.
+const char *conv_select_simd(unsigned simd);
 
 void conv_copy(void *output, const void *input,
       int width, int height,
@@ -22,6 +22,15 @@
 #include <stdio.h>
 #include <math.h>
 #include "../../performance.h"
+#include "../../general.h"
+
+#ifdef HAVE_CONFIG_H
+#include "../../config.h"
+#endif
+
+#ifdef HAVE_THREADS
+#include "../../thread.h"
+#endif
 
 // In case aligned allocs are needed later ...
 void *scaler_alloc(size_t elem_size, size_t size)
@@ -137,9 +146,366 @@ static bool set_pix_conv(struct scaler_ctx *ctx)
    return true;
 }
 
+// Scaling is split into jobs which each handle one horizontal slice of the image.
+typedef void (*scaler_slice_func_t)(const struct scaler_ctx *ctx,
+      void *output, const void *input, unsigned slice, unsigned slices);
+
+#ifdef HAVE_THREADS
+struct scaler_worker
+{
+   struct scaler_thread_pool *pool;
+   sthread_t *thread;
+   scond_t *cond;
+   unsigned slice;
+   bool has_work;
+};
+
+struct scaler_thread_pool
+{
+   slock_t *lock;
+   scond_t *cond; // Signalled when the last worker is done with its slice.
+   struct scaler_worker *workers;
+   unsigned num_workers;
+   unsigned pending;
+   bool quit;
+
+   scaler_slice_func_t func;
+   const struct scaler_ctx *ctx;
+   void *output;
+   const void *input;
+};
+
+static void scaler_worker_thread(void *data)
+{
+   struct scaler_worker *worker = (struct scaler_worker*)data;
+   struct scaler_thread_pool *pool = worker->pool;
+
+   slock_lock(pool->lock);
+   for (;;)
+   {
+      while (!worker->has_work && !pool->quit)
+         scond_wait(worker->cond, pool->lock);
+
+      if (pool->quit)
+         break;
+
+      worker->has_work = false;
+      slock_unlock(pool->lock);
+
+      pool->func(pool->ctx, pool->output, pool->input, worker->slice, pool->num_workers + 1);
+
+      slock_lock(pool->lock);
+      if (--pool->pending == 0)
+         scond_signal(pool->cond);
+   }
+   slock_unlock(pool->lock);
+}
+
+static void scaler_pool_free(struct scaler_thread_pool *pool)
+{
+   if (!pool)
+      return;
+
+   if (pool->lock && pool->workers)
+   {
+      slock_lock(pool->lock);
+      pool->quit = true;
+      for (unsigned i = 0; i < pool->num_workers; i++)
+      {
+         if (pool->workers[i].cond)
+            scond_signal(pool->workers[i].cond);
+      }
+      slock_unlock(pool->lock);
+   }
+
+   if (pool->workers)
+   {
+      for (unsigned i = 0; i < pool->num_workers; i++)
+      {
+         if (pool->workers[i].thread)
+            sthread_join(pool->workers[i].thread);
+         if (pool->workers[i].cond)
+            scond_free(pool->workers[i].cond);
+      }
+   }
+
+   if (pool->cond)
+      scond_free(pool->cond);
+   if (pool->lock)
+      slock_free(pool->lock);
+
+   free(pool->workers);
+   free(pool);
+}
+
+static struct scaler_thread_pool *scaler_pool_new(unsigned num_workers)
+{
+   struct scaler_thread_pool *pool = (struct scaler_thread_pool*)calloc(1, sizeof(*pool));
+   if (!pool)
+      return NULL;
+
+   pool->lock    = slock_new();
+   pool->cond    = scond_new();
+   pool->workers = (struct scaler_worker*)calloc(num_workers, sizeof(*pool->workers));
+   if (!pool->lock || !pool->cond || !pool->workers)
+      goto error;
+
+   pool->num_workers = num_workers;
+
+   for (unsigned i = 0; i < num_workers; i++)
+   {
+      struct scaler_worker *worker = &pool->workers[i];
+      worker->pool  = pool;
+      worker->slice = i;
+
+      if (!(worker->cond = scond_new()))
+         goto error;
+      if (!(worker->thread = sthread_create(scaler_worker_thread, worker)))
+         goto error;
+   }
+
+   return pool;
+
+error:
+   scaler_pool_free(pool);
+   return NULL;
+}
+#endif
+
+static bool scaler_ctx_gen_pool(struct scaler_ctx *ctx)
+{
+#ifdef HAVE_THREADS
+   unsigned num_workers = ctx->threads > 1 ? ctx->threads - 1 : 0;
+   if (ctx->pool && ctx->pool->num_workers == num_workers)
+      return true;
+
+   scaler_pool_free(ctx->pool);
+   ctx->pool = NULL;
+
+   if (num_workers)
+   {
+      ctx->pool = scaler_pool_new(num_workers);
+      if (!ctx->pool)
+         return false;
+   }
+#endif
+
+   return true;
+}
+
+// Runs func over every slice of the image, and returns when all slices are done.
+// The calling thread processes the last slice itself.
+static void scaler_run_slices(const struct scaler_ctx *ctx, scaler_slice_func_t func,
+      void *output, const void *input)
+{
+#ifdef HAVE_THREADS
+   struct scaler_thread_pool *pool = ctx->pool;
+   if (pool)
+   {
+      slock_lock(pool->lock);
+      pool->func    = func;
+      pool->ctx     = ctx;
+      pool->output  = output;
+      pool->input   = input;
+      pool->pending = pool->num_workers;
+
+      for (unsigned i = 0; i < pool->num_workers; i++)
+      {
+         pool->workers[i].has_work = true;
+         scond_signal(pool->workers[i].cond);
+      }
+      slock_unlock(pool->lock);
+
+      func(ctx, output, input, pool->num_workers, pool->num_workers + 1);
+
+      slock_lock(pool->lock);
+      while (pool->pending)
+         scond_wait(pool->cond, pool->lock);
+      slock_unlock(pool->lock);
+      return;
+   }
+#endif
+
+   func(ctx, output, input, 0, 1);
+}
+
+static inline void slice_range(int len, unsigned slice, unsigned slices, int *start, int *end)
+{
+   *start = (int)(((int64_t)len * slice) / slices);
+   *end   = (int)(((int64_t)len * (slice + 1)) / slices);
+}
+
+static void scale_direct_slice(const struct scaler_ctx *ctx,
+      void *output, const void *input, unsigned slice, unsigned slices)
+{
+   int start, end;
+   slice_range(ctx->out_height, slice, slices, &start, &end);
+   if (start == end)
+      return;
+
+   ctx->direct_pixconv((uint8_t*)output + start * ctx->out_stride,
+         (const uint8_t*)input + start * ctx->in_stride,
+         ctx->out_width, end - start,
+         ctx->out_stride, ctx->in_stride);
+}
+
+static void scale_input_slice(const struct scaler_ctx *ctx,
+      void *output, const void *input, unsigned slice, unsigned slices)
+{
+   (void)output;
+
+   int start, end;
+   slice_range(ctx->in_height, slice, slices, &start, &end);
+   if (start == end)
+      return;
+
+   ctx->in_pixconv(ctx->input.frame + start * (ctx->input.stride >> 2),
+         (const uint8_t*)input + start * ctx->in_stride,
+         ctx->in_width, end - start,
+         ctx->input.stride, ctx->in_stride);
+}
+
+static void scale_special_slice(const struct scaler_ctx *ctx,
+      void *output, const void *input, unsigned slice, unsigned slices)
+{
+   int start, end;
+   slice_range(ctx->out_height, slice, slices, &start, &end);
+   if (start == end)
+      return;
+
+   const void *inp = input;
+   int in_stride   = ctx->in_stride;
+
+   if (ctx->in_fmt != SCALER_FMT_ARGB8888)
+   {
+      inp       = ctx->input.frame;
+      in_stride = ctx->input.stride;
+   }
+
+   if (ctx->out_fmt != SCALER_FMT_ARGB8888)
+   {
+      ctx->scaler_special(ctx, ctx->output.frame, inp,
+            ctx->out_width, ctx->out_height,
+            ctx->in_width, ctx->in_height,
+            ctx->output.stride, in_stride,
+            start, end);
+
+      ctx->out_pixconv((uint8_t*)output + start * ctx->out_stride,
+            ctx->output.frame + start * (ctx->output.stride >> 2),
+            ctx->out_width, end - start,
+            ctx->out_stride, ctx->output.stride);
+   }
+   else
+   {
+      ctx->scaler_special(ctx, output, inp,
+            ctx->out_width, ctx->out_height,
+            ctx->in_width, ctx->in_height,
+            ctx->out_stride, in_stride,
+            start, end);
+   }
+}
+
+// The filter kernels work on a whole context, so hand them a copy which only covers our slice.
+static void scale_horiz_slice(const struct scaler_ctx *ctx,
+      void *output, const void *input, unsigned slice, unsigned slices)
+{
+   (void)output;
+
+   int start, end;
+   slice_range(ctx->scaled.height, slice, slices, &start, &end);
+   if (start == end)
+      return;
+
+   struct scaler_ctx sub = *ctx;
+   sub.scaled.frame  = ctx->scaled.frame + start * (ctx->scaled.stride >> 3);
+   sub.scaled.height = end - start;
+
+   if (ctx->in_fmt != SCALER_FMT_ARGB8888)
+   {
+      uint32_t *frame = ctx->input.frame + start * (ctx->input.stride >> 2);
+
+      ctx->in_pixconv(frame, (const uint8_t*)input + start * ctx->in_stride,
+            ctx->in_width, end - start,
+            ctx->input.stride, ctx->in_stride);
+
+      ctx->scaler_horiz(&sub, frame, ctx->input.stride);
+   }
+   else
+      ctx->scaler_horiz(&sub, (const uint8_t*)input + start * ctx->in_stride, ctx->in_stride);
+}
+
+static void scale_vert_slice(const struct scaler_ctx *ctx,
+      void *output, const void *input, unsigned slice, unsigned slices)
+{
+   (void)input;
+
+   int start, end;
+   slice_range(ctx->out_height, slice, slices, &start, &end);
+   if (start == end)
+      return;
+
+   struct scaler_ctx sub = *ctx;
+   sub.out_height      = end - start;
+   sub.vert.filter     = ctx->vert.filter + start * ctx->vert.filter_stride;
+   sub.vert.filter_pos = ctx->vert.filter_pos + start;
+
+   if (ctx->out_fmt != SCALER_FMT_ARGB8888)
+   {
+      uint32_t *frame = ctx->output.frame + start * (ctx->output.stride >> 2);
+
+      ctx->scaler_vert(&sub, frame, ctx->output.stride);
+
+      ctx->out_pixconv((uint8_t*)output + start * ctx->out_stride, frame,
+            ctx->out_width, end - start,
+            ctx->out_stride, ctx->output.stride);
+   }
+   else
+      ctx->scaler_vert(&sub, (uint8_t*)output + start * ctx->out_stride, ctx->out_stride);
+}
+
+static void scaler_ctx_free_frames(struct scaler_ctx *ctx)
+{
+   scaler_free(ctx->horiz.filter);
+   scaler_free(ctx->horiz.filter_pos);
+   scaler_free(ctx->vert.filter);
+   scaler_free(ctx->vert.filter_pos);
+   scaler_free(ctx->scaled.frame);
+   scaler_free(ctx->input.frame);
+   scaler_free(ctx->output.frame);
+
+   memset(&ctx->horiz, 0, sizeof(ctx->horiz));
+   memset(&ctx->vert, 0, sizeof(ctx->vert));
+   memset(&ctx->scaled, 0, sizeof(ctx->scaled));
+   memset(&ctx->input, 0, sizeof(ctx->input));
+   memset(&ctx->output, 0, sizeof(ctx->output));
+}
+
+// Kernels are picked once per process from what the CPU supports,
+// so one binary can use AVX2 where available and still run on plain SSE2.
+static void scaler_init_simd(void)
+{
+   static bool simd_init;
+   if (simd_init)
+      return;
+   simd_init = true;
+
+   struct rarch_cpu_features cpu;
+   rarch_get_cpu_features(&cpu);
+
+   const char *conv  = conv_select_simd(cpu.simd);
+   const char *scale = scaler_argb8888_select_simd(cpu.simd);
+   RARCH_LOG("[Scaler]: Using %s pixel conversion, %s scaling kernels.\n", conv, scale);
+}
+
 bool scaler_ctx_gen_filter(struct scaler_ctx *ctx)
 {
-   scaler_ctx_gen_reset(ctx);
+   scaler_init_simd();
+
+   // Keep the worker pool around, it's only rebuilt if the thread count changes.
+   scaler_ctx_free_frames(ctx);
+
+   if (!scaler_ctx_gen_pool(ctx))
+      return false;
 
    if (ctx->in_width == ctx->out_width && ctx->in_height == ctx->out_height)
       ctx->unscaled = true; // Only pixel format conversion ...
@@ -174,90 +540,32 @@ bool scaler_ctx_gen_filter(struct scaler_ctx *ctx)
 
 void scaler_ctx_gen_reset(struct scaler_ctx *ctx)
 {
-   scaler_free(ctx->horiz.filter);
-   scaler_free(ctx->horiz.filter_pos);
-   scaler_free(ctx->vert.filter);
-   scaler_free(ctx->vert.filter_pos);
-   scaler_free(ctx->scaled.frame);
-   scaler_free(ctx->input.frame);
-   scaler_free(ctx->output.frame);
+   scaler_ctx_free_frames(ctx);
 
-   memset(&ctx->horiz, 0, sizeof(ctx->horiz));
-   memset(&ctx->vert, 0, sizeof(ctx->vert));
-   memset(&ctx->scaled, 0, sizeof(ctx->scaled));
-   memset(&ctx->input, 0, sizeof(ctx->input));
-   memset(&ctx->output, 0, sizeof(ctx->output));
+#ifdef HAVE_THREADS
+   scaler_pool_free(ctx->pool);
+   ctx->pool = NULL;
+#endif
 }
 
 void scaler_ctx_scale(struct scaler_ctx *ctx,
       void *output, const void *input)
 {
    if (ctx->unscaled) // Just perform straight pixel conversion.
-   {
-      ctx->direct_pixconv(output, input,
-            ctx->out_width, ctx->out_height,
-            ctx->out_stride, ctx->in_stride);
-   }
+      scaler_run_slices(ctx, scale_direct_slice, output, input);
    else if (ctx->scaler_special) // Take some special, and (hopefully) more optimized path.
    {
-      const void *inp = input;
-      int in_stride   = ctx->in_stride;
-
+      // Special scalers may sample any input row, so convert all of them first.
       if (ctx->in_fmt != SCALER_FMT_ARGB8888)
-      {
-         ctx->in_pixconv(ctx->input.frame, input,
-               ctx->in_width, ctx->in_height,
-               ctx->input.stride, ctx->in_stride);
-
-         inp       = ctx->input.frame;
-         in_stride = ctx->input.stride;
-      }
-
-      bool conv_out  = ctx->out_fmt != SCALER_FMT_ARGB8888;
-      void *outp     = output;
-      int out_stride = ctx->out_stride;
-
-      if (conv_out)
-      {
-         outp       = ctx->output.frame;
-         out_stride = ctx->output.stride;
-      }
-
-      ctx->scaler_special(ctx, outp, inp,
-            ctx->out_width, ctx->out_height,
-            ctx->in_width, ctx->in_height,
-            out_stride, in_stride);
+         scaler_run_slices(ctx, scale_input_slice, output, input);
 
-      if (conv_out)
-      {
-         ctx->out_pixconv(output, ctx->output.frame,
-               ctx->out_width, ctx->out_height,
-               ctx->out_stride, ctx->output.stride);
-      }
+      scaler_run_slices(ctx, scale_special_slice, output, input);
    }
    else // Take generic filter path.
    {
-      if (ctx->in_fmt != SCALER_FMT_ARGB8888)
-      {
-         ctx->in_pixconv(ctx->input.frame, input,
-               ctx->in_width, ctx->in_height,
-               ctx->input.stride, ctx->in_stride);
-
-         ctx->scaler_horiz(ctx, ctx->input.frame, ctx->input.stride);
-      }
-      else
-         ctx->scaler_horiz(ctx, input, ctx->in_stride);
-
-      if (ctx->out_fmt != SCALER_FMT_ARGB8888)
-      {
-         ctx->scaler_vert(ctx, ctx->output.frame, ctx->output.stride);
-
-         ctx->out_pixconv(output, ctx->output.frame,
-               ctx->out_width, ctx->out_height,
-               ctx->out_stride, ctx->output.stride);
-      }
-      else
-         ctx->scaler_vert(ctx, output, ctx->out_stride);
+      // Vertical pass may sample any row of the horizontal pass, so it has to finish first.
+      scaler_run_slices(ctx, scale_horiz_slice, output, input);
+      scaler_run_slices(ctx, scale_vert_slice, output, input);
    }
 }
 
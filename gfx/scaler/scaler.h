@@ -46,6 +46,8 @@ struct scaler_filter
    int     *filter_pos;
 };
 
+struct scaler_thread_pool;
+
 struct scaler_ctx
 {
    int in_width;
@@ -60,12 +62,19 @@ struct scaler_ctx
    enum scaler_pix_fmt out_fmt;
    enum scaler_type scaler_type;
 
+   // Number of threads to scale with. 0 or 1 scales on the calling thread.
+   // Rows are split into slices, so output is identical regardless of thread count.
+   // Takes effect on scaler_ctx_gen_filter(). Ignored without HAVE_THREADS.
+   unsigned threads;
+   struct scaler_thread_pool *pool;
+
    void (*scaler_horiz)(const struct scaler_ctx*,
          const void*, int);
    void (*scaler_vert)(const struct scaler_ctx*,
          void*, int);
+   // Last two arguments are the range of output rows to generate.
    void (*scaler_special)(const struct scaler_ctx*,
-         void*, const void*, int, int, int, int, int, int);
+         void*, const void*, int, int, int, int, int, int, int, int);
 
    void (*in_pixconv)(void*, const void*, int, int, int, int);
    void (*out_pixconv)(void*, const void*, int, int, int, int);
@@ -14,13 +14,18 @@
  */
 
 #include "scaler_int.h"
+#include "../../performance.h"
 
 #ifdef SCALER_NO_SIMD
 #undef __SSE2__
 #endif
 
-#if defined(__SSE2__)
-#include <emmintrin.h>
+// x86 kernels are always built, and picked at runtime in scaler_argb8888_select_simd().
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(SCALER_NO_SIMD)
+#define SCALER_HAVE_X86
+#define SCALER_SSE2 __attribute__((target("sse2")))
+#define SCALER_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
 #endif
 
 static inline uint64_t build_argb64(uint16_t a, uint16_t r, uint16_t g, uint16_t b)
@@ -55,52 +60,7 @@ static inline uint8_t clamp_8bit(int16_t col)
 //
 // The C version of scalers perform the exact same operations as the SIMD code for testing purposes.
 
-#if defined(__SSE2__)
-void scaler_argb8888_vert(const struct scaler_ctx *ctx, void *output_, int stride)
-{
-   const uint64_t *input = ctx->scaled.frame;
-   uint32_t *output = (uint32_t*)output_;
-
-   const int16_t *filter_vert = ctx->vert.filter;
-
-   for (int h = 0; h < ctx->out_height; h++, filter_vert += ctx->vert.filter_stride, output += stride >> 2)
-   {
-      const uint64_t *input_base = input + ctx->vert.filter_pos[h] * (ctx->scaled.stride >> 3);
-
-      for (int w = 0; w < ctx->out_width; w++)
-      {
-         __m128i res = _mm_setzero_si128();
-
-         const uint64_t *input_base_y = input_base + w;
-
-         size_t y;
-         for (y = 0; (y + 1) < ctx->vert.filter_len; y += 2, input_base_y += (ctx->scaled.stride >> 2))
-         {
-            __m128i coeff = _mm_set_epi64x(filter_vert[y + 1] * 0x0001000100010001ll, filter_vert[y + 0] * 0x0001000100010001ll);
-            __m128i col   = _mm_set_epi64x(input_base_y[ctx->scaled.stride >> 3], input_base_y[0]);
-
-            res = _mm_adds_epi16(_mm_mulhi_epi16(col, coeff), res);
-         }
-
-         for (; y < ctx->vert.filter_len; y++, input_base_y += (ctx->scaled.stride >> 3))
-         {
-            __m128i coeff = _mm_set_epi64x(0, filter_vert[y] * 0x0001000100010001ll);
-            __m128i col   = _mm_set_epi64x(0, input_base_y[0]);
-
-            res = _mm_adds_epi16(_mm_mulhi_epi16(col, coeff), res);
-         }
-
-         res = _mm_adds_epi16(_mm_srli_si128(res, 8), res);
-         res = _mm_srai_epi16(res, (7 - 2 - 2));
-
-         __m128i final = _mm_packus_epi16(res, res);
-
-         output[w] = _mm_cvtsi128_si32(final);
-      }
-   }
-}
-#else
-void scaler_argb8888_vert(const struct scaler_ctx *ctx, void *output_, int stride)
+static void scaler_argb8888_vert_c(const struct scaler_ctx *ctx, void *output_, int stride)
 {
    const uint64_t *input = ctx->scaled.frame;
    uint32_t *output = (uint32_t*)output_;
@@ -145,12 +105,10 @@ void scaler_argb8888_vert(const struct scaler_ctx *ctx, void *output_, int strid
       }
    }
 }
-#endif
 
-#if defined(__SSE2__)
-void scaler_argb8888_horiz(const struct scaler_ctx *ctx, const void *input_, int stride)
+static void scaler_argb8888_horiz_c(const struct scaler_ctx *ctx, const void *input_, int stride)
 {
-   const uint32_t *input = (const uint32_t*)input_;
+   const uint32_t *input = (uint32_t*)input_;
    uint64_t *output      = ctx->scaled.frame;
 
    for (int h = 0; h < ctx->scaled.height; h++, input += stride >> 2, output += ctx->scaled.stride >> 3)
@@ -159,52 +117,168 @@ void scaler_argb8888_horiz(const struct scaler_ctx *ctx, const void *input_, int
 
       for (int w = 0; w < ctx->scaled.width; w++, filter_horiz += ctx->horiz.filter_stride)
       {
-         __m128i res = _mm_setzero_si128();
-
          const uint32_t *input_base_x = input + ctx->horiz.filter_pos[w];
 
-         size_t x;
-         for (x = 0; (x + 1) < ctx->horiz.filter_len; x += 2)
+         int16_t res_a = 0;
+         int16_t res_r = 0;
+         int16_t res_g = 0;
+         int16_t res_b = 0;
+
+         for (size_t x = 0; x < ctx->horiz.filter_len; x++)
          {
-            __m128i coeff = _mm_set_epi64x(filter_horiz[x + 1] * 0x0001000100010001ll, filter_horiz[x + 0] * 0x0001000100010001ll);
+            uint32_t col = input_base_x[x];
 
-            __m128i col = _mm_unpacklo_epi8(_mm_set_epi64x(0,
-                     ((uint64_t)input_base_x[x + 1] << 32) | input_base_x[x + 0]), _mm_setzero_si128());
+            int16_t a = (col >> (24 - 7)) & (0xff << 7);
+            int16_t r = (col >> (16 - 7)) & (0xff << 7);
+            int16_t g = (col >> ( 8 - 7)) & (0xff << 7);
+            int16_t b = (col << ( 0 + 7)) & (0xff << 7);
+
+            int16_t coeff = filter_horiz[x];
 
-            col = _mm_slli_epi16(col, 7);
-            res = _mm_adds_epi16(_mm_mulhi_epi16(col, coeff), res);
+            res_a += (a * coeff) >> 16;
+            res_r += (r * coeff) >> 16;
+            res_g += (g * coeff) >> 16;
+            res_b += (b * coeff) >> 16;
          }
 
-         for (; x < ctx->horiz.filter_len; x++)
+         output[w] = build_argb64(res_a, res_r, res_g, res_b);
+      }
+   }
+}
+
+#if defined(SCALER_HAVE_X86)
+// Filters one output pixel. Even taps are accumulated in the low half and odd taps in the high half.
+static inline SCALER_SSE2 uint32_t scaler_vert_pixel_sse2(const struct scaler_ctx *ctx,
+      const uint64_t *input_base_y, const int16_t *filter_vert)
+{
+   __m128i res = _mm_setzero_si128();
+
+   size_t y;
+   for (y = 0; (y + 1) < ctx->vert.filter_len; y += 2, input_base_y += (ctx->scaled.stride >> 2))
+   {
+      __m128i coeff = _mm_set_epi64x((uint16_t)filter_vert[y + 1] * 0x0001000100010001ull, (uint16_t)filter_vert[y + 0] * 0x0001000100010001ull);
+      __m128i col   = _mm_set_epi64x(input_base_y[ctx->scaled.stride >> 3], input_base_y[0]);
+
+      res = _mm_adds_epi16(_mm_mulhi_epi16(col, coeff), res);
+   }
+
+   for (; y < ctx->vert.filter_len; y++, input_base_y += (ctx->scaled.stride >> 3))
+   {
+      __m128i coeff = _mm_set_epi64x(0, (uint16_t)filter_vert[y] * 0x0001000100010001ull);
+      __m128i col   = _mm_set_epi64x(0, input_base_y[0]);
+
+      res = _mm_adds_epi16(_mm_mulhi_epi16(col, coeff), res);
+   }
+
+   res = _mm_adds_epi16(_mm_srli_si128(res, 8), res);
+   res = _mm_srai_epi16(res, (7 - 2 - 2));
+
+   __m128i final = _mm_packus_epi16(res, res);
+
+   return _mm_cvtsi128_si32(final);
+}
+
+static SCALER_SSE2 void scaler_argb8888_vert_sse2(const struct scaler_ctx *ctx, void *output_, int stride)
+{
+   const uint64_t *input = ctx->scaled.frame;
+   uint32_t *output = (uint32_t*)output_;
+
+   const int16_t *filter_vert = ctx->vert.filter;
+
+   for (int h = 0; h < ctx->out_height; h++, filter_vert += ctx->vert.filter_stride, output += stride >> 2)
+   {
+      const uint64_t *input_base = input + ctx->vert.filter_pos[h] * (ctx->scaled.stride >> 3);
+
+      for (int w = 0; w < ctx->out_width; w++)
+         output[w] = scaler_vert_pixel_sse2(ctx, input_base + w, filter_vert);
+   }
+}
+
+// The vertical filter is the same for a whole row, so AVX2 filters 4 adjacent pixels at a time.
+// Even and odd taps are summed separately, like the SSE2 kernel, which keeps output bit-identical.
+static SCALER_AVX2 void scaler_argb8888_vert_avx2(const struct scaler_ctx *ctx, void *output_, int stride)
+{
+   const uint64_t *input = ctx->scaled.frame;
+   uint32_t *output = (uint32_t*)output_;
+
+   const int16_t *filter_vert = ctx->vert.filter;
+   int vec_width = ctx->out_width & ~3;
+
+   for (int h = 0; h < ctx->out_height; h++, filter_vert += ctx->vert.filter_stride, output += stride >> 2)
+   {
+      const uint64_t *input_base = input + ctx->vert.filter_pos[h] * (ctx->scaled.stride >> 3);
+
+      int w;
+      for (w = 0; w < vec_width; w += 4)
+      {
+         __m256i res_even = _mm256_setzero_si256();
+         __m256i res_odd  = _mm256_setzero_si256();
+
+         const uint64_t *input_base_y = input_base + w;
+
+         size_t y;
+         for (y = 0; (y + 1) < ctx->vert.filter_len; y += 2, input_base_y += (ctx->scaled.stride >> 2))
          {
-            __m128i coeff = _mm_set_epi64x(0, filter_horiz[x] * 0x0001000100010001ll);
-            __m128i col   = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, 0, input_base_x[x]), _mm_setzero_si128());
+            __m256i col_even = _mm256_loadu_si256((const __m256i*)input_base_y);
+            __m256i col_odd  = _mm256_loadu_si256((const __m256i*)(input_base_y + (ctx->scaled.stride >> 3)));
 
-            col = _mm_slli_epi16(col, 7);
-            res = _mm_adds_epi16(_mm_mulhi_epi16(col, coeff), res);
+            res_even = _mm256_adds_epi16(_mm256_mulhi_epi16(col_even, _mm256_set1_epi16(filter_vert[y + 0])), res_even);
+            res_odd  = _mm256_adds_epi16(_mm256_mulhi_epi16(col_odd,  _mm256_set1_epi16(filter_vert[y + 1])), res_odd);
          }
 
-         res       = _mm_adds_epi16(_mm_srli_si128(res, 8), res);
-
-#ifdef __x86_64__
-         output[w] = _mm_cvtsi128_si64(res);
-#else // 32-bit doesn't have si64. Do it in two steps.
-         union
+         for (; y < ctx->vert.filter_len; y++, input_base_y += (ctx->scaled.stride >> 3))
          {
-            uint32_t *u32;
-            uint64_t *u64;
-         } u;
-         u.u64 = output + w;
-         u.u32[0] = _mm_cvtsi128_si32(res);
-         u.u32[1] = _mm_cvtsi128_si32(_mm_srli_si128(res, 4));
-#endif
+            __m256i col = _mm256_loadu_si256((const __m256i*)input_base_y);
+            res_even = _mm256_adds_epi16(_mm256_mulhi_epi16(col, _mm256_set1_epi16(filter_vert[y])), res_even);
+         }
+
+         __m256i res = _mm256_adds_epi16(res_odd, res_even);
+         res = _mm256_srai_epi16(res, (7 - 2 - 2));
+
+         // Packing is done per 128-bit lane, so gather the two lanes' pixels into the low half.
+         __m256i final = _mm256_permute4x64_epi64(_mm256_packus_epi16(res, res), 0x08);
+         _mm_storeu_si128((__m128i*)(output + w), _mm256_castsi256_si128(final));
       }
+
+      for (; w < ctx->out_width; w++)
+         output[w] = scaler_vert_pixel_sse2(ctx, input_base + w, filter_vert);
    }
 }
-#else
-void scaler_argb8888_horiz(const struct scaler_ctx *ctx, const void *input_, int stride)
+
+// Filters one output pixel. Even taps are accumulated in the low half and odd taps in the high half.
+static inline SCALER_SSE2 void scaler_horiz_pixel_sse2(const struct scaler_ctx *ctx,
+      uint64_t *output, const uint32_t *input_base_x, const int16_t *filter_horiz)
 {
-   const uint32_t *input = (uint32_t*)input_;
+   __m128i res = _mm_setzero_si128();
+
+   size_t x;
+   for (x = 0; (x + 1) < ctx->horiz.filter_len; x += 2)
+   {
+      __m128i coeff = _mm_set_epi64x((uint16_t)filter_horiz[x + 1] * 0x0001000100010001ull, (uint16_t)filter_horiz[x + 0] * 0x0001000100010001ull);
+
+      __m128i col = _mm_unpacklo_epi8(_mm_set_epi64x(0,
+               ((uint64_t)input_base_x[x + 1] << 32) | input_base_x[x + 0]), _mm_setzero_si128());
+
+      col = _mm_slli_epi16(col, 7);
+      res = _mm_adds_epi16(_mm_mulhi_epi16(col, coeff), res);
+   }
+
+   for (; x < ctx->horiz.filter_len; x++)
+   {
+      __m128i coeff = _mm_set_epi64x(0, (uint16_t)filter_horiz[x] * 0x0001000100010001ull);
+      __m128i col   = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, 0, input_base_x[x]), _mm_setzero_si128());
+
+      col = _mm_slli_epi16(col, 7);
+      res = _mm_adds_epi16(_mm_mulhi_epi16(col, coeff), res);
+   }
+
+   res = _mm_adds_epi16(_mm_srli_si128(res, 8), res);
+   _mm_storel_epi64((__m128i*)output, res);
+}
+
+static SCALER_SSE2 void scaler_argb8888_horiz_sse2(const struct scaler_ctx *ctx, const void *input_, int stride)
+{
+   const uint32_t *input = (const uint32_t*)input_;
    uint64_t *output      = ctx->scaled.frame;
 
    for (int h = 0; h < ctx->scaled.height; h++, input += stride >> 2, output += ctx->scaled.stride >> 3)
@@ -212,42 +286,106 @@ void scaler_argb8888_horiz(const struct scaler_ctx *ctx, const void *input_, int
       const int16_t *filter_horiz = ctx->horiz.filter;
 
       for (int w = 0; w < ctx->scaled.width; w++, filter_horiz += ctx->horiz.filter_stride)
+         scaler_horiz_pixel_sse2(ctx, output + w, input + ctx->horiz.filter_pos[w], filter_horiz);
+   }
+}
+
+// AVX2 filters two output pixels at a time, one in each 128-bit lane.
+// Each lane does exactly what the SSE2 kernel does, so output is bit-identical.
+static SCALER_AVX2 void scaler_argb8888_horiz_avx2(const struct scaler_ctx *ctx, const void *input_, int stride)
+{
+   const uint32_t *input = (const uint32_t*)input_;
+   uint64_t *output      = ctx->scaled.frame;
+
+   for (int h = 0; h < ctx->scaled.height; h++, input += stride >> 2, output += ctx->scaled.stride >> 3)
+   {
+      const int16_t *filter_horiz = ctx->horiz.filter;
+
+      int w;
+      for (w = 0; (w + 1) < ctx->scaled.width; w += 2, filter_horiz += 2 * ctx->horiz.filter_stride)
       {
-         const uint32_t *input_base_x = input + ctx->horiz.filter_pos[w];
+         const int16_t *filter0 = filter_horiz;
+         const int16_t *filter1 = filter_horiz + ctx->horiz.filter_stride;
+         const uint32_t *input0 = input + ctx->horiz.filter_pos[w + 0];
+         const uint32_t *input1 = input + ctx->horiz.filter_pos[w + 1];
 
-         int16_t res_a = 0;
-         int16_t res_r = 0;
-         int16_t res_g = 0;
-         int16_t res_b = 0;
+         __m256i res = _mm256_setzero_si256();
 
-         for (size_t x = 0; x < ctx->horiz.filter_len; x++)
+         size_t x;
+         for (x = 0; (x + 1) < ctx->horiz.filter_len; x += 2)
          {
-            uint32_t col = input_base_x[x];
+            __m256i coeff = _mm256_set_epi64x(
+                  (uint16_t)filter1[x + 1] * 0x0001000100010001ull, (uint16_t)filter1[x + 0] * 0x0001000100010001ull,
+                  (uint16_t)filter0[x + 1] * 0x0001000100010001ull, (uint16_t)filter0[x + 0] * 0x0001000100010001ull);
 
-            int16_t a = (col >> (24 - 7)) & (0xff << 7);
-            int16_t r = (col >> (16 - 7)) & (0xff << 7);
-            int16_t g = (col >> ( 8 - 7)) & (0xff << 7);
-            int16_t b = (col << ( 0 + 7)) & (0xff << 7);
+            __m128i col0 = _mm_loadl_epi64((const __m128i*)(input0 + x));
+            __m128i col1 = _mm_loadl_epi64((const __m128i*)(input1 + x));
+            __m256i col  = _mm256_cvtepu8_epi16(_mm_unpacklo_epi64(col0, col1));
 
-            int16_t coeff = filter_horiz[x];
+            col = _mm256_slli_epi16(col, 7);
+            res = _mm256_adds_epi16(_mm256_mulhi_epi16(col, coeff), res);
+         }
 
-            res_a += (a * coeff) >> 16;
-            res_r += (r * coeff) >> 16;
-            res_g += (g * coeff) >> 16;
-            res_b += (b * coeff) >> 16;
+         for (; x < ctx->horiz.filter_len; x++)
+         {
+            __m256i coeff = _mm256_set_epi64x(
+                  0, (uint16_t)filter1[x] * 0x0001000100010001ull,
+                  0, (uint16_t)filter0[x] * 0x0001000100010001ull);
+
+            __m256i col = _mm256_cvtepu8_epi16(_mm_set_epi32(0, (int)input1[x], 0, (int)input0[x]));
+
+            col = _mm256_slli_epi16(col, 7);
+            res = _mm256_adds_epi16(_mm256_mulhi_epi16(col, coeff), res);
          }
 
-         output[w] = build_argb64(res_a, res_r, res_g, res_b);
+         res = _mm256_adds_epi16(_mm256_srli_si256(res, 8), res);
+         _mm_storel_epi64((__m128i*)(output + w + 0), _mm256_castsi256_si128(res));
+         _mm_storel_epi64((__m128i*)(output + w + 1), _mm256_extracti128_si256(res, 1));
       }
+
+      for (; w < ctx->scaled.width; w++, filter_horiz += ctx->horiz.filter_stride)
+         scaler_horiz_pixel_sse2(ctx, output + w, input + ctx->horiz.filter_pos[w], filter_horiz);
    }
 }
 #endif
 
+#if defined(SCALER_HAVE_X86) && defined(__SSE2__)
+void (*scaler_argb8888_vert)(const struct scaler_ctx*, void*, int) = scaler_argb8888_vert_sse2;
+void (*scaler_argb8888_horiz)(const struct scaler_ctx*, const void*, int) = scaler_argb8888_horiz_sse2;
+#else
+void (*scaler_argb8888_vert)(const struct scaler_ctx*, void*, int) = scaler_argb8888_vert_c;
+void (*scaler_argb8888_horiz)(const struct scaler_ctx*, const void*, int) = scaler_argb8888_horiz_c;
+#endif
+
+const char *scaler_argb8888_select_simd(unsigned simd)
+{
+#if defined(SCALER_HAVE_X86)
+   if (simd & RARCH_SIMD_AVX2)
+   {
+      scaler_argb8888_vert  = scaler_argb8888_vert_avx2;
+      scaler_argb8888_horiz = scaler_argb8888_horiz_avx2;
+      return "AVX2";
+   }
+   else if (simd & RARCH_SIMD_SSE2)
+   {
+      scaler_argb8888_vert  = scaler_argb8888_vert_sse2;
+      scaler_argb8888_horiz = scaler_argb8888_horiz_sse2;
+      return "SSE2";
+   }
+#endif
+
+   (void)simd;
+   scaler_argb8888_vert  = scaler_argb8888_vert_c;
+   scaler_argb8888_horiz = scaler_argb8888_horiz_c;
+   return "C";
+}
+
 void scaler_argb8888_point_special(const struct scaler_ctx *ctx,
       void *output_, const void *input_,
       int out_width, int out_height,
       int in_width, int in_height,
-      int out_stride, int in_stride)
+      int out_stride, int in_stride,
+      int y_start, int y_end)
 {
    (void)ctx;
    int x_pos  = (1 << 15) * in_width / out_width - (1 << 15);
@@ -261,9 +399,10 @@ void scaler_argb8888_point_special(const struct scaler_ctx *ctx,
       y_pos = 0;
 
    const uint32_t *input = (const uint32_t*)input_;
-   uint32_t *output = (uint32_t*)output_;
+   uint32_t *output = (uint32_t*)output_ + y_start * (out_stride >> 2);
+   y_pos += y_start * y_step;
 
-   for (int h = 0; h < out_height; h++, y_pos += y_step, output += out_stride >> 2)
+   for (int h = y_start; h < y_end; h++, y_pos += y_step, output += out_stride >> 2)
    {
       int x = x_pos;
       const uint32_t *inp = input + (y_pos >> 16) * (in_stride >> 2);
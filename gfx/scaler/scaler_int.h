@@ -18,14 +18,18 @@
 
 #include "scaler.h"
 
-void scaler_argb8888_vert(const struct scaler_ctx *ctx, void *output, int stride);
-void scaler_argb8888_horiz(const struct scaler_ctx *ctx, const void *input, int stride);
+extern void (*scaler_argb8888_vert)(const struct scaler_ctx *ctx, void *output, int stride);
+extern void (*scaler_argb8888_horiz)(const struct scaler_ctx *ctx, const void *input, int stride);
+
+// Picks the fastest kernels for a RARCH_SIMD_* mask. Returns the name of the chosen ISA.
+const char *scaler_argb8888_select_simd(unsigned simd);
 
 void scaler_argb8888_point_special(const struct scaler_ctx *ctx,
       void *output, const void *input,
       int out_width, int out_height,
       int in_width, int in_height,
-      int out_stride, int in_stride);
+      int out_stride, int in_stride,
+      int y_start, int y_end);
 
 #endif
 
@@ -0,0 +1,306 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Verifies that every SIMD pixel converter and scaling kernel supported by the CPU
+// produces output identical to the C reference, and benchmarks each of them.
+
+#include "../scaler.h"
+#include "../scaler_int.h"
+#include "../pixconv.h"
+#include "../../../performance.h"
+#include "../../../general.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct global g_extern;
+struct settings g_settings;
+
+#define BENCH_WIDTH  1920
+#define BENCH_HEIGHT 1080
+#define BENCH_FRAMES 30
+
+static double get_time(void)
+{
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return tv.tv_sec + tv.tv_nsec / 1000000000.0;
+}
+
+enum conv_id
+{
+   CONV_RGB565_0RGB1555 = 0,
+   CONV_0RGB1555_RGB565,
+   CONV_0RGB1555_ARGB8888,
+   CONV_RGB565_ARGB8888,
+   CONV_0RGB1555_BGR24,
+   CONV_RGB565_BGR24,
+   CONV_BGR24_ARGB8888,
+   CONV_ARGB8888_0RGB1555,
+   CONV_ARGB8888_BGR24,
+   CONV_COUNT
+};
+
+static const struct
+{
+   const char *name;
+   unsigned in_size;
+   unsigned out_size;
+} conv_info[CONV_COUNT] = {
+   { "rgb565   -> 0rgb1555", 2, 2 },
+   { "0rgb1555 -> rgb565  ", 2, 2 },
+   { "0rgb1555 -> argb8888", 2, 4 },
+   { "rgb565   -> argb8888", 2, 4 },
+   { "0rgb1555 -> bgr24   ", 2, 3 },
+   { "rgb565   -> bgr24   ", 2, 3 },
+   { "bgr24    -> argb8888", 3, 4 },
+   { "argb8888 -> 0rgb1555", 4, 2 },
+   { "argb8888 -> bgr24   ", 4, 3 },
+};
+
+// Looked up after every conv_select_simd(), as the globals are repointed.
+static conv_func_t get_conv(enum conv_id id)
+{
+   switch (id)
+   {
+      case CONV_RGB565_0RGB1555:   return conv_rgb565_0rgb1555;
+      case CONV_0RGB1555_RGB565:   return conv_0rgb1555_rgb565;
+      case CONV_0RGB1555_ARGB8888: return conv_0rgb1555_argb8888;
+      case CONV_RGB565_ARGB8888:   return conv_rgb565_argb8888;
+      case CONV_0RGB1555_BGR24:    return conv_0rgb1555_bgr24;
+      case CONV_RGB565_BGR24:      return conv_rgb565_bgr24;
+      case CONV_BGR24_ARGB8888:    return conv_bgr24_argb8888;
+      case CONV_ARGB8888_0RGB1555: return conv_argb8888_0rgb1555;
+      case CONV_ARGB8888_BGR24:    return conv_argb8888_bgr24;
+      default:                     return NULL;
+   }
+}
+
+static void fill_random(uint8_t *buf, size_t size)
+{
+   for (size_t i = 0; i < size; i++)
+      buf[i] = rand();
+}
+
+// Converts odd sized rectangles with padded strides, so that the scalar tails
+// and the bytes right after each row are checked as well.
+static bool verify_conv(enum conv_id id, unsigned simd, const char *isa)
+{
+   bool ok = true;
+
+   for (int width = 1; width <= 131 && ok; width += 3)
+   {
+      int height     = 5;
+      int in_stride  = width * conv_info[id].in_size + 13;
+      int out_stride = width * conv_info[id].out_size + 11;
+
+      uint8_t *input     = (uint8_t*)malloc(in_stride * height);
+      uint8_t *reference = (uint8_t*)malloc(out_stride * height);
+      uint8_t *output    = (uint8_t*)malloc(out_stride * height);
+
+      fill_random(input, in_stride * height);
+      memset(reference, 0xaa, out_stride * height);
+      memset(output, 0xaa, out_stride * height);
+
+      conv_select_simd(0);
+      get_conv(id)(reference, input, width, height, out_stride, in_stride);
+      conv_select_simd(simd);
+      get_conv(id)(output, input, width, height, out_stride, in_stride);
+
+      if (memcmp(reference, output, out_stride * height))
+      {
+         fprintf(stderr, "%s %s: mismatch at width %d.\n", conv_info[id].name, isa, width);
+         ok = false;
+      }
+
+      free(input);
+      free(reference);
+      free(output);
+   }
+
+   return ok;
+}
+
+static double bench_conv(enum conv_id id, unsigned simd)
+{
+   int in_stride  = BENCH_WIDTH * conv_info[id].in_size;
+   int out_stride = BENCH_WIDTH * conv_info[id].out_size;
+
+   uint8_t *input  = (uint8_t*)malloc(in_stride * BENCH_HEIGHT);
+   uint8_t *output = (uint8_t*)malloc(out_stride * BENCH_HEIGHT);
+   fill_random(input, in_stride * BENCH_HEIGHT);
+
+   conv_select_simd(simd);
+   conv_func_t conv = get_conv(id);
+
+   double start = get_time();
+   for (unsigned i = 0; i < BENCH_FRAMES; i++)
+      conv(output, input, BENCH_WIDTH, BENCH_HEIGHT, out_stride, in_stride);
+   double elapsed = get_time() - start;
+
+   free(input);
+   free(output);
+   return 1000.0 * elapsed / BENCH_FRAMES;
+}
+
+// Scales 256x224 (and an odd sized frame) up and down with bilinear and sinc filters.
+static bool run_scaler(enum scaler_type type, unsigned in_width, unsigned in_height,
+      unsigned out_width, unsigned out_height, unsigned simd,
+      const uint32_t *input, uint32_t *output, double *ms)
+{
+   scaler_argb8888_select_simd(simd);
+
+   struct scaler_ctx ctx;
+   memset(&ctx, 0, sizeof(ctx));
+   ctx.in_width    = in_width;
+   ctx.in_height   = in_height;
+   ctx.in_stride   = in_width * sizeof(uint32_t);
+   ctx.out_width   = out_width;
+   ctx.out_height  = out_height;
+   ctx.out_stride  = out_width * sizeof(uint32_t);
+   ctx.in_fmt      = SCALER_FMT_ARGB8888;
+   ctx.out_fmt     = SCALER_FMT_ARGB8888;
+   ctx.scaler_type = type;
+
+   if (!scaler_ctx_gen_filter(&ctx))
+      return false;
+
+   unsigned frames = ms ? BENCH_FRAMES : 1;
+   double start = get_time();
+   for (unsigned i = 0; i < frames; i++)
+      scaler_ctx_scale(&ctx, output, input);
+   double elapsed = get_time() - start;
+
+   if (ms)
+      *ms = 1000.0 * elapsed / frames;
+
+   scaler_ctx_gen_reset(&ctx);
+   return true;
+}
+
+static bool verify_scaler(unsigned simd, const char *isa, const uint32_t *input)
+{
+   static const struct
+   {
+      unsigned in_width, in_height, out_width, out_height;
+   } sizes[] = {
+      { 256, 224, 1920, 1080 },
+      { 256, 224, 97, 61 },
+      { 253, 223, 643, 479 },
+   };
+
+   static const enum scaler_type types[] = { SCALER_TYPE_BILINEAR, SCALER_TYPE_SINC };
+
+   bool ok = true;
+   uint32_t *reference = (uint32_t*)malloc(1920 * 1080 * sizeof(uint32_t));
+   uint32_t *output    = (uint32_t*)malloc(1920 * 1080 * sizeof(uint32_t));
+
+   for (unsigned t = 0; t < sizeof(types) / sizeof(types[0]); t++)
+   {
+      for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+      {
+         size_t size = sizes[s].out_width * sizes[s].out_height * sizeof(uint32_t);
+         memset(reference, 0, size);
+         memset(output, 0, size);
+
+         if (!run_scaler(types[t], sizes[s].in_width, sizes[s].in_height,
+                  sizes[s].out_width, sizes[s].out_height, 0, input, reference, NULL) ||
+               !run_scaler(types[t], sizes[s].in_width, sizes[s].in_height,
+                  sizes[s].out_width, sizes[s].out_height, simd, input, output, NULL))
+         {
+            fprintf(stderr, "Failed to create scaler.\n");
+            exit(1);
+         }
+
+         if (memcmp(reference, output, size))
+         {
+            fprintf(stderr, "Scaler %s: mismatch for %ux%u -> %ux%u.\n", isa,
+                  sizes[s].in_width, sizes[s].in_height, sizes[s].out_width, sizes[s].out_height);
+            ok = false;
+         }
+      }
+   }
+
+   free(reference);
+   free(output);
+   return ok;
+}
+
+int main(void)
+{
+   struct rarch_cpu_features cpu;
+   rarch_get_cpu_features(&cpu);
+
+   static const struct
+   {
+      unsigned simd;
+      const char *name;
+   } isas[] = {
+      { 0, "C" },
+      { RARCH_SIMD_SSE2, "SSE2" },
+      { RARCH_SIMD_AVX2, "AVX2" },
+      { RARCH_SIMD_NEON, "NEON" },
+   };
+
+   uint32_t *input = (uint32_t*)malloc(256 * 224 * sizeof(uint32_t));
+   srand(0);
+   fill_random((uint8_t*)input, 256 * 224 * sizeof(uint32_t));
+
+   // The first scaler created selects kernels by itself, get that out of the way
+   // so it won't override our own selection below.
+   uint32_t dummy;
+   run_scaler(SCALER_TYPE_BILINEAR, 256, 224, 1, 1, 0, input, &dummy, NULL);
+
+   bool ok = true;
+   for (unsigned i = 0; i < sizeof(isas) / sizeof(isas[0]); i++)
+   {
+      if (isas[i].simd && !(cpu.simd & isas[i].simd))
+      {
+         printf("%s: not supported, skipping.\n", isas[i].name);
+         continue;
+      }
+
+      printf("%s:\n", isas[i].name);
+
+      for (unsigned id = 0; id < CONV_COUNT; id++)
+      {
+         bool identical = verify_conv(id, isas[i].simd, isas[i].name);
+         ok &= identical;
+         printf("   %s: %7.3f ms/frame%s\n", conv_info[id].name,
+               bench_conv(id, isas[i].simd), identical ? "" : " MISMATCH");
+      }
+
+      bool identical = verify_scaler(isas[i].simd, isas[i].name, input);
+      ok &= identical;
+
+      double ms = 0.0;
+      uint32_t *output = (uint32_t*)malloc(BENCH_WIDTH * BENCH_HEIGHT * sizeof(uint32_t));
+      run_scaler(SCALER_TYPE_BILINEAR, 256, 224, BENCH_WIDTH, BENCH_HEIGHT, isas[i].simd, input, output, &ms);
+      free(output);
+      printf("   bilinear 256x224 -> %ux%u: %7.3f ms/frame%s\n",
+            BENCH_WIDTH, BENCH_HEIGHT, ms, identical ? "" : " MISMATCH");
+   }
+
+   free(input);
+
+   if (!ok)
+   {
+      fprintf(stderr, "SIMD output differs from C output.\n");
+      return 1;
+   }
+
+   return 0;
+}
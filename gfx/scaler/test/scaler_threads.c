@@ -0,0 +1,156 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
+ * 
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Benchmarks scaling a 256x224 frame to 1920x1080 with point, bilinear and sinc filters
+// on a varying number of threads, and verifies that output is identical to the single-threaded path.
+
+#include "../scaler.h"
+#include "../../../general.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct global g_extern;
+struct settings g_settings;
+
+#define IN_WIDTH   256
+#define IN_HEIGHT  224
+#define OUT_WIDTH  1920
+#define OUT_HEIGHT 1080
+#define FRAMES     60
+
+static double get_time(void)
+{
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return tv.tv_sec + tv.tv_nsec / 1000000000.0;
+}
+
+static const char *type_to_str(enum scaler_type type)
+{
+   switch (type)
+   {
+      case SCALER_TYPE_POINT:
+         return "point";
+      case SCALER_TYPE_BILINEAR:
+         return "bilinear";
+      case SCALER_TYPE_SINC:
+         return "sinc";
+      default:
+         return "unknown";
+   }
+}
+
+// Returns false if output differs from reference. Reference is filled in if NULL.
+static bool run_test(enum scaler_type type, enum scaler_pix_fmt in_fmt, enum scaler_pix_fmt out_fmt,
+      unsigned threads, const void *input, uint8_t *output, const uint8_t *reference)
+{
+   unsigned in_size  = in_fmt == SCALER_FMT_ARGB8888 ? 4 : 2;
+   unsigned out_size = out_fmt == SCALER_FMT_BGR24 ? 3 : 4;
+
+   struct scaler_ctx ctx;
+   memset(&ctx, 0, sizeof(ctx));
+   ctx.in_width    = IN_WIDTH;
+   ctx.in_height   = IN_HEIGHT;
+   ctx.in_stride   = IN_WIDTH * in_size;
+   ctx.out_width   = OUT_WIDTH;
+   ctx.out_height  = OUT_HEIGHT;
+   ctx.out_stride  = OUT_WIDTH * out_size;
+   ctx.in_fmt      = in_fmt;
+   ctx.out_fmt     = out_fmt;
+   ctx.scaler_type = type;
+   ctx.threads     = threads;
+
+   if (!scaler_ctx_gen_filter(&ctx))
+   {
+      fprintf(stderr, "Failed to create scaler.\n");
+      exit(1);
+   }
+
+   memset(output, 0, OUT_WIDTH * OUT_HEIGHT * 4);
+
+   double start = get_time();
+   for (unsigned i = 0; i < FRAMES; i++)
+      scaler_ctx_scale(&ctx, output, input);
+   double elapsed = get_time() - start;
+
+   scaler_ctx_gen_reset(&ctx);
+
+   bool identical = !reference || !memcmp(output, reference, OUT_WIDTH * OUT_HEIGHT * out_size);
+
+   printf("%8s %s -> %s, %u thread(s): %7.3f ms/frame%s\n",
+         type_to_str(type),
+         in_fmt == SCALER_FMT_ARGB8888 ? "ARGB8888" : "RGB565  ",
+         out_fmt == SCALER_FMT_BGR24 ? "BGR24   " : "ARGB8888",
+         threads, 1000.0 * elapsed / FRAMES,
+         identical ? "" : " MISMATCH");
+
+   return identical;
+}
+
+int main(int argc, char *argv[])
+{
+   unsigned max_threads = argc > 1 ? strtoul(argv[1], NULL, 0) : 4;
+   if (!max_threads)
+      max_threads = 1;
+
+   uint32_t *input = (uint32_t*)malloc(IN_WIDTH * IN_HEIGHT * sizeof(uint32_t));
+   uint8_t *output = (uint8_t*)malloc(OUT_WIDTH * OUT_HEIGHT * 4);
+   uint8_t *reference = (uint8_t*)malloc(OUT_WIDTH * OUT_HEIGHT * 4);
+   if (!input || !output || !reference)
+      return 1;
+
+   srand(0);
+   for (unsigned i = 0; i < IN_WIDTH * IN_HEIGHT; i++)
+      input[i] = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+
+   static const enum scaler_type types[] = {
+      SCALER_TYPE_POINT, SCALER_TYPE_BILINEAR, SCALER_TYPE_SINC,
+   };
+
+   static const struct
+   {
+      enum scaler_pix_fmt in_fmt;
+      enum scaler_pix_fmt out_fmt;
+   } fmts[] = {
+      { SCALER_FMT_ARGB8888, SCALER_FMT_ARGB8888 },
+      { SCALER_FMT_RGB565, SCALER_FMT_ARGB8888 },
+      { SCALER_FMT_ARGB8888, SCALER_FMT_BGR24 },
+   };
+
+   bool ok = true;
+   for (unsigned t = 0; t < sizeof(types) / sizeof(types[0]); t++)
+   {
+      for (unsigned f = 0; f < sizeof(fmts) / sizeof(fmts[0]); f++)
+      {
+         run_test(types[t], fmts[f].in_fmt, fmts[f].out_fmt, 1, input, reference, NULL);
+         for (unsigned threads = 2; threads <= max_threads; threads++)
+            ok &= run_test(types[t], fmts[f].in_fmt, fmts[f].out_fmt, threads, input, output, reference);
+      }
+   }
+
+   free(input);
+   free(output);
+   free(reference);
+
+   if (!ok)
+   {
+      fprintf(stderr, "Threaded output differs from single-threaded output.\n");
+      return 1;
+   }
+
+   return 0;
+}
@@ -0,0 +1,434 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thread_wrapper.h"
+#include "../thread.h"
+#include "../general.h"
+#include <stdlib.h>
+#include <string.h>
+
+enum thread_cmd
+{
+   CMD_NONE = 0,
+   CMD_INIT,
+   CMD_FREE,
+   CMD_SET_NONBLOCK_STATE,
+   CMD_SET_SHADER,
+   CMD_SET_ROTATION,
+   CMD_VIEWPORT_INFO,
+   CMD_READ_VIEWPORT
+};
+
+typedef struct thread_video
+{
+   const video_driver_t *driver;
+   void *driver_data;
+
+   // What the wrapper exposes. Optional hooks the wrapped driver lacks are left out,
+   // so callers still see that they are missing and pick their fallbacks.
+   video_driver_t wrapper;
+
+   sthread_t *thread;
+   slock_t *lock;
+   scond_t *cond_thread; // Render thread waits for commands and frames.
+   scond_t *cond_cmd; // Emulation thread waits for replies, and for the frame slot to be free.
+
+   // Cached after every frame, so the emulation thread never has to wait for these.
+   bool alive;
+   bool focus;
+
+   // Only touched by the emulation thread.
+   bool nonblock;
+   unsigned bytes_per_pixel;
+
+   enum thread_cmd send_cmd;
+   enum thread_cmd reply_cmd;
+
+   // Arguments and results of the command in flight.
+   struct
+   {
+      const video_info_t *info;
+      const input_driver_t **input;
+      void **input_data;
+
+      bool state;
+      enum rarch_shader_type shader_type;
+      const char *shader_path;
+      unsigned rotation;
+      struct rarch_viewport *vp;
+      uint8_t *buffer;
+
+      bool ret;
+   } cmd_data;
+
+   // The frame slot. The emulation thread owns it while updated is false, the render thread while true.
+   struct
+   {
+      uint8_t *buffer;
+      size_t buffer_size;
+      bool has_data;
+      unsigned width;
+      unsigned height;
+      unsigned pitch;
+      char msg[1024];
+      bool has_msg;
+      bool updated;
+   } frame;
+} thread_video_t;
+
+static void thread_handle_cmd(thread_video_t *thr, enum thread_cmd cmd)
+{
+   switch (cmd)
+   {
+      case CMD_INIT:
+         thr->driver_data = thr->driver->init(thr->cmd_data.info,
+               thr->cmd_data.input, thr->cmd_data.input_data);
+         thr->cmd_data.ret = thr->driver_data != NULL;
+         break;
+
+      case CMD_FREE:
+         if (thr->driver_data)
+            thr->driver->free(thr->driver_data);
+         thr->driver_data = NULL;
+         break;
+
+      case CMD_SET_NONBLOCK_STATE:
+         thr->driver->set_nonblock_state(thr->driver_data, thr->cmd_data.state);
+         break;
+
+      case CMD_SET_SHADER:
+         thr->cmd_data.ret = thr->driver->set_shader &&
+            thr->driver->set_shader(thr->driver_data, thr->cmd_data.shader_type, thr->cmd_data.shader_path);
+         break;
+
+      case CMD_SET_ROTATION:
+         if (thr->driver->set_rotation)
+            thr->driver->set_rotation(thr->driver_data, thr->cmd_data.rotation);
+         break;
+
+      case CMD_VIEWPORT_INFO:
+         if (thr->driver->viewport_info)
+            thr->driver->viewport_info(thr->driver_data, thr->cmd_data.vp);
+         else
+            memset(thr->cmd_data.vp, 0, sizeof(*thr->cmd_data.vp));
+         break;
+
+      case CMD_READ_VIEWPORT:
+         thr->cmd_data.ret = thr->driver->read_viewport &&
+            thr->driver->read_viewport(thr->driver_data, thr->cmd_data.buffer);
+         break;
+
+      default:
+         break;
+   }
+}
+
+static void thread_loop(void *data)
+{
+   thread_video_t *thr = (thread_video_t*)data;
+
+   for (;;)
+   {
+      slock_lock(thr->lock);
+      while (thr->send_cmd == CMD_NONE && !thr->frame.updated)
+         scond_wait(thr->cond_thread, thr->lock);
+
+      enum thread_cmd cmd = thr->send_cmd;
+      bool updated = thr->frame.updated;
+      slock_unlock(thr->lock);
+
+      // Commands go first, as the emulation thread is blocked on them.
+      if (cmd != CMD_NONE)
+      {
+         thread_handle_cmd(thr, cmd);
+
+         slock_lock(thr->lock);
+         thr->send_cmd  = CMD_NONE;
+         thr->reply_cmd = cmd;
+         if (cmd == CMD_INIT && thr->driver_data)
+         {
+            thr->alive = true;
+            thr->focus = true;
+         }
+         scond_signal(thr->cond_cmd);
+         slock_unlock(thr->lock);
+
+         if (cmd == CMD_FREE || (cmd == CMD_INIT && !thr->driver_data))
+            break;
+         continue;
+      }
+
+      if (updated)
+      {
+         bool ret = thr->driver->frame(thr->driver_data,
+               thr->frame.has_data ? thr->frame.buffer : NULL,
+               thr->frame.width, thr->frame.height, thr->frame.pitch,
+               thr->frame.has_msg ? thr->frame.msg : NULL);
+
+         bool alive = ret && thr->driver->alive(thr->driver_data);
+         bool focus = thr->driver->focus(thr->driver_data);
+
+         slock_lock(thr->lock);
+         thr->alive = alive;
+         thr->focus = focus;
+         thr->frame.updated = false;
+         scond_signal(thr->cond_cmd);
+         slock_unlock(thr->lock);
+      }
+   }
+}
+
+static void thread_send_cmd(thread_video_t *thr, enum thread_cmd cmd)
+{
+   slock_lock(thr->lock);
+   thr->send_cmd  = cmd;
+   thr->reply_cmd = CMD_NONE;
+   scond_signal(thr->cond_thread);
+
+   while (thr->reply_cmd != cmd)
+      scond_wait(thr->cond_cmd, thr->lock);
+   slock_unlock(thr->lock);
+}
+
+static bool thread_frame(void *data, const void *frame,
+      unsigned width, unsigned height, unsigned pitch, const char *msg)
+{
+   thread_video_t *thr = (thread_video_t*)data;
+
+   slock_lock(thr->lock);
+   if (!thr->alive)
+   {
+      slock_unlock(thr->lock);
+      return false;
+   }
+
+   // While syncing, wait for the previous frame to be presented. Otherwise, never wait,
+   // and drop the frame if the render thread is still busy.
+   if (thr->frame.updated && thr->nonblock)
+   {
+      slock_unlock(thr->lock);
+      return true;
+   }
+
+   while (thr->frame.updated)
+      scond_wait(thr->cond_cmd, thr->lock);
+   slock_unlock(thr->lock);
+
+   thr->frame.has_data = frame != NULL;
+   if (frame)
+   {
+      unsigned copy_pitch = width * thr->bytes_per_pixel;
+      size_t size = copy_pitch * height;
+
+      if (size > thr->frame.buffer_size)
+      {
+         uint8_t *buffer = (uint8_t*)realloc(thr->frame.buffer, size);
+         if (!buffer)
+            return false;
+
+         thr->frame.buffer      = buffer;
+         thr->frame.buffer_size = size;
+      }
+
+      const uint8_t *src = (const uint8_t*)frame;
+      uint8_t *dst = thr->frame.buffer;
+      for (unsigned h = 0; h < height; h++, src += pitch, dst += copy_pitch)
+         memcpy(dst, src, copy_pitch);
+
+      pitch = copy_pitch;
+   }
+
+   thr->frame.width   = width;
+   thr->frame.height  = height;
+   thr->frame.pitch   = pitch;
+   thr->frame.has_msg = msg != NULL;
+   if (msg)
+      strlcpy(thr->frame.msg, msg, sizeof(thr->frame.msg));
+
+   slock_lock(thr->lock);
+   thr->frame.updated = true;
+   scond_signal(thr->cond_thread);
+   slock_unlock(thr->lock);
+
+   return true;
+}
+
+static void thread_set_nonblock_state(void *data, bool state)
+{
+   thread_video_t *thr = (thread_video_t*)data;
+   thr->nonblock = state;
+   thr->cmd_data.state = state;
+   thread_send_cmd(thr, CMD_SET_NONBLOCK_STATE);
+}
+
+static bool thread_alive(void *data)
+{
+   thread_video_t *thr = (thread_video_t*)data;
+   slock_lock(thr->lock);
+   bool ret = thr->alive;
+   slock_unlock(thr->lock);
+   return ret;
+}
+
+static bool thread_focus(void *data)
+{
+   thread_video_t *thr = (thread_video_t*)data;
+   slock_lock(thr->lock);
+   bool ret = thr->focus;
+   slock_unlock(thr->lock);
+   return ret;
+}
+
+static bool thread_set_shader(void *data, enum rarch_shader_type type, const char *path)
+{
+   thread_video_t *thr = (thread_video_t*)data;
+   thr->cmd_data.shader_type = type;
+   thr->cmd_data.shader_path = path;
+   thread_send_cmd(thr, CMD_SET_SHADER);
+   return thr->cmd_data.ret;
+}
+
+static void thread_set_rotation(void *data, unsigned rotation)
+{
+   thread_video_t *thr = (thread_video_t*)data;
+   thr->cmd_data.rotation = rotation;
+   thread_send_cmd(thr, CMD_SET_ROTATION);
+}
+
+static void thread_viewport_info(void *data, struct rarch_viewport *vp)
+{
+   thread_video_t *thr = (thread_video_t*)data;
+   thr->cmd_data.vp = vp;
+   thread_send_cmd(thr, CMD_VIEWPORT_INFO);
+}
+
+static bool thread_read_viewport(void *data, uint8_t *buffer)
+{
+   thread_video_t *thr = (thread_video_t*)data;
+   thr->cmd_data.buffer = buffer;
+   thread_send_cmd(thr, CMD_READ_VIEWPORT);
+   return thr->cmd_data.ret;
+}
+
+static void thread_free(void *data)
+{
+   thread_video_t *thr = (thread_video_t*)data;
+   if (!thr)
+      return;
+
+   if (thr->thread)
+   {
+      // Waits for any frame in flight as well.
+      thread_send_cmd(thr, CMD_FREE);
+      sthread_join(thr->thread);
+   }
+
+   if (thr->lock)
+      slock_free(thr->lock);
+   if (thr->cond_thread)
+      scond_free(thr->cond_thread);
+   if (thr->cond_cmd)
+      scond_free(thr->cond_cmd);
+
+   free(thr->frame.buffer);
+   free(thr);
+}
+
+static void *thread_init_never_call(const video_info_t *video, const input_driver_t **input, void **input_data)
+{
+   (void)video;
+   (void)input;
+   (void)input_data;
+   RARCH_ERR("Sanity check fail! Threaded video driver must be initialized with rarch_threaded_video_init().\n");
+   return NULL;
+}
+
+static const video_driver_t video_thread = {
+   thread_init_never_call,
+   thread_frame,
+   thread_set_nonblock_state,
+   thread_alive,
+   thread_focus,
+   thread_set_shader,
+   thread_free,
+   "Thread wrapper",
+
+#if defined(HAVE_RMENU)
+   NULL,
+   NULL,
+   NULL,
+   NULL,
+   NULL,
+#endif
+
+   thread_set_rotation,
+   thread_viewport_info,
+   thread_read_viewport,
+};
+
+bool rarch_threaded_video_init(const video_driver_t **out_driver, void **out_data,
+      const input_driver_t **input, void **input_data,
+      const video_driver_t *driver, const video_info_t *info)
+{
+   thread_video_t *thr = (thread_video_t*)calloc(1, sizeof(*thr));
+   if (!thr)
+      return false;
+
+   thr->driver          = driver;
+   thr->nonblock        = !info->vsync;
+   thr->bytes_per_pixel = info->rgb32 ? sizeof(uint32_t) : sizeof(uint16_t);
+
+   thr->lock        = slock_new();
+   thr->cond_thread = scond_new();
+   thr->cond_cmd    = scond_new();
+   if (!thr->lock || !thr->cond_thread || !thr->cond_cmd)
+      goto error;
+
+   thr->thread = sthread_create(thread_loop, thr);
+   if (!thr->thread)
+      goto error;
+
+   thr->cmd_data.info       = info;
+   thr->cmd_data.input      = input;
+   thr->cmd_data.input_data = input_data;
+   thread_send_cmd(thr, CMD_INIT);
+
+   if (!thr->cmd_data.ret)
+   {
+      // The render thread has already exited.
+      sthread_join(thr->thread);
+      thr->thread = NULL;
+      goto error;
+   }
+
+   thr->wrapper = video_thread;
+   if (!driver->set_shader)
+      thr->wrapper.set_shader = NULL;
+   if (!driver->set_rotation)
+      thr->wrapper.set_rotation = NULL;
+   if (!driver->viewport_info)
+      thr->wrapper.viewport_info = NULL;
+   if (!driver->read_viewport)
+      thr->wrapper.read_viewport = NULL;
+
+   *out_driver = &thr->wrapper;
+   *out_data   = thr;
+   return true;
+
+error:
+   thread_free(thr);
+   return false;
+}
+
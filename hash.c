@@ -15,12 +15,25 @@
 
 // SHA256 implementation from bSNES. Written by valditx.
 //
+// Until hash_init() is called, SHA256 and CRC32 use portable C versions, CRC32 one byte at a time.
+// hash_init() is called once at startup, and picks the fastest implementation the CPU supports.
+// SHA256 uses the SHA extensions if present, CRC32 uses carry-less multiplication (PCLMULQDQ) to
+// fold 64 bytes at a time if present, and slicing-by-8 otherwise.
+// All implementations give identical results.
 
 #include "general.h"
 #include "hash.h"
+#include "performance.h"
 #include <string.h>
 #include <stdio.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HASH_HAVE_X86
+#define HASH_SHA __attribute__((target("sha,sse4.1")))
+#define HASH_PCLMUL __attribute__((target("pclmul,sse4.1")))
+#include <immintrin.h>
+#endif
+
 #define SWAP32(x) ((uint32_t)(           \
          (((uint32_t)(x) & 0x000000ff) << 24) | \
          (((uint32_t)(x) & 0x0000ff00) <<  8) | \
@@ -43,9 +56,15 @@ static inline uint32_t load32le(const uint32_t *addr)
    return is_little_endian() ? *addr : SWAP32(*addr);
 }
 
-static inline uint32_t load32be(const uint32_t *addr)
+// For unaligned input.
+static inline uint32_t read32be(const uint8_t *data)
 {
-   return is_little_endian() ? SWAP32(*addr) : *addr;
+   return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+static inline uint32_t read32le(const uint8_t *data)
+{
+   return ((uint32_t)data[3] << 24) | ((uint32_t)data[2] << 16) | ((uint32_t)data[1] << 8) | data[0];
 }
 
 #define LSL32(x, n) ((uint32_t)(x) << (n))
@@ -69,6 +88,19 @@ static const uint32_t T_K[64] = {
    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
 };
 
+// Processes a number of whole 64 byte blocks.
+typedef void (*sha256_blocks_t)(uint32_t *h, const uint8_t *data, size_t blocks);
+
+// Updates a CRC32 register, without the pre- and post-inversion.
+typedef uint32_t (*crc32_update_t)(uint32_t crc, const uint8_t *data, size_t length);
+
+static void sha256_blocks_c(uint32_t *state, const uint8_t *data, size_t blocks);
+static uint32_t crc32_update_bytewise(uint32_t crc, const uint8_t *data, size_t length);
+
+// Portable versions until hash_init() picks faster ones.
+static sha256_blocks_t sha256_blocks = sha256_blocks_c;
+static crc32_update_t crc32_update_impl = crc32_update_bytewise;
+
 struct sha256_ctx 
 {
    union
@@ -78,7 +110,6 @@ struct sha256_ctx
    } in;
    unsigned inlen;
 
-   uint32_t w[64];
    uint32_t h[8];
    uint64_t len;
 };
@@ -89,54 +120,101 @@ static void sha256_init(struct sha256_ctx *p)
    memcpy(p->h, T_H, sizeof(T_H));
 }
 
-static void sha256_block(struct sha256_ctx *p) 
+static void sha256_blocks_c(uint32_t *state, const uint8_t *data, size_t blocks)
 {
    unsigned i;
    uint32_t s0, s1;
    uint32_t a, b, c, d, e, f, g, h;
    uint32_t t1, t2, maj, ch;
+   uint32_t w[64];
 
-   for (i = 0; i < 16; i++) 
-      p->w[i] = load32be(p->in.u32 + i);
-
-   for (i = 16; i < 64; i++) 
+   for (; blocks; blocks--, data += 64)
    {
-      s0 = ROR32(p->w[i - 15],  7) ^ ROR32(p->w[i - 15], 18) ^ LSR32(p->w[i - 15],  3);
-      s1 = ROR32(p->w[i -  2], 17) ^ ROR32(p->w[i -  2], 19) ^ LSR32(p->w[i -  2], 10);
-      p->w[i] = p->w[i - 16] + s0 + p->w[i - 7] + s1;
+      for (i = 0; i < 16; i++) 
+         w[i] = read32be(data + 4 * i);
+
+      for (i = 16; i < 64; i++) 
+      {
+         s0 = ROR32(w[i - 15],  7) ^ ROR32(w[i - 15], 18) ^ LSR32(w[i - 15],  3);
+         s1 = ROR32(w[i -  2], 17) ^ ROR32(w[i -  2], 19) ^ LSR32(w[i -  2], 10);
+         w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+      }
+
+      a = state[0]; b = state[1]; c = state[2]; d = state[3];
+      e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+      for (i = 0; i < 64; i++) 
+      {
+         s0 = ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22);
+         maj = (a & b) ^ (a & c) ^ (b & c);
+         t2 = s0 + maj;
+         s1 = ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25);
+         ch = (e & f) ^ (~e & g);
+         t1 = h + s1 + ch + T_K[i] + w[i];
+
+         h = g; g = f; f = e; e = d + t1;
+         d = c; c = b; b = a; a = t1 + t2;
+      }
+
+      state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+      state[4] += e; state[5] += f; state[6] += g; state[7] += h;
    }
+}
 
-   a = p->h[0]; b = p->h[1]; c = p->h[2]; d = p->h[3];
-   e = p->h[4]; f = p->h[5]; g = p->h[6]; h = p->h[7];
+#ifdef HASH_HAVE_X86
+// The SHA extensions keep the state as ABEF and CDGH, and do two rounds per instruction.
+HASH_SHA
+static void sha256_blocks_sha(uint32_t *state, const uint8_t *data, size_t blocks)
+{
+   const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+
+   __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0xb1); // CDAB
+   __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(state + 4)), 0x1b); // EFGH
+   __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+   state1 = _mm_blend_epi16(state1, tmp, 0xf0); // CDGH
 
-   for (i = 0; i < 64; i++) 
+   for (; blocks; blocks--, data += 64)
    {
-      s0 = ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22);
-      maj = (a & b) ^ (a & c) ^ (b & c);
-      t2 = s0 + maj;
-      s1 = ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25);
-      ch = (e & f) ^ (~e & g);
-      t1 = h + s1 + ch + T_K[i] + p->w[i];
-
-      h = g; g = f; f = e; e = d + t1;
-      d = c; c = b; b = a; a = t1 + t2;
+      const __m128i abef = state0;
+      const __m128i cdgh = state1;
+
+      // Holds the 16 most recent message schedule words.
+      __m128i w[4];
+      for (unsigned i = 0; i < 4; i++)
+         w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16 * i)), bswap);
+
+      for (unsigned i = 0; i < 16; i++)
+      {
+         __m128i msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i*)(T_K + 4 * i)));
+         state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+         state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+
+         if (i < 12)
+         {
+            __m128i next = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+            next = _mm_add_epi32(next, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+            w[i & 3] = _mm_sha256msg2_epu32(next, w[(i + 3) & 3]);
+         }
+      }
+
+      state0 = _mm_add_epi32(state0, abef);
+      state1 = _mm_add_epi32(state1, cdgh);
    }
 
-   p->h[0] += a; p->h[1] += b; p->h[2] += c; p->h[3] += d;
-   p->h[4] += e; p->h[5] += f; p->h[6] += g; p->h[7] += h;
-
-   // Next block
-   p->inlen = 0;
+   tmp = _mm_shuffle_epi32(state0, 0x1b); // FEBA
+   state1 = _mm_shuffle_epi32(state1, 0xb1); // DCHG
+   _mm_storeu_si128((__m128i*)state, _mm_blend_epi16(tmp, state1, 0xf0)); // DCBA
+   _mm_storeu_si128((__m128i*)(state + 4), _mm_alignr_epi8(state1, tmp, 8)); // HGFE
 }
+#endif
 
-static void sha256_chunk(struct sha256_ctx *p, const uint8_t *s, unsigned len) 
+static void sha256_chunk(struct sha256_ctx *p, const uint8_t *s, size_t len) 
 {
-   unsigned l;
    p->len += len;
 
-   while (len) 
+   if (p->inlen)
    {
-      l = 64 - p->inlen;
+      unsigned l = 64 - p->inlen;
       l = (len < l) ? len : l;
 
       memcpy(p->in.u8 + p->inlen, s, l);
@@ -144,9 +222,21 @@ static void sha256_chunk(struct sha256_ctx *p, const uint8_t *s, unsigned len)
       p->inlen += l;
       len -= l;
 
-      if (p->inlen == 64) 
-         sha256_block(p);
+      if (p->inlen < 64)
+         return;
+
+      sha256_blocks(p->h, p->in.u8, 1);
+      p->inlen = 0;
    }
+
+   // Whole blocks are hashed straight from the input.
+   size_t blocks = len / 64;
+   sha256_blocks(p->h, s, blocks);
+   s += blocks * 64;
+   len -= blocks * 64;
+
+   memcpy(p->in.u8, s, len);
+   p->inlen = len;
 }
 
 static void sha256_final(struct sha256_ctx *p) 
@@ -157,7 +247,8 @@ static void sha256_final(struct sha256_ctx *p)
    if (p->inlen > 56) 
    {
       memset(p->in.u8 + p->inlen, 0, 64 - p->inlen);
-      sha256_block(p);
+      sha256_blocks(p->h, p->in.u8, 1);
+      p->inlen = 0;
    }
 
    memset(p->in.u8 + p->inlen, 0, 56 - p->inlen);
@@ -165,7 +256,7 @@ static void sha256_final(struct sha256_ctx *p)
    len = p->len << 3;
    store32be(p->in.u32 + 14, len >> 32);
    store32be(p->in.u32 + 15, len);
-   sha256_block(p);
+   sha256_blocks(p->h, p->in.u8, 1);
 }
 
 static void sha256_subhash(struct sha256_ctx *p, uint32_t *t) 
@@ -174,26 +265,6 @@ static void sha256_subhash(struct sha256_ctx *p, uint32_t *t)
       store32be(t++, p->h[i]);
 }
 
-void sha256_hash(char *out, const uint8_t *in, size_t size)
-{
-   struct sha256_ctx sha;
-
-   union
-   {
-      uint32_t u32[8];
-      uint8_t u8[32];
-   } shahash;
-
-   sha256_init(&sha);
-   sha256_chunk(&sha, in, size);
-   sha256_final(&sha);
-   sha256_subhash(&sha, shahash.u32);
-
-   for (unsigned i = 0; i < 32; i++)
-      snprintf(out + 2 * i, 3, "%02x", (unsigned)shahash.u8[i]);
-}
-
-#ifndef HAVE_ZLIB
 // Zlib crc32.
 static const uint32_t crc32_table[256] = {
     0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
@@ -241,17 +312,165 @@ static const uint32_t crc32_table[256] = {
     0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
+// crc32_slice[n][i] is the CRC of byte i followed by n zero bytes.
+static uint32_t crc32_slice[8][256];
+
 uint32_t crc32_adjust(uint32_t crc32, uint8_t input)
 {
    return ((crc32 >> 8) & 0x00ffffff) ^ crc32_table[(crc32 ^ input) & 0xff];
 }
 
-uint32_t crc32_calculate(const uint8_t *data, size_t length)
+static uint32_t crc32_update_bytewise(uint32_t crc, const uint8_t *data, size_t length)
 {
-   uint32_t crc32 = ~0;
    for (size_t i = 0; i < length; i++)
-      crc32 = crc32_adjust(crc32, data[i]);
-   return ~crc32;
+      crc = crc32_adjust(crc, data[i]);
+   return crc;
+}
+
+static void crc32_init_slices(void)
+{
+   memcpy(crc32_slice[0], crc32_table, sizeof(crc32_table));
+   for (unsigned n = 1; n < 8; n++)
+      for (unsigned i = 0; i < 256; i++)
+         crc32_slice[n][i] = crc32_adjust(crc32_slice[n - 1][i], 0);
+}
+
+// Consumes 8 bytes per iteration with independent table lookups.
+static uint32_t crc32_update_slice8(uint32_t crc, const uint8_t *data, size_t length)
+{
+   for (; length >= 8; length -= 8, data += 8)
+   {
+      uint32_t lo = crc ^ read32le(data);
+      uint32_t hi = read32le(data + 4);
+
+      crc = crc32_slice[7][lo & 0xff] ^ crc32_slice[6][(lo >> 8) & 0xff] ^
+         crc32_slice[5][(lo >> 16) & 0xff] ^ crc32_slice[4][lo >> 24] ^
+         crc32_slice[3][hi & 0xff] ^ crc32_slice[2][(hi >> 8) & 0xff] ^
+         crc32_slice[1][(hi >> 16) & 0xff] ^ crc32_slice[0][hi >> 24];
+   }
+
+   for (; length; length--)
+      crc = crc32_adjust(crc, *data++);
+
+   return crc;
 }
+
+#ifdef HASH_HAVE_X86
+// Folds four 128-bit lanes over 64 byte blocks, then reduces to 32 bits with Barrett reduction.
+// Constants for the bit-reflected polynomial are from
+// "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009).
+HASH_PCLMUL
+static uint32_t crc32_update_pclmul(uint32_t crc, const uint8_t *data, size_t length)
+{
+   if (length < 64)
+      return crc32_update_slice8(crc, data, length);
+
+   const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596ll, 0x0154442bd4ll);
+   const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009ell, 0x01751997d0ll);
+   const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124ll);
+   const __m128i poly = _mm_set_epi64x(0x01f7011641ll, 0x01db710641ll);
+   const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+   __m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)data), _mm_cvtsi32_si128(crc));
+   __m128i x1 = _mm_loadu_si128((const __m128i*)(data + 16));
+   __m128i x2 = _mm_loadu_si128((const __m128i*)(data + 32));
+   __m128i x3 = _mm_loadu_si128((const __m128i*)(data + 48));
+   data += 64;
+   length -= 64;
+
+   for (; length >= 64; length -= 64, data += 64)
+   {
+      x0 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x0, k1k2, 0x00), _mm_clmulepi64_si128(x0, k1k2, 0x11)),
+            _mm_loadu_si128((const __m128i*)data));
+      x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k1k2, 0x00), _mm_clmulepi64_si128(x1, k1k2, 0x11)),
+            _mm_loadu_si128((const __m128i*)(data + 16)));
+      x2 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x2, k1k2, 0x00), _mm_clmulepi64_si128(x2, k1k2, 0x11)),
+            _mm_loadu_si128((const __m128i*)(data + 32)));
+      x3 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x3, k1k2, 0x00), _mm_clmulepi64_si128(x3, k1k2, 0x11)),
+            _mm_loadu_si128((const __m128i*)(data + 48)));
+   }
+
+   // Fold the lanes into one, then any remaining 16 byte blocks.
+   x0 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x0, k3k4, 0x00), _mm_clmulepi64_si128(x0, k3k4, 0x11)), x1);
+   x0 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x0, k3k4, 0x00), _mm_clmulepi64_si128(x0, k3k4, 0x11)), x2);
+   x0 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x0, k3k4, 0x00), _mm_clmulepi64_si128(x0, k3k4, 0x11)), x3);
+
+   for (; length >= 16; length -= 16, data += 16)
+   {
+      x0 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x0, k3k4, 0x00), _mm_clmulepi64_si128(x0, k3k4, 0x11)),
+            _mm_loadu_si128((const __m128i*)data));
+   }
+
+   // 128 bits to 64 bits.
+   x0 = _mm_xor_si128(_mm_srli_si128(x0, 8), _mm_clmulepi64_si128(x0, k3k4, 0x10));
+   x0 = _mm_xor_si128(_mm_srli_si128(x0, 4), _mm_clmulepi64_si128(_mm_and_si128(x0, mask32), k5, 0x00));
+
+   // Barrett reduction to 32 bits.
+   __m128i t = _mm_clmulepi64_si128(_mm_and_si128(x0, mask32), poly, 0x10);
+   t = _mm_clmulepi64_si128(_mm_and_si128(t, mask32), poly, 0x00);
+   crc = _mm_extract_epi32(_mm_xor_si128(x0, t), 1);
+
+   return crc32_update_slice8(crc, data, length);
+}
+#endif
+
+void hash_init(void)
+{
+   static bool initialized;
+   if (initialized)
+      return;
+   initialized = true;
+
+   struct rarch_cpu_features cpu;
+   rarch_get_cpu_features(&cpu);
+
+   crc32_init_slices();
+
+   sha256_blocks = sha256_blocks_c;
+   crc32_update_impl = crc32_update_slice8;
+
+#ifdef HASH_HAVE_X86
+   const unsigned sse4 = RARCH_SIMD_SSSE3 | RARCH_SIMD_SSE4;
+
+   if ((cpu.simd & (sse4 | RARCH_SIMD_SHA)) == (sse4 | RARCH_SIMD_SHA))
+   {
+      RARCH_LOG("Using SHA extensions for SHA256.\n");
+      sha256_blocks = sha256_blocks_sha;
+   }
+
+   if ((cpu.simd & (sse4 | RARCH_SIMD_PCLMUL)) == (sse4 | RARCH_SIMD_PCLMUL))
+   {
+      RARCH_LOG("Using PCLMUL for CRC32.\n");
+      crc32_update_impl = crc32_update_pclmul;
+   }
 #endif
+}
 
+void sha256_hash(char *out, const uint8_t *in, size_t size)
+{
+   struct sha256_ctx sha;
+
+   union
+   {
+      uint32_t u32[8];
+      uint8_t u8[32];
+   } shahash;
+
+   sha256_init(&sha);
+   sha256_chunk(&sha, in, size);
+   sha256_final(&sha);
+   sha256_subhash(&sha, shahash.u32);
+
+   for (unsigned i = 0; i < 32; i++)
+      snprintf(out + 2 * i, 3, "%02x", (unsigned)shahash.u8[i]);
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t length)
+{
+   return crc32_update_impl(crc, data, length);
+}
+
+uint32_t crc32_calculate(const uint8_t *data, size_t length)
+{
+   return ~crc32_update(~0u, data, length);
+}
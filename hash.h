@@ -19,24 +19,25 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+// Picks the fastest CRC32 and SHA256 implementations for this CPU.
+// Must be called before any thread starts hashing. Until then, portable implementations are used.
+void hash_init(void);
+
 // Hashes sha256 and outputs a human readable string for comparing with the cheat XML values.
 void sha256_hash(char *out, const uint8_t *in, size_t size);
 
-#ifdef HAVE_ZLIB
-#include "deps/rzlib/zlib.h"
-static inline uint32_t crc32_calculate(const uint8_t *data, size_t length)
-{
-   return crc32(0, data, length);
-}
-
-static inline uint32_t crc32_adjust(uint32_t crc, uint8_t data)
-{
-   return crc32(crc, &data, 1);
-}
-#else
+// CRC32 as used by zlib, over a whole buffer.
 uint32_t crc32_calculate(const uint8_t *data, size_t length);
+
+// Steps a CRC32 register by one byte. The register is neither pre- nor post-inverted.
 uint32_t crc32_adjust(uint32_t crc, uint8_t data);
-#endif
+
+// Same as crc32_adjust(), over a buffer.
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t length);
 
 #endif
 
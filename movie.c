@@ -20,6 +20,7 @@
 #include <string.h>
 #include "general.h"
 #include "dynamic.h"
+#include "file.h"
 
 struct bsv_movie
 {
@@ -161,6 +162,9 @@ bsv_movie_t *bsv_movie_init(const char *path, enum rarch_movie_type type)
    if (!handle)
       return NULL;
 
+   // Movies are tied to the ROM by its CRC32.
+   rom_hash_wait();
+
    if (type == RARCH_MOVIE_PLAYBACK)
    {
       if (!init_playback(handle, path))
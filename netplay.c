@@ -23,6 +23,11 @@
 #include "autosave.h"
 #include "dynamic.h"
 #include "message.h"
+#include "performance.h"
+#include "hash.h"
+#include "file.h"
+#include "netplay_broadcast.h"
+#include "zlib_util.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -30,83 +35,161 @@
 static bool netplay_is_alive(netplay_t *handle);
 
 static bool netplay_poll(netplay_t *handle);
-static int16_t netplay_input_state(netplay_t *handle, bool port, unsigned device, unsigned index, unsigned id);
+static int16_t netplay_input_state(netplay_t *handle, unsigned port, unsigned device, unsigned index, unsigned id);
 
 // If we're fast-forward replaying to resync, check if we should actually show frame.
 static bool netplay_should_skip(netplay_t *handle);
 static bool netplay_can_poll(netplay_t *handle);
 static void netplay_set_spectate_input(netplay_t *handle, int16_t input);
 
-static bool netplay_send_cmd(netplay_t *handle, uint32_t cmd, const void *data, size_t size);
-static bool netplay_get_cmd(netplay_t *handle);
+struct netplay_peer;
+static bool netplay_send_cmd(netplay_t *handle, struct netplay_peer *peer, uint32_t cmd, const void *data, size_t size);
+static bool netplay_get_cmd(netplay_t *handle, struct netplay_peer *peer);
 
-#define PREV_PTR(x) ((x) == 0 ? handle->buffer_size - 1 : (x) - 1)
-#define NEXT_PTR(x) ((x + 1) % handle->buffer_size)
+#define FRAME_PTR(frame) ((frame) % handle->buffer_size)
+
+#define NETPLAY_MAX_PLAYERS 4
+
+// Input of one port for one frame.
+struct netplay_input
+{
+   uint16_t joypad;
+   int16_t analog[4]; // Left X, left Y, right X, right Y.
+};
 
 struct delta_frame
 {
    void *state;
 
-   uint16_t real_input_state;
-   uint16_t simulated_input_state;
-   bool is_simulated;
-   uint16_t self_state;
-   bool used_real;
+   struct netplay_input input[NETPLAY_MAX_PLAYERS]; // What the frame was last run with, real or predicted.
+   bool used_real; // Every port had real input. Such frames are never rolled back to.
 };
 
 #define UDP_FRAME_PACKETS 16
-#define MAX_SPECTATORS 16
+#define SPECTATE_BACKLOG 64
+// How far behind, in bytes of input, a spectator may fall before it is dropped.
+// Input is a few dozen bytes per frame, so this is well over ten seconds.
+#define SPECTATE_QUEUE_SIZE (64 * 1024)
+
+// Input history kept for every port, for prediction, replay and resending. Power of two.
+#define INPUT_HISTORY 64
+#define HISTORY_PTR(frame) ((frame) & (INPUT_HISTORY - 1))
+
+// UDP packets are made of 32-bit words:
+// - Header: sender port << 16 | number of input runs.
+// - Timestamps for round-trip time estimation.
+// - For every port, the next frame we want input for. The other side resends from there,
+//   so packets only carry the history which might not have arrived yet.
+// - Input runs: port << 24 | flags << 16 | frames, first frame, then one word of joypad state per frame,
+//   or three words with analog axes if any of the frames use them.
+#define UDP_PACKET_HEADER    0
+#define UDP_PACKET_TIME_SENT 1
+#define UDP_PACKET_TIME_ECHO 2
+#define UDP_PACKET_TIME_HOLD 3
+#define UDP_PACKET_ACK       4
+#define UDP_PACKET_RUNS      (UDP_PACKET_ACK + NETPLAY_MAX_PLAYERS)
+#define UDP_RUN_ANALOG       (1 << 0)
+#define UDP_MAX_RUN_FRAMES   UDP_FRAME_PACKETS
+#define UDP_PACKET_WORDS     (UDP_PACKET_RUNS + NETPLAY_MAX_PLAYERS * (2 + 3 * UDP_MAX_RUN_FRAMES))
+#define UDP_TIME_INVALID 0xffffffffu
+
+// Spectator join states are sent xored against the baseline and/or deflated.
+#define STATE_ENCODING_DELTA   (1 << 0)
+#define STATE_ENCODING_DEFLATE (1 << 1)
+
+#define MAX_INPUT_DELAY 8
+#define INPUT_DELAY_UPDATE_FRAMES 60
 
 #define NETPLAY_CMD_ACK 0
 #define NETPLAY_CMD_NAK 1
 #define NETPLAY_CMD_FLIP_PLAYERS 2
 
+// Someone we exchange input with directly. The host has one for every client,
+// clients only have the host. Input between clients is relayed by the host.
+struct netplay_peer
+{
+   char nick[32];
+   int fd; // TCP connection for commands.
+   unsigned port; // Player port the peer controls.
+
+   struct sockaddr_storage addr; // Where to send UDP packets. Learned from their packets on the host.
+   socklen_t addr_len;
+   bool has_addr;
+
+   uint32_t ack[NETPLAY_MAX_PLAYERS]; // Next frame of every port the peer still needs from us.
+
+   // Round-trip time estimation, in microseconds.
+   uint32_t remote_time; // Send time of the last packet received, in the other side's clock.
+   rarch_usec_t remote_time_recv; // When we received it.
+   bool has_remote_time;
+   unsigned rtt;
+   unsigned rtt_var;
+   bool has_rtt;
+};
+
 struct netplay
 {
    char nick[32];
    char other_nick[32];
-   struct sockaddr_storage other_addr;
 
    struct retro_callbacks cbs;
-   int fd; // TCP connection for state sending, etc. Also used for commands.
+   int fd; // TCP connection for state sending, etc. Listening socket while the host waits for players.
    int udp_fd; // UDP connection for game state updates.
-   unsigned port; // Which port is governed by netplay (other player)?
+   unsigned port; // Which port do we control?
+   unsigned num_players;
    bool has_connection;
 
+   struct netplay_peer peers[NETPLAY_MAX_PLAYERS - 1];
+   unsigned num_peers;
+
    struct delta_frame *buffer;
    size_t buffer_size;
-
-   size_t self_ptr; // Ptr where we are now.
-   size_t other_ptr; // Points to the last reliable state that self ever had.
-   size_t read_ptr; // Ptr to where we are reading. Generally, other_ptr <= read_ptr <= self_ptr.
-   size_t tmp_ptr; // A temporary pointer used on replay.
-
    size_t state_size;
 
    bool is_replay; // Are we replaying old frames?
    bool can_poll; // We don't want to poll several times on a frame.
 
-   uint32_t packet_buffer[UDP_FRAME_PACKETS * 2]; // To compat UDP packet loss we also send old data along with the packets.
+   // Real input of every port, indexed by HISTORY_PTR(frame). We have all input up to,
+   // but not including read_frame[port]. For our own port, this is how far we have queued up input.
+   struct netplay_input history[NETPLAY_MAX_PLAYERS][INPUT_HISTORY];
+   uint32_t read_frame[NETPLAY_MAX_PLAYERS];
+
    uint32_t frame_count;
-   uint32_t read_frame_count;
-   uint32_t other_frame_count;
-   uint32_t tmp_frame_count;
+   uint32_t other_frame_count; // Every frame before this one was run with real input.
+   uint32_t tmp_frame_count; // Frame being replayed.
    struct addrinfo *addr;
-   struct sockaddr_storage their_addr;
-   bool has_client_addr;
 
    unsigned timeout_cnt;
 
+   // Our input is sent, and applied, input_delay frames after it was read,
+   // so it has a chance to reach the others before it is needed there.
+   unsigned input_delay;
+   unsigned max_input_delay;
+
+   // Rollback statistics.
+   struct
+   {
+      uint64_t frames;
+      uint64_t rollbacks;
+      uint64_t frames_replayed;
+      unsigned max_depth;
+      uint64_t states_saved;
+   } stats;
+
    // Spectating.
    bool spectate;
    bool spectate_client;
-   int spectate_fds[MAX_SPECTATORS];
+   netplay_broadcast_t *spectate_broadcast;
    uint16_t *spectate_input;
    size_t spectate_input_ptr;
    size_t spectate_input_size;
 
+   // The state both sides had when netplay started. Checked with its CRC32.
+   void *baseline;
+   uint32_t baseline_crc;
+
    // Player flipping
-   // Flipping state. If ptr >= flip_frame, we apply the flip.
+   // Flipping state. If frame >= flip_frame, we apply the flip.
    // If not, we apply the opposite, effectively creating a trigger point.
    // To avoid collition we need to make sure our client/host is synced up well after flip_frame
    // before allowing another flip.
@@ -237,8 +320,8 @@ static void log_connection(const struct sockaddr_storage *their_addr,
 }
 #endif
 
-static int init_tcp_connection(const struct addrinfo *res, bool server, bool spectate,
-      struct sockaddr *other_addr, socklen_t addr_size)
+// Connects to the host, or sets up the socket we accept players or spectators on.
+static int init_tcp_connection(const struct addrinfo *res, bool server, bool spectate)
 {
    bool ret = true;
    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
@@ -256,39 +339,17 @@ static int init_tcp_connection(const struct addrinfo *res, bool server, bool spe
          goto end;
       }
    }
-   else if (spectate)
-   {
-      int yes = 1;
-      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, CONST_CAST &yes, sizeof(int));
-
-      if (bind(fd, res->ai_addr, res->ai_addrlen) < 0 ||
-            listen(fd, MAX_SPECTATORS) < 0)
-      {
-         ret = false;
-         goto end;
-      }
-   }
    else
    {
       int yes = 1;
       setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, CONST_CAST &yes, sizeof(int));
 
       if (bind(fd, res->ai_addr, res->ai_addrlen) < 0 ||
-            listen(fd, 1) < 0)
+            listen(fd, spectate ? SPECTATE_BACKLOG : NETPLAY_MAX_PLAYERS) < 0)
       {
          ret = false;
          goto end;
       }
-
-      int new_fd = accept(fd, other_addr, &addr_size);
-      if (new_fd < 0)
-      {
-         ret = false;
-         goto end;
-      }
-
-      close(fd);
-      fd = new_fd;
    }
 
 end:
@@ -330,8 +391,7 @@ static bool init_tcp_socket(netplay_t *handle, const char *server, uint16_t port
    while (tmp_info)
    {
       int fd;
-      if ((fd = init_tcp_connection(tmp_info, server, handle->spectate,
-               (struct sockaddr*)&handle->other_addr, sizeof(handle->other_addr))) >= 0)
+      if ((fd = init_tcp_connection(tmp_info, server, handle->spectate)) >= 0)
       {
          ret = true;
          handle->fd = fd;
@@ -551,14 +611,43 @@ static bool send_info(netplay_t *handle)
    RARCH_LOG("%s\n", msg);
    msg_queue_push(g_extern.msg_queue, msg, 1, 180);
 
+   // The host tells us which player we are once everyone has joined.
+   RARCH_LOG("Waiting for other players ...\n");
+   uint32_t players[2];
+   if (!recv_all(handle->fd, players, sizeof(players)))
+   {
+      RARCH_ERR("Failed to receive player info from host.\n");
+      return false;
+   }
+
+   handle->num_players = ntohl(players[0]);
+   handle->port = ntohl(players[1]);
+   if (handle->num_players < 2 || handle->num_players > NETPLAY_MAX_PLAYERS ||
+         handle->port == 0 || handle->port >= handle->num_players)
+   {
+      RARCH_ERR("Host sent invalid player info.\n");
+      return false;
+   }
+
+   struct netplay_peer *host = &handle->peers[0];
+   handle->num_peers = 1;
+   host->fd = handle->fd;
+   host->port = 0;
+   strlcpy(host->nick, handle->other_nick, sizeof(host->nick));
+   memcpy(&host->addr, handle->addr->ai_addr, handle->addr->ai_addrlen);
+   host->addr_len = handle->addr->ai_addrlen;
+   host->has_addr = true;
+   handle->fd = -1;
+
+   RARCH_LOG("Playing as player %u of %u.\n", handle->port + 1, handle->num_players);
    return true;
 }
 
-static bool get_info(netplay_t *handle)
+static bool get_info(netplay_t *handle, struct netplay_peer *peer)
 {
    uint32_t header[3];
 
-   if (!recv_all(handle->fd, header, sizeof(header)))
+   if (!recv_all(peer->fd, header, sizeof(header)))
    {
       RARCH_ERR("Failed to receive header from client.\n");
       return false;
@@ -582,30 +671,83 @@ static bool get_info(netplay_t *handle)
       return false;
    }
 
-   if (!get_nickname(handle, handle->fd))
+   if (!get_nickname(handle, peer->fd))
    {
       RARCH_ERR("Failed to get nickname from client.\n");
       return false;
    }
+   strlcpy(peer->nick, handle->other_nick, sizeof(peer->nick));
 
-   // Send SRAM data to our Player 2.
+   // Send SRAM data to our new player.
    const void *sram = pretro_get_memory_data(RETRO_MEMORY_SAVE_RAM);
    unsigned sram_size = pretro_get_memory_size(RETRO_MEMORY_SAVE_RAM);
-   if (!send_all(handle->fd, sram, sram_size))
+   if (!send_all(peer->fd, sram, sram_size))
    {
       RARCH_ERR("Failed to send SRAM data to client.\n");
       return false;
    }
 
-   if (!send_nickname(handle, handle->fd))
+   if (!send_nickname(handle, peer->fd))
    {
       RARCH_ERR("Failed to send nickname to client.\n");
       return false;
    }
 
+   return true;
+}
+
+// Waits for every player to join, then tells them which port they control.
+static bool accept_players(netplay_t *handle)
+{
+   handle->port = 0;
+
+   while (handle->num_peers + 1 < handle->num_players)
+   {
+      RARCH_LOG("Waiting for player %u of %u ...\n", handle->num_peers + 2, handle->num_players);
+
+      struct sockaddr_storage their_addr;
+      socklen_t addr_size = sizeof(their_addr);
+      int fd = accept(handle->fd, (struct sockaddr*)&their_addr, &addr_size);
+      if (fd < 0)
+      {
+         RARCH_ERR("Failed to accept incoming player.\n");
+         return false;
+      }
+
+      struct netplay_peer *peer = &handle->peers[handle->num_peers];
+      memset(peer, 0, sizeof(*peer));
+      peer->fd = fd;
+      peer->port = handle->num_peers + 1;
+
+      if (!get_info(handle, peer))
+      {
+         close(fd);
+         return false;
+      }
+
+      handle->num_peers++;
+
 #ifndef HAVE_SOCKET_LEGACY
-   log_connection(&handle->other_addr, 0, handle->other_nick);
+      log_connection(&their_addr, peer->port, peer->nick);
 #endif
+   }
+
+   close(handle->fd);
+   handle->fd = -1;
+
+   for (unsigned i = 0; i < handle->num_peers; i++)
+   {
+      uint32_t players[2] = {
+         htonl(handle->num_players),
+         htonl(handle->peers[i].port),
+      };
+
+      if (!send_all(handle->peers[i].fd, players, sizeof(players)))
+      {
+         RARCH_ERR("Failed to send player info to \"%s\".\n", handle->peers[i].nick);
+         return false;
+      }
+   }
 
    return true;
 }
@@ -671,9 +813,187 @@ static bool bsv_parse_header(const uint32_t *header, uint32_t magic)
    return true;
 }
 
+// Same trick as the rewind buffer. Xoring against a state the other side already has
+// zeroes out everything that has not changed since, which deflate squeezes down to almost nothing.
+static void state_xor(void *state_, const void *baseline_, size_t size)
+{
+   uint32_t *state = (uint32_t*)state_;
+   const uint32_t *baseline = (const uint32_t*)baseline_;
+
+   size_t words = size / sizeof(uint32_t);
+   for (size_t i = 0; i < words; i++)
+      state[i] ^= baseline[i];
+
+   for (size_t i = words * sizeof(uint32_t); i < size; i++)
+      ((uint8_t*)state_)[i] ^= ((const uint8_t*)baseline_)[i];
+}
+
+static bool init_baseline(netplay_t *handle)
+{
+   handle->state_size = pretro_serialize_size();
+   if (!handle->state_size)
+      return true;
+
+   handle->baseline = malloc(handle->state_size);
+   if (!handle->baseline)
+      return false;
+
+   // Not fatal, join states are just sent as is.
+   if (!pretro_serialize(handle->baseline, handle->state_size))
+   {
+      RARCH_WARN("Failed to serialize netplay baseline state.\n");
+      free(handle->baseline);
+      handle->baseline = NULL;
+      return true;
+   }
+
+   handle->baseline_crc = crc32_calculate((const uint8_t*)handle->baseline, handle->state_size);
+   return true;
+}
+
+static bool send_baseline_info(netplay_t *handle)
+{
+   uint32_t encodings = 0;
+   if (handle->baseline)
+      encodings |= STATE_ENCODING_DELTA;
+#ifdef HAVE_ZLIB
+   encodings |= STATE_ENCODING_DEFLATE;
+#endif
+
+   uint32_t info[2] = {
+      htonl(handle->baseline_crc),
+      htonl(encodings),
+   };
+
+   return send_all(handle->fd, info, sizeof(info));
+}
+
+static bool get_state_spectate(netplay_t *handle, void *state, size_t size)
+{
+   uint32_t info[2];
+   if (!recv_all(handle->fd, info, sizeof(info)))
+      return false;
+
+   uint32_t encoding = ntohl(info[0]);
+   size_t payload_size = ntohl(info[1]);
+
+   uint32_t supported = STATE_ENCODING_DELTA;
+#ifdef HAVE_ZLIB
+   supported |= STATE_ENCODING_DEFLATE;
+#endif
+
+   if ((encoding & ~supported) || ((encoding & STATE_ENCODING_DELTA) && !handle->baseline) ||
+         (encoding & STATE_ENCODING_DEFLATE ? payload_size > size : payload_size != size))
+   {
+      RARCH_ERR("Host sent state with unsupported encoding 0x%x.\n", (unsigned)encoding);
+      return false;
+   }
+
+   void *payload = state;
+   if (encoding & STATE_ENCODING_DEFLATE)
+   {
+      payload = malloc(payload_size);
+      if (!payload)
+         return false;
+   }
+
+   bool ret = recv_all(handle->fd, payload, payload_size);
+
+#ifdef HAVE_ZLIB
+   if (encoding & STATE_ENCODING_DEFLATE)
+   {
+      if (ret && !zlib_inflate_buffer(state, size, payload, payload_size))
+      {
+         RARCH_ERR("Failed to inflate state from host.\n");
+         ret = false;
+      }
+      free(payload);
+   }
+#endif
+
+   if (ret && (encoding & STATE_ENCODING_DELTA))
+      state_xor(state, handle->baseline, size);
+
+   if (ret)
+   {
+      RARCH_LOG("Received %u byte state from host as %u bytes.\n",
+            (unsigned)size, (unsigned)payload_size);
+   }
+
+   return ret;
+}
+
+// Encodes our current state for a spectator that has a baseline with remote_crc,
+// in the smallest encoding it supports. Returns BSV header, encoding info and payload in one buffer.
+static uint8_t *encode_state_spectate(netplay_t *handle, uint32_t remote_crc, uint32_t remote_encodings,
+      size_t *size)
+{
+   size_t header_size;
+   uint32_t *header = bsv_header_generate(&header_size, implementation_magic_value());
+   if (!header)
+   {
+      RARCH_ERR("Failed to generate BSV header.\n");
+      return NULL;
+   }
+
+   uint8_t *state = (uint8_t*)(header + 4);
+   size_t state_size = header_size - 4 * sizeof(uint32_t);
+
+   const uint8_t *payload = state;
+   size_t payload_size = state_size;
+   uint32_t encoding = 0;
+
+   if (handle->baseline && (remote_encodings & STATE_ENCODING_DELTA) && remote_crc == handle->baseline_crc)
+   {
+      state_xor(state, handle->baseline, state_size);
+      encoding |= STATE_ENCODING_DELTA;
+   }
+
+   uint8_t *compressed = NULL;
+#ifdef HAVE_ZLIB_DEFLATE
+   if (state_size && (remote_encodings & STATE_ENCODING_DEFLATE))
+   {
+      size_t compressed_size = zlib_deflate_bound(state_size);
+      compressed = (uint8_t*)malloc(compressed_size);
+
+      // Deflating stalls the host for a frame.
+      if (compressed && zlib_deflate_buffer(compressed, &compressed_size, state, state_size) &&
+            compressed_size < state_size)
+      {
+         payload = compressed;
+         payload_size = compressed_size;
+         encoding |= STATE_ENCODING_DEFLATE;
+      }
+   }
+#endif
+
+   uint32_t info[2] = {
+      htonl(encoding),
+      htonl(payload_size),
+   };
+
+   *size = 4 * sizeof(uint32_t) + sizeof(info) + payload_size;
+   uint8_t *buf = (uint8_t*)malloc(*size);
+   if (buf)
+   {
+      memcpy(buf, header, 4 * sizeof(uint32_t));
+      memcpy(buf + 4 * sizeof(uint32_t), info, sizeof(info));
+      memcpy(buf + 4 * sizeof(uint32_t) + sizeof(info), payload, payload_size);
+
+      RARCH_LOG("Sending %u byte state to spectator as %u bytes (%s%s).\n",
+            (unsigned)state_size, (unsigned)payload_size,
+            encoding & STATE_ENCODING_DELTA ? "delta" : "full",
+            encoding & STATE_ENCODING_DEFLATE ? ", deflated" : "");
+   }
+
+   free(compressed);
+   free(header);
+   return buf;
+}
+
 static bool get_info_spectate(netplay_t *handle)
 {
-   if (!send_nickname(handle, handle->fd))
+   if (!send_nickname(handle, handle->fd) || !send_baseline_info(handle))
    {
       RARCH_ERR("Failed to send nickname to host.\n");
       return false;
@@ -709,9 +1029,7 @@ static bool get_info_spectate(netplay_t *handle)
    if (!buf)
       return false;
 
-   size_t size = save_state_size;
-
-   if (!recv_all(handle->fd, buf, size))
+   if (!get_state_spectate(handle, buf, save_state_size))
    {
       RARCH_ERR("Failed to receive save state from host.\n");
       free(buf);
@@ -726,15 +1044,30 @@ static bool get_info_spectate(netplay_t *handle)
    return ret;
 }
 
-static void init_buffers(netplay_t *handle)
+static bool init_buffers(netplay_t *handle)
 {
    handle->buffer = (struct delta_frame*)calloc(handle->buffer_size, sizeof(*handle->buffer));
+   if (!handle->buffer)
+      return false;
+
    handle->state_size = pretro_serialize_size();
    for (unsigned i = 0; i < handle->buffer_size; i++)
    {
       handle->buffer[i].state = malloc(handle->state_size);
-      handle->buffer[i].is_simulated = true;
+      if (!handle->buffer[i].state)
+         return false;
    }
+
+   // First frame we always give zero input to every port, since relying on input from
+   // first frame screws up when we use -F 0.
+   for (unsigned i = 0; i < NETPLAY_MAX_PLAYERS; i++)
+   {
+      handle->read_frame[i] = 1;
+      for (unsigned j = 0; j < handle->num_peers; j++)
+         handle->peers[j].ack[i] = 1;
+   }
+
+   return true;
 }
 
 netplay_t *netplay_new(const char *server, uint16_t port,
@@ -749,10 +1082,12 @@ netplay_t *netplay_new(const char *server, uint16_t port,
    if (!handle)
       return NULL;
 
+   // Everyone must have the same ROM, which is checked with its CRC32.
+   rom_hash_wait();
+
    handle->fd = -1;
    handle->udp_fd = -1;
    handle->cbs = *cb;
-   handle->port = server ? 0 : 1;
    handle->spectate = spectate;
    handle->spectate_client = server != NULL;
    strlcpy(handle->nick, nick, sizeof(handle->nick));
@@ -765,14 +1100,20 @@ netplay_t *netplay_new(const char *server, uint16_t port,
 
    if (spectate)
    {
+      if (!init_baseline(handle))
+         goto error;
+
       if (server)
       {
          if (!get_info_spectate(handle))
             goto error;
       }
-
-      for (unsigned i = 0; i < MAX_SPECTATORS; i++)
-         handle->spectate_fds[i] = -1;
+      else
+      {
+         handle->spectate_broadcast = netplay_broadcast_new(SPECTATE_QUEUE_SIZE);
+         if (!handle->spectate_broadcast)
+            goto error;
+      }
    }
    else
    {
@@ -783,13 +1124,26 @@ netplay_t *netplay_new(const char *server, uint16_t port,
       }
       else
       {
-         if (!get_info(handle))
+         handle->num_players = g_settings.netplay_players;
+         if (handle->num_players < 2)
+            handle->num_players = 2;
+         else if (handle->num_players > NETPLAY_MAX_PLAYERS)
+         {
+            RARCH_WARN("Netplay supports at most %u players.\n", NETPLAY_MAX_PLAYERS);
+            handle->num_players = NETPLAY_MAX_PLAYERS;
+         }
+
+         if (!accept_players(handle))
             goto error;
       }
 
       handle->buffer_size = frames + 1;
+      handle->max_input_delay = g_settings.netplay_input_delay_max;
+      if (handle->max_input_delay > MAX_INPUT_DELAY)
+         handle->max_input_delay = MAX_INPUT_DELAY;
 
-      init_buffers(handle);
+      if (!init_buffers(handle))
+         goto error;
       handle->has_connection = true;
    }
 
@@ -800,7 +1154,19 @@ error:
       close(handle->fd);
    if (handle->udp_fd >= 0)
       close(handle->udp_fd);
+   for (unsigned i = 0; i < handle->num_peers; i++)
+      close(handle->peers[i].fd);
+   if (handle->addr)
+      freeaddrinfo(handle->addr);
 
+   if (handle->buffer)
+   {
+      for (unsigned i = 0; i < handle->buffer_size; i++)
+         free(handle->buffer[i].state);
+      free(handle->buffer);
+   }
+
+   free(handle->baseline);
    free(handle);
    return NULL;
 }
@@ -811,25 +1177,122 @@ static bool netplay_is_alive(netplay_t *handle)
    return handle->has_connection;
 }
 
-static bool send_chunk(netplay_t *handle)
+static inline bool netplay_is_host(netplay_t *handle)
 {
-   const struct sockaddr *addr = NULL;
-   if (handle->addr)
-      addr = handle->addr->ai_addr;
-   else if (handle->has_client_addr)
-      addr = (const struct sockaddr*)&handle->their_addr;
+   return handle->port == 0;
+}
+
+static bool input_has_analog(const struct netplay_input *input)
+{
+   return input->analog[0] || input->analog[1] || input->analog[2] || input->analog[3];
+}
+
+static bool input_equal(const struct netplay_input *a, const struct netplay_input *b)
+{
+   return a->joypad == b->joypad &&
+      a->analog[0] == b->analog[0] && a->analog[1] == b->analog[1] &&
+      a->analog[2] == b->analog[2] && a->analog[3] == b->analog[3];
+}
+
+// Writes the input of a port we have, but the peer has not acknowledged yet, oldest first.
+// Returns number of words written.
+static size_t write_input_run(netplay_t *handle, const struct netplay_peer *peer,
+      unsigned port, uint32_t *words)
+{
+   uint32_t first = peer->ack[port];
+   uint32_t end = handle->read_frame[port];
+   if (first >= end)
+      return 0;
+
+   // Anything older has been overwritten, and the peer cannot be waiting for it anyways.
+   if (end - first > INPUT_HISTORY)
+      first = end - INPUT_HISTORY;
+
+   unsigned frames = end - first;
+   if (frames > UDP_MAX_RUN_FRAMES)
+      frames = UDP_MAX_RUN_FRAMES;
+
+   bool analog = false;
+   for (unsigned i = 0; i < frames; i++)
+      analog |= input_has_analog(&handle->history[port][HISTORY_PTR(first + i)]);
+
+   size_t ptr = 0;
+   words[ptr++] = htonl((port << 24) | ((analog ? UDP_RUN_ANALOG : 0) << 16) | frames);
+   words[ptr++] = htonl(first);
+
+   for (unsigned i = 0; i < frames; i++)
+   {
+      const struct netplay_input *input = &handle->history[port][HISTORY_PTR(first + i)];
+      if (analog)
+      {
+         words[ptr++] = htonl(((uint32_t)input->joypad << 16) | (uint16_t)input->analog[0]);
+         words[ptr++] = htonl(((uint32_t)(uint16_t)input->analog[1] << 16) | (uint16_t)input->analog[2]);
+         words[ptr++] = htonl((uint32_t)(uint16_t)input->analog[3] << 16);
+      }
+      else
+         words[ptr++] = htonl((uint32_t)input->joypad << 16);
+   }
 
-   if (addr)
+   return ptr;
+}
+
+// Sends every peer the input it has not acknowledged yet.
+// Clients only send their own input, the host relays input between clients.
+static bool send_packets(netplay_t *handle)
+{
+   rarch_usec_t now = rarch_get_time_usec();
+
+   for (unsigned i = 0; i < handle->num_peers; i++)
    {
-      if (sendto(handle->udp_fd, CONST_CAST handle->packet_buffer,
-               sizeof(handle->packet_buffer), 0, addr,
-               sizeof(struct sockaddr)) != sizeof(handle->packet_buffer))
+      struct netplay_peer *peer = &handle->peers[i];
+      if (!peer->has_addr)
+         continue;
+
+      uint32_t packet[UDP_PACKET_WORDS];
+      size_t words = UDP_PACKET_RUNS;
+      unsigned runs = 0;
+
+      for (unsigned port = 0; port < handle->num_players; port++)
+      {
+         if (port == peer->port || (port != handle->port && !netplay_is_host(handle)))
+            continue;
+
+         size_t run_words = write_input_run(handle, peer, port, packet + words);
+         if (run_words)
+         {
+            words += run_words;
+            runs++;
+         }
+      }
+
+      packet[UDP_PACKET_HEADER] = htonl((handle->port << 16) | runs);
+
+      // Echo back the last timestamp we got, and for how long we sat on it.
+      packet[UDP_PACKET_TIME_SENT] = htonl((uint32_t)now);
+      if (peer->has_remote_time)
+      {
+         packet[UDP_PACKET_TIME_ECHO] = htonl(peer->remote_time);
+         packet[UDP_PACKET_TIME_HOLD] = htonl((uint32_t)(now - peer->remote_time_recv));
+      }
+      else
+      {
+         packet[UDP_PACKET_TIME_ECHO] = 0;
+         packet[UDP_PACKET_TIME_HOLD] = htonl(UDP_TIME_INVALID);
+      }
+
+      for (unsigned port = 0; port < NETPLAY_MAX_PLAYERS; port++)
+         packet[UDP_PACKET_ACK + port] = htonl(handle->read_frame[port]);
+
+      size_t size = words * sizeof(uint32_t);
+      if (sendto(handle->udp_fd, CONST_CAST packet, size, 0,
+               (const struct sockaddr*)&peer->addr, peer->addr_len) != (ssize_t)size)
       {
          warn_hangup();
          handle->has_connection = false;
          return false;
       }
    }
+
    return true;
 }
 
@@ -838,15 +1301,22 @@ static bool send_chunk(netplay_t *handle)
 
 static int poll_input(netplay_t *handle, bool block)
 {
-   int max_fd = (handle->fd > handle->udp_fd ? handle->fd : handle->udp_fd) + 1;
+   int max_fd = handle->udp_fd;
+   for (unsigned i = 0; i < handle->num_peers; i++)
+   {
+      if (handle->peers[i].fd > max_fd)
+         max_fd = handle->peers[i].fd;
+   }
+   max_fd++;
 
    struct timeval tv = {0};
    tv.tv_sec = 0;
    tv.tv_usec = block ? (RETRY_MS * 1000) : 0;
 
    do
-   { 
-      handle->timeout_cnt++;
+   {
+      if (block)
+         handle->timeout_cnt++;
 
       // select() does not take pointer to const struct timeval.
       // Technically possible for select() to modify tmp_tv, so we go paranoia mode.
@@ -855,25 +1325,25 @@ static int poll_input(netplay_t *handle, bool block)
       fd_set fds;
       FD_ZERO(&fds);
       FD_SET(handle->udp_fd, &fds);
-      FD_SET(handle->fd, &fds);
+      for (unsigned i = 0; i < handle->num_peers; i++)
+         FD_SET(handle->peers[i].fd, &fds);
 
       if (select(max_fd, &fds, NULL, NULL, &tmp_tv) < 0)
          return -1;
 
       // Somewhat hacky,
       // but we aren't using the TCP connection for anything useful atm.
-      if (FD_ISSET(handle->fd, &fds) && !netplay_get_cmd(handle))
-         return -1; 
+      for (unsigned i = 0; i < handle->num_peers; i++)
+      {
+         if (FD_ISSET(handle->peers[i].fd, &fds) && !netplay_get_cmd(handle, &handle->peers[i]))
+            return -1;
+      }
 
       if (FD_ISSET(handle->udp_fd, &fds))
          return 1;
 
-      if (block && !send_chunk(handle))
-      {
-         warn_hangup();
-         handle->has_connection = false;
+      if (block && !send_packets(handle))
          return -1;
-      }
 
       if (block)
       {
@@ -887,78 +1357,253 @@ static int poll_input(netplay_t *handle, bool block)
    return 0;
 }
 
+// Picks an input delay which hides the one-way latency to the farthest peer, with some room for jitter.
+static void update_input_delay(netplay_t *handle)
+{
+   if (!handle->max_input_delay || handle->frame_count % INPUT_DELAY_UPDATE_FRAMES)
+      return;
+
+   const struct netplay_peer *worst = NULL;
+   unsigned latency = 0;
+   for (unsigned i = 0; i < handle->num_peers; i++)
+   {
+      const struct netplay_peer *peer = &handle->peers[i];
+      if (!peer->has_rtt)
+         continue;
+
+      unsigned peer_latency = peer->rtt / 2 + 2 * peer->rtt_var;
+      if (!worst || peer_latency > latency)
+      {
+         worst = peer;
+         latency = peer_latency;
+      }
+   }
+
+   if (!worst)
+      return;
+
+   unsigned frame_usec = 1000000.0 / g_extern.system.av_info.timing.fps;
+   unsigned delay = frame_usec ? (latency + frame_usec - 1) / frame_usec : 0;
+   if (delay > handle->max_input_delay)
+      delay = handle->max_input_delay;
+
+   // Go up right away to avoid rollbacks, but come down slowly so we don't oscillate.
+   unsigned old_delay = handle->input_delay;
+   if (delay > handle->input_delay)
+      handle->input_delay = delay;
+   else if (delay < handle->input_delay)
+      handle->input_delay--;
+
+   if (handle->input_delay != old_delay)
+   {
+      RARCH_LOG("Netplay input delay: %u frames (RTT to player %u: %.1f ms, jitter: %.1f ms).\n",
+            handle->input_delay, worst->port + 1, worst->rtt / 1000.0, worst->rtt_var / 1000.0);
+   }
+}
+
 // Grab our own input state and send this over the network.
 static bool get_self_input_state(netplay_t *handle)
 {
-   struct delta_frame *ptr = &handle->buffer[handle->self_ptr];
+   update_input_delay(handle);
+
+   struct netplay_input state;
+   memset(&state, 0, sizeof(state));
 
-   uint32_t state = 0;
    if (handle->frame_count > 0) // First frame we always give zero input since relying on input from first frame screws up when we use -F 0.
    {
       retro_input_state_t cb = handle->cbs.state_cb;
-      for (unsigned i = 0; i < RARCH_FIRST_META_KEY; i++)
+      unsigned port = g_settings.input.netplay_client_swap_input ? 0 : handle->port;
+
+      for (unsigned i = 0; i < RARCH_FIRST_CUSTOM_BIND; i++)
       {
-         int16_t tmp = cb(g_settings.input.netplay_client_swap_input ? 0 : !handle->port,
-               RETRO_DEVICE_JOYPAD, 0, i);
-         state |= tmp ? 1 << i : 0;
+         int16_t tmp = cb(port, RETRO_DEVICE_JOYPAD, 0, i);
+         state.joypad |= tmp ? 1 << i : 0;
       }
-   }
 
-   memmove(handle->packet_buffer, handle->packet_buffer + 2,
-         sizeof (handle->packet_buffer) - 2 * sizeof(uint32_t));
-   handle->packet_buffer[(UDP_FRAME_PACKETS - 1) * 2] = htonl(handle->frame_count); 
-   handle->packet_buffer[(UDP_FRAME_PACKETS - 1) * 2 + 1] = htonl(state);
+      for (unsigned i = 0; i < 4; i++)
+         state.analog[i] = cb(port, RETRO_DEVICE_ANALOG, i >> 1, i & 1);
+   }
 
-   if (!send_chunk(handle))
+   // Queue up our input for input_delay frames from now. If the delay went up, the frames in between
+   // get the same input. If it went down, input for this frame has already been queued up and sent.
+   // Either way, the others see input for every frame exactly once.
+   uint32_t *self_frame = &handle->read_frame[handle->port];
+   while (*self_frame <= handle->frame_count + handle->input_delay)
    {
-      warn_hangup();
-      handle->has_connection = false;
-      return false;
+      handle->history[handle->port][HISTORY_PTR(*self_frame)] = state;
+      (*self_frame)++;
    }
 
-   ptr->self_state = state;
-   handle->self_ptr = NEXT_PTR(handle->self_ptr);
-   return true;
+   return send_packets(handle);
 }
 
+// Oldest frame which does not have real input for every port yet.
+static uint32_t confirmed_frame(netplay_t *handle)
+{
+   uint32_t frame = handle->read_frame[handle->port];
+   for (unsigned port = 0; port < handle->num_players; port++)
+   {
+      if (handle->read_frame[port] < frame)
+         frame = handle->read_frame[port];
+   }
+   return frame;
+}
+
+// Sets up the input a frame is run with. Ports we do not have input for yet repeat their newest input.
 // TODO: Somewhat better prediction. :P
-static void simulate_input(netplay_t *handle)
+static void setup_frame_input(netplay_t *handle, uint32_t frame)
 {
-   size_t ptr = PREV_PTR(handle->self_ptr);
-   size_t prev = PREV_PTR(handle->read_ptr);
+   struct delta_frame *ptr = &handle->buffer[FRAME_PTR(frame)];
+   ptr->used_real = true;
 
-   handle->buffer[ptr].simulated_input_state = handle->buffer[prev].real_input_state;
-   handle->buffer[ptr].is_simulated = true;
-   handle->buffer[ptr].used_real = false;
+   for (unsigned port = 0; port < handle->num_players; port++)
+   {
+      uint32_t read_frame = handle->read_frame[port];
+      if (frame < read_frame)
+         ptr->input[port] = handle->history[port][HISTORY_PTR(frame)];
+      else
+      {
+         ptr->input[port] = handle->history[port][HISTORY_PTR(read_frame - 1)];
+         ptr->used_real = false;
+      }
+   }
 }
 
-static void parse_packet(netplay_t *handle, uint32_t *buffer, unsigned size)
+// Returns true if any new input was accepted.
+static bool parse_packet(netplay_t *handle, struct netplay_peer *peer, const uint32_t *buffer, size_t words)
 {
-   for (unsigned i = 0; i < size * 2; i++)
-      buffer[i] = ntohl(buffer[i]);
+   for (unsigned port = 0; port < NETPLAY_MAX_PLAYERS; port++)
+   {
+      uint32_t ack = ntohl(buffer[UDP_PACKET_ACK + port]);
+      if (ack > peer->ack[port])
+         peer->ack[port] = ack;
+   }
 
-   for (unsigned i = 0; i < size && handle->read_frame_count <= handle->frame_count; i++)
+   // Input far ahead of what we have confirmed would overwrite history we might still replay.
+   uint32_t max_frame = handle->other_frame_count + INPUT_HISTORY / 2;
+   unsigned runs = ntohl(buffer[UDP_PACKET_HEADER]) & 0xffff;
+   size_t ptr = UDP_PACKET_RUNS;
+   bool got_input = false;
+
+   for (unsigned run = 0; run < runs; run++)
    {
-      uint32_t frame = buffer[2 * i + 0];
-      uint32_t state = buffer[2 * i + 1];
+      if (ptr + 2 > words)
+         break;
+
+      uint32_t header = ntohl(buffer[ptr++]);
+      uint32_t frame = ntohl(buffer[ptr++]);
+      unsigned port = header >> 24;
+      bool analog = (header >> 16) & UDP_RUN_ANALOG;
+      unsigned frames = header & 0xffff;
+      unsigned frame_words = analog ? 3 : 1;
+
+      if (port >= handle->num_players || frames > UDP_MAX_RUN_FRAMES || ptr + frames * frame_words > words)
+         break;
 
-      if (frame == handle->read_frame_count)
+      // We never take our own input from the network, and clients can only speak for themselves.
+      bool accept = port != handle->port && (!netplay_is_host(handle) || port == peer->port);
+
+      for (unsigned i = 0; i < frames; i++, frame++, ptr += frame_words)
       {
-         handle->buffer[handle->read_ptr].is_simulated = false;
-         handle->buffer[handle->read_ptr].real_input_state = state;
-         handle->read_ptr = NEXT_PTR(handle->read_ptr);
-         handle->read_frame_count++;
+         if (!accept || frame != handle->read_frame[port] || frame >= max_frame)
+            continue;
+
+         struct netplay_input *input = &handle->history[port][HISTORY_PTR(frame)];
+         uint32_t word = ntohl(buffer[ptr]);
+         input->joypad = word >> 16;
+         if (analog)
+         {
+            input->analog[0] = (int16_t)(word & 0xffff);
+            word = ntohl(buffer[ptr + 1]);
+            input->analog[1] = (int16_t)(word >> 16);
+            input->analog[2] = (int16_t)(word & 0xffff);
+            word = ntohl(buffer[ptr + 2]);
+            input->analog[3] = (int16_t)(word >> 16);
+         }
+         else
+            memset(input->analog, 0, sizeof(input->analog));
+
+         handle->read_frame[port]++;
          handle->timeout_cnt = 0;
+         got_input = true;
       }
    }
+
+   return got_input;
+}
+
+static void parse_packet_time(struct netplay_peer *peer, const uint32_t *buffer)
+{
+   rarch_usec_t now = rarch_get_time_usec();
+   uint32_t echo = ntohl(buffer[UDP_PACKET_TIME_ECHO]);
+   uint32_t hold = ntohl(buffer[UDP_PACKET_TIME_HOLD]);
+
+   peer->remote_time      = ntohl(buffer[UDP_PACKET_TIME_SENT]);
+   peer->remote_time_recv = now;
+   peer->has_remote_time  = true;
+
+   if (hold == UDP_TIME_INVALID)
+      return;
+
+   // Timestamps wrap around, but the difference is still correct.
+   uint32_t rtt = (uint32_t)now - echo - hold;
+   if (rtt > 10000000) // Reordered packets and the like.
+      return;
+
+   if (!peer->has_rtt)
+   {
+      peer->rtt     = rtt;
+      peer->rtt_var = rtt / 2;
+      peer->has_rtt = true;
+   }
+   else
+   {
+      // Same smoothing as TCP uses for its retransmission timer.
+      unsigned err = rtt > peer->rtt ? rtt - peer->rtt : peer->rtt - rtt;
+      peer->rtt_var = (3 * peer->rtt_var + err) / 4;
+      peer->rtt     = (7 * peer->rtt + rtt) / 8;
+   }
 }
 
-static bool receive_data(netplay_t *handle, uint32_t *buffer, size_t size)
+// Reads one packet. Returns false if the socket failed.
+static bool receive_packet(netplay_t *handle, bool *got_input)
 {
-   socklen_t addrlen = sizeof(handle->their_addr);
-   if (recvfrom(handle->udp_fd, NONCONST_CAST buffer, size, 0, (struct sockaddr*)&handle->their_addr, &addrlen) != (ssize_t)size)
+   uint32_t buffer[UDP_PACKET_WORDS];
+   struct sockaddr_storage addr;
+   socklen_t addr_len = sizeof(addr);
+
+   ssize_t ret = recvfrom(handle->udp_fd, NONCONST_CAST buffer, sizeof(buffer), 0,
+         (struct sockaddr*)&addr, &addr_len);
+   if (ret < 0)
       return false;
-   handle->has_client_addr = true;
+
+   // Ignore anything malformed, or from someone who is not playing.
+   size_t words = ret / sizeof(uint32_t);
+   if (words < UDP_PACKET_RUNS)
+      return true;
+
+   unsigned sender = ntohl(buffer[UDP_PACKET_HEADER]) >> 16;
+   struct netplay_peer *peer = NULL;
+   for (unsigned i = 0; i < handle->num_peers; i++)
+   {
+      if (handle->peers[i].port == sender)
+         peer = &handle->peers[i];
+   }
+
+   if (!peer)
+      return true;
+
+   // The host only learns where to send packets from the client's own packets.
+   if (netplay_is_host(handle))
+   {
+      memcpy(&peer->addr, &addr, addr_len);
+      peer->addr_len = addr_len;
+      peer->has_addr = true;
+   }
+
+   parse_packet_time(peer, buffer);
+   if (parse_packet(handle, peer, buffer, words))
+      *got_input = true;
    return true;
 }
 
@@ -973,101 +1618,89 @@ static bool netplay_poll(netplay_t *handle)
    if (!get_self_input_state(handle))
       return false;
 
-   // We skip reading the first frame so the host has a chance to grab our host info so we don't block forever :')
-   if (handle->frame_count == 0)
+   bool relay = false;
+   for (;;)
    {
-      handle->buffer[0].used_real = true;
-      handle->buffer[0].is_simulated = false;
-      handle->buffer[0].real_input_state = 0;
-      handle->read_ptr = NEXT_PTR(handle->read_ptr);
-      handle->read_frame_count++;
-      return true;
-   }
+      // We might have reached the end of the buffer, where we simply have to block
+      // until the oldest unconfirmed frame has input from everyone.
+      bool block = handle->frame_count + 1 - handle->other_frame_count >= handle->buffer_size &&
+         confirmed_frame(handle) <= handle->other_frame_count;
 
-   // We might have reached the end of the buffer, where we simply have to block.
-   int res = poll_input(handle, handle->other_ptr == handle->self_ptr);
-   if (res == -1)
-   {
-      handle->has_connection = false;
-      warn_hangup();
-      return false;
-   }
-
-   if (res == 1)
-   {
-      uint32_t first_read = handle->read_frame_count;
-      do 
+      int res = poll_input(handle, block);
+      if (res == -1)
       {
-         uint32_t buffer[UDP_FRAME_PACKETS * 2];
-         if (!receive_data(handle, buffer, sizeof(buffer)))
-         {
-            warn_hangup();
-            handle->has_connection = false;
-            return false;
-         }
-         parse_packet(handle, buffer, UDP_FRAME_PACKETS);
+         handle->has_connection = false;
+         warn_hangup();
+         return false;
+      }
 
-      } while ((handle->read_frame_count <= handle->frame_count) && 
-            poll_input(handle, (handle->other_ptr == handle->self_ptr) && 
-               (first_read == handle->read_frame_count)) == 1);
-   }
-   else
-   {
-      // Cannot allow this. Should not happen though.
-      if (handle->self_ptr == handle->other_ptr)
+      if (res == 0)
+         break;
+
+      bool got_input = false;
+      if (!receive_packet(handle, &got_input))
       {
          warn_hangup();
+         handle->has_connection = false;
          return false;
       }
+
+      // Pass new input on right away. Clients might be blocking on it.
+      if (got_input && netplay_is_host(handle) && handle->num_peers > 1)
+      {
+         if (!block)
+            relay = true;
+         else if (!send_packets(handle))
+            return false;
+      }
    }
 
-   if (handle->read_ptr != handle->self_ptr)
-      simulate_input(handle);
-   else
-      handle->buffer[PREV_PTR(handle->self_ptr)].used_real = true;
+   if (relay && !send_packets(handle))
+      return false;
 
+   setup_frame_input(handle, handle->frame_count);
    return true;
 }
 
-static bool netplay_send_cmd(netplay_t *handle, uint32_t cmd, const void *data, size_t size)
+static bool netplay_send_cmd(netplay_t *handle, struct netplay_peer *peer, uint32_t cmd, const void *data, size_t size)
 {
    cmd = (cmd << 16) | (size & 0xffff);
    cmd = htonl(cmd);
 
-   if (!send_all(handle->fd, &cmd, sizeof(cmd)))
+   if (!send_all(peer->fd, &cmd, sizeof(cmd)))
       return false;
 
-   if (!send_all(handle->fd, data, size))
+   if (!send_all(peer->fd, data, size))
       return false;
 
    return true;
 }
 
-static bool netplay_cmd_ack(netplay_t *handle)
+static bool netplay_cmd_ack(struct netplay_peer *peer)
 {
    uint32_t cmd = htonl(NETPLAY_CMD_ACK);
-   return send_all(handle->fd, &cmd, sizeof(cmd));
+   return send_all(peer->fd, &cmd, sizeof(cmd));
 }
 
-static bool netplay_cmd_nak(netplay_t *handle)
+static bool netplay_cmd_nak(struct netplay_peer *peer)
 {
    uint32_t cmd = htonl(NETPLAY_CMD_NAK);
-   return send_all(handle->fd, &cmd, sizeof(cmd));
+   return send_all(peer->fd, &cmd, sizeof(cmd));
 }
 
-static bool netplay_get_response(netplay_t *handle)
+static bool netplay_get_response(struct netplay_peer *peer)
 {
    uint32_t response;
-   if (!recv_all(handle->fd, &response, sizeof(response)))
+   if (!recv_all(peer->fd, &response, sizeof(response)))
       return false;
 
    return ntohl(response) == NETPLAY_CMD_ACK;
 }
 
-static bool netplay_get_cmd(netplay_t *handle)
+static bool netplay_get_cmd(netplay_t *handle, struct netplay_peer *peer)
 {
    uint32_t cmd;
-   if (!recv_all(handle->fd, &cmd, sizeof(cmd)))
+   if (!recv_all(peer->fd, &cmd, sizeof(cmd)))
       return false;
 
    cmd = ntohl(cmd);
@@ -1082,21 +1715,21 @@ static bool netplay_get_cmd(netplay_t *handle)
          if (cmd_size != sizeof(uint32_t))
          {
             RARCH_ERR("CMD_FLIP_PLAYERS has unexpected command size.\n");
-            return netplay_cmd_nak(handle);
+            return netplay_cmd_nak(peer);
          }
 
          uint32_t flip_frame;
-         if (!recv_all(handle->fd, &flip_frame, sizeof(flip_frame)))
+         if (!recv_all(peer->fd, &flip_frame, sizeof(flip_frame)))
          {
             RARCH_ERR("Failed to receive CMD_FLIP_PLAYERS argument.\n");
-            return netplay_cmd_nak(handle);
+            return netplay_cmd_nak(peer);
          }
 
          flip_frame = ntohl(flip_frame);
          if (flip_frame < handle->flip_frame)
          {
             RARCH_ERR("Host asked us to flip players in the past. Not possible ...\n");
-            return netplay_cmd_nak(handle);
+            return netplay_cmd_nak(peer);
          }
 
          handle->flip ^= true;
@@ -1105,12 +1738,12 @@ static bool netplay_get_cmd(netplay_t *handle)
          RARCH_LOG("Netplay players are flipped.\n");
          msg_queue_push(g_extern.msg_queue, "Netplay players are flipped.", 1, 180);
 
-         return netplay_cmd_ack(handle);
+         return netplay_cmd_ack(peer);
       }
 
       default:
          RARCH_ERR("Unknown netplay command received.\n");
-         return netplay_cmd_nak(handle);
+         return netplay_cmd_nak(peer);
    }
 }
 
@@ -1126,35 +1759,35 @@ void netplay_flip_players(netplay_t *handle)
       goto error;
    }
 
-   if (handle->port == 0)
+   if (!netplay_is_host(handle))
    {
       msg = "Cannot flip players if you're not the host.";
       goto error;
    }
 
-   // Make sure both clients are definitely synced up.
+   // Make sure all clients are definitely synced up.
    if (handle->frame_count < (handle->flip_frame + 2 * UDP_FRAME_PACKETS))
    {
       msg = "Cannot flip players yet. Wait a second or two before attempting flip.";
       goto error;
    }
 
-   if (netplay_send_cmd(handle, NETPLAY_CMD_FLIP_PLAYERS, &flip_frame_net, sizeof(flip_frame_net))
-         && netplay_get_response(handle))
+   for (unsigned i = 0; i < handle->num_peers; i++)
    {
-      RARCH_LOG("Netplay players are flipped.\n");
-      msg_queue_push(g_extern.msg_queue, "Netplay players are flipped.", 1, 180);
-
-      // Queue up a flip well enough in the future.
-      handle->flip ^= true;
-      handle->flip_frame = flip_frame;
-   }
-   else
-   {
-      msg = "Failed to flip players.";
-      goto error;
+      if (!netplay_send_cmd(handle, &handle->peers[i], NETPLAY_CMD_FLIP_PLAYERS,
+               &flip_frame_net, sizeof(flip_frame_net)) || !netplay_get_response(&handle->peers[i]))
+      {
+         msg = "Failed to flip players.";
+         goto error;
+      }
    }
 
+   RARCH_LOG("Netplay players are flipped.\n");
+   msg_queue_push(g_extern.msg_queue, "Netplay players are flipped.", 1, 180);
+
+   // Queue up a flip well enough in the future.
+   handle->flip ^= true;
+   handle->flip_frame = flip_frame;
    return;
 
 error:
@@ -1162,9 +1795,10 @@ error:
    msg_queue_push(g_extern.msg_queue, msg, 1, 180);
 }
 
-static bool netplay_flip_port(netplay_t *handle, bool port)
+// Flipping swaps who controls player 1 and 2. Any other players stay put.
+static unsigned netplay_flip_port(netplay_t *handle, unsigned port)
 {
-   if (handle->flip_frame == 0)
+   if (handle->flip_frame == 0 || port > 1)
       return port;
 
    size_t frame = handle->is_replay ? handle->tmp_frame_count : handle->frame_count;
@@ -1172,41 +1806,71 @@ static bool netplay_flip_port(netplay_t *handle, bool port)
    return port ^ handle->flip ^ (frame < handle->flip_frame);
 }
 
-int16_t netplay_input_state(netplay_t *handle, bool port, unsigned device, unsigned index, unsigned id)
+int16_t netplay_input_state(netplay_t *handle, unsigned port, unsigned device, unsigned index, unsigned id)
 {
-   uint16_t input_state = 0;
-   size_t ptr = handle->is_replay ? handle->tmp_ptr : PREV_PTR(handle->self_ptr);
+   if (port >= handle->num_players)
+      return 0;
 
+   uint32_t frame = handle->is_replay ? handle->tmp_frame_count : handle->frame_count;
    port = netplay_flip_port(handle, port);
 
-   if ((port ? 1 : 0) == handle->port)
+   const struct netplay_input *input = &handle->buffer[FRAME_PTR(frame)].input[port];
+
+   switch (device & RETRO_DEVICE_MASK)
    {
-      if (handle->buffer[ptr].is_simulated)
-         input_state = handle->buffer[ptr].simulated_input_state;
-      else
-         input_state = handle->buffer[ptr].real_input_state;
+      case RETRO_DEVICE_ANALOG:
+         return index < 2 && id < 2 ? input->analog[index * 2 + id] : 0;
+
+      default:
+         return id < RARCH_FIRST_CUSTOM_BIND && ((1 << id) & input->joypad) ? 1 : 0;
    }
-   else
-      input_state = handle->buffer[ptr].self_state;
+}
+
+void netplay_print_stats(netplay_t *handle, FILE *file)
+{
+   if (handle->spectate || !handle->stats.frames)
+      return;
+
+   double seconds = handle->stats.frames / g_extern.system.av_info.timing.fps;
+
+   fprintf(file, "Netplay stats for %llu frames:\n", (unsigned long long)handle->stats.frames);
+   fprintf(file, "\tRollbacks: %llu (%.2f/sec), %llu frames replayed, max depth %u frames.\n",
+         (unsigned long long)handle->stats.rollbacks, handle->stats.rollbacks / seconds,
+         (unsigned long long)handle->stats.frames_replayed, handle->stats.max_depth);
+   fprintf(file, "\tSave states: %llu (%.2f per frame).\n",
+         (unsigned long long)handle->stats.states_saved,
+         (double)handle->stats.states_saved / handle->stats.frames);
+   fprintf(file, "\tInput delay: %u frames.\n", handle->input_delay);
 
-   return ((1 << id) & input_state) ? 1 : 0;
+   for (unsigned i = 0; i < handle->num_peers; i++)
+   {
+      const struct netplay_peer *peer = &handle->peers[i];
+      fprintf(file, "\t\"%s\" (player %u): RTT: %.1f ms, jitter: %.1f ms.\n",
+            peer->nick, peer->port + 1, peer->rtt / 1000.0, peer->rtt_var / 1000.0);
+   }
 }
 
 void netplay_free(netplay_t *handle)
 {
-   close(handle->fd);
+   if (g_extern.verbose)
+      netplay_print_stats(handle, LOG_FILE);
+
+   if (handle->fd >= 0)
+      close(handle->fd);
 
    if (handle->spectate)
    {
-      for (unsigned i = 0; i < MAX_SPECTATORS; i++)
-         if (handle->spectate_fds[i] >= 0)
-            close(handle->spectate_fds[i]);
+      if (handle->spectate_broadcast)
+         netplay_broadcast_free(handle->spectate_broadcast);
 
       free(handle->spectate_input);
+      free(handle->baseline);
    }
    else
    {
       close(handle->udp_fd);
+      for (unsigned i = 0; i < handle->num_peers; i++)
+         close(handle->peers[i].fd);
 
       for (unsigned i = 0; i < handle->buffer_size; i++)
          free(handle->buffer[i].state);
@@ -1227,10 +1891,17 @@ static bool netplay_should_skip(netplay_t *handle)
 
 static void netplay_pre_frame_net(netplay_t *handle)
 {
-   pretro_serialize(handle->buffer[handle->self_ptr].state, handle->state_size);
+   struct delta_frame *ptr = &handle->buffer[FRAME_PTR(handle->frame_count)];
    handle->can_poll = true;
 
    input_poll_net();
+
+   // We can only ever have to roll back to a frame we run on predicted input.
+   if (handle->has_connection && !ptr->used_real)
+   {
+      pretro_serialize(ptr->state, handle->state_size);
+      handle->stats.states_saved++;
+   }
 }
 
 static void netplay_set_spectate_input(netplay_t *handle, int16_t input)
@@ -1299,24 +1970,8 @@ static void netplay_pre_frame_spectate(netplay_t *handle)
       return;
    }
 
-   int index = -1;
-   for (unsigned i = 0; i < MAX_SPECTATORS; i++)
-   {
-      if (handle->spectate_fds[i] == -1)
-      {
-         index = i;
-         break;
-      }
-   }
-
-   // No vacant client streams :(
-   if (index == -1)
-   {
-      close(new_fd);
-      return;
-   }
-
-   if (!get_nickname(handle, new_fd))
+   uint32_t baseline_info[2];
+   if (!get_nickname(handle, new_fd) || !recv_all(new_fd, baseline_info, sizeof(baseline_info)))
    {
       RARCH_ERR("Failed to get nickname from client.\n");
       close(new_fd);
@@ -1330,31 +1985,25 @@ static void netplay_pre_frame_spectate(netplay_t *handle)
       return;
    }
 
-   size_t header_size;
-   uint32_t *header = bsv_header_generate(&header_size, implementation_magic_value());
-   if (!header)
+   size_t state_size;
+   uint8_t *state = encode_state_spectate(handle, ntohl(baseline_info[0]), ntohl(baseline_info[1]), &state_size);
+   if (!state)
    {
-      RARCH_ERR("Failed to generate BSV header.\n");
       close(new_fd);
       return;
    }
 
-   int bufsize = header_size;
-   setsockopt(new_fd, SOL_SOCKET, SO_SNDBUF, CONST_CAST &bufsize, sizeof(int));
-
-   if (!send_all(new_fd, header, header_size))
+   // The state is queued up ahead of the input stream, so a slow spectator does not stall us.
+   int id = netplay_broadcast_add(handle->spectate_broadcast, new_fd, state, state_size);
+   free(state);
+   if (id < 0)
    {
-      RARCH_ERR("Failed to send header to client.\n");
-      close(new_fd);
-      free(header);
+      RARCH_ERR("Failed to add spectator.\n");
       return;
    }
 
-   free(header);
-   handle->spectate_fds[index] = new_fd;
-
 #ifndef HAVE_SOCKET_LEGACY
-   log_connection(&their_addr, index, handle->other_nick);
+   log_connection(&their_addr, id, handle->other_nick);
 #endif
 }
 
@@ -1369,47 +2018,68 @@ void netplay_pre_frame(netplay_t *handle)
 static void netplay_post_frame_net(netplay_t *handle)
 {
    handle->frame_count++;
+   handle->stats.frames++;
 
-   // Nothing to do...
-   if (handle->other_frame_count == handle->read_frame_count)
-      return;
+   uint32_t confirmed = confirmed_frame(handle);
+   if (confirmed > handle->frame_count)
+      confirmed = handle->frame_count;
 
    // Skip ahead if we predicted correctly. Skip until our simulation failed.
-   while (handle->other_frame_count < handle->read_frame_count)
+   while (handle->other_frame_count < confirmed)
    {
-      const struct delta_frame *ptr = &handle->buffer[handle->other_ptr];
-      if ((ptr->simulated_input_state != ptr->real_input_state) && !ptr->used_real)
-         break;
-      handle->other_ptr = NEXT_PTR(handle->other_ptr);
+      uint32_t frame = handle->other_frame_count;
+      const struct delta_frame *ptr = &handle->buffer[FRAME_PTR(frame)];
+      if (!ptr->used_real)
+      {
+         bool correct = true;
+         for (unsigned port = 0; port < handle->num_players; port++)
+         {
+            if (!input_equal(&ptr->input[port], &handle->history[port][HISTORY_PTR(frame)]))
+               correct = false;
+         }
+
+         if (!correct)
+            break;
+      }
+
       handle->other_frame_count++;
    }
 
-   if (handle->other_frame_count < handle->read_frame_count)
+   if (handle->other_frame_count < confirmed)
    {
       // Replay frames
       handle->is_replay = true;
-      handle->tmp_ptr = handle->other_ptr;
       handle->tmp_frame_count = handle->other_frame_count;
 
-      pretro_unserialize(handle->buffer[handle->other_ptr].state, handle->state_size);
-      bool first = true;
-      while (first || (handle->tmp_ptr != handle->self_ptr))
+      unsigned depth = handle->frame_count - handle->other_frame_count;
+      handle->stats.rollbacks++;
+      handle->stats.frames_replayed += depth;
+      if (depth > handle->stats.max_depth)
+         handle->stats.max_depth = depth;
+
+      RARCH_PERFORMANCE_INIT(netplay_rollback);
+      RARCH_PERFORMANCE_START(netplay_rollback);
+
+      pretro_unserialize(handle->buffer[FRAME_PTR(handle->other_frame_count)].state, handle->state_size);
+      for (; handle->tmp_frame_count < handle->frame_count; handle->tmp_frame_count++)
       {
-         pretro_serialize(handle->buffer[handle->tmp_ptr].state, handle->state_size);
-#ifdef HAVE_THREADS
-         lock_autosave();
-#endif
+         // Frames we still have no input for are predicted again from the newest input.
+         setup_frame_input(handle, handle->tmp_frame_count);
+
+         // Only frames which are still predicted can be rolled back to again.
+         // The first frame's state was just loaded, so it is up to date already.
+         struct delta_frame *ptr = &handle->buffer[FRAME_PTR(handle->tmp_frame_count)];
+         if (handle->tmp_frame_count != handle->other_frame_count && !ptr->used_real)
+         {
+            pretro_serialize(ptr->state, handle->state_size);
+            handle->stats.states_saved++;
+         }
          pretro_run();
-#ifdef HAVE_THREADS
-         unlock_autosave();
-#endif
-         handle->tmp_ptr = NEXT_PTR(handle->tmp_ptr);
-         handle->tmp_frame_count++;
-         first = false;
       }
 
-      handle->other_ptr = handle->read_ptr;
-      handle->other_frame_count = handle->read_frame_count;
+      RARCH_PERFORMANCE_STOP(netplay_rollback);
+
+      handle->other_frame_count = confirmed;
       handle->is_replay = false;
    }
 }
@@ -1419,27 +2089,19 @@ static void netplay_post_frame_spectate(netplay_t *handle)
    if (handle->spectate_client)
       return;
 
-   for (unsigned i = 0; i < MAX_SPECTATORS; i++)
-   {
-      if (handle->spectate_fds[i] == -1)
-         continue;
-
-      if (!send_all(handle->spectate_fds[i],
-               handle->spectate_input, handle->spectate_input_ptr * sizeof(int16_t)))
-      {
-         RARCH_LOG("Client (#%u) disconnected ...\n", i);
+   netplay_broadcast_push(handle->spectate_broadcast,
+         handle->spectate_input, handle->spectate_input_ptr * sizeof(int16_t));
+   handle->spectate_input_ptr = 0;
 
-         char msg[512];
-         snprintf(msg, sizeof(msg), "Client (#%u) disconnected.", i);
-         msg_queue_push(g_extern.msg_queue, msg, 1, 180);
+   int id;
+   while ((id = netplay_broadcast_get_dropped(handle->spectate_broadcast)) >= 0)
+   {
+      RARCH_LOG("Client (#%d) disconnected ...\n", id);
 
-         close(handle->spectate_fds[i]);
-         handle->spectate_fds[i] = -1;
-         break;
-      }
+      char msg[512];
+      snprintf(msg, sizeof(msg), "Client (#%d) disconnected.", id);
+      msg_queue_push(g_extern.msg_queue, msg, 1, 180);
    }
-
-   handle->spectate_input_ptr = 0;
 }
 
 // Here we check if we have new input and replay from recorded input.
@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdio.h>
 #include "boolean.h"
 #include "libretro.h"
 
@@ -58,5 +59,8 @@ void netplay_pre_frame(netplay_t *handle);
 // Call this after running retro_run()
 void netplay_post_frame(netplay_t *handle);
 
+// Prints rollback statistics, round-trip time and the current input delay.
+void netplay_print_stats(netplay_t *handle, FILE *file);
+
 #endif
 
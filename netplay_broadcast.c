@@ -0,0 +1,485 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "netplay_compat.h"
+#include "netplay_broadcast.h"
+#include "general.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(__CELLOS_LV2__) && !defined(__PSL1GHT__)
+#include <netex/errno.h>
+#endif
+
+#if defined(HAVE_THREADS) && defined(__linux__)
+#define HAVE_BROADCAST_THREAD
+#include "thread.h"
+#include <sys/epoll.h>
+#endif
+
+#define BROADCAST_MAX_EVENTS 64
+
+struct spectator
+{
+   int fd;
+   int id;
+   bool dead;
+
+   // Sent before anything from the shared stream.
+   uint8_t *prefix;
+   size_t prefix_size;
+   size_t prefix_ptr;
+
+   uint64_t pos; // Stream position of the next byte to send.
+};
+
+struct netplay_broadcast
+{
+   // Everything pushed ends up here. write_pos counts every byte ever pushed,
+   // so a spectator is write_pos - pos bytes behind.
+   uint8_t *ring;
+   size_t ring_size;
+   uint64_t write_pos;
+
+   struct spectator **clients;
+   size_t num_clients;
+   size_t cap_clients;
+   int next_id;
+
+   int *dropped;
+   size_t num_dropped;
+   size_t cap_dropped;
+
+#ifdef HAVE_BROADCAST_THREAD
+   sthread_t *thread;
+   slock_t *lock; // Protects everything above.
+   int epoll_fd;
+   int wake_fd[2];
+   bool quit;
+#endif
+};
+
+static bool socket_nonblock(int fd)
+{
+#ifdef _WIN32
+   u_long mode = 1;
+   return ioctlsocket(fd, FIONBIO, &mode) == 0;
+#elif defined(__CELLOS_LV2__) && !defined(__PSL1GHT__)
+   int nonblock = 1;
+   return setsockopt(fd, SOL_SOCKET, SO_NBIO, &nonblock, sizeof(nonblock)) == 0;
+#else
+   return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0;
+#endif
+}
+
+static bool socket_would_block(void)
+{
+#ifdef _WIN32
+   return WSAGetLastError() == WSAEWOULDBLOCK;
+#elif defined(__CELLOS_LV2__) && !defined(__PSL1GHT__)
+   return sys_net_errno == SYS_NET_EAGAIN || sys_net_errno == SYS_NET_EWOULDBLOCK;
+#else
+   return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+static inline void broadcast_lock(netplay_broadcast_t *bc)
+{
+#ifdef HAVE_BROADCAST_THREAD
+   slock_lock(bc->lock);
+#else
+   (void)bc;
+#endif
+}
+
+static inline void broadcast_unlock(netplay_broadcast_t *bc)
+{
+#ifdef HAVE_BROADCAST_THREAD
+   slock_unlock(bc->lock);
+#else
+   (void)bc;
+#endif
+}
+
+// Writes as much pending data as the socket takes right now. Called with the lock held.
+static void flush_client(netplay_broadcast_t *bc, struct spectator *c)
+{
+   while (!c->dead)
+   {
+      const uint8_t *data;
+      size_t size;
+
+      if (c->prefix_ptr < c->prefix_size)
+      {
+         data = c->prefix + c->prefix_ptr;
+         size = c->prefix_size - c->prefix_ptr;
+      }
+      else if (c->pos < bc->write_pos)
+      {
+         size_t offset = c->pos & (bc->ring_size - 1);
+         data = bc->ring + offset;
+         size = bc->write_pos - c->pos;
+         if (size > bc->ring_size - offset)
+            size = bc->ring_size - offset;
+      }
+      else
+         break;
+
+      int ret = send(c->fd, CONST_CAST data, size, 0);
+      if (ret < 0)
+      {
+         // With edge triggered epoll, we are woken up again once the socket drains.
+         if (!socket_would_block())
+            c->dead = true;
+         break;
+      }
+
+      if (c->prefix_ptr < c->prefix_size)
+         c->prefix_ptr += ret;
+      else
+         c->pos += ret;
+   }
+}
+
+static void flush_all(netplay_broadcast_t *bc)
+{
+   for (size_t i = 0; ; i++)
+   {
+      // Only hold the lock for one client at a time, so pushes are never stuck behind a full sweep.
+      broadcast_lock(bc);
+      if (i >= bc->num_clients)
+      {
+         broadcast_unlock(bc);
+         break;
+      }
+      flush_client(bc, bc->clients[i]);
+      broadcast_unlock(bc);
+   }
+}
+
+// Closes dead spectators. Only the thread writing to the sockets does this. Called with the lock held.
+static void reap_clients(netplay_broadcast_t *bc)
+{
+   for (size_t i = 0; i < bc->num_clients; )
+   {
+      struct spectator *c = bc->clients[i];
+      if (!c->dead)
+      {
+         i++;
+         continue;
+      }
+
+      close(c->fd);
+
+      if (bc->num_dropped >= bc->cap_dropped)
+      {
+         size_t cap = bc->cap_dropped ? bc->cap_dropped * 2 : 16;
+         int *dropped = (int*)realloc(bc->dropped, cap * sizeof(int));
+         if (dropped)
+         {
+            bc->dropped = dropped;
+            bc->cap_dropped = cap;
+         }
+      }
+      if (bc->num_dropped < bc->cap_dropped)
+         bc->dropped[bc->num_dropped++] = c->id;
+
+      free(c->prefix);
+      free(c);
+      bc->clients[i] = bc->clients[--bc->num_clients];
+   }
+}
+
+#ifdef HAVE_BROADCAST_THREAD
+static void broadcast_thread(void *data)
+{
+   netplay_broadcast_t *bc = (netplay_broadcast_t*)data;
+   struct epoll_event events[BROADCAST_MAX_EVENTS];
+
+   for (;;)
+   {
+      int num = epoll_wait(bc->epoll_fd, events, BROADCAST_MAX_EVENTS, -1);
+      if (num < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         RARCH_ERR("Spectator broadcast epoll_wait() failed.\n");
+         break;
+      }
+
+      slock_lock(bc->lock);
+      bool quit = bc->quit;
+      slock_unlock(bc->lock);
+      if (quit)
+         break;
+
+      bool woken = false;
+      for (int i = 0; i < num; i++)
+      {
+         struct spectator *c = (struct spectator*)events[i].data.ptr;
+         if (!c)
+         {
+            char tmp[64];
+            while (read(bc->wake_fd[0], tmp, sizeof(tmp)) > 0)
+               ;
+            woken = true;
+            continue;
+         }
+
+         slock_lock(bc->lock);
+         flush_client(bc, c);
+         slock_unlock(bc->lock);
+      }
+
+      // New data was pushed.
+      if (woken)
+         flush_all(bc);
+
+      // Events refer to clients directly, so only free them once the whole batch is handled.
+      slock_lock(bc->lock);
+      reap_clients(bc);
+      slock_unlock(bc->lock);
+   }
+}
+#endif
+
+netplay_broadcast_t *netplay_broadcast_new(size_t queue_size)
+{
+   netplay_broadcast_t *bc = (netplay_broadcast_t*)calloc(1, sizeof(*bc));
+   if (!bc)
+      return NULL;
+
+#ifdef HAVE_BROADCAST_THREAD
+   bc->epoll_fd = -1;
+   bc->wake_fd[0] = bc->wake_fd[1] = -1;
+#endif
+
+   bc->ring_size = next_pow2(queue_size);
+   bc->ring = (uint8_t*)malloc(bc->ring_size);
+   if (!bc->ring)
+      goto error;
+
+#ifdef HAVE_BROADCAST_THREAD
+   bc->lock = slock_new();
+   if (!bc->lock)
+      goto error;
+
+   bc->epoll_fd = epoll_create(BROADCAST_MAX_EVENTS);
+   if (bc->epoll_fd < 0)
+      goto error;
+
+   if (pipe(bc->wake_fd) < 0)
+      goto error;
+   if (!socket_nonblock(bc->wake_fd[0]) || !socket_nonblock(bc->wake_fd[1]))
+      goto error;
+
+   {
+      struct epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLIN;
+      event.data.ptr = NULL;
+      if (epoll_ctl(bc->epoll_fd, EPOLL_CTL_ADD, bc->wake_fd[0], &event) < 0)
+         goto error;
+   }
+
+   bc->thread = sthread_create(broadcast_thread, bc);
+   if (!bc->thread)
+      goto error;
+#endif
+
+   return bc;
+
+error:
+   RARCH_ERR("Failed to initialize spectator broadcast.\n");
+   netplay_broadcast_free(bc);
+   return NULL;
+}
+
+void netplay_broadcast_free(netplay_broadcast_t *bc)
+{
+   if (!bc)
+      return;
+
+#ifdef HAVE_BROADCAST_THREAD
+   if (bc->thread)
+   {
+      slock_lock(bc->lock);
+      bc->quit = true;
+      slock_unlock(bc->lock);
+
+      char c = 0;
+      if (write(bc->wake_fd[1], &c, 1) < 0)
+         RARCH_WARN("Failed to wake up spectator broadcast thread.\n");
+      sthread_join(bc->thread);
+   }
+
+   if (bc->epoll_fd >= 0)
+      close(bc->epoll_fd);
+   if (bc->wake_fd[0] >= 0)
+      close(bc->wake_fd[0]);
+   if (bc->wake_fd[1] >= 0)
+      close(bc->wake_fd[1]);
+   if (bc->lock)
+      slock_free(bc->lock);
+#endif
+
+   for (size_t i = 0; i < bc->num_clients; i++)
+   {
+      close(bc->clients[i]->fd);
+      free(bc->clients[i]->prefix);
+      free(bc->clients[i]);
+   }
+
+   free(bc->clients);
+   free(bc->dropped);
+   free(bc->ring);
+   free(bc);
+}
+
+int netplay_broadcast_add(netplay_broadcast_t *bc, int fd, const void *prefix, size_t prefix_size)
+{
+   struct spectator *c = (struct spectator*)calloc(1, sizeof(*c));
+   if (!c)
+      goto error;
+
+   c->fd = fd;
+   if (prefix_size)
+   {
+      c->prefix = (uint8_t*)malloc(prefix_size);
+      if (!c->prefix)
+         goto error;
+      memcpy(c->prefix, prefix, prefix_size);
+      c->prefix_size = prefix_size;
+   }
+
+   if (!socket_nonblock(fd))
+      goto error;
+
+   broadcast_lock(bc);
+
+   if (bc->num_clients >= bc->cap_clients)
+   {
+      size_t cap = bc->cap_clients ? bc->cap_clients * 2 : 16;
+      struct spectator **clients = (struct spectator**)realloc(bc->clients, cap * sizeof(*clients));
+      if (!clients)
+      {
+         broadcast_unlock(bc);
+         goto error;
+      }
+
+      bc->clients = clients;
+      bc->cap_clients = cap;
+   }
+
+#ifdef HAVE_BROADCAST_THREAD
+   {
+      // Becoming writable is an edge by itself, so the thread will send the prefix right away.
+      struct epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLOUT | EPOLLET;
+      event.data.ptr = c;
+      if (epoll_ctl(bc->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+      {
+         broadcast_unlock(bc);
+         goto error;
+      }
+   }
+#endif
+
+   c->id = bc->next_id++;
+   c->pos = bc->write_pos;
+   bc->clients[bc->num_clients++] = c;
+
+#ifndef HAVE_BROADCAST_THREAD
+   flush_client(bc, c);
+#endif
+
+   broadcast_unlock(bc);
+   return c->id;
+
+error:
+   close(fd);
+   if (c)
+      free(c->prefix);
+   free(c);
+   return -1;
+}
+
+void netplay_broadcast_push(netplay_broadcast_t *bc, const void *data_, size_t size)
+{
+   const uint8_t *data = (const uint8_t*)data_;
+
+   broadcast_lock(bc);
+
+   // Evict those who would lose data they have not gotten yet.
+   for (size_t i = 0; i < bc->num_clients; i++)
+   {
+      struct spectator *c = bc->clients[i];
+      if (!c->dead && bc->write_pos + size - c->pos > bc->ring_size)
+      {
+         RARCH_WARN("Spectator #%d fell too far behind, dropping.\n", c->id);
+         c->dead = true;
+      }
+   }
+
+   while (size)
+   {
+      size_t offset = bc->write_pos & (bc->ring_size - 1);
+      size_t copy = bc->ring_size - offset;
+      if (copy > size)
+         copy = size;
+
+      memcpy(bc->ring + offset, data, copy);
+      bc->write_pos += copy;
+      data += copy;
+      size -= copy;
+   }
+
+#ifdef HAVE_BROADCAST_THREAD
+   broadcast_unlock(bc);
+
+   // If the pipe is full, the thread is already due to wake up.
+   char c = 0;
+   if (write(bc->wake_fd[1], &c, 1) < 0 && !socket_would_block())
+      RARCH_WARN("Failed to wake up spectator broadcast thread.\n");
+#else
+   broadcast_unlock(bc);
+   flush_all(bc);
+   reap_clients(bc);
+#endif
+}
+
+unsigned netplay_broadcast_count(netplay_broadcast_t *bc)
+{
+   broadcast_lock(bc);
+   unsigned ret = bc->num_clients;
+   broadcast_unlock(bc);
+   return ret;
+}
+
+int netplay_broadcast_get_dropped(netplay_broadcast_t *bc)
+{
+   int ret = -1;
+   broadcast_lock(bc);
+   if (bc->num_dropped)
+   {
+      ret = bc->dropped[0];
+      memmove(bc->dropped, bc->dropped + 1, --bc->num_dropped * sizeof(int));
+   }
+   broadcast_unlock(bc);
+   return ret;
+}
+
@@ -0,0 +1,50 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NETPLAY_BROADCAST_H__
+#define NETPLAY_BROADCAST_H__
+
+#include <stddef.h>
+#include "boolean.h"
+
+// Sends one stream of data to any number of spectators without ever blocking the caller.
+//
+// Pushed data goes into a single ring buffer shared by every spectator, and each spectator
+// only tracks how far into it it has gotten. A spectator that falls more than queue_size bytes
+// behind is evicted.
+//
+// On Linux with threads, sockets are written to from a separate thread driven by epoll.
+// Elsewhere, the caller thread does non-blocking writes on every push.
+typedef struct netplay_broadcast netplay_broadcast_t;
+
+netplay_broadcast_t *netplay_broadcast_new(size_t queue_size);
+void netplay_broadcast_free(netplay_broadcast_t *bc);
+
+// Takes ownership of a connected socket. prefix is copied and sent to this spectator only,
+// ahead of everything pushed from now on.
+// Returns the spectator id, or -1 on failure, in which case fd is closed.
+int netplay_broadcast_add(netplay_broadcast_t *bc, int fd, const void *prefix, size_t prefix_size);
+
+// Queues data for every spectator.
+void netplay_broadcast_push(netplay_broadcast_t *bc, const void *data, size_t size);
+
+// Number of connected spectators.
+unsigned netplay_broadcast_count(netplay_broadcast_t *bc);
+
+// Returns the id of a spectator that got disconnected or evicted since the last call, or -1 if none.
+int netplay_broadcast_get_dropped(netplay_broadcast_t *bc);
+
+#endif
+
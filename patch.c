@@ -1,6 +1,6 @@
 /*  RetroArch - A frontend for libretro.
  *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
- * 
+ *
  *  RetroArch is free software: you can redistribute it and/or modify it under the terms
  *  of the GNU General Public License as published by the Free Software Found-
  *  ation, either version 3 of the License, or (at your option) any later version.
@@ -21,8 +21,13 @@
 #include "boolean.h"
 #include "msvc/msvc_compat.h"
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+// Patch data is read, and the target is checksummed, this much at a time.
+#define PATCH_BLOCK_SIZE (64 * 1024)
+
 enum bps_mode
 {
    SOURCE_READ = 0,
@@ -31,33 +36,166 @@ enum bps_mode
    TARGET_COPY
 };
 
-struct bps_data
+// Buffered reader over the patch file, which checksums everything read.
+struct patch_stream
+{
+   FILE *file;
+   uint64_t size;
+
+   uint8_t buf[PATCH_BLOCK_SIZE];
+   size_t ptr, end; // Unread data is buf[ptr, end).
+   size_t crc_ptr; // buf[crc_ptr, ptr) is read, but not yet checksummed.
+   uint64_t offset; // File offset of buf[0].
+   uint32_t crc;
+
+   bool overrun; // Tried to read past the end of the file.
+};
+
+// The target is always written front to back.
+struct patch_target
 {
-   const uint8_t *modify_data, *source_data; 
-   uint8_t *target_data;
-   size_t modify_length, source_length, target_length;
-   size_t modify_offset, source_offset, target_offset;
-   uint32_t modify_checksum, source_checksum, target_checksum;
+   uint8_t *data;
+   size_t size;
+   size_t offset; // Everything before this is written.
+   size_t crc_offset; // data[crc_offset, offset) is written, but not yet checksummed.
+   uint32_t crc;
+};
+
+struct patch
+{
+   patch_type_t type;
+   bool prepared;
+   bool applied;
+
+   size_t source_size;
+   size_t target_size;
 
-   size_t source_relative_offset, target_relative_offset, output_offset;
+   // BPS and UPS headers.
+   uint64_t header_source_size;
+   uint64_t header_target_size;
+
+   struct patch_stream stream;
 };
 
-static uint8_t bps_read(struct bps_data *bps)
+static void stream_reset(struct patch_stream *s, uint64_t offset)
+{
+   s->ptr = s->end = s->crc_ptr = 0;
+   s->offset = offset;
+   s->crc = ~0u;
+   s->overrun = false;
+}
+
+static void stream_flush_crc(struct patch_stream *s)
+{
+   s->crc = crc32_update(s->crc, s->buf + s->crc_ptr, s->ptr - s->crc_ptr);
+   s->crc_ptr = s->ptr;
+}
+
+// Only called once everything buffered is read.
+static bool stream_refill(struct patch_stream *s)
+{
+   stream_flush_crc(s);
+   s->offset += s->end;
+   s->ptr = s->crc_ptr = 0;
+   s->end = fread(s->buf, 1, sizeof(s->buf), s->file);
+   return s->end > 0;
+}
+
+static inline uint64_t stream_tell(const struct patch_stream *s)
+{
+   return s->offset + s->ptr;
+}
+
+static inline uint8_t stream_byte(struct patch_stream *s)
+{
+   if (s->ptr == s->end && !stream_refill(s))
+   {
+      s->overrun = true;
+      return 0;
+   }
+
+   return s->buf[s->ptr++];
+}
+
+// Reads straight into dst once the buffer is drained, so large reads are not copied twice.
+static void stream_read(struct patch_stream *s, uint8_t *dst, size_t size)
+{
+   size_t avail = s->end - s->ptr;
+   size_t copy = size < avail ? size : avail;
+   memcpy(dst, s->buf + s->ptr, copy);
+   s->ptr += copy;
+
+   if (copy == size)
+      return;
+
+   dst += copy;
+   size -= copy;
+
+   stream_flush_crc(s);
+   s->offset += s->end;
+   s->ptr = s->end = s->crc_ptr = 0;
+
+   size_t got = fread(dst, 1, size, s->file);
+   s->crc = crc32_update(s->crc, dst, got);
+   s->offset += got;
+
+   if (got < size)
+   {
+      memset(dst + got, 0, size - got);
+      s->overrun = true;
+   }
+}
+
+static void stream_skip(struct patch_stream *s, uint64_t size)
+{
+   while (size)
+   {
+      if (s->ptr == s->end && !stream_refill(s))
+      {
+         s->overrun = true;
+         return;
+      }
+
+      size_t avail = s->end - s->ptr;
+      size_t skip = size < avail ? size : avail;
+      s->ptr += skip;
+      size -= skip;
+   }
+}
+
+// Checksum of everything read so far.
+static uint32_t stream_checksum(struct patch_stream *s)
+{
+   stream_flush_crc(s);
+   return ~s->crc;
+}
+
+static uint32_t stream_read32le(struct patch_stream *s)
+{
+   uint32_t data = 0;
+   for (unsigned i = 0; i < 32; i += 8)
+      data |= (uint32_t)stream_byte(s) << i;
+   return data;
+}
+
+static uint32_t stream_read_be(struct patch_stream *s, unsigned bytes)
 {
-   uint8_t data = bps->modify_data[bps->modify_offset++];
-   bps->modify_checksum = crc32_adjust(bps->modify_checksum, data);
+   uint32_t data = 0;
+   for (unsigned i = 0; i < bytes; i++)
+      data = (data << 8) | stream_byte(s);
    return data;
 }
 
-static uint64_t bps_decode(struct bps_data *bps)
+// Variable length number as used by BPS and UPS.
+static uint64_t stream_decode(struct patch_stream *s)
 {
    uint64_t data = 0, shift = 1;
 
    for (;;)
    {
-      uint8_t x = bps_read(bps);
+      uint8_t x = stream_byte(s);
       data += (x & 0x7f) * shift;
-      if (x & 0x80)
+      if ((x & 0x80) || s->overrun)
          break;
       shift <<= 7;
       data += shift;
@@ -66,334 +204,511 @@ static uint64_t bps_decode(struct bps_data *bps)
    return data;
 }
 
-static void bps_write(struct bps_data *bps, uint8_t data)
+static void target_flush_crc(struct patch_target *t)
 {
-   bps->target_data[bps->output_offset++] = data;
-   bps->target_checksum = crc32_adjust(bps->target_checksum, data);
+   t->crc = crc32_update(t->crc, t->data + t->crc_offset, t->offset - t->crc_offset);
+   t->crc_offset = t->offset;
 }
 
-patch_error_t bps_apply_patch(
-      const uint8_t *modify_data, size_t modify_length,
-      const uint8_t *source_data, size_t source_length,
-      uint8_t *target_data, size_t *target_length)
+// Checksums in blocks while freshly written data is still in cache.
+static inline void target_advance(struct patch_target *t, size_t size)
 {
-   if (modify_length < 19)
+   t->offset += size;
+   if (t->offset - t->crc_offset >= PATCH_BLOCK_SIZE)
+      target_flush_crc(t);
+}
+
+static uint32_t target_checksum(struct patch_target *t)
+{
+   target_flush_crc(t);
+   return ~t->crc;
+}
+
+static void target_copy(struct patch_target *t, const uint8_t *src, size_t size)
+{
+   while (size)
+   {
+      size_t copy = size < PATCH_BLOCK_SIZE ? size : PATCH_BLOCK_SIZE;
+      memcpy(t->data + t->offset, src, copy);
+      src += copy;
+      size -= copy;
+      target_advance(t, copy);
+   }
+}
+
+static void target_fill(struct patch_target *t, uint8_t value, size_t size)
+{
+   while (size)
+   {
+      size_t copy = size < PATCH_BLOCK_SIZE ? size : PATCH_BLOCK_SIZE;
+      memset(t->data + t->offset, value, copy);
+      size -= copy;
+      target_advance(t, copy);
+   }
+}
+
+static void target_read(struct patch_target *t, struct patch_stream *s, size_t size)
+{
+   while (size)
+   {
+      size_t copy = size < PATCH_BLOCK_SIZE ? size : PATCH_BLOCK_SIZE;
+      stream_read(s, t->data + t->offset, copy);
+      size -= copy;
+      target_advance(t, copy);
+   }
+}
+
+// Copies earlier target data, which may overlap what is being written, so short distances repeat.
+// The span already written doubles for every copy, until it is large enough to copy in whole blocks.
+static void target_repeat(struct patch_target *t, size_t src_offset, size_t size)
+{
+   const uint8_t *src = t->data + src_offset;
+
+   while (size)
+   {
+      uint8_t *dst = t->data + t->offset;
+      size_t dist = dst - src;
+
+      size_t copy = size;
+      if (dist > 1 && copy > dist)
+         copy = dist;
+      if (copy > PATCH_BLOCK_SIZE)
+         copy = PATCH_BLOCK_SIZE;
+
+      if (dist == 1)
+         memset(dst, *src, copy);
+      else
+         memcpy(dst, src, copy);
+
+      // Keeps the distance a multiple of the repeated pattern.
+      if (dist >= PATCH_BLOCK_SIZE)
+         src += copy;
+
+      size -= copy;
+      target_advance(t, copy);
+   }
+}
+
+// Moves a BPS relative offset, making sure it stays within [0, limit].
+static bool bps_move(size_t *offset, uint64_t encoded, size_t limit)
+{
+   uint64_t delta = encoded >> 1;
+
+   if (encoded & 1)
+   {
+      if (delta > *offset)
+         return false;
+      *offset -= delta;
+   }
+   else
+   {
+      if (delta > limit - *offset)
+         return false;
+      *offset += delta;
+   }
+
+   return true;
+}
+
+static patch_error_t bps_prepare(patch_t *patch)
+{
+   struct patch_stream *s = &patch->stream;
+   if (s->size < 19)
       return PATCH_PATCH_TOO_SMALL;
 
-   struct bps_data bps = {0};
-   bps.modify_data = modify_data;
-   bps.modify_length = modify_length;
-   bps.target_data = target_data;
-   bps.target_length = *target_length;
-   bps.source_data = source_data;
-   bps.source_length = source_length;
-   bps.modify_checksum = ~0;
-   bps.target_checksum = ~0;
-
-   if ((bps_read(&bps) != 'B') || (bps_read(&bps) != 'P') || (bps_read(&bps) != 'S') || (bps_read(&bps) != '1'))
+   if ((stream_byte(s) != 'B') || (stream_byte(s) != 'P') || (stream_byte(s) != 'S') || (stream_byte(s) != '1'))
       return PATCH_PATCH_INVALID_HEADER;
 
-   size_t modify_source_size = bps_decode(&bps);
-   size_t modify_target_size = bps_decode(&bps);
-   size_t modify_markup_size = bps_decode(&bps);
-   for (size_t i = 0; i < modify_markup_size; i++)
-      bps_read(&bps);
+   patch->header_source_size = stream_decode(s);
+   patch->header_target_size = stream_decode(s);
+   stream_skip(s, stream_decode(s)); // Markup
 
-   if (modify_source_size > bps.source_length)
+   if (s->overrun || stream_tell(s) > s->size - 12 || patch->header_target_size > (size_t)-1)
+      return PATCH_PATCH_INVALID_HEADER;
+   if (patch->header_source_size > patch->source_size)
       return PATCH_SOURCE_TOO_SMALL;
-   if (modify_target_size > bps.target_length)
-      return PATCH_TARGET_TOO_SMALL;
 
-   while (bps.modify_offset < bps.modify_length - 12)
+   patch->target_size = patch->header_target_size;
+   return PATCH_SUCCESS;
+}
+
+static patch_error_t bps_apply(patch_t *patch, const uint8_t *source, uint8_t *target)
+{
+   struct patch_stream *s = &patch->stream;
+   struct patch_target t = { target, patch->target_size, 0, 0, ~0u };
+   size_t source_size = patch->source_size;
+   size_t source_offset = 0, target_offset = 0;
+   uint64_t body_end = s->size - 12;
+
+   while (stream_tell(s) < body_end)
    {
-      size_t length = bps_decode(&bps);
+      uint64_t length = stream_decode(s);
       unsigned mode = length & 3;
       length = (length >> 2) + 1;
 
+      if (s->overrun || length > t.size - t.offset)
+         return PATCH_PATCH_INVALID;
+
       switch (mode)
       {
          case SOURCE_READ:
-            while (length--)
-               bps_write(&bps, bps.source_data[bps.output_offset]);
+            if (t.offset > source_size || length > source_size - t.offset)
+               return PATCH_SOURCE_TOO_SMALL;
+            target_copy(&t, source + t.offset, length);
             break;
 
          case TARGET_READ:
-            while (length--)
-               bps_write(&bps, bps_read(&bps));
+            target_read(&t, s, length);
             break;
 
          case SOURCE_COPY:
+            if (!bps_move(&source_offset, stream_decode(s), source_size) ||
+                  length > source_size - source_offset)
+               return PATCH_PATCH_INVALID;
+            target_copy(&t, source + source_offset, length);
+            source_offset += length;
+            break;
+
          case TARGET_COPY:
-         {
-            int offset = bps_decode(&bps);
-            bool negative = offset & 1;
-            offset >>= 1;
-            if (negative)
-               offset = -offset;
-
-            if (mode == SOURCE_COPY)
-            {
-               bps.source_offset += offset;
-               while (length--)
-                  bps_write(&bps, bps.source_data[bps.source_offset++]);
-            }
-            else
-            {
-               bps.target_offset += offset;
-               while (length--)
-                  bps_write(&bps, bps.target_data[bps.target_offset++]);
-               break;
-            }
+            if (!bps_move(&target_offset, stream_decode(s), t.offset) || target_offset == t.offset)
+               return PATCH_PATCH_INVALID;
+            target_repeat(&t, target_offset, length);
+            target_offset += length;
             break;
-         }
       }
    }
 
-   uint32_t modify_source_checksum = 0, modify_target_checksum = 0, modify_modify_checksum = 0;
-   for (unsigned i = 0; i < 32; i += 8)
-      modify_source_checksum |= bps_read(&bps) << i;
-   for (unsigned i = 0; i < 32; i += 8)
-      modify_target_checksum |= bps_read(&bps) << i;
-
-   uint32_t checksum = ~bps.modify_checksum;
-   for (unsigned i = 0; i < 32; i += 8)
-      modify_modify_checksum |= bps_read(&bps) << i;
+   if (s->overrun || stream_tell(s) != body_end || t.offset != t.size)
+      return PATCH_PATCH_INVALID;
 
-   bps.source_checksum = crc32_calculate(bps.source_data, bps.source_length);
-   bps.target_checksum = ~bps.target_checksum;
+   uint32_t modify_source_checksum = stream_read32le(s);
+   uint32_t modify_target_checksum = stream_read32le(s);
+   uint32_t checksum = stream_checksum(s);
+   uint32_t modify_modify_checksum = stream_read32le(s);
 
-   if (bps.source_checksum != modify_source_checksum)
+   if (crc32_calculate(source, source_size) != modify_source_checksum)
       return PATCH_SOURCE_CHECKSUM_INVALID;
-   if (bps.target_checksum != modify_target_checksum)
+   if (target_checksum(&t) != modify_target_checksum)
       return PATCH_TARGET_CHECKSUM_INVALID;
    if (checksum != modify_modify_checksum)
       return PATCH_PATCH_CHECKSUM_INVALID;
 
-   *target_length = modify_target_size;
-
    return PATCH_SUCCESS;
 }
 
-struct ups_data
+// UPS patches apply in both directions, so the source can be either side.
+static patch_error_t ups_prepare(patch_t *patch)
 {
-   const uint8_t *patch_data, *source_data; 
-   uint8_t *target_data;
-   unsigned patch_length, source_length, target_length;
-   unsigned patch_offset, source_offset, target_offset;
-   unsigned patch_checksum, source_checksum, target_checksum;
-};
+   struct patch_stream *s = &patch->stream;
+   if (s->size < 18)
+      return PATCH_PATCH_INVALID;
 
-static uint8_t ups_patch_read(struct ups_data *data) 
-{
-   if (data->patch_offset < data->patch_length) 
-   {
-      uint8_t n = data->patch_data[data->patch_offset++];
-      data->patch_checksum = crc32_adjust(data->patch_checksum, n);
-      return n;
-   }
-   return 0x00;
-}
+   if ((stream_byte(s) != 'U') || (stream_byte(s) != 'P') || (stream_byte(s) != 'S') || (stream_byte(s) != '1'))
+      return PATCH_PATCH_INVALID;
 
-static uint8_t ups_source_read(struct ups_data *data) 
-{
-   if (data->source_offset < data->source_length) 
-   {
-      uint8_t n = data->source_data[data->source_offset++];
-      data->source_checksum = crc32_adjust(data->source_checksum, n);
-      return n;
-   }
-   return 0x00;
-}
+   patch->header_source_size = stream_decode(s);
+   patch->header_target_size = stream_decode(s);
+   if (s->overrun)
+      return PATCH_PATCH_INVALID;
 
-static void ups_target_write(struct ups_data *data, uint8_t n) 
-{
-   if (data->target_offset < data->target_length) 
-   {
-      data->target_data[data->target_offset] = n;
-      data->target_checksum = crc32_adjust(data->target_checksum, n);
-   }
+   uint64_t target_size;
+   if (patch->source_size == patch->header_source_size)
+      target_size = patch->header_target_size;
+   else if (patch->source_size == patch->header_target_size)
+      target_size = patch->header_source_size;
+   else
+      return PATCH_SOURCE_INVALID;
+
+   if (target_size > (size_t)-1)
+      return PATCH_PATCH_INVALID;
 
-   data->target_offset++;
+   patch->target_size = target_size;
+   return PATCH_SUCCESS;
 }
 
-static uint64_t ups_decode(struct ups_data *data) 
+// Writes source bytes to target positions [pos, pos + size).
+// Positions past the source read as zero, positions past the target are dropped.
+static void ups_copy(struct patch_target *t, const uint8_t *source, size_t source_size,
+      uint64_t pos, uint64_t size)
 {
-   uint64_t offset = 0, shift = 1;
-   while (true) 
-   {
-      uint8_t x = ups_patch_read(data);
-      offset += (x & 0x7f) * shift;
-      if (x & 0x80) 
-         break;
-      shift <<= 7;
-      offset += shift;
-   }
-   return offset;
-}
+   if (pos >= t->size)
+      return;
+   if (size > t->size - pos)
+      size = t->size - pos;
 
-patch_error_t ups_apply_patch(
-      const uint8_t *patchdata, size_t patchlength,
-      const uint8_t *sourcedata, size_t sourcelength,
-      uint8_t *targetdata, size_t *targetlength)
-{
-   struct ups_data data = {0};
-   data.patch_data = patchdata;
-   data.source_data = sourcedata;
-   data.target_data = targetdata;
-   data.patch_length = patchlength;
-   data.source_length = sourcelength;
-   data.target_length = *targetlength;
-   data.patch_checksum = ~0;
-   data.source_checksum = ~0;
-   data.target_checksum = ~0;
-
-   if (data.patch_length < 18) 
-      return PATCH_PATCH_INVALID;
-   if (ups_patch_read(&data) != 'U') 
-      return PATCH_PATCH_INVALID;
-   if (ups_patch_read(&data) != 'P') 
-      return PATCH_PATCH_INVALID;
-   if (ups_patch_read(&data) != 'S') 
-      return PATCH_PATCH_INVALID;
-   if (ups_patch_read(&data) != '1') 
-      return PATCH_PATCH_INVALID;
+   size_t copy = 0;
+   if (pos < source_size)
+      copy = size < source_size - pos ? size : source_size - pos;
 
-   unsigned source_read_length = ups_decode(&data);
-   unsigned target_read_length = ups_decode(&data);
+   target_copy(t, source + pos, copy);
+   target_fill(t, 0, size - copy);
+}
 
-   if (data.source_length != source_read_length && data.source_length != target_read_length) 
-      return PATCH_SOURCE_INVALID;
-   *targetlength = (data.source_length == source_read_length ? target_read_length : source_read_length);
-   if (data.target_length < *targetlength) 
-      return PATCH_TARGET_TOO_SMALL;
-   data.target_length = *targetlength;
+static patch_error_t ups_apply(patch_t *patch, const uint8_t *source, uint8_t *target)
+{
+   struct patch_stream *s = &patch->stream;
+   struct patch_target t = { target, patch->target_size, 0, 0, ~0u };
+   size_t source_size = patch->source_size;
+   uint64_t body_end = s->size - 12;
+   uint64_t pos = 0;
 
-   while (data.patch_offset < data.patch_length - 12) 
+   while (stream_tell(s) < body_end)
    {
-      unsigned length = ups_decode(&data);
-      while (length--) 
-         ups_target_write(&data, ups_source_read(&data));
-      while (true) 
+      uint64_t length = stream_decode(s);
+      if (s->overrun || pos + length < pos)
+         return PATCH_PATCH_INVALID;
+
+      ups_copy(&t, source, source_size, pos, length);
+      pos += length;
+
+      // XOR run, terminated by a zero.
+      for (;;)
       {
-         uint8_t patch_xor = ups_patch_read(&data);
-         ups_target_write(&data, patch_xor ^ ups_source_read(&data));
-         if (patch_xor == 0) break;
-      }
-   }
+         uint8_t patch_xor = stream_byte(s);
+         if (pos < t.size)
+         {
+            t.data[t.offset] = patch_xor ^ (pos < source_size ? source[pos] : 0);
+            target_advance(&t, 1);
+         }
+         pos++;
 
-   while (data.source_offset < data.source_length) 
-      ups_target_write(&data, ups_source_read(&data));
-   while (data.target_offset < data.target_length) 
-      ups_target_write(&data, ups_source_read(&data));
+         if (patch_xor == 0)
+            break;
+      }
 
-   uint32_t patch_read_checksum = 0, source_read_checksum = 0, target_read_checksum = 0;
-   for (unsigned i = 0; i < 4; i++) 
-      source_read_checksum |= ups_patch_read(&data) << (i * 8);
-   for (unsigned i = 0; i < 4; i++) 
-      target_read_checksum |= ups_patch_read(&data) << (i * 8);
+      if (s->overrun)
+         return PATCH_PATCH_INVALID;
+   }
 
-   uint32_t patch_result_checksum = ~data.patch_checksum;
-   data.source_checksum = ~data.source_checksum;
-   data.target_checksum = ~data.target_checksum;
+   ups_copy(&t, source, source_size, t.offset, t.size - t.offset);
 
-   for (unsigned i = 0; i < 4; i++) 
-      patch_read_checksum |= ups_patch_read(&data) << (i * 8);
+   uint32_t source_read_checksum = stream_read32le(s);
+   uint32_t target_read_checksum = stream_read32le(s);
+   uint32_t patch_result_checksum = stream_checksum(s);
+   uint32_t patch_read_checksum = stream_read32le(s);
 
-   if (patch_result_checksum != patch_read_checksum) 
+   if (s->overrun || patch_result_checksum != patch_read_checksum)
       return PATCH_PATCH_INVALID;
 
-   if (data.source_checksum == source_read_checksum && data.source_length == source_read_length) 
+   uint32_t source_checksum = crc32_calculate(source, source_size);
+   uint32_t target_result_checksum = target_checksum(&t);
+
+   if (source_checksum == source_read_checksum && source_size == patch->header_source_size)
    {
-      if (data.target_checksum == target_read_checksum && data.target_length == target_read_length) 
+      if (target_result_checksum == target_read_checksum && t.size == patch->header_target_size)
          return PATCH_SUCCESS;
       return PATCH_TARGET_INVALID;
-   } 
-   else if (data.source_checksum == target_read_checksum && data.source_length == target_read_length) 
+   }
+   else if (source_checksum == target_read_checksum && source_size == patch->header_target_size)
    {
-      if (data.target_checksum == source_read_checksum && data.target_length == source_read_length) 
+      if (target_result_checksum == source_read_checksum && t.size == patch->header_source_size)
          return PATCH_SUCCESS;
       return PATCH_TARGET_INVALID;
-   } 
+   }
    else
       return PATCH_SOURCE_INVALID;
 }
 
-patch_error_t ips_apply_patch(
-      const uint8_t *patchdata, size_t patchlen,
-      const uint8_t *sourcedata, size_t sourcelength,
-      uint8_t *targetdata, size_t *targetlength)
-{
-   if (patchlen < 8 ||
-         patchdata[0] != 'P' ||
-         patchdata[1] != 'A' ||
-         patchdata[2] != 'T' ||
-         patchdata[3] != 'C' ||
-         patchdata[4] != 'H')
-      return PATCH_PATCH_INVALID;
+#define IPS_EOF 0x454f46
+
+// Reads the address of the next IPS record. Returns false at the end of the patch,
+// and sets truncate if the patch ends with a target size.
+static bool ips_next_record(struct patch_stream *s, uint32_t *address, bool *truncate)
+{
+   *truncate = false;
+   *address = stream_read_be(s, 3);
+
+   if (*address == IPS_EOF)
+   {
+      uint64_t pos = stream_tell(s);
+      if (pos == s->size)
+         return false;
+      else if (pos == s->size - 3)
+      {
+         *truncate = true;
+         return false;
+      }
+   }
 
-   memcpy(targetdata, sourcedata, sourcelength);
+   return true;
+}
+
+// IPS has no header beyond the magic, so the target size is found by walking the records.
+static patch_error_t ips_prepare(patch_t *patch)
+{
+   struct patch_stream *s = &patch->stream;
+   if (s->size < 8 ||
+         stream_byte(s) != 'P' ||
+         stream_byte(s) != 'A' ||
+         stream_byte(s) != 'T' ||
+         stream_byte(s) != 'C' ||
+         stream_byte(s) != 'H')
+      return PATCH_PATCH_INVALID;
 
-   uint32_t offset = 5;
-   *targetlength = sourcelength;
+   size_t target_size = patch->source_size;
 
    for (;;)
    {
-      if (offset > patchlen - 3)
-         break;
-
-      uint32_t address = patchdata[offset++] << 16;
-      address |= patchdata[offset++] << 8;
-      address |= patchdata[offset++] << 0;
+      if (stream_tell(s) > s->size - 3)
+         return PATCH_PATCH_INVALID;
 
-      if (address == 0x454f46) // EOF
+      uint32_t address;
+      bool truncate;
+      if (!ips_next_record(s, &address, &truncate))
       {
-         if (offset == patchlen)
-            return PATCH_SUCCESS;
-         else if (offset == patchlen - 3)
-         {
-            uint32_t size = patchdata[offset++] << 16;
-            size |= patchdata[offset++] << 8;
-            size |= patchdata[offset++] << 0;
-            *targetlength = size;
-            return PATCH_SUCCESS;
-         }
+         if (truncate)
+            target_size = stream_read_be(s, 3);
+         break;
       }
 
-      if (offset > patchlen - 2)
-         break;
+      if (stream_tell(s) > s->size - 2)
+         return PATCH_PATCH_INVALID;
 
-      unsigned length = patchdata[offset++] << 8;
-      length |= patchdata[offset++] << 0;
+      unsigned length = stream_read_be(s, 2);
 
       if (length) // Copy
       {
-         if (offset > patchlen - length)
-            break;
-
-         while (length--)
-            targetdata[address++] = patchdata[offset++];
+         if (stream_tell(s) > s->size - length)
+            return PATCH_PATCH_INVALID;
+         stream_skip(s, length);
       }
       else // RLE
       {
-         if (offset > patchlen - 3)
-            break;
-
-         length  = patchdata[offset++] << 8;
-         length |= patchdata[offset++] << 0;
+         if (stream_tell(s) > s->size - 3)
+            return PATCH_PATCH_INVALID;
 
+         length = stream_read_be(s, 2);
          if (length == 0) // Illegal
-            break;
+            return PATCH_PATCH_INVALID;
+         stream_skip(s, 1);
+      }
+
+      if (address + length > target_size)
+         target_size = address + length;
+   }
 
-         while (length--)
-            targetdata[address++] = patchdata[offset];
+   patch->target_size = target_size;
+   return PATCH_SUCCESS;
+}
+
+// Records may write anywhere, so the source is copied up front. The truncated size may cut records short.
+static patch_error_t ips_apply(patch_t *patch, const uint8_t *source, uint8_t *target)
+{
+   struct patch_stream *s = &patch->stream;
+   size_t target_size = patch->target_size;
+
+   size_t copy = patch->source_size < target_size ? patch->source_size : target_size;
+   memcpy(target, source, copy);
+   memset(target + copy, 0, target_size - copy);
+
+   if (fseek(s->file, 5, SEEK_SET) < 0)
+      return PATCH_PATCH_INVALID;
+   stream_reset(s, 5);
 
-         offset++;
+   uint32_t address;
+   bool truncate;
+   while (ips_next_record(s, &address, &truncate))
+   {
+      unsigned length = stream_read_be(s, 2);
+      bool rle = length == 0;
+      if (rle)
+         length = stream_read_be(s, 2);
+
+      size_t write = 0;
+      if (address < target_size)
+         write = length < target_size - address ? length : target_size - address;
+
+      if (rle)
+         memset(target + address, stream_byte(s), write);
+      else
+      {
+         stream_read(s, target + address, write);
+         stream_skip(s, length - write);
       }
+   }
+
+   return s->overrun ? PATCH_PATCH_INVALID : PATCH_SUCCESS;
+}
+
+patch_t *patch_open(const char *path, patch_type_t type)
+{
+   FILE *file = fopen(path, "rb");
+   if (!file)
+      return NULL;
 
-      if (address > *targetlength)
-         *targetlength = address;
+   patch_t *patch = (patch_t*)calloc(1, sizeof(*patch));
+   if (!patch)
+   {
+      fclose(file);
+      return NULL;
    }
 
-   return PATCH_PATCH_INVALID;
+   patch->type = type;
+   patch->stream.file = file;
+
+   fseek(file, 0, SEEK_END);
+   long size = ftell(file);
+   rewind(file);
+   patch->stream.size = size > 0 ? size : 0;
+
+   stream_reset(&patch->stream, 0);
+   return patch;
+}
+
+void patch_close(patch_t *patch)
+{
+   if (!patch)
+      return;
+
+   fclose(patch->stream.file);
+   free(patch);
 }
 
+patch_error_t patch_prepare(patch_t *patch, size_t source_size, size_t *target_size)
+{
+   if (patch->prepared)
+      return PATCH_UNKNOWN;
+
+   patch->source_size = source_size;
+
+   patch_error_t err = PATCH_UNKNOWN;
+   switch (patch->type)
+   {
+      case PATCH_TYPE_BPS:
+         err = bps_prepare(patch);
+         break;
+      case PATCH_TYPE_UPS:
+         err = ups_prepare(patch);
+         break;
+      case PATCH_TYPE_IPS:
+         err = ips_prepare(patch);
+         break;
+   }
+
+   if (err == PATCH_SUCCESS)
+   {
+      patch->prepared = true;
+      *target_size = patch->target_size;
+   }
+   return err;
+}
+
+patch_error_t patch_apply(patch_t *patch, const uint8_t *source, uint8_t *target)
+{
+   if (!patch->prepared || patch->applied)
+      return PATCH_UNKNOWN;
+
+   patch->applied = true;
+
+   switch (patch->type)
+   {
+      case PATCH_TYPE_BPS:
+         return bps_apply(patch, source, target);
+      case PATCH_TYPE_UPS:
+         return ups_apply(patch, source, target);
+      case PATCH_TYPE_IPS:
+         return ips_apply(patch, source, target);
+   }
+
+   return PATCH_UNKNOWN;
+}
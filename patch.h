@@ -38,22 +38,28 @@ typedef enum
    PATCH_PATCH_CHECKSUM_INVALID
 } patch_error_t;
 
-typedef patch_error_t (*patch_func_t)(const uint8_t*, size_t, const uint8_t*, size_t, uint8_t*, size_t*);
+typedef enum
+{
+   PATCH_TYPE_IPS,
+   PATCH_TYPE_UPS,
+   PATCH_TYPE_BPS
+} patch_type_t;
 
-patch_error_t bps_apply_patch(
-      const uint8_t *patch_data, size_t patch_length,
-      const uint8_t *source_data, size_t source_length,
-      uint8_t *target_data, size_t *target_length);
+// Patches are applied in one pass, while reading the patch file in small blocks.
+// Only the source and target images are ever fully in memory.
+typedef struct patch patch_t;
 
-patch_error_t ups_apply_patch(
-      const uint8_t *patch_data, size_t patch_length,
-      const uint8_t *source_data, size_t source_length,
-      uint8_t *target_data, size_t *target_length);
+// Returns NULL if the file cannot be opened.
+patch_t *patch_open(const char *path, patch_type_t type);
+void patch_close(patch_t *patch);
 
+// Reads the patch header and checks it against the size of the source.
+// On success, target_size is set to the size of the patched image.
+patch_error_t patch_prepare(patch_t *patch, size_t source_size, size_t *target_size);
 
-patch_error_t ips_apply_patch(
-      const uint8_t *patch_data, size_t patch_length,
-      const uint8_t *source_data, size_t source_length,
-      uint8_t *target_data, size_t *target_length);
+// Writes the patched image to target, which must hold target_size bytes as returned by patch_prepare().
+// Source and target must not overlap. All checksums are verified as the patch is applied.
+// Can only be called once per opened patch.
+patch_error_t patch_apply(patch_t *patch, const uint8_t *source, uint8_t *target);
 
 #endif
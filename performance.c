@@ -15,11 +15,22 @@
  */
 
 #include "performance.h"
+#include <math.h>
+#include <string.h>
 
 #ifdef ANDROID
 #include "android/native/jni/cpufeatures.h"
 #endif
 
+#if defined(__CELLOS_LV2__) && !defined(__PSL1GHT__)
+#include <sys/sys_time.h>
+#elif defined(GEKKO)
+#include <ogc/lwp_watchdog.h>
+#elif !defined(_WIN32)
+#include <sys/time.h>
+#include <time.h>
+#endif
+
 #ifdef PERF_TEST
 
 #if defined(__CELLOS_LV2__) || defined(GEKKO)
@@ -121,10 +132,10 @@ static void x86_cpuid(int func, int flags[4])
          "cpuid\n"
          "xchg %%" REG_b ", %%" REG_S "\n"
          : "=a"(flags[0]), "=S"(flags[1]), "=c"(flags[2]), "=d"(flags[3])
-         : "a"(func));
+         : "a"(func), "c"(0));
 
 #elif defined(_MSC_VER)
-   __cpuid(flags, func);
+   __cpuidex(flags, func, 0);
 #endif
 }
 #endif
@@ -142,7 +153,8 @@ void rarch_get_cpu_features(struct rarch_cpu_features *cpu)
    memcpy(vendor, vendor_shuffle, sizeof(vendor_shuffle));
    RARCH_LOG("[CPUID]: Vendor: %s\n", vendor);
 
-   if (flags[0] < 1) // Does CPUID not support func = 1? (unlikely ...)
+   int max_flag = flags[0];
+   if (max_flag < 1) // Does CPUID not support func = 1? (unlikely ...)
       return;
 
    x86_cpuid(1, flags);
@@ -153,13 +165,39 @@ void rarch_get_cpu_features(struct rarch_cpu_features *cpu)
    if (flags[3] & (1 << 26))
       cpu->simd |= RARCH_SIMD_SSE2;
 
+   if (flags[2] & (1 << 9))
+      cpu->simd |= RARCH_SIMD_SSSE3;
+
+   if (flags[2] & (1 << 19))
+      cpu->simd |= RARCH_SIMD_SSE4;
+
+   if (flags[2] & (1 << 1))
+      cpu->simd |= RARCH_SIMD_PCLMUL;
+
    const int avx_flags = (1 << 27) | (1 << 28);
    if ((flags[2] & avx_flags) == avx_flags)
       cpu->simd |= RARCH_SIMD_AVX;
 
-   RARCH_LOG("[CPUID]: SSE:  %u\n", !!(cpu->simd & RARCH_SIMD_SSE));
-   RARCH_LOG("[CPUID]: SSE2: %u\n", !!(cpu->simd & RARCH_SIMD_SSE2));
-   RARCH_LOG("[CPUID]: AVX:  %u\n", !!(cpu->simd & RARCH_SIMD_AVX));
+   if (max_flag >= 7)
+   {
+      x86_cpuid(7, flags);
+
+      // AVX2 is only meaningful if AVX is usable by the OS.
+      if ((flags[1] & (1 << 5)) && (cpu->simd & RARCH_SIMD_AVX))
+         cpu->simd |= RARCH_SIMD_AVX2;
+
+      if (flags[1] & (1 << 29))
+         cpu->simd |= RARCH_SIMD_SHA;
+   }
+
+   RARCH_LOG("[CPUID]: SSE:    %u\n", !!(cpu->simd & RARCH_SIMD_SSE));
+   RARCH_LOG("[CPUID]: SSE2:   %u\n", !!(cpu->simd & RARCH_SIMD_SSE2));
+   RARCH_LOG("[CPUID]: SSSE3:  %u\n", !!(cpu->simd & RARCH_SIMD_SSSE3));
+   RARCH_LOG("[CPUID]: SSE4.1: %u\n", !!(cpu->simd & RARCH_SIMD_SSE4));
+   RARCH_LOG("[CPUID]: PCLMUL: %u\n", !!(cpu->simd & RARCH_SIMD_PCLMUL));
+   RARCH_LOG("[CPUID]: SHA:    %u\n", !!(cpu->simd & RARCH_SIMD_SHA));
+   RARCH_LOG("[CPUID]: AVX:    %u\n", !!(cpu->simd & RARCH_SIMD_AVX));
+   RARCH_LOG("[CPUID]: AVX2:   %u\n", !!(cpu->simd & RARCH_SIMD_AVX2));
 #elif defined(ANDROID) && defined(ANDROID_ARM)
    uint64_t cpu_flags = android_getCpuFeatures();
 
@@ -175,3 +213,222 @@ void rarch_get_cpu_features(struct rarch_cpu_features *cpu)
    RARCH_LOG("[CPUID]: VMX128: %u\n", !!(cpu->simd & RARCH_SIMD_VMX128));
 #endif
 }
+
+rarch_usec_t rarch_get_time_usec(void)
+{
+#if defined(_WIN32)
+   static LARGE_INTEGER freq;
+   LARGE_INTEGER count;
+   if (!freq.QuadPart)
+      QueryPerformanceFrequency(&freq);
+   QueryPerformanceCounter(&count);
+
+   // Split up to avoid overflowing with high frequency counters.
+   return (count.QuadPart / freq.QuadPart) * 1000000 +
+      (count.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#elif defined(__CELLOS_LV2__) && !defined(__PSL1GHT__)
+   return sys_time_get_system_time();
+#elif defined(GEKKO)
+   return ticks_to_microsecs(gettime());
+#elif defined(__MACH__) // OSX doesn't have clock_gettime ... :(
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return (rarch_usec_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#else
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return (rarch_usec_t)tv.tv_sec * 1000000 + tv.tv_nsec / 1000;
+#endif
+}
+
+// Histograms are log-linear, like HdrHistogram. Values below 2 * FRAME_HIST_SUB are exact,
+// above that every power of two is split in FRAME_HIST_SUB buckets, i.e. ~6% precision.
+// Highest bucket covers everything from ~67 seconds.
+#define FRAME_HIST_SUB_BITS 4
+#define FRAME_HIST_SUB (1 << FRAME_HIST_SUB_BITS)
+#define FRAME_HIST_MAX_BITS 26
+#define FRAME_HIST_BUCKETS ((FRAME_HIST_MAX_BITS - FRAME_HIST_SUB_BITS + 2) * FRAME_HIST_SUB)
+
+#define FRAME_RING_SIZE 256
+
+struct frame_hist
+{
+   uint32_t buckets[FRAME_HIST_BUCKETS];
+   uint64_t count;
+   uint64_t total;
+   rarch_usec_t max;
+};
+
+struct frame_record
+{
+   uint64_t frame;
+   uint32_t usec[RARCH_FRAME_STAGE_LAST];
+};
+
+static struct
+{
+   struct frame_hist hist[RARCH_FRAME_STAGE_LAST];
+   struct frame_record ring[FRAME_RING_SIZE];
+   unsigned ring_ptr;
+   uint64_t frames;
+
+   rarch_usec_t stage[RARCH_FRAME_STAGE_LAST];
+   rarch_usec_t frame_start;
+   rarch_usec_t prev_frame_start;
+} frame_stats;
+
+static const char *frame_stage_names[RARCH_FRAME_STAGE_LAST] = {
+   "input_poll",
+   "run",
+   "video",
+   "audio",
+   "swap",
+   "frame",
+   "interval",
+};
+
+static unsigned frame_hist_index(rarch_usec_t usec)
+{
+   if (usec < 2 * FRAME_HIST_SUB)
+      return usec;
+
+   unsigned msb = 0;
+   for (rarch_usec_t v = usec; v > 1; v >>= 1)
+      msb++;
+
+   if (msb > FRAME_HIST_MAX_BITS)
+      return FRAME_HIST_BUCKETS - 1;
+
+   unsigned shift = msb - FRAME_HIST_SUB_BITS;
+   return (shift + 1) * FRAME_HIST_SUB + (unsigned)(usec >> shift) - FRAME_HIST_SUB;
+}
+
+// Highest value which lands in bucket.
+static rarch_usec_t frame_hist_value(unsigned index)
+{
+   if (index < 2 * FRAME_HIST_SUB)
+      return index;
+
+   unsigned shift = index / FRAME_HIST_SUB - 1;
+   rarch_usec_t sub = index % FRAME_HIST_SUB + FRAME_HIST_SUB;
+   return ((sub + 1) << shift) - 1;
+}
+
+static rarch_usec_t frame_hist_percentile(const struct frame_hist *hist, double percentile)
+{
+   uint64_t target = (uint64_t)ceil(hist->count * percentile);
+   uint64_t seen = 0;
+
+   for (unsigned i = 0; i < FRAME_HIST_BUCKETS; i++)
+   {
+      seen += hist->buckets[i];
+      if (seen >= target && seen)
+      {
+         rarch_usec_t value = frame_hist_value(i);
+         return value < hist->max ? value : hist->max;
+      }
+   }
+
+   return hist->max;
+}
+
+void rarch_frame_stats_begin(void)
+{
+   frame_stats.frame_start = rarch_get_time_usec();
+   memset(frame_stats.stage, 0, sizeof(frame_stats.stage));
+}
+
+void rarch_frame_stats_add(enum rarch_frame_stage stage, rarch_usec_t start)
+{
+   frame_stats.stage[stage] += rarch_get_time_usec() - start;
+}
+
+void rarch_frame_stats_end(void)
+{
+   rarch_usec_t *stage = frame_stats.stage;
+   stage[RARCH_FRAME_STAGE_FRAME] = rarch_get_time_usec() - frame_stats.frame_start;
+
+   // Make stages exclusive. Callbacks are nested inside pretro_run(), and swap inside video.
+   stage[RARCH_FRAME_STAGE_VIDEO] -= min(stage[RARCH_FRAME_STAGE_VIDEO], stage[RARCH_FRAME_STAGE_SWAP]);
+   rarch_usec_t nested = stage[RARCH_FRAME_STAGE_INPUT_POLL] + stage[RARCH_FRAME_STAGE_VIDEO] +
+      stage[RARCH_FRAME_STAGE_SWAP] + stage[RARCH_FRAME_STAGE_AUDIO];
+   stage[RARCH_FRAME_STAGE_RUN] -= min(stage[RARCH_FRAME_STAGE_RUN], nested);
+
+   // First frame has no interval.
+   unsigned stages = RARCH_FRAME_STAGE_LAST;
+   if (frame_stats.prev_frame_start)
+      stage[RARCH_FRAME_STAGE_INTERVAL] = frame_stats.frame_start - frame_stats.prev_frame_start;
+   else
+      stages = RARCH_FRAME_STAGE_INTERVAL;
+   frame_stats.prev_frame_start = frame_stats.frame_start;
+
+   struct frame_record *record = &frame_stats.ring[frame_stats.ring_ptr];
+   frame_stats.ring_ptr = (frame_stats.ring_ptr + 1) % FRAME_RING_SIZE;
+   record->frame = g_extern.frame_count;
+
+   for (unsigned i = 0; i < RARCH_FRAME_STAGE_LAST; i++)
+   {
+      record->usec[i] = stage[i] > UINT32_MAX ? UINT32_MAX : stage[i];
+      if (i >= stages)
+         continue;
+
+      struct frame_hist *hist = &frame_stats.hist[i];
+      hist->buckets[frame_hist_index(stage[i])]++;
+      hist->count++;
+      hist->total += stage[i];
+      if (stage[i] > hist->max)
+         hist->max = stage[i];
+   }
+
+   frame_stats.frames++;
+}
+
+void rarch_frame_stats_break(void)
+{
+   frame_stats.prev_frame_start = 0;
+}
+
+void rarch_frame_stats_reset(void)
+{
+   memset(&frame_stats, 0, sizeof(frame_stats));
+}
+
+void rarch_frame_stats_dump(FILE *file, bool recent_frames)
+{
+   fprintf(file, "Frame stats for %llu frames (usec):\n", (unsigned long long)frame_stats.frames);
+   fprintf(file, "%-10s %9s %9s %9s %9s %9s %9s\n", "stage", "mean", "p50", "p90", "p99", "p99.9", "max");
+
+   for (unsigned i = 0; i < RARCH_FRAME_STAGE_LAST; i++)
+   {
+      const struct frame_hist *hist = &frame_stats.hist[i];
+      if (!hist->count)
+         continue;
+
+      fprintf(file, "%-10s %9.1f %9llu %9llu %9llu %9llu %9llu\n", frame_stage_names[i],
+            (double)hist->total / hist->count,
+            (unsigned long long)frame_hist_percentile(hist, 0.50),
+            (unsigned long long)frame_hist_percentile(hist, 0.90),
+            (unsigned long long)frame_hist_percentile(hist, 0.99),
+            (unsigned long long)frame_hist_percentile(hist, 0.999),
+            (unsigned long long)hist->max);
+   }
+
+   if (!recent_frames)
+      return;
+
+   uint64_t recent = frame_stats.frames < FRAME_RING_SIZE ? frame_stats.frames : FRAME_RING_SIZE;
+   fprintf(file, "\nLast %u frames (usec):\n%10s", (unsigned)recent, "frame");
+   for (unsigned i = 0; i < RARCH_FRAME_STAGE_LAST; i++)
+      fprintf(file, " %10s", frame_stage_names[i]);
+   fprintf(file, "\n");
+
+   unsigned ptr = (frame_stats.ring_ptr + FRAME_RING_SIZE - recent) % FRAME_RING_SIZE;
+   for (unsigned r = 0; r < recent; r++, ptr = (ptr + 1) % FRAME_RING_SIZE)
+   {
+      const struct frame_record *record = &frame_stats.ring[ptr];
+      fprintf(file, "%10llu", (unsigned long long)record->frame);
+      for (unsigned i = 0; i < RARCH_FRAME_STAGE_LAST; i++)
+         fprintf(file, " %10u", record->usec[i]);
+      fprintf(file, "\n");
+   }
+}
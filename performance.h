@@ -52,9 +52,44 @@ struct rarch_cpu_features
 #define RARCH_SIMD_VMX128   (1 << 3)
 #define RARCH_SIMD_AVX      (1 << 4)
 #define RARCH_SIMD_NEON     (1 << 5)
+#define RARCH_SIMD_AVX2     (1 << 6)
+#define RARCH_SIMD_SSSE3    (1 << 7)
+#define RARCH_SIMD_SSE4     (1 << 8)
+#define RARCH_SIMD_PCLMUL   (1 << 9)
+#define RARCH_SIMD_SHA      (1 << 10)
 
 void rarch_get_cpu_features(struct rarch_cpu_features *cpu);
 
+// Frame timing. Unlike the counters below, this is always built and always running.
+// Every frame, time spent in each stage is recorded into a histogram and a ring of recent frames.
+typedef uint64_t rarch_usec_t;
+
+// Monotonic wall clock in microseconds.
+rarch_usec_t rarch_get_time_usec(void);
+
+enum rarch_frame_stage
+{
+   RARCH_FRAME_STAGE_INPUT_POLL = 0,
+   RARCH_FRAME_STAGE_RUN,      // pretro_run(), not counting input, video and audio callbacks.
+   RARCH_FRAME_STAGE_VIDEO,    // video_frame(), not counting swap.
+   RARCH_FRAME_STAGE_AUDIO,
+   RARCH_FRAME_STAGE_SWAP,
+   RARCH_FRAME_STAGE_FRAME,    // All of rarch_main_iterate().
+   RARCH_FRAME_STAGE_INTERVAL, // From start of previous frame to start of this one.
+
+   RARCH_FRAME_STAGE_LAST
+};
+
+void rarch_frame_stats_begin(void);
+void rarch_frame_stats_end(void);
+// Next frame won't count towards frame intervals, e.g. after pausing.
+void rarch_frame_stats_break(void);
+// Adds time since start to a stage. A stage may be entered several times per frame.
+void rarch_frame_stats_add(enum rarch_frame_stage stage, rarch_usec_t start);
+void rarch_frame_stats_reset(void);
+// Writes percentiles for every stage, and optionally the ring of recent frames.
+void rarch_frame_stats_dump(FILE *file, bool recent_frames);
+
 #ifdef PERF_TEST
 
 #define RARCH_PERFORMANCE_INIT(X)  static rarch_perf_counter_t X = {#X}; \
@@ -6,6 +6,7 @@ HAVE_THREADS=auto       # Threading support
 HAVE_FFMPEG=auto        # Enable FFmpeg recording support
 HAVE_DYLIB=auto         # Enable dynamic loading support
 HAVE_NETPLAY=auto       # Enable netplay support
+HAVE_ZLIB=auto          # Enable zlib support (compresses netplay states)
 HAVE_CONFIGFILE=yes     # Disable support for config file
 HAVE_OPENGL=yes         # Disable OpenGL support
 HAVE_GLES=no            # Use GLESv2 instead of desktop GL
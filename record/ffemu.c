@@ -34,6 +34,7 @@ extern "C" {
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "../boolean.h"
 #include "../fifo_buffer.h"
 #include "../thread.h"
@@ -147,6 +148,14 @@ struct ff_config_param
    AVDictionary *audio_opts;
 };
 
+#define FFEMU_FRAME_POOL 8
+
+struct ffemu_video_frame
+{
+   struct ffemu_video_data data;
+   int index; // Index into frame pool, -1 for dupes.
+};
+
 struct ffemu
 {
    struct ff_video_info video;
@@ -156,14 +165,21 @@ struct ffemu
    
    struct ffemu_params params;
 
+   // The FIFOs are single-producer/single-consumer and lock-free.
+   // cond and cond_lock are only used to sleep when a thread has nothing to do.
    scond_t *cond;
    slock_t *cond_lock;
-   slock_t *lock;
    fifo_buffer_t *audio_fifo;
-   fifo_buffer_t *video_fifo;
    fifo_buffer_t *attr_fifo;
    sthread_t *thread;
 
+   // Pool of video frames. A frame is owned by the producer until it is pushed
+   // through attr_fifo, and the encoder hands it back through free_fifo once encoded.
+   uint8_t *frames[FFEMU_FRAME_POOL];
+   size_t frame_size;
+   int pending_frame; // Acquired by producer, but not pushed yet. -1 if none.
+   fifo_buffer_t *free_fifo;
+
    volatile bool alive;
    volatile bool can_sleep;
 };
@@ -277,7 +293,7 @@ static bool ffemu_init_audio(ffemu_t *handle)
       audio->codec->sample_rate = params->sample_rate;
       audio->codec->time_base = av_d2q(1.0 / params->sample_rate, 1000000);
 
-      audio->resampler = resampler_new();
+      audio->resampler = resampler_new(RESAMPLER_QUALITY_HIGH);
    }
    else
    {
@@ -403,6 +419,8 @@ static bool ffemu_init_video(ffemu_t *handle)
          return false;
    }
 
+   video->scaler.threads = param->scaler_threads;
+
    video->codec = avcodec_alloc_context3(codec);
 
    // Useful to set scale_factor to 2 for chroma subsampled formats to maintain full chroma resolution.
@@ -550,21 +568,32 @@ static void ffemu_thread(void *data);
 
 static bool init_thread(ffemu_t *handle)
 {
-   handle->lock = slock_new();
    handle->cond_lock = slock_new();
    handle->cond = scond_new();
    handle->audio_fifo = fifo_new(32000 * sizeof(int16_t) * handle->params.channels * MAX_FRAMES / 60); // Some arbitrary max size.
-   handle->attr_fifo = fifo_new(sizeof(struct ffemu_video_data) * MAX_FRAMES);
-   handle->video_fifo = fifo_new(handle->params.fb_width * handle->params.fb_height *
-            handle->video.pix_size * MAX_FRAMES);
+   handle->attr_fifo = fifo_new(sizeof(struct ffemu_video_frame) * MAX_FRAMES);
+   handle->free_fifo = fifo_new(sizeof(unsigned) * FFEMU_FRAME_POOL);
+   assert(handle->free_fifo);
+
+   // For some reason, FFmpeg has a tendency to crash if we don't overallocate a bit. :s
+   handle->frame_size = (handle->params.fb_height + 1) *
+      handle->params.fb_width * handle->video.pix_size;
+
+   for (unsigned i = 0; i < FFEMU_FRAME_POOL; i++)
+   {
+      handle->frames[i] = (uint8_t*)av_malloc(handle->frame_size);
+      assert(handle->frames[i]);
+      fifo_write(handle->free_fifo, &i, sizeof(i));
+   }
+   handle->pending_frame = -1;
 
    handle->alive = true;
    handle->can_sleep = true;
    handle->thread = sthread_create(ffemu_thread, handle);
 
-   assert(handle->lock && handle->cond_lock &&
+   assert(handle->cond_lock &&
       handle->cond && handle->audio_fifo &&
-      handle->attr_fifo && handle->video_fifo && handle->thread);
+      handle->attr_fifo && handle->thread);
 
    return true;
 }
@@ -582,7 +611,6 @@ static void deinit_thread(ffemu_t *handle)
    scond_signal(handle->cond);
    sthread_join(handle->thread);
 
-   slock_free(handle->lock);
    slock_free(handle->cond_lock);
    scond_free(handle->cond);
 
@@ -603,10 +631,16 @@ static void deinit_thread_buf(ffemu_t *handle)
       handle->attr_fifo = NULL;
    }
 
-   if (handle->video_fifo)
+   if (handle->free_fifo)
    {
-      fifo_free(handle->video_fifo);
-      handle->video_fifo = NULL;
+      fifo_free(handle->free_fifo);
+      handle->free_fifo = NULL;
+   }
+
+   for (unsigned i = 0; i < FFEMU_FRAME_POOL; i++)
+   {
+      av_free(handle->frames[i]);
+      handle->frames[i] = NULL;
    }
 }
 
@@ -694,90 +728,137 @@ void ffemu_free(ffemu_t *handle)
    free(handle);
 }
 
-bool ffemu_push_video(ffemu_t *handle, const struct ffemu_video_data *data)
+static void ffemu_sleep(ffemu_t *handle)
+{
+   slock_lock(handle->cond_lock);
+   if (handle->can_sleep)
+   {
+      handle->can_sleep = false;
+      scond_wait(handle->cond, handle->cond_lock);
+      handle->can_sleep = true;
+   }
+   else
+      scond_signal(handle->cond);
+
+   slock_unlock(handle->cond_lock);
+}
+
+static bool ffemu_drop_frame(ffemu_t *handle)
 {
    bool drop_frame = handle->video.frame_drop_count++ % handle->video.frame_drop_ratio;
    handle->video.frame_drop_count %= handle->video.frame_drop_ratio;
-   if (drop_frame)
-      return true;
+   return drop_frame;
+}
 
-   for (;;)
+// Grabs a free frame from the pool. If every frame is in flight,
+// we wait for the encoder to give one back rather than dropping the frame.
+static int ffemu_acquire_frame(ffemu_t *handle)
+{
+   if (handle->pending_frame >= 0)
+      return handle->pending_frame;
+
+   while (fifo_read_avail(handle->free_fifo) < sizeof(unsigned))
    {
-      slock_lock(handle->lock);
-      unsigned avail = fifo_write_avail(handle->attr_fifo);
-      slock_unlock(handle->lock);
+      if (!handle->alive)
+         return -1;
+
+      ffemu_sleep(handle);
+   }
 
+   unsigned index;
+   fifo_read(handle->free_fifo, &index, sizeof(index));
+   handle->pending_frame = index;
+   return index;
+}
+
+static bool ffemu_submit_frame(ffemu_t *handle, const struct ffemu_video_data *data, int index)
+{
+   while (fifo_write_avail(handle->attr_fifo) < sizeof(struct ffemu_video_frame))
+   {
       if (!handle->alive)
          return false;
 
-      if (avail >= sizeof(*data))
-         break;
+      ffemu_sleep(handle);
+   }
 
-      slock_lock(handle->cond_lock);
-      if (handle->can_sleep)
-      {
-         handle->can_sleep = false;
-         scond_wait(handle->cond, handle->cond_lock);
-         handle->can_sleep = true;
-      }
-      else
-         scond_signal(handle->cond);
+   struct ffemu_video_frame frame;
+   frame.data  = *data;
+   frame.index = index;
 
-      slock_unlock(handle->cond_lock);
-   }
+   fifo_write(handle->attr_fifo, &frame, sizeof(frame));
+   if (index >= 0)
+      handle->pending_frame = -1;
+
+   scond_signal(handle->cond);
+   return true;
+}
 
-   slock_lock(handle->lock);
+bool ffemu_push_video(ffemu_t *handle, const struct ffemu_video_data *data)
+{
+   if (ffemu_drop_frame(handle))
+      return true;
 
-   // Tightly pack our frame to conserve memory. libretro tends to use a very large pitch.
    struct ffemu_video_data attr_data = *data;
+   int index = -1;
 
    if (attr_data.is_dupe)
+   {
+      attr_data.data  = NULL;
       attr_data.width = attr_data.height = attr_data.pitch = 0;
+   }
    else
+   {
+      index = ffemu_acquire_frame(handle);
+      if (index < 0)
+         return false;
+
+      // Tightly pack our frame to conserve memory. libretro tends to use a very large pitch.
+      // This is the only copy the frame goes through, the encoder converts straight out of the pool.
+      uint8_t *out = handle->frames[index];
+      const uint8_t *in = (const uint8_t*)data->data;
       attr_data.pitch = attr_data.width * handle->video.pix_size;
+      attr_data.data  = out;
 
-   fifo_write(handle->attr_fifo, &attr_data, sizeof(attr_data));
+      for (unsigned y = 0; y < attr_data.height; y++, in += data->pitch, out += attr_data.pitch)
+         memcpy(out, in, attr_data.pitch);
+   }
 
-   int offset = 0;
-   for (unsigned y = 0; y < attr_data.height; y++, offset += data->pitch)
-      fifo_write(handle->video_fifo, (const uint8_t*)data->data + offset, attr_data.pitch);
+   return ffemu_submit_frame(handle, &attr_data, index);
+}
 
-   slock_unlock(handle->lock);
-   scond_signal(handle->cond);
+void *ffemu_get_video_frame(ffemu_t *handle, size_t *size)
+{
+   int index = ffemu_acquire_frame(handle);
+   if (index < 0)
+      return NULL;
 
-   return true;
+   *size = handle->frame_size;
+   return handle->frames[index];
+}
+
+bool ffemu_push_video_frame(ffemu_t *handle, const struct ffemu_video_data *data)
+{
+   // A dropped frame stays pending, and is handed out again by ffemu_get_video_frame().
+   if (ffemu_drop_frame(handle))
+      return true;
+
+   if (handle->pending_frame < 0)
+      return false;
+
+   return ffemu_submit_frame(handle, data, handle->pending_frame);
 }
 
 bool ffemu_push_audio(ffemu_t *handle, const struct ffemu_audio_data *data)
 {
-   for (;;)
+   while (fifo_write_avail(handle->audio_fifo) < data->frames * handle->params.channels * sizeof(int16_t))
    {
-      slock_lock(handle->lock);
-      unsigned avail = fifo_write_avail(handle->audio_fifo);
-      slock_unlock(handle->lock);
-
       if (!handle->alive)
          return false;
 
-      if (avail >= data->frames * handle->params.channels * sizeof(int16_t))
-         break;
-
-      slock_lock(handle->cond_lock);
-      if (handle->can_sleep)
-      {
-         handle->can_sleep = false;
-         scond_wait(handle->cond, handle->cond_lock);
-         handle->can_sleep = true;
-      }
-      else
-         scond_signal(handle->cond);
-
-      slock_unlock(handle->cond_lock);
+      ffemu_sleep(handle);
    }
 
-   slock_lock(handle->lock);
    fifo_write(handle->audio_fifo, data->data, data->frames * handle->params.channels * sizeof(int16_t));
-   slock_unlock(handle->lock);
    scond_signal(handle->cond);
 
    return true;
@@ -838,7 +919,6 @@ static void ffemu_scale_input(ffemu_t *handle, const struct ffemu_video_data *da
       {
          handle->video.scaler.in_width  = data->width;
          handle->video.scaler.in_height = data->height;
-         handle->video.scaler.in_stride = data->pitch;
 
          handle->video.scaler.scaler_type = shrunk ? SCALER_TYPE_BILINEAR : SCALER_TYPE_POINT;
 
@@ -849,6 +929,8 @@ static void ffemu_scale_input(ffemu_t *handle, const struct ffemu_video_data *da
          scaler_ctx_gen_filter(&handle->video.scaler);
       }
 
+      // Pitch can differ between frames of the same size, e.g. flipped GPU read-backs.
+      handle->video.scaler.in_stride = data->pitch;
       scaler_ctx_scale(&handle->video.scaler, handle->video.conv_frame->data[0], data->data);
    }
 }
@@ -1112,9 +1194,23 @@ static void ffemu_flush_video(ffemu_t *handle)
    }
 }
 
+// Encodes the next frame straight out of its pool buffer, and gives the buffer back to the producer.
+static void ffemu_pull_video(ffemu_t *handle)
+{
+   struct ffemu_video_frame frame;
+   fifo_read(handle->attr_fifo, &frame, sizeof(frame));
+
+   ffemu_push_video_thread(handle, &frame.data);
+
+   if (frame.index >= 0)
+   {
+      unsigned index = frame.index;
+      fifo_write(handle->free_fifo, &index, sizeof(index));
+   }
+}
+
 static void ffemu_flush_buffers(ffemu_t *handle)
 {
-   void *video_buf = av_malloc(2 * handle->params.fb_width * handle->params.fb_height * handle->video.pix_size);
    size_t audio_buf_size = handle->audio.codec->frame_size * handle->params.channels * sizeof(int16_t);
    void *audio_buf = av_malloc(audio_buf_size);
 
@@ -1136,14 +1232,9 @@ static void ffemu_flush_buffers(ffemu_t *handle)
          did_work = true;
       }
 
-      struct ffemu_video_data attr_buf;
-      if (fifo_read_avail(handle->attr_fifo) >= sizeof(attr_buf))
+      if (fifo_read_avail(handle->attr_fifo) >= sizeof(struct ffemu_video_frame))
       {
-         fifo_read(handle->attr_fifo, &attr_buf, sizeof(attr_buf));
-         fifo_read(handle->video_fifo, video_buf, attr_buf.height * attr_buf.pitch);
-         attr_buf.data = video_buf;
-         ffemu_push_video_thread(handle, &attr_buf);
-
+         ffemu_pull_video(handle);
          did_work = true;
       }
    } while (did_work);
@@ -1154,7 +1245,6 @@ static void ffemu_flush_buffers(ffemu_t *handle)
    // Flush out last video.
    ffemu_flush_video(handle);
 
-   av_free(video_buf);
    av_free(audio_buf);
 }
 
@@ -1177,71 +1267,54 @@ static void ffemu_thread(void *data)
 {
    ffemu_t *ff = (ffemu_t*)data;
 
-   // For some reason, FFmpeg has a tendency to crash if we don't overallocate a bit. :s
-   void *video_buf = av_malloc(2 * ff->params.fb_width * ff->params.fb_height * ff->video.pix_size);
-   assert(video_buf);
-
    size_t audio_buf_size = ff->audio.codec->frame_size * ff->params.channels * sizeof(int16_t);
    void *audio_buf = av_malloc(audio_buf_size);
 
    while (ff->alive)
    {
-      struct ffemu_video_data attr_buf;
-
       bool avail_video = false;
       bool avail_audio = false;
 
-      slock_lock(ff->lock);
-      if (fifo_read_avail(ff->attr_fifo) >= sizeof(attr_buf))
+      if (fifo_read_avail(ff->attr_fifo) >= sizeof(struct ffemu_video_frame))
          avail_video = true;
 
       if (fifo_read_avail(ff->audio_fifo) >= audio_buf_size)
          avail_audio = true;
-      slock_unlock(ff->lock);
 
       if (!avail_video && !avail_audio)
-      {
-         slock_lock(ff->cond_lock);
-         if (ff->can_sleep)
-         {
-            ff->can_sleep = false;
-            scond_wait(ff->cond, ff->cond_lock);
-            ff->can_sleep = true;
-         }
-         else
-            scond_signal(ff->cond);
-
-         slock_unlock(ff->cond_lock);
-      }
+         ffemu_sleep(ff);
 
       if (avail_video)
       {
-         slock_lock(ff->lock);
-         fifo_read(ff->attr_fifo, &attr_buf, sizeof(attr_buf));
-         fifo_read(ff->video_fifo, video_buf, attr_buf.height * attr_buf.pitch);
-         slock_unlock(ff->lock);
+         ffemu_pull_video(ff);
          scond_signal(ff->cond);
-
-         attr_buf.data = video_buf;
-         ffemu_push_video_thread(ff, &attr_buf);
       }
 
       if (avail_audio)
       {
-         slock_lock(ff->lock);
-         fifo_read(ff->audio_fifo, audio_buf, audio_buf_size);
-         slock_unlock(ff->lock);
-         scond_signal(ff->cond);
-
          struct ffemu_audio_data aud = {0};
          aud.frames = ff->audio.codec->frame_size;
-         aud.data = audio_buf;
 
-         ffemu_push_audio_thread(ff, &aud, true);
+         // Encode straight out of the FIFO unless the samples wrap around the end of it.
+         size_t contiguous = 0;
+         const void *samples = fifo_read_peek(ff->audio_fifo, &contiguous);
+         if (contiguous >= audio_buf_size)
+         {
+            aud.data = samples;
+            ffemu_push_audio_thread(ff, &aud, true);
+            fifo_read_consume(ff->audio_fifo, audio_buf_size);
+         }
+         else
+         {
+            fifo_read(ff->audio_fifo, audio_buf, audio_buf_size);
+            aud.data = audio_buf;
+            ffemu_push_audio_thread(ff, &aud, true);
+         }
+
+         scond_signal(ff->cond);
       }
    }
 
-   av_free(video_buf);
    av_free(audio_buf);
 }
 
@@ -61,6 +61,9 @@ struct ffemu_params
 
    // Path to config. Optional.
    const char *config;
+
+   // Threads to scale input frames with. 0 or 1 scales on the calling thread.
+   unsigned scaler_threads;
 };
 
 struct ffemu_video_data
@@ -84,6 +87,15 @@ ffemu_t *ffemu_new(const struct ffemu_params *params);
 void ffemu_free(ffemu_t* handle);
 
 bool ffemu_push_video(ffemu_t *handle, const struct ffemu_video_data *data);
+
+// Zero-copy alternative to ffemu_push_video().
+// Returns a buffer from the recorder's frame pool, at least *size bytes large, which
+// the caller fills and hands to the encoder with ffemu_push_video_frame().
+// data->data must point inside this buffer. Blocks while every buffer is being encoded.
+// The same buffer is returned until it has been pushed.
+void *ffemu_get_video_frame(ffemu_t *handle, size_t *size);
+bool ffemu_push_video_frame(ffemu_t *handle, const struct ffemu_video_data *data);
+
 bool ffemu_push_audio(ffemu_t *handle, const struct ffemu_audio_data *data);
 bool ffemu_finalize(ffemu_t *handle);
 
@@ -32,6 +32,7 @@
 #include "compat/strl.h"
 #include "screenshot.h"
 #include "cheats.h"
+#include "hash.h"
 #include "compat/getopt_rarch.h"
 
 #if defined(_WIN32) && !defined(_XBOX)
@@ -56,6 +57,59 @@
 #define RARCH_PERFORMANCE_MODE
 #endif
 
+// The audio thread uses the audio driver by itself while it's running.
+static void audio_driver_lock(void)
+{
+#ifdef HAVE_THREADS
+   if (g_extern.audio_data.thread)
+      audio_thread_lock(g_extern.audio_data.thread);
+#endif
+}
+
+static void audio_driver_unlock(void)
+{
+#ifdef HAVE_THREADS
+   if (g_extern.audio_data.thread)
+      audio_thread_unlock(g_extern.audio_data.thread);
+#endif
+}
+
+// Writing to a stopped driver might block, so the audio thread is held off until the driver is started again.
+static bool audio_stopped;
+
+static void audio_stop(void)
+{
+   if (!audio_stopped)
+      audio_driver_lock();
+   audio_stopped = true;
+   audio_stop_func();
+}
+
+static bool audio_start(void)
+{
+   bool ret = audio_start_func();
+   if (audio_stopped)
+      audio_driver_unlock();
+   audio_stopped = false;
+   return ret;
+}
+
+#ifdef HAVE_DYLIB
+// The audio thread runs the DSP plugin, so the main thread must hold it off while calling into the plugin.
+// While audio is stopped, the lock is already held.
+static void audio_dsp_lock(void)
+{
+   if (!audio_stopped)
+      audio_driver_lock();
+}
+
+static void audio_dsp_unlock(void)
+{
+   if (!audio_stopped)
+      audio_driver_unlock();
+}
+#endif
+
 // To avoid continous switching if we hold the button down, we require that the button must go from pressed, unpressed back to pressed to be able to toggle between then.
 static void check_fast_forward_button(void)
 {
@@ -79,12 +133,23 @@ static void check_fast_forward_button(void)
 
    if (update_sync)
    {
+      g_extern.is_fast_forward = syncing_state;
+
       // Only apply non-block-state for video if we're using vsync.
       if (g_extern.video_active && g_settings.video.vsync && !g_extern.system.force_nonblock)
          video_set_nonblock_state_func(syncing_state);
 
       if (g_extern.audio_active)
-         audio_set_nonblock_state_func(g_settings.audio.sync ? syncing_state : true);
+      {
+         bool nonblock = g_settings.audio.sync ? syncing_state : true;
+         audio_driver_lock();
+         audio_set_nonblock_state_func(nonblock);
+         audio_driver_unlock();
+#ifdef HAVE_THREADS
+         if (g_extern.audio_data.thread)
+            audio_thread_set_nonblock_state(g_extern.audio_data.thread, nonblock);
+#endif
+      }
 
       g_extern.audio_data.chunk_size =
          syncing_state ? g_extern.audio_data.nonblock_chunk_size : g_extern.audio_data.block_chunk_size;
@@ -178,7 +243,14 @@ static void take_screenshot(void)
 
 static void readjust_audio_input_rate(void)
 {
-   int avail = audio_write_avail_func();
+   int avail;
+#ifdef HAVE_THREADS
+   if (g_extern.audio_data.thread)
+      avail = audio_thread_write_avail(g_extern.audio_data.thread);
+   else
+#endif
+      avail = audio_write_avail_func();
+
    //RARCH_LOG_OUTPUT("Audio buffer is %u%% full\n",
    //      (unsigned)(100 - (avail * 100) / g_extern.audio_data.driver_buffer_size));
 
@@ -201,15 +273,14 @@ static void recording_dump_frame(const void *data, unsigned width, unsigned heig
 {
    struct ffemu_video_data ffemu_data = {0};
 
-   if (g_extern.record_gpu_buffer)
+   if (g_extern.record_gpu)
    {
       struct rarch_viewport vp = {0};
       video_viewport_info_func(&vp);
       if (!vp.width || !vp.height)
       {
          RARCH_WARN("Viewport size calculation failed! Will continue using raw data. This will probably not work right ...\n");
-         free(g_extern.record_gpu_buffer);
-         g_extern.record_gpu_buffer = NULL;
+         g_extern.record_gpu = false;
 
          recording_dump_frame(data, width, height, pitch);
          return;
@@ -228,18 +299,27 @@ static void recording_dump_frame(const void *data, unsigned width, unsigned heig
          return;
       }
 
+      // Read back straight into the recorder's frame pool, so the frame isn't copied again
+      // before the encoder thread converts it.
+      size_t size = 0;
+      uint8_t *buffer = (uint8_t*)ffemu_get_video_frame(g_extern.rec, &size);
+      if (!buffer)
+         return;
+
       // Big bottleneck.
       // Since we might need to do read-backs asynchronously, it might take 3-4 times
       // before this returns true ...
-      if (!video_read_viewport_func(g_extern.record_gpu_buffer))
+      if (!video_read_viewport_func(buffer))
          return;
 
       ffemu_data.pitch  = g_extern.record_gpu_width * 3;
       ffemu_data.width  = g_extern.record_gpu_width;
       ffemu_data.height = g_extern.record_gpu_height;
-      ffemu_data.data   = g_extern.record_gpu_buffer + (ffemu_data.height - 1) * ffemu_data.pitch;
+      ffemu_data.data   = buffer + (ffemu_data.height - 1) * ffemu_data.pitch;
 
       ffemu_data.pitch  = -ffemu_data.pitch;
+
+      ffemu_push_video_frame(g_extern.rec, &ffemu_data);
    }
    else
    {
@@ -248,17 +328,19 @@ static void recording_dump_frame(const void *data, unsigned width, unsigned heig
       ffemu_data.width   = width;
       ffemu_data.height  = height;
       ffemu_data.is_dupe = !data;
-   }
 
-   ffemu_push_video(g_extern.rec, &ffemu_data);
+      ffemu_push_video(g_extern.rec, &ffemu_data);
+   }
 }
 #endif
 
 static void video_frame(const void *data, unsigned width, unsigned height, size_t pitch)
 {
-   if (!g_extern.video_active)
+   if (!g_extern.video_active || g_extern.run_ahead.skip_video)
       return;
 
+   rarch_usec_t start = rarch_get_time_usec();
+
    if (g_extern.system.pix_fmt == RETRO_PIXEL_FORMAT_0RGB1555 && data)
    {
       RARCH_PERFORMANCE_INIT(video_frame_conv);
@@ -279,7 +361,7 @@ static void video_frame(const void *data, unsigned width, unsigned height, size_
    // Slightly messy code,
    // but we really need to do processing before blocking on VSync for best possible scheduling.
 #ifdef HAVE_FFMPEG
-   if (g_extern.recording && (!g_extern.filter.active || !g_settings.video.post_filter_record || !data || g_extern.record_gpu_buffer))
+   if (g_extern.recording && (!g_extern.filter.active || !g_settings.video.post_filter_record || !data || g_extern.record_gpu))
       recording_dump_frame(data, width, height, pitch);
 #endif
 
@@ -321,6 +403,8 @@ static void video_frame(const void *data, unsigned width, unsigned height, size_
    g_extern.frame_cache.width  = width;
    g_extern.frame_cache.height = height;
    g_extern.frame_cache.pitch  = pitch;
+
+   rarch_frame_stats_add(RARCH_FRAME_STAGE_VIDEO, start);
 }
 
 void rarch_render_cached_frame(void)
@@ -344,24 +428,10 @@ void rarch_render_cached_frame(void)
 #endif
 }
 
-static bool audio_flush(const int16_t *data, size_t samples)
+// Converts, resamples and writes audio to the driver.
+// Runs on the audio thread if threaded audio is enabled.
+bool rarch_audio_process(const int16_t *data, size_t samples)
 {
-#ifdef HAVE_FFMPEG
-   if (g_extern.recording)
-   {
-      struct ffemu_audio_data ffemu_data = {0};
-      ffemu_data.data                    = data;
-      ffemu_data.frames                  = samples / 2;
-
-      ffemu_push_audio(g_extern.rec, &ffemu_data);
-   }
-#endif
-
-   if (g_extern.is_paused || g_extern.audio_data.mute)
-      return true;
-   if (!g_extern.audio_active)
-      return false;
-
    const sample_t *output_data = NULL;
    unsigned output_frames      = 0;
 
@@ -417,11 +487,11 @@ static bool audio_flush(const int16_t *data, size_t samples)
    {
       RARCH_PERFORMANCE_INIT(audio_convert_float);
       RARCH_PERFORMANCE_START(audio_convert_float);
-      audio_convert_float_to_s16(g_extern.audio_data.conv_outsamples,
+      audio_convert_float_to_s16(g_extern.audio_data.s16_outsamples,
             output_data, output_frames * 2);
       RARCH_PERFORMANCE_STOP(audio_convert_float);
 
-      if (audio_write_func(g_extern.audio_data.conv_outsamples, output_frames * sizeof(int16_t) * 2) < 0)
+      if (audio_write_func(g_extern.audio_data.s16_outsamples, output_frames * sizeof(int16_t) * 2) < 0)
       {
          RARCH_ERR("Audio backend failed to write. Will continue without sound.\n");
          return false;
@@ -431,6 +501,40 @@ static bool audio_flush(const int16_t *data, size_t samples)
    return true;
 }
 
+static bool audio_flush_internal(const int16_t *data, size_t samples)
+{
+#ifdef HAVE_FFMPEG
+   if (g_extern.recording)
+   {
+      struct ffemu_audio_data ffemu_data = {0};
+      ffemu_data.data                    = data;
+      ffemu_data.frames                  = samples / 2;
+
+      ffemu_push_audio(g_extern.rec, &ffemu_data);
+   }
+#endif
+
+   if (g_extern.is_paused || g_extern.audio_data.mute)
+      return true;
+   if (!g_extern.audio_active)
+      return false;
+
+#ifdef HAVE_THREADS
+   if (g_extern.audio_data.thread)
+      return audio_thread_write(g_extern.audio_data.thread, data, samples);
+#endif
+
+   return rarch_audio_process(data, samples);
+}
+
+static bool audio_flush(const int16_t *data, size_t samples)
+{
+   rarch_usec_t start = rarch_get_time_usec();
+   bool ret = audio_flush_internal(data, samples);
+   rarch_frame_stats_add(RARCH_FRAME_STAGE_AUDIO, start);
+   return ret;
+}
+
 static void audio_sample_rewind(int16_t left, int16_t right)
 {
    g_extern.audio_data.rewind_buf[--g_extern.audio_data.rewind_ptr] = right;
@@ -448,6 +552,9 @@ size_t audio_sample_batch_rewind(const int16_t *data, size_t frames)
 
 static void audio_sample(int16_t left, int16_t right)
 {
+   if (g_extern.run_ahead.skip_audio)
+      return;
+
    g_extern.audio_data.conv_outsamples[g_extern.audio_data.data_ptr++] = left;
    g_extern.audio_data.conv_outsamples[g_extern.audio_data.data_ptr++] = right;
 
@@ -462,6 +569,9 @@ static void audio_sample(int16_t left, int16_t right)
 
 size_t audio_sample_batch(const int16_t *data, size_t frames)
 {
+   if (g_extern.run_ahead.skip_audio)
+      return frames;
+
    if (frames > (AUDIO_CHUNK_SIZE_NONBLOCKING >> 1))
       frames = AUDIO_CHUNK_SIZE_NONBLOCKING >> 1;
 
@@ -471,7 +581,13 @@ size_t audio_sample_batch(const int16_t *data, size_t frames)
 
 static void input_poll(void)
 {
+   // Speculative frames must see the same input as the real frame.
+   if (g_extern.run_ahead.skip_input_poll)
+      return;
+
+   rarch_usec_t start = rarch_get_time_usec();
    input_poll_func();
+   rarch_frame_stats_add(RARCH_FRAME_STAGE_INPUT_POLL, start);
 }
 
 // Turbo scheme: If turbo button is held, all buttons pressed except for D-pad will go into
@@ -646,7 +762,7 @@ static void print_help(void)
 
 #ifdef HAVE_NETPLAY
    puts("\t-H/--host: Host netplay as player 1.");
-   puts("\t-C/--connect: Connect to netplay as player 2.");
+   puts("\t-C/--connect: Connect to netplay as player 2 or higher.");
    puts("\t--port: Port used to netplay. Default is 55435.");
    puts("\t-F/--frames: Sync frames when using netplay.");
    puts("\t--spectate: Netplay will become spectating mode.");
@@ -665,6 +781,9 @@ static void print_help(void)
    puts("\t--size: Overrides output video size when recording with FFmpeg (format: WIDTHxHEIGHT).");
 #endif
    puts("\t-v/--verbose: Verbose logging.");
+   puts("\t--benchmark-frames: Runs N frames as fast as possible with null drivers, then reports frames/sec");
+   puts("\t\tand a per-stage time breakdown. Combine with -P/--bsvplay for reproducible input.");
+   puts("\t\tThe ROM is optional, and the libretro-test core is used if no libretro path is set.");
    puts("\t-U/--ups: Specifies path for UPS patch that will be applied to ROM.");
    puts("\t--bps: Specifies path for BPS patch that will be applied to ROM.");
    puts("\t--ips: Specifies path for IPS patch that will be applied to ROM.");
@@ -836,6 +955,7 @@ static void parse_input(int argc, char *argv[])
       { "xml", 1, NULL, 'X' },
       { "detach", 0, NULL, 'D' },
       { "features", 0, &val, 'f' },
+      { "benchmark-frames", 1, &val, 'b' },
       { NULL, 0, NULL, 0 }
    };
 
@@ -1036,6 +1156,7 @@ static void parse_input(int argc, char *argv[])
 
          case 'F':
             g_extern.netplay_sync_frames = strtol(optarg, NULL, 0);
+            g_extern.has_set_netplay_sync_frames = true;
             break;
 #endif
 
@@ -1130,6 +1251,19 @@ static void parse_input(int argc, char *argv[])
                   print_features();
                   exit(0);
 
+               case 'b':
+               {
+                  char *ptr;
+                  g_extern.benchmark.frames = strtoul(optarg, &ptr, 0);
+                  if (*ptr != '\0' || !g_extern.benchmark.frames)
+                  {
+                     RARCH_ERR("Wrong format for --benchmark-frames.\n");
+                     print_help();
+                     rarch_fail(1, "parse_input()");
+                  }
+                  break;
+               }
+
                default:
                   break;
             }
@@ -1147,10 +1281,19 @@ static void parse_input(int argc, char *argv[])
 
    if (optind < argc)
       set_paths(argv[optind]);
-   else
+   else if (!g_extern.benchmark.frames) // Benchmarks can run cores without a ROM.
       verify_stdin_paths();
 }
 
+static void set_controller_port_device(unsigned port, unsigned device)
+{
+   pretro_set_controller_port_device(port, device);
+#ifdef HAVE_DYNAMIC
+   if (g_extern.run_ahead.instance)
+      g_extern.run_ahead.instance->set_controller_port_device(port, device);
+#endif
+}
+
 static void init_controllers(void)
 {
    for (unsigned i = 0; i < MAX_PLAYERS; i++)
@@ -1158,39 +1301,39 @@ static void init_controllers(void)
       if (g_extern.disconnect_device[i])
       {
          RARCH_LOG("Disconnecting device from port %u.\n", i + 1);
-         pretro_set_controller_port_device(i, RETRO_DEVICE_NONE);
+         set_controller_port_device(i, RETRO_DEVICE_NONE);
       }
       else if (g_extern.has_dualanalog[i])
       {
          RARCH_LOG("Connecting dualanalog to port %u.\n", i + 1);
-         pretro_set_controller_port_device(i, RETRO_DEVICE_ANALOG);
+         set_controller_port_device(i, RETRO_DEVICE_ANALOG);
       }
       else if (g_extern.has_mouse[i])
       {
          RARCH_LOG("Connecting mouse to port %u.\n", i + 1);
-         pretro_set_controller_port_device(i, RETRO_DEVICE_MOUSE);
+         set_controller_port_device(i, RETRO_DEVICE_MOUSE);
       }
    }
 
    if (g_extern.has_justifier)
    {
       RARCH_LOG("Connecting Justifier to port 2.\n");
-      pretro_set_controller_port_device(1, RETRO_DEVICE_LIGHTGUN_JUSTIFIER);
+      set_controller_port_device(1, RETRO_DEVICE_LIGHTGUN_JUSTIFIER);
    }
    else if (g_extern.has_justifiers)
    {
       RARCH_LOG("Connecting Justifiers to port 2.\n");
-      pretro_set_controller_port_device(1, RETRO_DEVICE_LIGHTGUN_JUSTIFIERS);
+      set_controller_port_device(1, RETRO_DEVICE_LIGHTGUN_JUSTIFIERS);
    }
    else if (g_extern.has_multitap)
    {
       RARCH_LOG("Connecting Multitap to port 2.\n");
-      pretro_set_controller_port_device(1, RETRO_DEVICE_JOYPAD_MULTITAP);
+      set_controller_port_device(1, RETRO_DEVICE_JOYPAD_MULTITAP);
    }
    else if (g_extern.has_scope)
    {
       RARCH_LOG("Connecting scope to port 2.\n");
-      pretro_set_controller_port_device(1, RETRO_DEVICE_LIGHTGUN_SUPER_SCOPE);
+      set_controller_port_device(1, RETRO_DEVICE_LIGHTGUN_SUPER_SCOPE);
    }
 }
 
@@ -1289,6 +1432,7 @@ static void init_recording(void)
    params.samplerate = samplerate;
    params.pix_fmt    = g_extern.system.pix_fmt == RETRO_PIXEL_FORMAT_XRGB8888 ? FFEMU_PIX_ARGB8888 : FFEMU_PIX_RGB565;
    params.config     = *g_extern.record_config ? g_extern.record_config : NULL;
+   params.scaler_threads = g_settings.video.scaler_threads;
 
    if (g_settings.video.gpu_record && driver.video->read_viewport)
    {
@@ -1320,13 +1464,7 @@ static void init_recording(void)
       RARCH_LOG("Detected viewport of %u x %u\n",
             vp.width, vp.height);
 
-      g_extern.record_gpu_buffer = (uint8_t*)malloc(vp.width * vp.height * 3);
-      if (!g_extern.record_gpu_buffer)
-      {
-         RARCH_ERR("Failed to allocate GPU record buffer.\n");
-         g_extern.recording = false;
-         return;
-      }
+      g_extern.record_gpu = true;
    }
    else
    {
@@ -1365,9 +1503,7 @@ static void init_recording(void)
    {
       RARCH_ERR("Failed to start FFmpeg recording.\n");
       g_extern.recording = false;
-
-      free(g_extern.record_gpu_buffer);
-      g_extern.record_gpu_buffer = NULL;
+      g_extern.record_gpu = false;
    }
 }
 
@@ -1379,9 +1515,7 @@ static void deinit_recording(void)
    ffemu_finalize(g_extern.rec);
    ffemu_free(g_extern.rec);
    g_extern.rec = NULL;
-
-   free(g_extern.record_gpu_buffer);
-   g_extern.record_gpu_buffer = NULL;
+   g_extern.record_gpu = false;
 }
 #endif
 
@@ -1450,7 +1584,35 @@ static void init_rewind(void)
    g_extern.state_manager = state_manager_new(aligned_state_size, g_settings.rewind_buffer_size, g_extern.state_buf);
 
    if (!g_extern.state_manager)
+   {
       RARCH_WARN("Failed to init rewind buffer. Rewinding will be disabled.\n");
+      return;
+   }
+
+   if (g_settings.rewind_keyframe_interval)
+   {
+      // Keyframes take up about a quarter of the rewind buffer size.
+      unsigned count = g_settings.rewind_buffer_size / (4 * aligned_state_size);
+      if (!state_manager_init_keyframes(g_extern.state_manager,
+               g_settings.rewind_keyframe_interval, count ? count : 1))
+         RARCH_WARN("Failed to allocate rewind keyframes. Seeking will be slow.\n");
+   }
+
+#ifdef HAVE_THREADS
+   if (g_settings.rewind_threaded)
+   {
+      // The worker reads the last pushed state while the next one is serialized, so we need two buffers.
+      g_extern.state_buf_back = calloc(1, aligned_state_size);
+      if (g_extern.state_buf_back && state_manager_start_thread(g_extern.state_manager))
+         RARCH_LOG("Rewind deltas are generated on a separate thread.\n");
+      else
+      {
+         RARCH_WARN("Failed to start rewind thread. Will rewind synchronously.\n");
+         free(g_extern.state_buf_back);
+         g_extern.state_buf_back = NULL;
+      }
+   }
+#endif
 }
 
 static void deinit_rewind(void)
@@ -1459,6 +1621,293 @@ static void deinit_rewind(void)
       state_manager_free(g_extern.state_manager);
    if (g_extern.state_buf)
       free(g_extern.state_buf);
+   if (g_extern.state_buf_back)
+      free(g_extern.state_buf_back);
+}
+
+static void deinit_run_ahead(void)
+{
+   free(g_extern.run_ahead.state);
+   g_extern.run_ahead.state = NULL;
+
+#ifdef HAVE_DYNAMIC
+   libretro_instance_free(g_extern.run_ahead.instance);
+   g_extern.run_ahead.instance = NULL;
+#endif
+}
+
+#ifdef HAVE_DYNAMIC
+// Has to be loaded before the game is, as the game is loaded into both instances.
+static void init_run_ahead_instance(void)
+{
+   if (!g_settings.run_ahead_frames || !g_settings.run_ahead_secondary_instance)
+      return;
+
+   struct retro_instance *inst = libretro_instance_new();
+   if (!inst)
+   {
+      RARCH_WARN("Failed to load second libretro instance. Will run ahead on the main instance.\n");
+      return;
+   }
+
+   // Which of the instances gets to output what is controlled with the skip flags.
+   inst->set_video_refresh(video_frame);
+   inst->set_audio_sample(audio_sample);
+   inst->set_audio_sample_batch(audio_sample_batch);
+   inst->set_input_poll(input_poll);
+   inst->set_input_state(input_state);
+
+   g_extern.run_ahead.instance = inst;
+}
+#endif
+
+static void init_run_ahead(void)
+{
+   if (!g_settings.run_ahead_frames)
+      return;
+
+#ifdef HAVE_NETPLAY
+   if (g_extern.netplay)
+   {
+      RARCH_WARN("Run-ahead cannot be used with netplay. Run-ahead will be disabled.\n");
+      goto error;
+   }
+#endif
+
+#ifdef HAVE_BSV_MOVIE
+   if (g_extern.bsv.movie)
+   {
+      RARCH_WARN("Run-ahead cannot be used with movies. Run-ahead will be disabled.\n");
+      goto error;
+   }
+#endif
+
+   g_extern.run_ahead.state_size = pretro_serialize_size();
+   if (!g_extern.run_ahead.state_size)
+   {
+      RARCH_ERR("Implementation does not support save states. Cannot use run-ahead.\n");
+      goto error;
+   }
+
+#ifdef HAVE_DYNAMIC
+   if (g_extern.run_ahead.instance && (!g_extern.run_ahead.instance->game_loaded ||
+            g_extern.run_ahead.instance->serialize_size() != g_extern.run_ahead.state_size))
+   {
+      RARCH_WARN("Second libretro instance is not usable. Will run ahead on the main instance.\n");
+      libretro_instance_free(g_extern.run_ahead.instance);
+      g_extern.run_ahead.instance = NULL;
+   }
+#endif
+
+   g_extern.run_ahead.state = malloc((g_extern.run_ahead.state_size + 3) & ~3);
+   if (!g_extern.run_ahead.state)
+   {
+      RARCH_ERR("Failed to allocate memory for run-ahead state.\n");
+      goto error;
+   }
+
+   g_extern.run_ahead.need_sync = true;
+#ifdef HAVE_DYNAMIC
+   if (g_extern.run_ahead.instance)
+      RARCH_LOG("Running %u frame(s) ahead on a second libretro instance.\n", g_settings.run_ahead_frames);
+   else
+#endif
+      RARCH_LOG("Running %u frame(s) ahead.\n", g_settings.run_ahead_frames);
+   return;
+
+error:
+   deinit_run_ahead();
+}
+
+static inline bool run_ahead_active(void)
+{
+   if (!g_extern.run_ahead.state)
+      return false;
+
+#ifdef HAVE_BSV_MOVIE
+   // Movie recording can be started at any time, and must only see the real frames.
+   if (g_extern.bsv.movie)
+      return false;
+#endif
+
+   // Nothing to gain from it when fast-forwarding, and rewinding runs with its own audio callbacks.
+   return !g_extern.is_fast_forward && !g_extern.frame_is_reverse;
+}
+
+#ifdef HAVE_DYNAMIC
+#define RUN_AHEAD_MAX_INPUTS 1024
+
+struct run_ahead_input
+{
+   struct
+   {
+      unsigned port;
+      unsigned device;
+      unsigned index;
+      unsigned id;
+      int16_t value;
+   } state[RUN_AHEAD_MAX_INPUTS];
+   unsigned count;
+   bool overflow;
+};
+
+// Input read by the main instance during the current and the previous frame.
+static struct run_ahead_input run_ahead_input[2];
+static unsigned run_ahead_input_ptr;
+
+// Input callback of the main instance when running ahead on a second instance.
+static int16_t input_state_run_ahead(unsigned port, unsigned device, unsigned index, unsigned id)
+{
+   int16_t res = input_state(port, device, index, id);
+
+   struct run_ahead_input *input = &run_ahead_input[run_ahead_input_ptr];
+   if (input->count < RUN_AHEAD_MAX_INPUTS)
+   {
+      input->state[input->count].port   = port;
+      input->state[input->count].device = device;
+      input->state[input->count].index  = index;
+      input->state[input->count].id     = id;
+      input->state[input->count].value  = res;
+      input->count++;
+   }
+   else
+      input->overflow = true;
+
+   return res;
+}
+
+// The second instance ran ahead assuming input would stay the same as in the previous frame.
+static bool run_ahead_input_changed(void)
+{
+   const struct run_ahead_input *cur  = &run_ahead_input[run_ahead_input_ptr];
+   const struct run_ahead_input *prev = &run_ahead_input[run_ahead_input_ptr ^ 1];
+
+   if (cur->overflow || prev->overflow || cur->count != prev->count)
+      return true;
+
+   for (unsigned i = 0; i < cur->count; i++)
+   {
+      if (cur->state[i].port != prev->state[i].port ||
+            cur->state[i].device != prev->state[i].device ||
+            cur->state[i].index != prev->state[i].index ||
+            cur->state[i].id != prev->state[i].id ||
+            cur->state[i].value != prev->state[i].value)
+         return true;
+   }
+
+   return false;
+}
+
+// Runs the real frame on the main instance with video suppressed, and presents a frame from the
+// second instance, which is kept run_ahead_frames ahead of it. As long as input does not change,
+// that is a single frame on each instance. Otherwise, the second instance is synced up with the main one
+// and has to catch up again.
+static void run_ahead_frame_instance(void)
+{
+   struct retro_instance *inst = g_extern.run_ahead.instance;
+
+   run_ahead_input_ptr ^= 1;
+   run_ahead_input[run_ahead_input_ptr].count    = 0;
+   run_ahead_input[run_ahead_input_ptr].overflow = false;
+
+   g_extern.run_ahead.skip_video = true;
+   pretro_run();
+
+   g_extern.run_ahead.skip_audio      = true;
+   g_extern.run_ahead.skip_input_poll = true;
+
+   if (g_extern.run_ahead.need_sync || run_ahead_input_changed())
+   {
+      RARCH_PERFORMANCE_INIT(run_ahead_sync);
+      RARCH_PERFORMANCE_START(run_ahead_sync);
+      bool ret = pretro_serialize(g_extern.run_ahead.state, g_extern.run_ahead.state_size) &&
+         inst->unserialize(g_extern.run_ahead.state, g_extern.run_ahead.state_size);
+
+      for (unsigned i = 1; ret && i < g_settings.run_ahead_frames; i++)
+         inst->run();
+      RARCH_PERFORMANCE_STOP(run_ahead_sync);
+
+      if (!ret)
+      {
+         RARCH_ERR("Failed to sync second libretro instance. Run-ahead will be disabled.\n");
+         g_extern.run_ahead.skip_video      = false;
+         g_extern.run_ahead.skip_audio      = false;
+         g_extern.run_ahead.skip_input_poll = false;
+         deinit_run_ahead();
+         return;
+      }
+
+      g_extern.run_ahead.need_sync = false;
+   }
+
+   g_extern.run_ahead.skip_video = false;
+
+   RARCH_PERFORMANCE_INIT(run_ahead_instance);
+   RARCH_PERFORMANCE_START(run_ahead_instance);
+   inst->run();
+   RARCH_PERFORMANCE_STOP(run_ahead_instance);
+
+   g_extern.run_ahead.skip_audio      = false;
+   g_extern.run_ahead.skip_input_poll = false;
+}
+#endif
+
+// Runs the real frame with video suppressed and saves its state.
+// Then runs ahead with the same input, only presenting the last frame, and rolls back.
+// Audio is taken from the real frame only, so sound is unaffected.
+static void run_ahead_frame_rollback(void)
+{
+   g_extern.run_ahead.skip_video = true;
+   pretro_run();
+
+   RARCH_PERFORMANCE_INIT(run_ahead_serialize);
+   RARCH_PERFORMANCE_START(run_ahead_serialize);
+   bool ret = pretro_serialize(g_extern.run_ahead.state, g_extern.run_ahead.state_size);
+   RARCH_PERFORMANCE_STOP(run_ahead_serialize);
+
+   if (!ret)
+   {
+      RARCH_ERR("Failed to save state for run-ahead. Run-ahead will be disabled.\n");
+      g_extern.run_ahead.skip_video = false;
+      deinit_run_ahead();
+      return;
+   }
+
+   g_extern.run_ahead.skip_audio      = true;
+   g_extern.run_ahead.skip_input_poll = true;
+
+   RARCH_PERFORMANCE_INIT(run_ahead_speculate);
+   RARCH_PERFORMANCE_START(run_ahead_speculate);
+   for (unsigned i = 1; i < g_settings.run_ahead_frames; i++)
+      pretro_run();
+
+   g_extern.run_ahead.skip_video = false;
+   pretro_run();
+   RARCH_PERFORMANCE_STOP(run_ahead_speculate);
+
+   g_extern.run_ahead.skip_audio      = false;
+   g_extern.run_ahead.skip_input_poll = false;
+
+   RARCH_PERFORMANCE_INIT(run_ahead_unserialize);
+   RARCH_PERFORMANCE_START(run_ahead_unserialize);
+   ret = pretro_unserialize(g_extern.run_ahead.state, g_extern.run_ahead.state_size);
+   RARCH_PERFORMANCE_STOP(run_ahead_unserialize);
+
+   if (!ret)
+   {
+      RARCH_ERR("Failed to load state for run-ahead. Run-ahead will be disabled.\n");
+      deinit_run_ahead();
+   }
+}
+
+static void run_ahead_frame(void)
+{
+#ifdef HAVE_DYNAMIC
+   if (g_extern.run_ahead.instance)
+      run_ahead_frame_instance();
+   else
+#endif
+      run_ahead_frame_rollback();
 }
 
 #ifdef HAVE_BSV_MOVIE
@@ -1598,6 +2047,11 @@ static void init_libretro_cbs_plain(void)
    pretro_set_audio_sample_batch(audio_sample_batch);
    pretro_set_input_state(input_state);
    pretro_set_input_poll(input_poll);
+
+#ifdef HAVE_DYNAMIC
+   if (g_extern.run_ahead.instance)
+      pretro_set_input_state(input_state_run_ahead);
+#endif
 }
 
 static void init_libretro_cbs(void)
@@ -1829,6 +2283,9 @@ static void load_auto_state(void)
       return;
 #endif
 
+   if (g_extern.benchmark.frames)
+      return;
+
    char savestate_name_auto[PATH_MAX];
    fill_pathname_noext(savestate_name_auto, g_extern.savestate_name,
          ".auto", sizeof(savestate_name_auto));
@@ -1858,14 +2315,46 @@ static void save_auto_state(void)
    RARCH_LOG("Auto save state to \"%s\" %s.\n", savestate_name_auto, ret ? "succeeded" : "failed");
 }
 
-void rarch_load_state(void)
+static void init_state_io(void)
 {
-   char load_path[PATH_MAX];
+   g_extern.state_io = state_io_new(g_settings.savestate_compression);
+   if (!g_extern.state_io)
+      RARCH_ERR("Failed to initialize savestate I/O.\n");
+}
 
-   if (g_extern.state_slot > 0)
-      snprintf(load_path, sizeof(load_path), "%s%u", g_extern.savestate_name, g_extern.state_slot);
+static void deinit_state_io(void)
+{
+   if (g_extern.state_io)
+   {
+      state_io_free(g_extern.state_io);
+      g_extern.state_io = NULL;
+   }
+}
+
+static void fill_state_slot_path(char *path, size_t size, unsigned slot)
+{
+   if (slot > 0)
+      snprintf(path, size, "%s%u", g_extern.savestate_name, slot);
    else
-      snprintf(load_path, sizeof(load_path), "%s", g_extern.savestate_name);
+      snprintf(path, size, "%s", g_extern.savestate_name);
+}
+
+// Reads the current slot in the background, so loading it is instant.
+static void prefetch_state_slot(void)
+{
+   if (!g_extern.state_io)
+      return;
+
+   char path[PATH_MAX];
+   fill_state_slot_path(path, sizeof(path), g_extern.state_slot);
+   if (path_file_exists(path))
+      state_io_prefetch(g_extern.state_io, path);
+}
+
+void rarch_load_state(void)
+{
+   char load_path[PATH_MAX];
+   fill_state_slot_path(load_path, sizeof(load_path), g_extern.state_slot);
 
    char msg[512];
    if (load_state(load_path))
@@ -1883,11 +2372,7 @@ void rarch_save_state(void)
       g_extern.state_slot++;
 
    char save_path[PATH_MAX];
-
-   if (g_extern.state_slot > 0)
-      snprintf(save_path, sizeof(save_path), "%s%u", g_extern.savestate_name, g_extern.state_slot);
-   else
-      snprintf(save_path, sizeof(save_path), "%s", g_extern.savestate_name);
+   fill_state_slot_path(save_path, sizeof(save_path), g_extern.state_slot);
 
    char msg[512];
    if (save_state(save_path))
@@ -1918,6 +2403,16 @@ static void check_savestates(bool immutable)
          rarch_load_state();
       old_should_loadstate = should_loadstate;
    }
+
+   // States are written in the background, so failures show up later.
+   char path[PATH_MAX];
+   if (g_extern.state_io && state_io_get_error(g_extern.state_io, path, sizeof(path)))
+   {
+      char msg[PATH_MAX + 64];
+      snprintf(msg, sizeof(msg), "Failed to save state to \"%s\".", path);
+      msg_queue_clear(g_extern.msg_queue);
+      msg_queue_push(g_extern.msg_queue, msg, 2, 180);
+   }
 }
 
 #if !defined(RARCH_PERFORMANCE_MODE)
@@ -1961,6 +2456,8 @@ void rarch_state_slot_increase(void)
       msg_queue_push(g_extern.msg_queue, msg, 1, 180);
 
    RARCH_LOG("%s\n", msg);
+
+   prefetch_state_slot();
 }
 
 void rarch_state_slot_decrease(void)
@@ -1983,6 +2480,8 @@ void rarch_state_slot_decrease(void)
       msg_queue_push(g_extern.msg_queue, msg, 1, 180);
 
    RARCH_LOG("%s\n", msg);
+
+   prefetch_state_slot();
 }
 
 static void check_stateslots(void)
@@ -2073,6 +2572,14 @@ static void check_rewind(void)
       {
          pretro_serialize(g_extern.state_buf, g_extern.state_size);
          state_manager_push(g_extern.state_manager, g_extern.state_buf);
+
+         // With threaded rewind, the pushed buffer is in use until the next push, so serialize into the other one.
+         if (g_extern.state_buf_back)
+         {
+            void *tmp = g_extern.state_buf;
+            g_extern.state_buf = g_extern.state_buf_back;
+            g_extern.state_buf_back = tmp;
+         }
       }
    }
 
@@ -2082,6 +2589,43 @@ static void check_rewind(void)
          audio_sample_batch_rewind : audio_sample_batch);
 }
 
+bool rarch_rewind_seek(float seconds)
+{
+   if (!g_extern.state_manager || seconds <= 0.0f)
+      return false;
+
+#ifdef HAVE_BSV_MOVIE
+   // Movies can only be rewound one frame at a time.
+   if (g_extern.bsv.movie)
+      return false;
+#endif
+
+   unsigned granularity = g_settings.rewind_granularity ? g_settings.rewind_granularity : 1;
+   unsigned states = (unsigned)(seconds * g_extern.system.av_info.timing.fps / granularity + 0.5);
+   if (!states)
+      states = 1;
+
+   void *buf;
+   unsigned rewound = state_manager_seek(g_extern.state_manager, states, &buf);
+
+   msg_queue_clear(g_extern.msg_queue);
+   if (!rewound)
+   {
+      msg_queue_push(g_extern.msg_queue, "Reached end of rewind buffer.", 1, 30);
+      return false;
+   }
+
+   pretro_unserialize(buf, g_extern.state_size);
+   g_extern.run_ahead.need_sync = true;
+
+   char msg[64];
+   snprintf(msg, sizeof(msg), "Rewound %.1f seconds.",
+         (float)(rewound * granularity) / g_extern.system.av_info.timing.fps);
+   msg_queue_push(g_extern.msg_queue, msg, 1, 180);
+   RARCH_LOG("%s\n", msg);
+   return true;
+}
+
 static void check_slowmotion(void)
 {
    g_extern.is_slowmotion = input_key_pressed_func(RARCH_SLOWMOTION);
@@ -2191,14 +2735,14 @@ static void check_pause(void)
       {
          RARCH_LOG("Paused.\n");
          if (driver.audio_data)
-            audio_stop_func();
+            audio_stop();
       }
       else 
       {
          RARCH_LOG("Unpaused.\n");
          if (driver.audio_data)
          {
-            if (!audio_start_func())
+            if (!audio_start())
             {
                RARCH_ERR("Failed to resume audio driver. Will continue without audio.\n");
                g_extern.audio_active = false;
@@ -2210,7 +2754,7 @@ static void check_pause(void)
    {
       RARCH_LOG("Unpaused.\n");
       g_extern.is_paused = false;
-      if (driver.audio_data && !audio_start_func())
+      if (driver.audio_data && !audio_start())
       {
          RARCH_ERR("Failed to resume audio driver. Will continue without audio.\n");
          g_extern.audio_active = false;
@@ -2221,7 +2765,7 @@ static void check_pause(void)
       RARCH_LOG("Paused.\n");
       g_extern.is_paused = true;
       if (driver.audio_data)
-         audio_stop_func();
+         audio_stop();
    }
 
    old_focus = focus;
@@ -2249,6 +2793,7 @@ void rarch_game_reset(void)
    msg_queue_clear(g_extern.msg_queue);
    msg_queue_push(g_extern.msg_queue, "Reset.", 1, 120);
    pretro_reset();
+   g_extern.run_ahead.need_sync = true;
    init_controllers(); // bSNES since v073r01 resets controllers to JOYPAD after a reset, so just enforce it here.
 }
 
@@ -2387,7 +2932,11 @@ static void check_dsp_config(void)
    static bool old_pressed = false;
    bool pressed = input_key_pressed_func(RARCH_DSP_CONFIG);
    if (pressed && !old_pressed)
+   {
+      audio_dsp_lock();
       g_extern.audio_data.dsp_plugin->config(g_extern.audio_data.dsp_handle);
+      audio_dsp_unlock();
+   }
 
    old_pressed = pressed;
 }
@@ -2613,9 +3162,53 @@ static void validate_cpu_features(void)
 #endif
 }
 
+#if defined(__APPLE__)
+#define BENCHMARK_DEFAULT_LIBRETRO "libretro-test/libretro.dylib"
+#elif defined(_WIN32)
+#define BENCHMARK_DEFAULT_LIBRETRO "libretro-test/retro.dll"
+#else
+#define BENCHMARK_DEFAULT_LIBRETRO "libretro-test/libretro.so"
+#endif
+
+// Overrides config so that a benchmark only measures the core and the frontend itself,
+// and runs the same way every time.
+static void init_benchmark(void)
+{
+   RARCH_LOG("Benchmarking %u frames.\n", g_extern.benchmark.frames);
+
+   strlcpy(g_settings.video.driver, "null", sizeof(g_settings.video.driver));
+   strlcpy(g_settings.audio.driver, "null", sizeof(g_settings.audio.driver));
+   strlcpy(g_settings.input.driver, "null", sizeof(g_settings.input.driver));
+   g_settings.video.vsync = false;
+   g_settings.audio.sync = false;
+   g_settings.audio.rate_control = false;
+
+   // Don't let state from earlier runs leak in, or leak out.
+   g_extern.sram_load_disable = true;
+   g_extern.sram_save_disable = true;
+   g_settings.savestate_auto_save = false;
+
+#ifdef HAVE_DYNAMIC
+   if (!*g_settings.libretro)
+      strlcpy(g_settings.libretro, BENCHMARK_DEFAULT_LIBRETRO, sizeof(g_settings.libretro));
+#endif
+}
+
+static void print_benchmark(void)
+{
+   uint64_t elapsed = rarch_get_time_usec() - g_extern.benchmark.start_usec;
+   double seconds = elapsed / 1000000.0;
+
+   printf("Benchmark: %u frames in %.3f s, %.2f frames/sec.\n",
+         g_extern.frame_count, seconds, seconds > 0.0 ? g_extern.frame_count / seconds : 0.0);
+   rarch_frame_stats_dump(stdout, false);
+   fflush(stdout);
+}
+
 int rarch_main_init(int argc, char *argv[])
 {
    init_state();
+   rarch_frame_stats_reset();
 
    int sjlj_ret;
    if ((sjlj_ret = setjmp(g_extern.error_sjlj_context)) > 0)
@@ -2636,6 +3229,12 @@ int rarch_main_init(int argc, char *argv[])
    validate_cpu_features();
    config_load();
 
+   // The ROM hashing thread is started later on.
+   hash_init();
+
+   if (g_extern.benchmark.frames)
+      init_benchmark();
+
    init_libretro_sym();
    init_system_info();
 
@@ -2644,6 +3243,10 @@ int rarch_main_init(int argc, char *argv[])
    verify_api_version();
    pretro_init();
 
+#ifdef HAVE_DYNAMIC
+   init_run_ahead_instance();
+#endif
+
    g_extern.use_sram = true;
 #ifdef HAVE_XML
    bool allow_cheats = true;
@@ -2662,7 +3265,9 @@ int rarch_main_init(int argc, char *argv[])
    else
       RARCH_LOG("Skipping SRAM load.\n");
 
+   init_state_io();
    load_auto_state();
+   prefetch_state_slot();
 
 #ifdef HAVE_BSV_MOVIE
    init_movie();
@@ -2682,6 +3287,8 @@ int rarch_main_init(int argc, char *argv[])
    if (!g_extern.netplay)
 #endif
       init_rewind();
+
+   init_run_ahead();
       
    init_libretro_cbs();
    init_controllers();
@@ -2716,9 +3323,11 @@ int rarch_main_init(int argc, char *argv[])
 #endif
 
    g_extern.error_in_init = false;
+   g_extern.benchmark.start_usec = rarch_get_time_usec();
    return 0;
 
 error:
+   deinit_run_ahead();
    pretro_unload_game();
    pretro_deinit();
    uninit_drivers();
@@ -2735,10 +3344,16 @@ static inline bool rarch_main_paused(void)
 
 bool rarch_main_iterate(void)
 {
+   rarch_frame_stats_begin();
+
 #ifdef HAVE_DYLIB
    // DSP plugin GUI events.
    if (g_extern.audio_data.dsp_handle && g_extern.audio_data.dsp_plugin->events)
+   {
+      audio_dsp_lock();
       g_extern.audio_data.dsp_plugin->events(g_extern.audio_data.dsp_handle);
+      audio_dsp_unlock();
+   }
 #endif
 
    // SHUTDOWN on consoles should exit RetroArch completely.
@@ -2750,6 +3365,9 @@ bool rarch_main_iterate(void)
       return false;
    }
 
+   if (g_extern.benchmark.frames && g_extern.frame_count >= g_extern.benchmark.frames)
+      return false;
+
    // Time to drop?
    if (input_key_pressed_func(RARCH_QUIT_KEY) ||
          !video_alive_func())
@@ -2776,10 +3394,6 @@ bool rarch_main_iterate(void)
    do_state_checks();
 
    // Run libretro for one frame.
-#ifdef HAVE_THREADS
-   lock_autosave();
-#endif
-
 #ifdef HAVE_NETPLAY
    if (g_extern.netplay)
       netplay_pre_frame(g_extern.netplay);
@@ -2790,7 +3404,15 @@ bool rarch_main_iterate(void)
       bsv_movie_set_frame_start(g_extern.bsv.movie);
 #endif
 
-   pretro_run();
+   rarch_usec_t run_start = rarch_get_time_usec();
+   if (run_ahead_active())
+      run_ahead_frame();
+   else
+   {
+      pretro_run();
+      g_extern.run_ahead.need_sync = true;
+   }
+   rarch_frame_stats_add(RARCH_FRAME_STAGE_RUN, run_start);
    g_extern.frame_count++;
 
 #ifdef HAVE_BSV_MOVIE
@@ -2804,9 +3426,12 @@ bool rarch_main_iterate(void)
 #endif
 
 #ifdef HAVE_THREADS
-   unlock_autosave();
+   // SRAM is consistent between frames.
+   update_autosave();
 #endif
 
+   rarch_frame_stats_end();
+
 #ifdef HAVE_RMENU
    if (input_key_pressed_func(RARCH_FRAMEADVANCE))
    {
@@ -2820,8 +3445,38 @@ bool rarch_main_iterate(void)
    return true;
 }
 
+static void dump_frame_stats(void)
+{
+   if (*g_settings.frame_stats_path)
+   {
+      FILE *file = fopen(g_settings.frame_stats_path, "w");
+      if (file)
+      {
+         rarch_frame_stats_dump(file, true);
+#ifdef HAVE_NETPLAY
+         if (g_extern.netplay)
+            netplay_print_stats(g_extern.netplay, file);
+#endif
+         fclose(file);
+         RARCH_LOG("Wrote frame stats to \"%s\".\n", g_settings.frame_stats_path);
+      }
+      else
+         RARCH_ERR("Failed to open \"%s\" for frame stats.\n", g_settings.frame_stats_path);
+   }
+
+   if (g_extern.verbose)
+      rarch_frame_stats_dump(LOG_FILE, false);
+}
+
 void rarch_main_deinit(void)
 {
+   rom_hash_wait();
+
+   if (g_extern.benchmark.frames)
+      print_benchmark();
+
+   dump_frame_stats();
+
 #ifdef HAVE_NETPLAY
    deinit_netplay();
 #endif
@@ -2846,6 +3501,8 @@ void rarch_main_deinit(void)
 #endif
       deinit_rewind();
 
+   deinit_run_ahead();
+
 #ifdef HAVE_XML
    deinit_cheats();
 #endif
@@ -2855,6 +3512,7 @@ void rarch_main_deinit(void)
 #endif
 
    save_auto_state();
+   deinit_state_io();
 
    pretro_unload_game();
    pretro_deinit();
@@ -2878,6 +3536,7 @@ static bool rarch_main_idle_iterate(void)
 
    input_poll();
    rarch_sleep(10);
+   rarch_frame_stats_break();
    return true;
 }
 
@@ -20,9 +20,57 @@
 #include <string.h>
 #include <limits.h>
 #include "general.h"
+#include "performance.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_THREADS
+#include "thread.h"
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define REWIND_HAVE_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+// The rewind buffer is a stack of uint64_t entries where each delta is separated by a 0 sentinel.
+// Two kinds of entries can make up a delta:
+// - Single word: (index << 32) | xor. Bit 63 is always clear as states are far smaller than 8 GiB.
+// - Run: ceil(len / 2) words with two packed xor values each, followed by a header word,
+//   REWIND_RUN_FLAG | (len << 32) | index. The header is on top so it is found first when popping.
+// No entry can ever be 0, so the sentinel is unambiguous.
+#define REWIND_RUN_FLAG (UINT64_C(1) << 63)
+#define REWIND_RUN_LEN_MASK 0x7fffffffu
+
+// Shorter runs are cheaper (or equally cheap) to store as single words.
+#define REWIND_RUN_MIN 4
+
+// Periodic full copies of the state, so a seek only has to replay deltas back from the nearest keyframe.
+struct state_keyframe
+{
+   uint32_t *data;
+   uint64_t frame; // Number of pushes the state corresponds to.
+   uint64_t pos; // Absolute position of top_ptr right after the state was pushed.
+   bool valid;
+};
+
+// Returns index of the first 32-bit word in [i, size) where old and new state differ, or size if none do.
+typedef size_t (*find_change_t)(const uint32_t *old_state, const uint32_t *new_state, size_t i, size_t size);
 
 struct state_manager
 {
+   find_change_t find_change;
+
    uint64_t *buffer;
    size_t buf_size;
    size_t buf_size_mask;
@@ -31,6 +79,22 @@ struct state_manager
    size_t bottom_ptr;
    size_t state_size;
    bool first_pop;
+
+   uint64_t frame; // Number of pushes tmp_state corresponds to.
+   uint64_t top_abs; // Absolute (never wrapping) position of top_ptr.
+
+   struct state_keyframe *keyframes;
+   unsigned keyframe_count;
+   unsigned keyframe_interval;
+   unsigned keyframe_index;
+
+#ifdef HAVE_THREADS
+   sthread_t *thread;
+   slock_t *lock;
+   scond_t *cond;
+   const void *pending; // State handed to the worker which has not been turned into a delta yet.
+   bool thread_alive;
+#endif
 };
 
 static inline size_t nearest_pow2_size(size_t v)
@@ -60,6 +124,101 @@ static inline size_t nearest_pow2_size(size_t v)
       return prev;
 }
 
+static size_t find_change_c(const uint32_t *old_state, const uint32_t *new_state, size_t i, size_t size)
+{
+   for (; i < size; i++)
+      if (old_state[i] != new_state[i])
+         return i;
+
+   return size;
+}
+
+// The SIMD kernels only find the dirty block.
+// The exact word is found with the scalar loop so the generated delta is bit-identical to the C version.
+#if defined(__SSE2__)
+static size_t find_change_sse2(const uint32_t *old_state, const uint32_t *new_state, size_t i, size_t size)
+{
+   for (; i + 8 <= size; i += 8)
+   {
+      __m128i eq_lo = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(old_state + i + 0)),
+            _mm_loadu_si128((const __m128i*)(new_state + i + 0)));
+      __m128i eq_hi = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(old_state + i + 4)),
+            _mm_loadu_si128((const __m128i*)(new_state + i + 4)));
+
+      if (_mm_movemask_epi8(_mm_and_si128(eq_lo, eq_hi)) != 0xffff)
+         break;
+   }
+
+   return find_change_c(old_state, new_state, i, size);
+}
+#endif
+
+#ifdef REWIND_HAVE_AVX2
+__attribute__((target("avx2")))
+static size_t find_change_avx2(const uint32_t *old_state, const uint32_t *new_state, size_t i, size_t size)
+{
+   for (; i + 16 <= size; i += 16)
+   {
+      __m256i eq_lo = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(old_state + i + 0)),
+            _mm256_loadu_si256((const __m256i*)(new_state + i + 0)));
+      __m256i eq_hi = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(old_state + i + 8)),
+            _mm256_loadu_si256((const __m256i*)(new_state + i + 8)));
+
+      if (_mm256_movemask_epi8(_mm256_and_si256(eq_lo, eq_hi)) != -1)
+         break;
+   }
+
+   return find_change_c(old_state, new_state, i, size);
+}
+#endif
+
+#if defined(__ARM_NEON__)
+static size_t find_change_neon(const uint32_t *old_state, const uint32_t *new_state, size_t i, size_t size)
+{
+   for (; i + 8 <= size; i += 8)
+   {
+      uint32x4_t eq_lo = vceqq_u32(vld1q_u32(old_state + i + 0), vld1q_u32(new_state + i + 0));
+      uint32x4_t eq_hi = vceqq_u32(vld1q_u32(old_state + i + 4), vld1q_u32(new_state + i + 4));
+      uint32x4_t eq = vandq_u32(eq_lo, eq_hi);
+
+      uint32x2_t res = vand_u32(vget_low_u32(eq), vget_high_u32(eq));
+      res = vpmin_u32(res, res);
+      if (vget_lane_u32(res, 0) != 0xffffffffu)
+         break;
+   }
+
+   return find_change_c(old_state, new_state, i, size);
+}
+#endif
+
+static find_change_t find_change_select(void)
+{
+   struct rarch_cpu_features cpu;
+   rarch_get_cpu_features(&cpu);
+
+#ifdef REWIND_HAVE_AVX2
+   if (cpu.simd & RARCH_SIMD_AVX2)
+   {
+      RARCH_LOG("Using AVX2 rewind delta kernel.\n");
+      return find_change_avx2;
+   }
+#endif
+#if defined(__SSE2__)
+   if (cpu.simd & RARCH_SIMD_SSE2)
+   {
+      RARCH_LOG("Using SSE2 rewind delta kernel.\n");
+      return find_change_sse2;
+   }
+#endif
+#if defined(__ARM_NEON__)
+   // If we're compiled with NEON, the compiler might use it anywhere already.
+   RARCH_LOG("Using NEON rewind delta kernel.\n");
+   return find_change_neon;
+#endif
+
+   return find_change_c;
+}
+
 state_manager_t *state_manager_new(size_t state_size, size_t buffer_size, void *init_buffer)
 {
    if (buffer_size <= state_size * 4) // Need a sufficient buffer size.
@@ -71,7 +230,11 @@ state_manager_t *state_manager_new(size_t state_size, size_t buffer_size, void *
 
    // We need 4-byte aligned state_size to avoid having to enforce this with unneeded memcpy's!
    rarch_assert(state_size % 4 == 0);
+   // Indices must fit in 31 bits, see REWIND_RUN_FLAG.
+   rarch_assert(state_size / sizeof(uint32_t) <= REWIND_RUN_LEN_MASK);
    state->top_ptr = 1;
+   state->top_abs = 1;
+   state->find_change = find_change_select();
 
    state->state_size = state_size / sizeof(uint32_t); // Works in multiple of 4.
    state->buf_size = nearest_pow2_size(buffer_size) / sizeof(uint64_t); // Works in multiple of 8.
@@ -97,15 +260,82 @@ error:
    return NULL;
 }
 
+#ifdef HAVE_THREADS
+static void state_manager_stop_thread(state_manager_t *state);
+#endif
+
+static void free_keyframes(state_manager_t *state)
+{
+   if (!state->keyframes)
+      return;
+
+   for (unsigned i = 0; i < state->keyframe_count; i++)
+      free(state->keyframes[i].data);
+   free(state->keyframes);
+
+   state->keyframes = NULL;
+   state->keyframe_count = 0;
+}
+
 void state_manager_free(state_manager_t *state)
 {
+#ifdef HAVE_THREADS
+   state_manager_stop_thread(state);
+#endif
    free(state->buffer);
    free(state->tmp_state);
+   free_keyframes(state);
    free(state);
 }
 
+bool state_manager_init_keyframes(state_manager_t *state, unsigned interval, unsigned count)
+{
+   if (!interval || !count || state->keyframes)
+      return false;
+
+   state->keyframes = (struct state_keyframe*)calloc(count, sizeof(*state->keyframes));
+   if (!state->keyframes)
+      return false;
+
+   state->keyframe_count = count;
+   state->keyframe_interval = interval;
+
+   for (unsigned i = 0; i < count; i++)
+   {
+      state->keyframes[i].data = (uint32_t*)malloc(state->state_size * sizeof(uint32_t));
+      if (!state->keyframes[i].data)
+      {
+         free_keyframes(state);
+         return false;
+      }
+   }
+
+   RARCH_LOG("Rewind keyframe every %u states, %u keyframes.\n", interval, count);
+   return true;
+}
+
+#ifdef HAVE_THREADS
+// Waits until the worker has appended the in-flight delta, if any.
+static void state_manager_drain(state_manager_t *state)
+{
+   if (!state->thread)
+      return;
+
+   slock_lock(state->lock);
+   while (state->pending)
+      scond_wait(state->cond, state->lock);
+   slock_unlock(state->lock);
+}
+#endif
+
+static bool pop_delta(state_manager_t *state);
+
 bool state_manager_pop(state_manager_t *state, void **data)
 { 
+#ifdef HAVE_THREADS
+   state_manager_drain(state);
+#endif
+
    *data = state->tmp_state;
    if (state->first_pop)
    {
@@ -113,6 +343,13 @@ bool state_manager_pop(state_manager_t *state, void **data)
       return true;
    }
 
+   return pop_delta(state);
+}
+
+// Applies the delta on top of the stack to tmp_state.
+static bool pop_delta(state_manager_t *state)
+{
+   size_t old_top = state->top_ptr;
    state->top_ptr = (state->top_ptr - 1) & state->buf_size_mask;
 
    if (state->top_ptr == state->bottom_ptr) // Our stack is completely empty... :v
@@ -121,25 +358,96 @@ bool state_manager_pop(state_manager_t *state, void **data)
       return false;
    }
 
-   while (state->buffer[state->top_ptr])
+   uint64_t entry;
+   while ((entry = state->buffer[state->top_ptr]))
    {
-      // Apply the xor patch.
-      uint32_t addr = state->buffer[state->top_ptr] >> 32;
-      uint32_t xor_ = state->buffer[state->top_ptr] & 0xFFFFFFFFU;
-      state->tmp_state[addr] ^= xor_;
+      if (entry & REWIND_RUN_FLAG)
+      {
+         // Apply a run of xor patches. Packed words are below the header.
+         uint32_t *dst = state->tmp_state + (uint32_t)entry;
+         size_t len = (entry >> 32) & REWIND_RUN_LEN_MASK;
+
+         for (size_t i = (len + 1) & ~(size_t)1; i; i -= 2)
+         {
+            state->top_ptr = (state->top_ptr - 1) & state->buf_size_mask;
+            uint64_t xor_ = state->buffer[state->top_ptr];
+
+            dst[i - 2] ^= (uint32_t)xor_;
+            if (i - 1 < len)
+               dst[i - 1] ^= (uint32_t)(xor_ >> 32);
+         }
+      }
+      else
+      {
+         // Apply the xor patch.
+         uint32_t addr = entry >> 32;
+         uint32_t xor_ = entry & 0xFFFFFFFFU;
+         state->tmp_state[addr] ^= xor_;
+      }
 
       state->top_ptr = (state->top_ptr - 1) & state->buf_size_mask;
    }
 
    if (state->top_ptr == state->bottom_ptr) // Our stack is completely empty... :v
-   {
       state->top_ptr = (state->top_ptr + 1) & state->buf_size_mask;
-      return true;
-   }
+
+   state->top_abs -= (old_top - state->top_ptr) & state->buf_size_mask;
+   state->frame--;
+
+   // Keyframes newer than us are from a future which will now be overwritten.
+   for (unsigned i = 0; i < state->keyframe_count; i++)
+      if (state->keyframes[i].frame > state->frame)
+         state->keyframes[i].valid = false;
 
    return true;
 }
 
+// A keyframe is usable as long as the deltas below it have not been overwritten.
+static bool keyframe_is_live(const state_manager_t *state, const struct state_keyframe *key)
+{
+   uint64_t bottom_abs = state->top_abs - ((state->top_ptr - state->bottom_ptr) & state->buf_size_mask);
+   return key->valid && key->pos > bottom_abs && key->pos <= state->top_abs;
+}
+
+unsigned state_manager_seek(state_manager_t *state, unsigned frames, void **data)
+{
+#ifdef HAVE_THREADS
+   state_manager_drain(state);
+#endif
+
+   *data = state->tmp_state;
+   state->first_pop = false;
+
+   uint64_t start = state->frame;
+   uint64_t target = frames < start ? start - frames : 0;
+
+   // Find the oldest live keyframe which is not older than the target.
+   // We can jump straight to it, and only replay deltas from there.
+   struct state_keyframe *best = NULL;
+   for (unsigned i = 0; i < state->keyframe_count; i++)
+   {
+      struct state_keyframe *key = &state->keyframes[i];
+      if (key->frame >= target && key->frame < state->frame && keyframe_is_live(state, key) &&
+            (!best || key->frame < best->frame))
+         best = key;
+   }
+
+   if (best)
+   {
+      memcpy(state->tmp_state, best->data, state->state_size * sizeof(uint32_t));
+      state->top_ptr = best->pos & state->buf_size_mask;
+      state->top_abs = best->pos;
+      state->frame = best->frame;
+
+      for (unsigned i = 0; i < state->keyframe_count; i++)
+         if (state->keyframes[i].frame > state->frame)
+            state->keyframes[i].valid = false;
+   }
+
+   while (state->frame > target && pop_delta(state));
+   return (unsigned)(start - state->frame);
+}
+
 static void reassign_bottom(state_manager_t *state)
 {
    state->bottom_ptr = (state->top_ptr + 1) & state->buf_size_mask;
@@ -147,8 +455,37 @@ static void reassign_bottom(state_manager_t *state)
       state->bottom_ptr = (state->bottom_ptr + 1) & state->buf_size_mask;
 }
 
+static inline void push_entry(state_manager_t *state, uint64_t entry, bool *crossed)
+{
+   state->buffer[state->top_ptr] = entry;
+   state->top_ptr = (state->top_ptr + 1) & state->buf_size_mask;
+
+   if (state->top_ptr == state->bottom_ptr)
+      *crossed = true;
+}
+
+// Finds the end of a dirty run starting at i.
+// Single clean words are absorbed into the run, as a 0 xor is cheaper than a new run header.
+// Two clean words in a row would risk a packed word of 0, which would be mistaken for a sentinel.
+static inline size_t find_run_end(const uint32_t *old_state, const uint32_t *new_state, size_t i, size_t size)
+{
+   size_t end = i + 1;
+   while (end < size)
+   {
+      if (old_state[end] != new_state[end])
+         end++;
+      else if (end + 1 < size && old_state[end + 1] != new_state[end + 1])
+         end += 2;
+      else
+         break;
+   }
+
+   return end;
+}
+
 static void generate_delta(state_manager_t *state, const void *data)
 {
+   size_t old_top = state->top_ptr;
    bool crossed = false;
    const uint32_t *old_state = state->tmp_state;
    const uint32_t *new_state = (const uint32_t*)data;
@@ -160,34 +497,161 @@ static void generate_delta(state_manager_t *state, const void *data)
    if (state->top_ptr == state->bottom_ptr)
       crossed = true;
 
-   for (uint64_t i = 0; i < state->state_size; i++)
+   // If the data differs (xor != 0), we push that xor on the stack with index and xor.
+   // This can be reversed by reapplying the xor.
+   // This, if states don't really differ much, we'll save lots of space :)
+   // Hopefully this will work really well with save states.
+   // Unchanged regions are skipped over in bulk by the SIMD kernels.
+   // Contiguous dirty regions (DMA, VRAM uploads) are stored as runs, which halves their footprint.
+   size_t size = state->state_size;
+   for (size_t i = state->find_change(old_state, new_state, 0, size); i < size; )
    {
-      uint64_t xor_ = old_state[i] ^ new_state[i];
+      size_t end = find_run_end(old_state, new_state, i, size);
+      size_t len = end - i;
 
-      // If the data differs (xor != 0), we push that xor on the stack with index and xor.
-      // This can be reversed by reapplying the xor.
-      // This, if states don't really differ much, we'll save lots of space :)
-      // Hopefully this will work really well with save states.
-      if (xor_)
+      if (len >= REWIND_RUN_MIN)
       {
-         state->buffer[state->top_ptr] = (i << 32) | xor_;
-         state->top_ptr = (state->top_ptr + 1) & state->buf_size_mask;
-
-         if (state->top_ptr == state->bottom_ptr)
-            crossed = true;
+         for (size_t j = i; j < end; j += 2)
+         {
+            uint64_t xor_ = old_state[j] ^ new_state[j];
+            if (j + 1 < end)
+               xor_ |= (uint64_t)(old_state[j + 1] ^ new_state[j + 1]) << 32;
+            push_entry(state, xor_, &crossed);
+         }
+
+         push_entry(state, REWIND_RUN_FLAG | ((uint64_t)len << 32) | i, &crossed);
+      }
+      else
+      {
+         for (size_t j = i; j < end; j++)
+         {
+            uint64_t xor_ = old_state[j] ^ new_state[j];
+            if (xor_)
+               push_entry(state, ((uint64_t)j << 32) | xor_, &crossed);
+         }
       }
+
+      i = state->find_change(old_state, new_state, end, size);
    }
 
    if (crossed)
       reassign_bottom(state);
+
+   state->top_abs += (state->top_ptr - old_top) & state->buf_size_mask;
 }
 
-bool state_manager_push(state_manager_t *state, const void *data)
+static void push_delta(state_manager_t *state, const void *data)
 {
    generate_delta(state, data);
    memcpy(state->tmp_state, data, state->state_size * sizeof(uint32_t));
    state->first_pop = true;
+   state->frame++;
+
+   if (state->keyframes && (state->frame % state->keyframe_interval) == 0)
+   {
+      // Reuse the oldest slot.
+      struct state_keyframe *key = &state->keyframes[state->keyframe_index];
+      state->keyframe_index = (state->keyframe_index + 1) % state->keyframe_count;
+
+      memcpy(key->data, data, state->state_size * sizeof(uint32_t));
+      key->frame = state->frame;
+      key->pos = state->top_abs;
+      key->valid = true;
+   }
+}
+
+bool state_manager_push(state_manager_t *state, const void *data)
+{
+#ifdef HAVE_THREADS
+   if (state->thread)
+   {
+      slock_lock(state->lock);
+      // Only one delta can be in flight. If the worker is still busy, we have to wait for it.
+      while (state->pending)
+         scond_wait(state->cond, state->lock);
+      state->pending = data;
+      scond_signal(state->cond);
+      slock_unlock(state->lock);
+      return true;
+   }
+#endif
 
+   push_delta(state, data);
    return true;
 }
 
+#ifdef HAVE_THREADS
+static void state_manager_thread(void *data)
+{
+   state_manager_t *state = (state_manager_t*)data;
+
+   slock_lock(state->lock);
+   for (;;)
+   {
+      while (!state->pending && state->thread_alive)
+         scond_wait(state->cond, state->lock);
+
+      if (!state->pending)
+         break;
+
+      const void *pending = state->pending;
+      slock_unlock(state->lock);
+
+      push_delta(state, pending);
+
+      slock_lock(state->lock);
+      state->pending = NULL;
+      scond_signal(state->cond);
+   }
+   slock_unlock(state->lock);
+}
+
+bool state_manager_start_thread(state_manager_t *state)
+{
+   if (state->thread)
+      return true;
+
+   state->lock = slock_new();
+   state->cond = scond_new();
+   if (!state->lock || !state->cond)
+      goto error;
+
+   state->thread_alive = true;
+   state->thread = sthread_create(state_manager_thread, state);
+   if (!state->thread)
+      goto error;
+
+   return true;
+
+error:
+   if (state->lock)
+      slock_free(state->lock);
+   if (state->cond)
+      scond_free(state->cond);
+   state->lock = NULL;
+   state->cond = NULL;
+   state->thread_alive = false;
+   return false;
+}
+
+static void state_manager_stop_thread(state_manager_t *state)
+{
+   if (!state->thread)
+      return;
+
+   slock_lock(state->lock);
+   state->thread_alive = false;
+   scond_signal(state->cond);
+   slock_unlock(state->lock);
+
+   // The worker finishes any in-flight delta before it exits.
+   sthread_join(state->thread);
+   slock_free(state->lock);
+   scond_free(state->cond);
+
+   state->thread = NULL;
+   state->lock = NULL;
+   state->cond = NULL;
+}
+#endif
+
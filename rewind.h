@@ -19,6 +19,10 @@
 #include <stddef.h>
 #include "boolean.h"
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 typedef struct state_manager state_manager_t;
 
 // Always pass in at least 4-byte aligned data and sizes!
@@ -28,4 +32,19 @@ void state_manager_free(state_manager_t *state);
 bool state_manager_pop(state_manager_t *state, void **data);
 bool state_manager_push(state_manager_t *state, const void *data);
 
+// Stores a full copy of every interval'th pushed state, keeping the last count copies.
+// This bounds the cost of state_manager_seek() by the keyframe interval instead of how far back we seek.
+bool state_manager_init_keyframes(state_manager_t *state, unsigned interval, unsigned count);
+
+// Rewinds up to the given number of pushed states at once, discarding the newer history like a pop would.
+// Returns how many states were actually rewound, which is less than requested if the buffer does not reach back far enough.
+unsigned state_manager_seek(state_manager_t *state, unsigned frames, void **data);
+
+#ifdef HAVE_THREADS
+// Moves delta generation in state_manager_push() to a worker thread.
+// Data passed to state_manager_push() is then in use until the next push returns, or until the next pop,
+// so callers must alternate between two buffers.
+bool state_manager_start_thread(state_manager_t *state);
+#endif
+
 #endif
@@ -162,6 +162,8 @@ void config_set_defaults(void)
    g_settings.video.fullscreen_y = fullscreen_y;
    g_settings.video.disable_composition = disable_composition;
    g_settings.video.vsync = vsync;
+   g_settings.video.threaded = video_threaded;
+   g_settings.video.scaler_threads = video_scaler_threads;
    g_settings.video.smooth = video_smooth;
    g_settings.video.force_aspect = force_aspect;
    g_settings.video.crop_overscan = crop_overscan;
@@ -208,17 +210,26 @@ void config_set_defaults(void)
    g_settings.audio.rate_control = rate_control;
    g_settings.audio.rate_control_delta = rate_control_delta;
    g_settings.audio.volume = audio_volume;
+   g_settings.audio.resampler_quality = audio_resampler_quality;
+   g_settings.audio.threaded = audio_threaded;
 
    g_settings.rewind_enable = rewind_enable;
    g_settings.rewind_buffer_size = rewind_buffer_size;
    g_settings.rewind_granularity = rewind_granularity;
+   g_settings.rewind_threaded = rewind_threaded;
+   g_settings.rewind_keyframe_interval = rewind_keyframe_interval;
+   g_settings.run_ahead_frames = run_ahead_frames;
+   g_settings.run_ahead_secondary_instance = run_ahead_secondary_instance;
    g_settings.slowmotion_ratio = slowmotion_ratio;
    g_settings.pause_nonactive = pause_nonactive;
    g_settings.autosave_interval = autosave_interval;
 
+   g_settings.netplay_input_delay_max = netplay_input_delay_max;
+   g_settings.netplay_players = netplay_players;
    g_settings.block_sram_overwrite = block_sram_overwrite;
    g_settings.savestate_auto_index = savestate_auto_index;
    g_settings.savestate_auto_save  = savestate_auto_save;
+   g_settings.savestate_compression = savestate_compression;
    g_settings.network_cmd_enable   = network_cmd_enable;
    g_settings.network_cmd_port     = network_cmd_port;
    g_settings.stdin_cmd_enable     = stdin_cmd_enable;
@@ -439,6 +450,8 @@ bool config_load_file(const char *path)
    CONFIG_GET_INT(video.monitor_index, "video_monitor_index");
    CONFIG_GET_BOOL(video.disable_composition, "video_disable_composition");
    CONFIG_GET_BOOL(video.vsync, "video_vsync");
+   CONFIG_GET_BOOL(video.threaded, "video_threaded");
+   CONFIG_GET_INT(video.scaler_threads, "video_scaler_threads");
    CONFIG_GET_BOOL(video.smooth, "video_smooth");
    CONFIG_GET_BOOL(video.force_aspect, "video_force_aspect");
    CONFIG_GET_BOOL(video.crop_overscan, "video_crop_overscan");
@@ -520,6 +533,8 @@ bool config_load_file(const char *path)
    CONFIG_GET_BOOL(audio.rate_control, "audio_rate_control");
    CONFIG_GET_FLOAT(audio.rate_control_delta, "audio_rate_control_delta");
    CONFIG_GET_FLOAT(audio.volume, "audio_volume");
+   CONFIG_GET_INT(audio.resampler_quality, "audio_resampler_quality");
+   CONFIG_GET_BOOL(audio.threaded, "audio_threaded");
 
    CONFIG_GET_STRING(video.driver, "video_driver");
    CONFIG_GET_STRING(audio.driver, "audio_driver");
@@ -543,6 +558,10 @@ bool config_load_file(const char *path)
       g_settings.rewind_buffer_size = buffer_size * UINT64_C(1000000);
 
    CONFIG_GET_INT(rewind_granularity, "rewind_granularity");
+   CONFIG_GET_BOOL(rewind_threaded, "rewind_threaded");
+   CONFIG_GET_INT(rewind_keyframe_interval, "rewind_keyframe_interval");
+   CONFIG_GET_INT(run_ahead_frames, "run_ahead_frames");
+   CONFIG_GET_BOOL(run_ahead_secondary_instance, "run_ahead_secondary_instance");
    CONFIG_GET_FLOAT(slowmotion_ratio, "slowmotion_ratio");
    if (g_settings.slowmotion_ratio < 1.0f)
       g_settings.slowmotion_ratio = 1.0f;
@@ -553,14 +572,19 @@ bool config_load_file(const char *path)
    CONFIG_GET_PATH(cheat_database, "cheat_database_path");
    CONFIG_GET_PATH(cheat_settings_path, "cheat_settings_path");
 
+   CONFIG_GET_INT(netplay_input_delay_max, "netplay_input_delay_max");
+   CONFIG_GET_INT(netplay_players, "netplay_players");
    CONFIG_GET_BOOL(block_sram_overwrite, "block_sram_overwrite");
    CONFIG_GET_BOOL(savestate_auto_index, "savestate_auto_index");
    CONFIG_GET_BOOL(savestate_auto_save, "savestate_auto_save");
+   CONFIG_GET_BOOL(savestate_compression, "savestate_compression");
 
    CONFIG_GET_BOOL(network_cmd_enable, "network_cmd_enable");
    CONFIG_GET_INT(network_cmd_port, "network_cmd_port");
    CONFIG_GET_BOOL(stdin_cmd_enable, "stdin_cmd_enable");
 
+   CONFIG_GET_PATH(frame_stats_path, "frame_stats_path");
+
    CONFIG_GET_INT(input.turbo_period, "input_turbo_period");
    CONFIG_GET_INT(input.turbo_duty_cycle, "input_duty_cycle");
 
@@ -576,6 +600,11 @@ bool config_load_file(const char *path)
       }
    }
 
+#ifdef HAVE_NETPLAY
+   if (!g_extern.has_set_netplay_sync_frames)
+      config_get_uint(conf, "netplay_sync_frames", &g_extern.netplay_sync_frames);
+#endif
+
    if (!g_extern.has_set_save_path && config_get_path(conf, "savefile_directory", tmp_str, sizeof(tmp_str)))
    {
       if (path_is_directory(tmp_str))
@@ -0,0 +1,573 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "state_io.h"
+#include "general.h"
+#include "compat/strl.h"
+#include "zlib_util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_THREADS
+#include "thread.h"
+#endif
+
+// Compressed states start with the magic and the uncompressed size (LE), followed by a zlib stream.
+// Anything else is a raw state.
+#define STATE_MAGIC "RASTATEZ"
+#define STATE_MAGIC_SIZE 8
+#define STATE_HEADER_SIZE 12
+
+// Writes queued beyond this block the caller, so slow storage cannot pile up states in memory.
+#define STATE_MAX_JOBS 2
+
+// Free buffers kept around for reuse.
+#define STATE_MAX_POOL 2
+
+struct state_buffer
+{
+   uint8_t *data;
+   size_t size;
+   size_t cap;
+   char path[PATH_MAX];
+   struct state_buffer *next;
+};
+
+struct state_io
+{
+   bool compress;
+
+   struct state_buffer *jobs; // Queued writes, oldest first. The worker is writing the first one.
+   struct state_buffer *pool;
+   struct state_buffer *cache; // Uncompressed contents of cache->path as last written or read.
+   const struct state_buffer *lent; // Handed out by state_io_read(), must not be reused until the next call.
+
+   char prefetch_path[PATH_MAX];
+   bool prefetch; // Requested, but not started.
+   bool prefetching; // Being read by the worker.
+
+   char error_path[PATH_MAX];
+   bool error;
+
+   // Scratch for compressed data, only used by whoever writes or prefetches.
+   uint8_t *zbuf;
+   size_t zbuf_cap;
+
+#ifdef HAVE_THREADS
+   slock_t *lock;
+   scond_t *cond; // Wakes up the worker.
+   scond_t *done_cond; // Signalled whenever the worker finishes something.
+   sthread_t *thread;
+   bool quit;
+#endif
+};
+
+static inline void state_io_lock(state_io_t *io)
+{
+#ifdef HAVE_THREADS
+   slock_lock(io->lock);
+#else
+   (void)io;
+#endif
+}
+
+static inline void state_io_unlock(state_io_t *io)
+{
+#ifdef HAVE_THREADS
+   slock_unlock(io->lock);
+#else
+   (void)io;
+#endif
+}
+
+static bool reserve(uint8_t **data, size_t *cap, size_t size)
+{
+   if (size <= *cap)
+      return true;
+
+   uint8_t *new_data = (uint8_t*)realloc(*data, size);
+   if (!new_data)
+      return false;
+
+   *data = new_data;
+   *cap = size;
+   return true;
+}
+
+static void buffer_free(struct state_buffer *buf)
+{
+   if (!buf)
+      return;
+
+   free(buf->data);
+   free(buf);
+}
+
+// Buffer management is always done with the lock held.
+static struct state_buffer *pool_take(state_io_t *io)
+{
+   for (struct state_buffer **buf = &io->pool; *buf; buf = &(*buf)->next)
+   {
+      if (*buf == io->lent)
+         continue;
+
+      struct state_buffer *ret = *buf;
+      *buf = ret->next;
+      ret->next = NULL;
+      return ret;
+   }
+
+   return (struct state_buffer*)calloc(1, sizeof(struct state_buffer));
+}
+
+static void pool_put(state_io_t *io, struct state_buffer *buf)
+{
+   unsigned count = 0;
+   for (const struct state_buffer *tmp = io->pool; tmp; tmp = tmp->next)
+      count++;
+
+   if (count >= STATE_MAX_POOL && buf != io->lent)
+   {
+      buffer_free(buf);
+      return;
+   }
+
+   buf->next = io->pool;
+   io->pool = buf;
+}
+
+static void cache_replace(state_io_t *io, struct state_buffer *buf)
+{
+   if (io->cache)
+      pool_put(io, io->cache);
+   io->cache = buf;
+}
+
+// The newest state of path which is in memory.
+static struct state_buffer *find_state(state_io_t *io, const char *path)
+{
+   struct state_buffer *found = NULL;
+   for (struct state_buffer *job = io->jobs; job; job = job->next)
+      if (strcmp(job->path, path) == 0)
+         found = job;
+
+   if (!found && io->cache && strcmp(io->cache->path, path) == 0)
+      found = io->cache;
+
+   return found;
+}
+
+static bool write_state_file(state_io_t *io, const struct state_buffer *buf)
+{
+   char tmp_path[PATH_MAX];
+   strlcpy(tmp_path, buf->path, sizeof(tmp_path));
+   strlcat(tmp_path, ".tmp", sizeof(tmp_path));
+
+   const uint8_t *data = buf->data;
+   size_t size = buf->size;
+   uint8_t header[STATE_HEADER_SIZE];
+   bool compressed = false;
+
+#ifdef HAVE_ZLIB_DEFLATE
+   size_t compressed_size = zlib_deflate_bound(size);
+   if (io->compress && reserve(&io->zbuf, &io->zbuf_cap, compressed_size) &&
+         zlib_deflate_buffer(io->zbuf, &compressed_size, buf->data, size) &&
+         compressed_size + STATE_HEADER_SIZE < size)
+   {
+      memcpy(header, STATE_MAGIC, STATE_MAGIC_SIZE);
+      for (unsigned i = 0; i < 4; i++)
+         header[STATE_MAGIC_SIZE + i] = (uint8_t)(size >> (8 * i));
+
+      data = io->zbuf;
+      size = compressed_size;
+      compressed = true;
+   }
+#else
+   (void)io;
+#endif
+
+   FILE *file = fopen(tmp_path, "wb");
+   if (!file)
+      return false;
+
+   bool failed = false;
+   if (compressed)
+      failed |= fwrite(header, 1, sizeof(header), file) != sizeof(header);
+   failed |= fwrite(data, 1, size, file) != size;
+   failed |= fflush(file) != 0;
+   failed |= fclose(file) != 0;
+
+#ifdef _WIN32
+   // rename() does not replace existing files here.
+   if (!failed)
+      remove(buf->path);
+#endif
+
+   if (!failed)
+      failed = rename(tmp_path, buf->path) != 0;
+
+   if (failed)
+      remove(tmp_path);
+   else
+   {
+      RARCH_LOG("Wrote state to \"%s\" (%u bytes%s).\n", buf->path,
+            (unsigned)size, compressed ? ", compressed" : "");
+   }
+
+   return !failed;
+}
+
+// Reads a compressed or raw state into buf.
+static bool read_state_file(const char *path, struct state_buffer *buf, uint8_t **zbuf, size_t *zbuf_cap)
+{
+   FILE *file = fopen(path, "rb");
+   if (!file)
+      return false;
+
+   bool ret = false;
+   uint8_t header[STATE_HEADER_SIZE];
+   size_t size, header_size;
+
+   fseek(file, 0, SEEK_END);
+   long file_size = ftell(file);
+   rewind(file);
+   if (file_size <= 0)
+      goto end;
+
+   size = file_size;
+   header_size = size < sizeof(header) ? size : sizeof(header);
+   if (fread(header, 1, header_size, file) != header_size)
+      goto end;
+
+   if (header_size == sizeof(header) && memcmp(header, STATE_MAGIC, STATE_MAGIC_SIZE) == 0)
+   {
+#ifdef HAVE_ZLIB
+      size_t raw_size = 0;
+      for (unsigned i = 0; i < 4; i++)
+         raw_size |= (size_t)header[STATE_MAGIC_SIZE + i] << (8 * i);
+
+      size -= sizeof(header);
+      if (!reserve(zbuf, zbuf_cap, size) || !reserve(&buf->data, &buf->cap, raw_size) ||
+            fread(*zbuf, 1, size, file) != size ||
+            !zlib_inflate_buffer(buf->data, raw_size, *zbuf, size))
+         goto end;
+
+      buf->size = raw_size;
+      ret = true;
+#else
+      RARCH_ERR("State \"%s\" is compressed, but zlib support is not built in.\n", path);
+#endif
+   }
+   else
+   {
+      if (!reserve(&buf->data, &buf->cap, size))
+         goto end;
+
+      memcpy(buf->data, header, header_size);
+      if (fread(buf->data + header_size, 1, size - header_size, file) != size - header_size)
+         goto end;
+
+      buf->size = size;
+      ret = true;
+   }
+
+end:
+   fclose(file);
+   return ret;
+}
+
+// Moves a finished write into the cache, so loading it back is instant.
+static void finish_job(state_io_t *io, struct state_buffer *job, bool ok)
+{
+   if (ok)
+      cache_replace(io, job);
+   else
+   {
+      RARCH_ERR("Failed to write state to \"%s\".\n", job->path);
+      strlcpy(io->error_path, job->path, sizeof(io->error_path));
+      io->error = true;
+      pool_put(io, job);
+   }
+}
+
+#ifdef HAVE_THREADS
+static void state_io_thread(void *data)
+{
+   state_io_t *io = (state_io_t*)data;
+
+   slock_lock(io->lock);
+   for (;;)
+   {
+      if (io->jobs)
+      {
+         // The job stays queued while writing, so it can still be loaded from memory.
+         struct state_buffer *job = io->jobs;
+         slock_unlock(io->lock);
+         bool ok = write_state_file(io, job);
+         slock_lock(io->lock);
+
+         io->jobs = job->next;
+         job->next = NULL;
+         finish_job(io, job, ok);
+         scond_signal(io->done_cond);
+      }
+      else if (io->prefetch)
+      {
+         io->prefetch = false;
+
+         if (!find_state(io, io->prefetch_path))
+         {
+            io->prefetching = true;
+            struct state_buffer *buf = pool_take(io);
+            slock_unlock(io->lock);
+            bool ok = buf && read_state_file(io->prefetch_path, buf, &io->zbuf, &io->zbuf_cap);
+            slock_lock(io->lock);
+            io->prefetching = false;
+
+            if (ok)
+            {
+               strlcpy(buf->path, io->prefetch_path, sizeof(buf->path));
+               cache_replace(io, buf);
+            }
+            else if (buf)
+               pool_put(io, buf);
+         }
+
+         scond_signal(io->done_cond);
+      }
+      else if (io->quit)
+         break;
+      else
+         scond_wait(io->cond, io->lock);
+   }
+   slock_unlock(io->lock);
+}
+#endif
+
+state_io_t *state_io_new(bool compress)
+{
+   state_io_t *io = (state_io_t*)calloc(1, sizeof(*io));
+   if (!io)
+      return NULL;
+
+#ifdef HAVE_ZLIB_DEFLATE
+   io->compress = compress;
+#else
+   (void)compress;
+#endif
+
+#ifdef HAVE_THREADS
+   io->lock = slock_new();
+   io->cond = scond_new();
+   io->done_cond = scond_new();
+   if (!io->lock || !io->cond || !io->done_cond)
+      goto error;
+
+   io->thread = sthread_create(state_io_thread, io);
+   if (!io->thread)
+      goto error;
+#endif
+
+   return io;
+
+#ifdef HAVE_THREADS
+error:
+   state_io_free(io);
+   return NULL;
+#endif
+}
+
+void state_io_free(state_io_t *io)
+{
+   if (!io)
+      return;
+
+#ifdef HAVE_THREADS
+   if (io->thread)
+   {
+      slock_lock(io->lock);
+      io->quit = true;
+      scond_signal(io->cond);
+      slock_unlock(io->lock);
+      sthread_join(io->thread);
+   }
+
+   if (io->lock)
+      slock_free(io->lock);
+   if (io->cond)
+      scond_free(io->cond);
+   if (io->done_cond)
+      scond_free(io->done_cond);
+#endif
+
+   while (io->pool)
+   {
+      struct state_buffer *next = io->pool->next;
+      buffer_free(io->pool);
+      io->pool = next;
+   }
+
+   buffer_free(io->cache);
+   free(io->zbuf);
+   free(io);
+}
+
+bool state_io_write(state_io_t *io, const char *path, size_t size, bool (*serialize)(void*, size_t))
+{
+   state_io_lock(io);
+   io->lent = NULL;
+   struct state_buffer *buf = pool_take(io);
+   state_io_unlock(io);
+
+   if (!buf)
+      return false;
+
+   if (!reserve(&buf->data, &buf->cap, size) || !serialize(buf->data, size))
+   {
+      state_io_lock(io);
+      pool_put(io, buf);
+      state_io_unlock(io);
+      return false;
+   }
+
+   buf->size = size;
+   strlcpy(buf->path, path, sizeof(buf->path));
+
+#ifdef HAVE_THREADS
+   slock_lock(io->lock);
+
+   unsigned count;
+   struct state_buffer **tail;
+   for (;;)
+   {
+      count = 0;
+      for (tail = &io->jobs; *tail; tail = &(*tail)->next)
+         count++;
+
+      if (count < STATE_MAX_JOBS)
+         break;
+      scond_wait(io->done_cond, io->lock);
+   }
+
+   *tail = buf;
+   scond_signal(io->cond);
+   slock_unlock(io->lock);
+   return true;
+#else
+   bool ok = write_state_file(io, buf);
+   finish_job(io, buf, ok);
+   return ok;
+#endif
+}
+
+const void *state_io_read(state_io_t *io, const char *path, size_t *size)
+{
+   state_io_lock(io);
+   io->lent = NULL;
+
+   struct state_buffer *found = find_state(io, path);
+
+#ifdef HAVE_THREADS
+   // Wait for a prefetch of the same state instead of reading it twice.
+   while (!found && (io->prefetch || io->prefetching) && strcmp(io->prefetch_path, path) == 0)
+   {
+      scond_wait(io->done_cond, io->lock);
+      found = find_state(io, path);
+   }
+#endif
+
+   if (!found)
+   {
+      struct state_buffer *buf = pool_take(io);
+      state_io_unlock(io);
+
+      uint8_t *zbuf = NULL;
+      size_t zbuf_cap = 0;
+      bool ok = buf && read_state_file(path, buf, &zbuf, &zbuf_cap);
+      free(zbuf);
+
+      state_io_lock(io);
+      if (ok)
+      {
+         strlcpy(buf->path, path, sizeof(buf->path));
+         cache_replace(io, buf);
+         found = buf;
+      }
+      else if (buf)
+         pool_put(io, buf);
+   }
+
+   io->lent = found;
+   state_io_unlock(io);
+
+   if (!found)
+      return NULL;
+
+   *size = found->size;
+   return found->data;
+}
+
+void state_io_prefetch(state_io_t *io, const char *path)
+{
+#ifdef HAVE_THREADS
+   slock_lock(io->lock);
+   io->lent = NULL;
+
+   if (!find_state(io, path) && !(io->prefetching && strcmp(io->prefetch_path, path) == 0))
+   {
+      // The worker only looks at the path with the lock held.
+      if (!io->prefetching)
+      {
+         strlcpy(io->prefetch_path, path, sizeof(io->prefetch_path));
+         io->prefetch = true;
+         scond_signal(io->cond);
+      }
+   }
+
+   slock_unlock(io->lock);
+#else
+   (void)io;
+   (void)path;
+#endif
+}
+
+void state_io_flush(state_io_t *io)
+{
+#ifdef HAVE_THREADS
+   slock_lock(io->lock);
+   io->lent = NULL;
+   while (io->jobs)
+      scond_wait(io->done_cond, io->lock);
+   slock_unlock(io->lock);
+#else
+   (void)io;
+#endif
+}
+
+bool state_io_get_error(state_io_t *io, char *path, size_t size)
+{
+   state_io_lock(io);
+   bool error = io->error;
+   if (error)
+      strlcpy(path, io->error_path, size);
+   io->error = false;
+   state_io_unlock(io);
+   return error;
+}
@@ -0,0 +1,57 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RARCH_STATE_IO_H
+#define __RARCH_STATE_IO_H
+
+#include <stddef.h>
+#include "boolean.h"
+
+// Save state file I/O, kept off the main thread.
+//
+// States are serialized into pooled buffers, then compressed and written by a worker thread.
+// Files are written to a temporary file which is renamed over the old one,
+// so a crash while saving never leaves a broken state behind.
+// Both compressed and raw state files can be read.
+//
+// The last state written or prefetched stays in memory, so loading it again does not touch the disk.
+// Without threads, everything is done by the caller.
+typedef struct state_io state_io_t;
+
+// Compression is only done if built with zlib. Compressed states can also be read with rzlib.
+state_io_t *state_io_new(bool compress);
+
+// Finishes all queued writes first.
+void state_io_free(state_io_t *io);
+
+// Serializes a state of size bytes with serialize, and queues it for writing to path.
+// Returns false if serializing fails, or if the write fails when there is no worker thread.
+bool state_io_write(state_io_t *io, const char *path, size_t size, bool (*serialize)(void*, size_t));
+
+// Reads a state, from memory if it is queued, cached or being prefetched.
+// The data belongs to io, and stays valid until the next call into it. Returns NULL on failure.
+const void *state_io_read(state_io_t *io, const char *path, size_t *size);
+
+// Starts reading a state in the background, so that a later state_io_read() of it is instant.
+void state_io_prefetch(state_io_t *io, const char *path);
+
+// Blocks until every queued state is written.
+void state_io_flush(state_io_t *io);
+
+// Returns true if a queued write failed since the last call, along with the path of the last one.
+bool state_io_get_error(state_io_t *io, char *path, size_t size);
+
+#endif
+
@@ -0,0 +1,247 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Benchmarks writing only dirty SRAM blocks against rewriting the whole file,
+// and how long the main thread is held up per frame.
+// Verifies that the autosaved file always matches SRAM, including a partial last block,
+// that unchanged SRAM is never written, and that a change is found even when it leaves the CRC32 intact.
+
+#include "../autosave.c"
+#include <time.h>
+#include <unistd.h>
+
+struct global g_extern;
+struct settings g_settings;
+
+// Not a multiple of the block size, so the last block is partial.
+#define SRAM_SIZE (8 * 1024 * 1024 + 100)
+
+static double get_time(void)
+{
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return tv.tv_sec + tv.tv_nsec / 1000000000.0;
+}
+
+// A game writing a save slot touches a few small runs.
+static void mutate_sram(uint8_t *sram, unsigned seed)
+{
+   srand(seed);
+   for (unsigned run = 0; run < 8; run++)
+   {
+      size_t start = (size_t)rand() % SRAM_SIZE;
+      size_t len = 1 + (size_t)rand() % 512;
+      for (size_t i = start; i < start + len && i < SRAM_SIZE; i++)
+         sram[i] ^= (uint8_t)rand() | 1;
+   }
+}
+
+static bool file_matches(const char *path, const uint8_t *sram)
+{
+   FILE *file = fopen(path, "rb");
+   if (!file)
+      return false;
+
+   uint8_t *buf = (uint8_t*)malloc(SRAM_SIZE + 1);
+   bool ret = buf && fread(buf, 1, SRAM_SIZE + 1, file) == SRAM_SIZE && memcmp(buf, sram, SRAM_SIZE) == 0;
+   free(buf);
+   fclose(file);
+   return ret;
+}
+
+// Runs frames through the autosave thread for a while, with SRAM written every write_every frames.
+// Returns the worst time update_autosave() held up a frame.
+static double run_frames(uint8_t *sram, double seconds, unsigned write_every, double *average)
+{
+   double max_frame = 0.0, total_frame = 0.0;
+   unsigned frames = 0;
+   double start = get_time();
+   while (get_time() - start < seconds)
+   {
+      if (frames % write_every == 0)
+         mutate_sram(sram, frames + 1000);
+
+      double frame_start = get_time();
+      update_autosave();
+      double frame_time = get_time() - frame_start;
+      total_frame += frame_time;
+      if (frame_time > max_frame)
+         max_frame = frame_time;
+
+      frames++;
+      usleep(2000);
+   }
+
+   *average = total_frame / frames;
+   return max_frame;
+}
+
+// Runs one save cycle of the thread directly, as if the interval passed,
+// with the main thread copying out the dirty blocks.
+static void save_cycle(autosave_t *save)
+{
+   bool first_log = false;
+   size_t count = find_dirty_blocks(save);
+   if (!count && !save->retry)
+      return;
+
+   copy_dirty_blocks(save);
+   autosave_save(save, count, &first_log);
+}
+
+int main(void)
+{
+   char dir[] = "/tmp/rarch-autosave-XXXXXX";
+   if (!mkdtemp(dir))
+   {
+      fprintf(stderr, "Failed to create temporary directory.\n");
+      return 1;
+   }
+
+   char path[PATH_MAX], thread_path[PATH_MAX];
+   snprintf(path, sizeof(path), "%s/game.srm", dir);
+   snprintf(thread_path, sizeof(thread_path), "%s/thread.srm", dir);
+
+   bool ret = false;
+   autosave_t *save = NULL;
+   uint8_t *sram = (uint8_t*)calloc(1, SRAM_SIZE);
+   if (!sram)
+      goto end;
+
+   // The thread never wakes up on its own here.
+   save = autosave_new(path, sram, SRAM_SIZE, 3600);
+   if (!save)
+      goto end;
+
+   save_cycle(save);
+   if (access(path, F_OK) == 0)
+   {
+      fprintf(stderr, "Unchanged SRAM was written.\n");
+      goto end;
+   }
+
+   // First change rewrites everything, later ones only the dirty blocks.
+   sram[SRAM_SIZE - 1] = 0xaa;
+   save_cycle(save);
+   if (!file_matches(path, sram))
+   {
+      fprintf(stderr, "First autosave does not match SRAM.\n");
+      goto end;
+   }
+
+   double dirty_time = 0.0;
+   for (unsigned i = 0; i < 16; i++)
+   {
+      mutate_sram(sram, i);
+      double start = get_time();
+      save_cycle(save);
+      dirty_time += get_time() - start;
+
+      if (!file_matches(path, sram))
+      {
+         fprintf(stderr, "Autosave #%u does not match SRAM.\n", i);
+         goto end;
+      }
+   }
+
+   // XORing in this pattern leaves the CRC32 of any block unchanged.
+   static const uint8_t crc_collision[] = { 0x01, 0x96, 0x30, 0x07, 0x77 };
+   for (unsigned i = 0; i < sizeof(crc_collision); i++)
+      sram[4096 + 100 + i] ^= crc_collision[i];
+   save_cycle(save);
+   if (!file_matches(path, sram))
+   {
+      fprintf(stderr, "Autosave missed a change which keeps the CRC32 of its block.\n");
+      goto end;
+   }
+
+   double full_time = 0.0;
+   for (unsigned i = 0; i < 16; i++)
+   {
+      mutate_sram(sram, i + 16);
+      double start = get_time();
+      memcpy(save->buffer, sram, SRAM_SIZE);
+      write_full(save);
+      full_time += get_time() - start;
+   }
+
+   printf("Save: %.3f ms writing dirty blocks, %.3f ms rewriting %u bytes.\n",
+         1000.0 * dirty_time / 16, 1000.0 * full_time / 16, (unsigned)SRAM_SIZE);
+
+   autosave_free(save);
+   save = NULL;
+
+   // Through the thread, with the main thread running frames.
+   g_extern.autosave[0] = autosave_new(thread_path, sram, SRAM_SIZE, 1);
+   if (!g_extern.autosave[0])
+      goto end;
+
+   // A game writing a save slot now and then, and one using SRAM as work RAM.
+   double sparse_average, busy_average;
+   double sparse_max = run_frames(sram, 2.5, 100, &sparse_average);
+   double busy_max = run_frames(sram, 2.5, 1, &busy_average);
+
+   // Once SRAM stops changing, the next autosave must catch up with it.
+   double start = get_time();
+   bool matches = false;
+   while (!matches && get_time() - start < 3.0)
+   {
+      update_autosave();
+      usleep(2000);
+      matches = file_matches(thread_path, sram);
+   }
+
+   if (!matches)
+   {
+      fprintf(stderr, "Threaded autosave does not match SRAM.\n");
+      goto end;
+   }
+
+   // What the old thread held the frame lock for every interval, comparing and copying all of SRAM.
+   uint8_t *copy = (uint8_t*)malloc(SRAM_SIZE);
+   if (!copy)
+      goto end;
+   memcpy(copy, sram, SRAM_SIZE);
+   copy[SRAM_SIZE - 1] ^= 1;
+   double lock_start = get_time();
+   volatile int differ = memcmp(copy, g_extern.autosave[0]->buffer, SRAM_SIZE);
+   if (differ)
+      memcpy(copy, sram, SRAM_SIZE);
+   double lock_time = get_time() - lock_start;
+   free(copy);
+
+   printf("Frame, SRAM written every 100 frames: %.1f ns average, %.3f ms worst.\n",
+         1e9 * sparse_average, 1000.0 * sparse_max);
+   printf("Frame, SRAM written every frame: %.1f ns average, %.3f ms worst.\n",
+         1e9 * busy_average, 1000.0 * busy_max);
+   printf("Old locked compare and copy, every interval: %.3f ms.\n", 1000.0 * lock_time);
+
+   ret = true;
+
+end:
+   printf("%s\n", ret ? "OK" : "FAILED");
+
+   if (save)
+      autosave_free(save);
+   if (g_extern.autosave[0])
+      autosave_free(g_extern.autosave[0]);
+   free(sram);
+
+   unlink(path);
+   unlink(thread_path);
+   rmdir(dir);
+
+   return ret ? 0 : 1;
+}
@@ -0,0 +1,222 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Checks every CRC32 and SHA256 implementation the CPU supports against known digests,
+// and against the plain C implementations for all sizes and alignments up to a few blocks.
+// Then measures throughput of each over 1 - 256 MiB buffers.
+
+#include "../hash.c"
+#include <stdlib.h>
+#include <time.h>
+
+struct global g_extern;
+struct settings g_settings;
+
+struct impl
+{
+   const char *name;
+   crc32_update_t crc32;
+   sha256_blocks_t sha256;
+};
+
+static double get_time(void)
+{
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return tv.tv_sec + tv.tv_nsec / 1000000000.0;
+}
+
+static unsigned get_impls(struct impl *impls)
+{
+   unsigned num = 0;
+   impls[num++] = (struct impl) { "C", crc32_update_slice8, sha256_blocks_c };
+
+#ifdef HASH_HAVE_X86
+   struct rarch_cpu_features cpu;
+   rarch_get_cpu_features(&cpu);
+   const unsigned sse4 = RARCH_SIMD_SSSE3 | RARCH_SIMD_SSE4;
+
+   if ((cpu.simd & sse4) == sse4)
+   {
+      impls[num++] = (struct impl) {
+         "SIMD",
+         (cpu.simd & RARCH_SIMD_PCLMUL) ? crc32_update_pclmul : NULL,
+         (cpu.simd & RARCH_SIMD_SHA) ? sha256_blocks_sha : NULL,
+      };
+   }
+#endif
+
+   return num;
+}
+
+static void use_impl(const struct impl *impl, const struct impl *fallback)
+{
+   crc32_update_impl = impl->crc32 ? impl->crc32 : fallback->crc32;
+   sha256_blocks = impl->sha256 ? impl->sha256 : fallback->sha256;
+}
+
+static uint32_t crc32_bytewise(const uint8_t *data, size_t length)
+{
+   uint32_t crc = ~0u;
+   for (size_t i = 0; i < length; i++)
+      crc = crc32_adjust(crc, data[i]);
+   return ~crc;
+}
+
+static bool check_known(const char *name)
+{
+   static const struct
+   {
+      const char *in;
+      const char *sha256;
+      uint32_t crc32;
+   } vectors[] = {
+      { "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855", 0x00000000 },
+      { "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", 0x352441c2 },
+      { "123456789", "15e2b0d3c33891ebb0f1ef609ec419420c20e320ce94c65fbc8c3312448eb225", 0xcbf43926 },
+      { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1", 0x171a3f5f },
+   };
+
+   bool ret = true;
+   char sha[65];
+   for (unsigned i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+   {
+      const uint8_t *in = (const uint8_t*)vectors[i].in;
+      size_t size = strlen(vectors[i].in);
+
+      sha256_hash(sha, in, size);
+      uint32_t crc = crc32_calculate(in, size);
+      if (strcmp(sha, vectors[i].sha256) != 0 || crc != vectors[i].crc32)
+      {
+         fprintf(stderr, "%s: Wrong digest for \"%s\".\n", name, vectors[i].in);
+         ret = false;
+      }
+   }
+
+   // One million times 'a' crosses many blocks.
+   uint8_t *million = (uint8_t*)malloc(1000000);
+   memset(million, 'a', 1000000);
+   sha256_hash(sha, million, 1000000);
+   if (strcmp(sha, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0") != 0)
+   {
+      fprintf(stderr, "%s: Wrong digest for a million a's.\n", name);
+      ret = false;
+   }
+   free(million);
+
+   return ret;
+}
+
+// Every length from 0 to a few blocks at every alignment in a 16 byte vector.
+static bool check_against_c(const char *name, const struct impl *impl, const struct impl *c_impl)
+{
+   uint8_t buf[16 + 1024];
+   for (unsigned i = 0; i < sizeof(buf); i++)
+      buf[i] = (uint8_t)(i * 131 + (i >> 3));
+
+   for (unsigned offset = 0; offset < 16; offset++)
+   {
+      for (unsigned size = 0; size <= 1024; size++)
+      {
+         char expected[65], sha[65];
+         const uint8_t *in = buf + offset;
+
+         use_impl(c_impl, c_impl);
+         sha256_hash(expected, in, size);
+         uint32_t expected_crc = crc32_bytewise(in, size);
+
+         use_impl(impl, c_impl);
+         sha256_hash(sha, in, size);
+         uint32_t crc = crc32_calculate(in, size);
+
+         if (strcmp(sha, expected) != 0 || crc != expected_crc)
+         {
+            fprintf(stderr, "%s: Digest mismatch for %u bytes at offset %u.\n", name, size, offset);
+            return false;
+         }
+      }
+   }
+
+   return true;
+}
+
+int main(int argc, char *argv[])
+{
+   size_t max_size = (argc > 1 ? strtoul(argv[1], NULL, 0) : 256) << 20;
+
+   hash_init();
+
+   struct impl impls[2];
+   unsigned num_impls = get_impls(impls);
+
+   bool ret = true;
+   for (unsigned i = 0; i < num_impls; i++)
+   {
+      use_impl(&impls[i], &impls[0]);
+      printf("%s: CRC32 %s, SHA256 %s.\n", impls[i].name,
+            impls[i].crc32 ? "yes" : "no", impls[i].sha256 ? "yes" : "no");
+      if (!check_known(impls[i].name) || !check_against_c(impls[i].name, &impls[i], &impls[0]))
+         ret = false;
+   }
+
+   uint8_t *buf = (uint8_t*)malloc(max_size);
+   if (!buf)
+   {
+      fprintf(stderr, "Failed to allocate %u MiB.\n", (unsigned)(max_size >> 20));
+      return 1;
+   }
+
+   uint32_t seed = 1;
+   for (size_t i = 0; i < max_size; i++)
+   {
+      seed = seed * 1664525u + 1013904223u;
+      buf[i] = seed >> 24;
+   }
+
+   for (size_t size = 1 << 20; size <= max_size; size <<= 2)
+   {
+      uint32_t crcs[2];
+      char shas[2][65];
+
+      for (unsigned i = 0; i < num_impls; i++)
+      {
+         use_impl(&impls[i], &impls[0]);
+
+         double start = get_time();
+         crcs[i] = crc32_calculate(buf, size);
+         double crc_time = get_time() - start;
+
+         start = get_time();
+         sha256_hash(shas[i], buf, size);
+         double sha_time = get_time() - start;
+
+         printf("%4u MiB, %-4s: CRC32 %7.2f GB/s, SHA256 %5.2f GB/s.\n",
+               (unsigned)(size >> 20), impls[i].name,
+               size / crc_time / 1e9, size / sha_time / 1e9);
+
+         if (crcs[i] != crcs[0] || strcmp(shas[i], shas[0]) != 0)
+         {
+            fprintf(stderr, "%s: Digest mismatch for %u MiB.\n", impls[i].name, (unsigned)(size >> 20));
+            ret = false;
+         }
+      }
+   }
+
+   free(buf);
+
+   printf("%s\n", ret ? "OK" : "FAILED");
+   return ret ? 0 : 1;
+}
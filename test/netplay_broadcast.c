@@ -0,0 +1,350 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Connects hundreds of fake spectators over loopback to the spectator broadcast.
+// Most of them read everything and verify the stream byte for byte.
+// Some never read at all, and must be evicted without ever stalling the pushes.
+
+#include "../netplay_broadcast.c"
+#include <stdio.h>
+#include <time.h>
+#include <signal.h>
+
+struct global g_extern;
+struct settings g_settings;
+
+#define FRAME_SIZE 512
+#define QUEUE_SIZE (32 * 1024)
+#define PREFIX_MAGIC 0x53504543u
+
+struct fake_spectator
+{
+   int fd;
+   int id;
+   bool slow;
+
+   uint32_t prefix[4]; // Magic, id, start position (lo, hi).
+   size_t prefix_ptr;
+   uint64_t pos;
+   bool failed;
+};
+
+struct reader
+{
+   struct fake_spectator *specs;
+   unsigned num_specs;
+
+   slock_t *lock;
+   bool quit;
+};
+
+static double get_time(void)
+{
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return tv.tv_sec + tv.tv_nsec / 1000000000.0;
+}
+
+static inline uint8_t stream_byte(uint64_t pos)
+{
+   return (uint8_t)(pos * 7 + (pos >> 8));
+}
+
+static void read_spectator(struct fake_spectator *spec)
+{
+   uint8_t buf[4096];
+   for (;;)
+   {
+      ssize_t ret = recv(spec->fd, buf, sizeof(buf), 0);
+      if (ret <= 0)
+         return;
+
+      const uint8_t *data = buf;
+      size_t size = ret;
+
+      if (spec->prefix_ptr < sizeof(spec->prefix))
+      {
+         size_t copy = sizeof(spec->prefix) - spec->prefix_ptr;
+         if (copy > size)
+            copy = size;
+         memcpy((uint8_t*)spec->prefix + spec->prefix_ptr, data, copy);
+         spec->prefix_ptr += copy;
+         data += copy;
+         size -= copy;
+
+         if (spec->prefix_ptr == sizeof(spec->prefix))
+         {
+            if (spec->prefix[0] != PREFIX_MAGIC || spec->prefix[1] != (uint32_t)spec->id)
+               spec->failed = true;
+            spec->pos = spec->prefix[2] | ((uint64_t)spec->prefix[3] << 32);
+         }
+      }
+
+      for (size_t i = 0; i < size; i++, spec->pos++)
+         if (data[i] != stream_byte(spec->pos))
+            spec->failed = true;
+   }
+}
+
+static void reader_thread(void *data)
+{
+   struct reader *reader = (struct reader*)data;
+
+   int epoll_fd = epoll_create(64);
+   for (unsigned i = 0; i < reader->num_specs; i++)
+   {
+      struct fake_spectator *spec = &reader->specs[i];
+      if (spec->slow)
+         continue;
+
+      struct epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLIN;
+      event.data.ptr = spec;
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, spec->fd, &event);
+   }
+
+   for (;;)
+   {
+      slock_lock(reader->lock);
+      bool quit = reader->quit;
+      slock_unlock(reader->lock);
+      if (quit)
+         break;
+
+      struct epoll_event events[64];
+      int num = epoll_wait(epoll_fd, events, 64, 10);
+      for (int i = 0; i < num; i++)
+      {
+         struct fake_spectator *spec = (struct fake_spectator*)events[i].data.ptr;
+         slock_lock(reader->lock);
+         read_spectator(spec);
+         slock_unlock(reader->lock);
+      }
+   }
+
+   close(epoll_fd);
+}
+
+static bool connect_spectator(netplay_broadcast_t *bc, int listen_fd,
+      const struct sockaddr_in *addr, struct fake_spectator *spec, bool slow)
+{
+   spec->slow = slow;
+   spec->fd = socket(AF_INET, SOCK_STREAM, 0);
+   if (spec->fd < 0)
+      return false;
+
+   // Keep the kernel from absorbing too much for those who never read.
+   if (slow)
+   {
+      int bufsize = 4096;
+      setsockopt(spec->fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(int));
+   }
+
+   if (connect(spec->fd, (const struct sockaddr*)addr, sizeof(*addr)) < 0)
+      return false;
+
+   int fd = accept(listen_fd, NULL, NULL);
+   if (fd < 0)
+      return false;
+
+   if (slow)
+   {
+      int bufsize = 4096;
+      setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(int));
+   }
+
+   if (!socket_nonblock(spec->fd))
+      return false;
+
+   // The id is only known once added, and it is simply handed out in order.
+   uint64_t start = bc->write_pos;
+   uint32_t prefix[4] = {
+      PREFIX_MAGIC,
+      (uint32_t)bc->next_id,
+      (uint32_t)start,
+      (uint32_t)(start >> 32),
+   };
+
+   spec->id = netplay_broadcast_add(bc, fd, prefix, sizeof(prefix));
+   return spec->id >= 0;
+}
+
+int main(int argc, char *argv[])
+{
+   unsigned num_specs = argc > 1 ? strtoul(argv[1], NULL, 0) : 256;
+   unsigned frames = argc > 2 ? strtoul(argv[2], NULL, 0) : 2000;
+   unsigned num_slow = num_specs / 8;
+
+   if (!num_specs || !frames)
+   {
+      fprintf(stderr, "Usage: %s [spectators] [frames]\n", argv[0]);
+      return 1;
+   }
+
+   signal(SIGPIPE, SIG_IGN);
+
+   int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+   struct sockaddr_in addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   socklen_t addr_len = sizeof(addr);
+   if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+         listen(listen_fd, 64) < 0 || getsockname(listen_fd, (struct sockaddr*)&addr, &addr_len) < 0)
+   {
+      fprintf(stderr, "Failed to set up loopback listener.\n");
+      return 1;
+   }
+
+   netplay_broadcast_t *bc = netplay_broadcast_new(QUEUE_SIZE);
+   struct fake_spectator *specs = (struct fake_spectator*)calloc(num_specs, sizeof(*specs));
+   if (!bc || !specs)
+      return 1;
+
+   // Half join before the first frame, the rest halfway through.
+   // Every eighth spectator never reads.
+   unsigned joined = 0;
+   unsigned first_half = num_specs / 2;
+   for (; joined < first_half; joined++)
+   {
+      if (!connect_spectator(bc, listen_fd, &addr, &specs[joined], joined % 8 == 7))
+      {
+         fprintf(stderr, "Failed to connect spectator #%u.\n", joined);
+         return 1;
+      }
+   }
+
+   printf("%u spectators (%u never read), %u frames of %u bytes, %u KiB queue.\n",
+         num_specs, num_slow, frames, FRAME_SIZE, QUEUE_SIZE / 1024);
+
+   struct reader reader = {0};
+   reader.specs = specs;
+   reader.num_specs = num_specs;
+   reader.lock = slock_new();
+
+   // Spectators joining later are only picked up by a reader started after they are connected.
+   sthread_t *thread = sthread_create(reader_thread, &reader);
+   sthread_t *late_thread = NULL;
+
+   struct reader late_reader = {0};
+
+   uint8_t frame[FRAME_SIZE];
+   uint64_t pos = 0;
+   double max_push = 0.0;
+   double total_push = 0.0;
+
+   for (unsigned f = 0; f < frames; f++)
+   {
+      if (f == frames / 2)
+      {
+         for (; joined < num_specs; joined++)
+         {
+            if (!connect_spectator(bc, listen_fd, &addr, &specs[joined], joined % 8 == 7))
+            {
+               fprintf(stderr, "Failed to connect spectator #%u.\n", joined);
+               return 1;
+            }
+         }
+
+         late_reader.specs = specs + first_half;
+         late_reader.num_specs = num_specs - first_half;
+         late_reader.lock = reader.lock;
+         late_thread = sthread_create(reader_thread, &late_reader);
+      }
+
+      for (unsigned i = 0; i < FRAME_SIZE; i++)
+         frame[i] = stream_byte(pos + i);
+      pos += FRAME_SIZE;
+
+      double start = get_time();
+      netplay_broadcast_push(bc, frame, sizeof(frame));
+      double elapsed = get_time() - start;
+
+      total_push += elapsed;
+      if (elapsed > max_push)
+         max_push = elapsed;
+
+      // Emulate a host running at a few hundred frames per second.
+      struct timespec tv = { 0, 2000000 };
+      nanosleep(&tv, NULL);
+   }
+
+   // Wait for everyone still connected to catch up.
+   double deadline = get_time() + 10.0;
+   bool done = false;
+   while (!done && get_time() < deadline)
+   {
+      done = true;
+      slock_lock(reader.lock);
+      for (unsigned i = 0; i < num_specs; i++)
+         if (!specs[i].slow && specs[i].pos != pos)
+            done = false;
+      slock_unlock(reader.lock);
+
+      struct timespec tv = { 0, 10000000 };
+      nanosleep(&tv, NULL);
+   }
+
+   slock_lock(reader.lock);
+   reader.quit = true;
+   late_reader.quit = true;
+   slock_unlock(reader.lock);
+   sthread_join(thread);
+   if (late_thread)
+      sthread_join(late_thread);
+
+   bool *dropped = (bool*)calloc(num_specs, sizeof(bool));
+   unsigned num_dropped = 0;
+   int id;
+   while ((id = netplay_broadcast_get_dropped(bc)) >= 0)
+   {
+      if ((unsigned)id < num_specs)
+         dropped[id] = true;
+      num_dropped++;
+   }
+
+   bool ret = true;
+   for (unsigned i = 0; i < num_specs; i++)
+   {
+      const struct fake_spectator *spec = &specs[i];
+      if (spec->slow && !dropped[spec->id])
+      {
+         fprintf(stderr, "Spectator #%d never read, but was not evicted.\n", spec->id);
+         ret = false;
+      }
+      else if (!spec->slow && (dropped[spec->id] || spec->failed || spec->pos != pos))
+      {
+         fprintf(stderr, "Spectator #%d got a broken stream (%s, %llu of %llu bytes).\n",
+               spec->id, dropped[spec->id] ? "evicted" : "connected",
+               (unsigned long long)spec->pos, (unsigned long long)pos);
+         ret = false;
+      }
+   }
+
+   printf("Evicted %u spectators, %u still connected.\n", num_dropped, netplay_broadcast_count(bc));
+   printf("Push: %.2f us average, %.2f us worst.\n", 1000000.0 * total_push / frames, 1000000.0 * max_push);
+   printf("%s\n", ret ? "OK" : "FAILED");
+
+   netplay_broadcast_free(bc);
+   for (unsigned i = 0; i < num_specs; i++)
+      close(specs[i].fd);
+   close(listen_fd);
+   slock_free(reader.lock);
+   free(dropped);
+   free(specs);
+   return ret ? 0 : 1;
+}
+
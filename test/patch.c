@@ -0,0 +1,479 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Builds random targets from random sources, along with BPS patches using every action,
+// and UPS/IPS patches from diffing the two. Checks that every patch reproduces the target,
+// that UPS also applies in reverse, and that broken patches and wrong sources are caught.
+// Then measures patching a large image.
+
+#include "../patch.c"
+#include "../general.h"
+#include <time.h>
+#include <unistd.h>
+
+struct global g_extern;
+struct settings g_settings;
+
+struct buffer
+{
+   uint8_t *data;
+   size_t size;
+   size_t cap;
+};
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void)
+{
+   rng_state = rng_state * 1664525u + 1013904223u;
+   return rng_state >> 8;
+}
+
+static double get_time(void)
+{
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return tv.tv_sec + tv.tv_nsec / 1000000000.0;
+}
+
+static void reserve(struct buffer *buf, size_t size)
+{
+   if (buf->size + size <= buf->cap)
+      return;
+
+   while (buf->size + size > buf->cap)
+      buf->cap = buf->cap ? buf->cap * 2 : 4096;
+   buf->data = (uint8_t*)realloc(buf->data, buf->cap);
+   if (!buf->data)
+      abort();
+}
+
+static void put(struct buffer *buf, uint8_t data)
+{
+   reserve(buf, 1);
+   buf->data[buf->size++] = data;
+}
+
+static void put_data(struct buffer *buf, const uint8_t *data, size_t size)
+{
+   reserve(buf, size);
+   memcpy(buf->data + buf->size, data, size);
+   buf->size += size;
+}
+
+static void put_number(struct buffer *buf, uint64_t data)
+{
+   for (;;)
+   {
+      uint8_t x = data & 0x7f;
+      data >>= 7;
+      if (!data)
+      {
+         put(buf, x | 0x80);
+         break;
+      }
+      put(buf, x);
+      data--;
+   }
+}
+
+static void put32le(struct buffer *buf, uint32_t data)
+{
+   for (unsigned i = 0; i < 32; i += 8)
+      put(buf, data >> i);
+}
+
+static void put_be(struct buffer *buf, uint32_t data, unsigned bytes)
+{
+   while (bytes--)
+      put(buf, data >> (bytes * 8));
+}
+
+static void put_offset(struct buffer *buf, size_t *rel, size_t offset)
+{
+   if (offset >= *rel)
+      put_number(buf, (uint64_t)(offset - *rel) << 1);
+   else
+      put_number(buf, ((uint64_t)(*rel - offset) << 1) | 1);
+   *rel = offset;
+}
+
+static void put_action(struct buffer *buf, unsigned mode, size_t length)
+{
+   put_number(buf, ((uint64_t)(length - 1) << 2) | mode);
+}
+
+static size_t rand_length(size_t max)
+{
+   // Mostly short, sometimes long.
+   size_t len = (rng() & 7) ? 1 + rng() % 64 : 1 + rng() % (256 * 1024);
+   return len < max ? len : max;
+}
+
+// Builds a target out of random BPS actions, and the BPS patch for it.
+static void make_bps(const uint8_t *source, size_t source_size, size_t target_size,
+      struct buffer *target, struct buffer *patch)
+{
+   size_t source_rel = 0, target_rel = 0;
+
+   put_data(patch, (const uint8_t*)"BPS1", 4);
+   put_number(patch, source_size);
+   put_number(patch, target_size);
+   put_number(patch, 5);
+   put_data(patch, (const uint8_t*)"notes", 5);
+
+   reserve(target, target_size);
+   while (target->size < target_size)
+   {
+      size_t out = target->size;
+      size_t len = rand_length(target_size - out);
+      unsigned choice = rng() % 8;
+
+      if (choice < 3 && out < source_size)
+      {
+         if (len > source_size - out)
+            len = source_size - out;
+         put_action(patch, SOURCE_READ, len);
+         put_data(target, source + out, len);
+      }
+      else if (choice < 5)
+      {
+         size_t offset = rng() % source_size;
+         if (len > source_size - offset)
+            len = source_size - offset;
+         put_action(patch, SOURCE_COPY, len);
+         put_offset(patch, &source_rel, offset);
+         put_data(target, source + offset, len);
+         source_rel += len;
+      }
+      else if (choice < 7 && out > 0)
+      {
+         // Short distances overlap what is being written.
+         size_t dist = (rng() & 1) ? 1 + rng() % 4 : 1 + rng() % out;
+         if (dist > out)
+            dist = out;
+         put_action(patch, TARGET_COPY, len);
+         put_offset(patch, &target_rel, out - dist);
+         for (size_t i = 0; i < len; i++)
+            put(target, target->data[out - dist + i]);
+         target_rel += len;
+      }
+      else
+      {
+         if (len > 4096)
+            len = 4096;
+         put_action(patch, TARGET_READ, len);
+         for (size_t i = 0; i < len; i++)
+         {
+            uint8_t data = rng();
+            put(patch, data);
+            put(target, data);
+         }
+      }
+   }
+
+   put32le(patch, crc32_calculate(source, source_size));
+   put32le(patch, crc32_calculate(target->data, target->size));
+   put32le(patch, crc32_calculate(patch->data, patch->size));
+}
+
+static inline uint8_t byte_at(const uint8_t *data, size_t size, size_t i)
+{
+   return i < size ? data[i] : 0;
+}
+
+static void make_ups(const uint8_t *source, size_t source_size,
+      const uint8_t *target, size_t target_size, struct buffer *patch)
+{
+   put_data(patch, (const uint8_t*)"UPS1", 4);
+   put_number(patch, source_size);
+   put_number(patch, target_size);
+
+   size_t max_size = source_size > target_size ? source_size : target_size;
+   size_t pos = 0, i = 0;
+   while (i < max_size)
+   {
+      if (byte_at(source, source_size, i) == byte_at(target, target_size, i))
+      {
+         i++;
+         continue;
+      }
+
+      put_number(patch, i - pos);
+      for (; i < max_size; i++)
+      {
+         uint8_t x = byte_at(source, source_size, i) ^ byte_at(target, target_size, i);
+         if (!x)
+            break;
+         put(patch, x);
+      }
+      put(patch, 0);
+      pos = ++i;
+   }
+
+   put32le(patch, crc32_calculate(source, source_size));
+   put32le(patch, crc32_calculate(target, target_size));
+   put32le(patch, crc32_calculate(patch->data, patch->size));
+}
+
+static void make_ips(const uint8_t *source, size_t source_size,
+      const uint8_t *target, size_t target_size, struct buffer *patch)
+{
+   put_data(patch, (const uint8_t*)"PATCH", 5);
+
+   size_t i = 0;
+   while (i < target_size)
+   {
+      if (i < source_size && source[i] == target[i])
+      {
+         i++;
+         continue;
+      }
+
+      // A record at the EOF marker address would end the patch, so start one byte earlier.
+      if (i == IPS_EOF)
+         i--;
+
+      size_t end = i + 1;
+      while (end < target_size && end - i < 0xffff && !(end < source_size && source[end] == target[end]))
+         end++;
+
+      size_t rle = 1;
+      while (i + rle < end && target[i + rle] == target[i])
+         rle++;
+
+      put_be(patch, i, 3);
+      if (rle == end - i && rle >= 8)
+      {
+         put_be(patch, 0, 2);
+         put_be(patch, rle, 2);
+         put(patch, target[i]);
+      }
+      else
+      {
+         put_be(patch, end - i, 2);
+         put_data(patch, target + i, end - i);
+      }
+      i = end;
+   }
+
+   put_data(patch, (const uint8_t*)"EOF", 3);
+   if (target_size != source_size)
+      put_be(patch, target_size, 3);
+}
+
+static bool write_patch(const char *path, const struct buffer *patch)
+{
+   FILE *file = fopen(path, "wb");
+   if (!file)
+      return false;
+   bool ret = fwrite(patch->data, 1, patch->size, file) == patch->size;
+   fclose(file);
+   return ret;
+}
+
+// Applies the patch file and compares with the expected target, or expects the given error.
+static bool check_patch(const char *path, patch_type_t type,
+      const uint8_t *source, size_t source_size,
+      const uint8_t *expected, size_t expected_size, patch_error_t expected_err, double *time)
+{
+   patch_t *patch = patch_open(path, type);
+   if (!patch)
+      return false;
+
+   double start = get_time();
+
+   uint8_t *target = NULL;
+   size_t target_size = 0;
+   patch_error_t err = patch_prepare(patch, source_size, &target_size);
+   if (err == PATCH_SUCCESS)
+   {
+      target = (uint8_t*)malloc(target_size ? target_size : 1);
+      err = patch_apply(patch, source, target);
+   }
+
+   if (time)
+      *time = get_time() - start;
+
+   patch_close(patch);
+
+   bool ret = err == expected_err;
+   if (ret && err == PATCH_SUCCESS)
+      ret = target_size == expected_size && memcmp(target, expected, target_size) == 0;
+
+   if (!ret)
+      fprintf(stderr, "%s: Got error #%u, expected #%u.\n", path, (unsigned)err, (unsigned)expected_err);
+
+   free(target);
+   return ret;
+}
+
+static void make_source(uint8_t *source, size_t size)
+{
+   // Somewhat compressible, like a ROM.
+   for (size_t i = 0; i < size; i++)
+      source[i] = (rng() & 3) ? (uint8_t)(i >> 6) : (uint8_t)rng();
+}
+
+static bool run_small(const char *dir, unsigned round)
+{
+   char path[PATH_MAX];
+   bool ret = true;
+
+   size_t source_size = 1 + rng() % (2 * 1024 * 1024);
+   size_t target_size = (rng() & 1) ? source_size : 1 + rng() % (2 * 1024 * 1024);
+   uint8_t *source = (uint8_t*)malloc(source_size);
+   make_source(source, source_size);
+
+   struct buffer target = {0}, bps = {0}, ups = {0}, ips = {0};
+   make_bps(source, source_size, target_size, &target, &bps);
+   make_ups(source, source_size, target.data, target.size, &ups);
+   make_ips(source, source_size, target.data, target.size, &ips);
+
+   snprintf(path, sizeof(path), "%s/test.bps", dir);
+   ret &= write_patch(path, &bps) &&
+      check_patch(path, PATCH_TYPE_BPS, source, source_size, target.data, target.size, PATCH_SUCCESS, NULL);
+
+   snprintf(path, sizeof(path), "%s/test.ups", dir);
+   ret &= write_patch(path, &ups) &&
+      check_patch(path, PATCH_TYPE_UPS, source, source_size, target.data, target.size, PATCH_SUCCESS, NULL);
+   if (target.size != source_size)
+   {
+      ret &= check_patch(path, PATCH_TYPE_UPS, target.data, target.size,
+            source, source_size, PATCH_SUCCESS, NULL);
+   }
+
+   snprintf(path, sizeof(path), "%s/test.ips", dir);
+   ret &= write_patch(path, &ips) &&
+      check_patch(path, PATCH_TYPE_IPS, source, source_size, target.data, target.size, PATCH_SUCCESS, NULL);
+
+   // A source which does not match must be caught.
+   source[rng() % source_size] ^= 0x10;
+   snprintf(path, sizeof(path), "%s/test.bps", dir);
+   ret &= check_patch(path, PATCH_TYPE_BPS, source, source_size, NULL, 0, PATCH_SOURCE_CHECKSUM_INVALID, NULL);
+   snprintf(path, sizeof(path), "%s/test.ups", dir);
+   ret &= check_patch(path, PATCH_TYPE_UPS, source, source_size, NULL, 0, PATCH_SOURCE_INVALID, NULL);
+
+   // So must broken patches, without ever reading or writing out of bounds.
+   size_t flip = 4 + rng() % (bps.size - 4);
+   bps.data[flip] ^= 1 << (rng() % 8);
+   snprintf(path, sizeof(path), "%s/test.bps", dir);
+   write_patch(path, &bps);
+   patch_t *patch = patch_open(path, PATCH_TYPE_BPS);
+   size_t size;
+   if (patch_prepare(patch, source_size, &size) == PATCH_SUCCESS)
+   {
+      uint8_t *target_data = (uint8_t*)malloc(size ? size : 1);
+      if (patch_apply(patch, source, target_data) == PATCH_SUCCESS)
+      {
+         fprintf(stderr, "Round %u: Broken BPS patch applied.\n", round);
+         ret = false;
+      }
+      free(target_data);
+   }
+   patch_close(patch);
+
+   ups.size -= 1 + rng() % (ups.size - 4);
+   snprintf(path, sizeof(path), "%s/test.ups", dir);
+   write_patch(path, &ups);
+   patch = patch_open(path, PATCH_TYPE_UPS);
+   if (patch_prepare(patch, source_size, &size) == PATCH_SUCCESS)
+   {
+      uint8_t *target_data = (uint8_t*)malloc(size ? size : 1);
+      if (patch_apply(patch, source, target_data) == PATCH_SUCCESS)
+      {
+         fprintf(stderr, "Round %u: Truncated UPS patch applied.\n", round);
+         ret = false;
+      }
+      free(target_data);
+   }
+   patch_close(patch);
+
+   if (!ret)
+      fprintf(stderr, "Round %u failed (%u -> %u bytes).\n", round, (unsigned)source_size, (unsigned)target.size);
+
+   free(source);
+   free(target.data);
+   free(bps.data);
+   free(ups.data);
+   free(ips.data);
+   return ret;
+}
+
+// Patches a large image, mostly made from copies, like a translation or a hack.
+static bool run_large(const char *dir, size_t size)
+{
+   char path[PATH_MAX];
+   bool ret = true;
+
+   uint8_t *source = (uint8_t*)malloc(size);
+   if (!source)
+      return false;
+   make_source(source, size);
+
+   struct buffer target = {0}, bps = {0}, ups = {0};
+   make_bps(source, size, size, &target, &bps);
+   make_ups(source, size, target.data, target.size, &ups);
+
+   double bps_time = 0.0, ups_time = 0.0;
+   snprintf(path, sizeof(path), "%s/large.bps", dir);
+   ret &= write_patch(path, &bps) &&
+      check_patch(path, PATCH_TYPE_BPS, source, size, target.data, target.size, PATCH_SUCCESS, &bps_time);
+   snprintf(path, sizeof(path), "%s/large.ups", dir);
+   ret &= write_patch(path, &ups) &&
+      check_patch(path, PATCH_TYPE_UPS, source, size, target.data, target.size, PATCH_SUCCESS, &ups_time);
+
+   printf("%u MiB image, %u KiB patch buffer.\n", (unsigned)(size >> 20), (unsigned)(sizeof(patch_t) >> 10));
+   printf("BPS: %7.1f MiB/s (%u KiB patch).\n", size / bps_time / (1024 * 1024), (unsigned)(bps.size >> 10));
+   printf("UPS: %7.1f MiB/s (%u KiB patch).\n", size / ups_time / (1024 * 1024), (unsigned)(ups.size >> 10));
+
+   free(source);
+   free(target.data);
+   free(bps.data);
+   free(ups.data);
+   return ret;
+}
+
+int main(int argc, char *argv[])
+{
+   size_t large_size = (argc > 1 ? strtoul(argv[1], NULL, 0) : 64) << 20;
+   hash_init();
+
+   char dir[] = "/tmp/rarch-patch-XXXXXX";
+   if (!mkdtemp(dir))
+   {
+      fprintf(stderr, "Failed to create temporary directory.\n");
+      return 1;
+   }
+
+   bool ret = true;
+   for (unsigned i = 0; i < 32; i++)
+      ret &= run_small(dir, i);
+
+   ret &= run_large(dir, large_size);
+
+   printf("%s\n", ret ? "OK" : "FAILED");
+
+   char path[PATH_MAX];
+   const char *files[] = { "test.bps", "test.ups", "test.ips", "large.bps", "large.ups" };
+   for (unsigned i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+   {
+      snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+      unlink(path);
+   }
+   rmdir(dir);
+
+   return ret ? 0 : 1;
+}
@@ -0,0 +1,257 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
+ * 
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Benchmarks the rewind delta kernels against the plain C loop,
+// verifies that every kernel generates bit-identical rewind buffers,
+// and that popping or seeking the buffer replays every pushed frame exactly.
+
+#include "../rewind.c"
+#include <stdio.h>
+#include <time.h>
+
+struct global g_extern;
+struct settings g_settings;
+
+static double get_time(void)
+{
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return tv.tv_sec + tv.tv_nsec / 1000000000.0;
+}
+
+// Dirties a few runs of words, like a typical frame would (WRAM, VRAM uploads, etc).
+static void mutate_state(uint32_t *state, size_t words, unsigned seed)
+{
+   srand(seed);
+   for (unsigned run = 0; run < 16; run++)
+   {
+      size_t start = (size_t)rand() % words;
+      size_t len = 1 + (size_t)rand() % 256;
+      for (size_t i = start; i < start + len && i < words; i++)
+         state[i] ^= (uint32_t)rand() | 1;
+   }
+}
+
+static double bench_kernel(find_change_t kernel, const uint32_t *a, const uint32_t *b, size_t words, unsigned iterations)
+{
+   size_t changes = 0;
+   double start = get_time();
+   for (unsigned iter = 0; iter < iterations; iter++)
+   {
+      for (size_t i = kernel(a, b, 0, words); i < words; i = kernel(a, b, i + 1, words))
+         changes++;
+   }
+   double elapsed = get_time() - start;
+
+   if (!changes)
+      fprintf(stderr, "No changes found?\n");
+
+   return ((double)words * sizeof(uint32_t) * iterations) / (elapsed * 1e9);
+}
+
+static bool verify_kernel(find_change_t kernel, size_t state_size)
+{
+   size_t words = state_size / sizeof(uint32_t);
+   uint32_t *frame = (uint32_t*)calloc(words, sizeof(uint32_t));
+   if (!frame)
+      return false;
+
+   state_manager_t *ref = state_manager_new(state_size, state_size * 16, frame);
+   state_manager_t *test = state_manager_new(state_size, state_size * 16, frame);
+   if (!ref || !test)
+      return false;
+
+   ref->find_change = find_change_c;
+   test->find_change = kernel;
+
+   for (unsigned i = 0; i < 64; i++)
+   {
+      mutate_state(frame, words, i);
+      state_manager_push(ref, frame);
+      state_manager_push(test, frame);
+   }
+
+   bool ret = ref->top_ptr == test->top_ptr && ref->bottom_ptr == test->bottom_ptr &&
+      memcmp(ref->buffer, test->buffer, ref->buf_size * sizeof(uint64_t)) == 0;
+
+   state_manager_free(ref);
+   state_manager_free(test);
+   free(frame);
+   return ret;
+}
+
+static bool verify_replay(size_t state_size, bool threaded)
+{
+   const unsigned frames = 64;
+   size_t words = state_size / sizeof(uint32_t);
+   uint32_t *history = (uint32_t*)calloc(words * frames, sizeof(uint32_t));
+   if (!history)
+      return false;
+
+   state_manager_t *state = state_manager_new(state_size, state_size * 16, history);
+   if (!state)
+      return false;
+
+#ifdef HAVE_THREADS
+   if (threaded && !state_manager_start_thread(state))
+      return false;
+#endif
+
+   for (unsigned i = 1; i < frames; i++)
+   {
+      uint32_t *frame = history + i * words;
+      memcpy(frame, frame - words, state_size);
+      mutate_state(frame, words, i);
+      state_manager_push(state, frame);
+   }
+
+   // Popping drains the worker, so only trust top_ptr after the first pop.
+   void *data;
+   bool ret = state_manager_pop(state, &data) && !memcmp(data, history + (frames - 1) * words, state_size);
+   size_t footprint = ((state->top_ptr - 1) * sizeof(uint64_t)) / (frames - 1);
+
+   for (unsigned i = frames - 1; ret && i-- > 0; )
+   {
+      if (!state_manager_pop(state, &data) || memcmp(data, history + i * words, state_size))
+      {
+         fprintf(stderr, "Replay mismatch at frame %u.\n", i);
+         ret = false;
+         break;
+      }
+   }
+
+   if (ret && !threaded)
+   {
+      printf("Delta footprint: %u bytes/frame (raw state: %u bytes).\n",
+            (unsigned)footprint, (unsigned)state_size);
+   }
+
+   state_manager_free(state);
+   free(history);
+   return ret;
+}
+
+static bool verify_seek(size_t state_size)
+{
+   const unsigned frames = 256;
+   size_t words = state_size / sizeof(uint32_t);
+   uint32_t *history = (uint32_t*)calloc(words * frames, sizeof(uint32_t));
+   if (!history)
+      return false;
+
+   state_manager_t *state = state_manager_new(state_size, state_size * 64, history);
+   if (!state || !state_manager_init_keyframes(state, 16, 8))
+      return false;
+
+   for (unsigned i = 1; i < frames; i++)
+   {
+      uint32_t *frame = history + i * words;
+      memcpy(frame, frame - words, state_size);
+      mutate_state(frame, words, i);
+      state_manager_push(state, frame);
+   }
+
+   // Seek back in uneven steps, hitting keyframes, deltas in between, and a push after a seek.
+   static const unsigned steps[] = { 1, 7, 16, 33, 40, 2, 100 };
+   bool ret = true;
+   unsigned current = frames - 1;
+   for (unsigned i = 0; i < sizeof(steps) / sizeof(steps[0]) && ret; i++)
+   {
+      void *data;
+      unsigned rewound = state_manager_seek(state, steps[i], &data);
+      current -= rewound;
+      if (rewound != steps[i] || memcmp(data, history + current * words, state_size))
+      {
+         fprintf(stderr, "Seek mismatch at frame %u.\n", current);
+         ret = false;
+      }
+
+      if (i == 3)
+      {
+         // Replay the frame we just rewound past. Keyframes in the old future must be gone.
+         current++;
+         state_manager_push(state, history + current * words);
+      }
+   }
+
+   state_manager_free(state);
+   free(history);
+   return ret;
+}
+
+static bool run_kernel(const char *ident, find_change_t kernel,
+      const uint32_t *a, const uint32_t *b, size_t words, unsigned iterations, double base)
+{
+   bool ok = verify_kernel(kernel, words * sizeof(uint32_t));
+   double gbps = bench_kernel(kernel, a, b, words, iterations);
+   printf("%-6s %8.2f GB/s (%5.2fx) %s\n", ident, gbps, base > 0.0 ? gbps / base : 1.0, ok ? "[OK]" : "[MISMATCH]");
+   return ok;
+}
+
+int main(int argc, char *argv[])
+{
+   size_t state_size = (argc > 1 ? strtoul(argv[1], NULL, 0) : 512) << 10;
+   unsigned iterations = argc > 2 ? strtoul(argv[2], NULL, 0) : 1000;
+   state_size &= ~(size_t)3;
+   size_t words = state_size / sizeof(uint32_t);
+
+   if (!words)
+   {
+      fprintf(stderr, "Usage: %s [state size in KiB] [iterations]\n", argv[0]);
+      return 1;
+   }
+
+   uint32_t *a = (uint32_t*)calloc(words, sizeof(uint32_t));
+   uint32_t *b = (uint32_t*)calloc(words, sizeof(uint32_t));
+   if (!a || !b)
+      return 1;
+
+   mutate_state(a, words, 1000);
+   memcpy(b, a, words * sizeof(uint32_t));
+   mutate_state(b, words, 1001);
+
+   struct rarch_cpu_features cpu;
+   rarch_get_cpu_features(&cpu);
+
+   printf("State size: %u KiB, %u iterations.\n", (unsigned)(state_size >> 10), iterations);
+   if (!verify_replay(state_size, false))
+      return 1;
+#ifdef HAVE_THREADS
+   if (!verify_replay(state_size, true))
+      return 1;
+#endif
+   if (!verify_seek(state_size))
+      return 1;
+
+   bool ok = true;
+   double base = bench_kernel(find_change_c, a, b, words, iterations);
+   printf("%-6s %8.2f GB/s (%5.2fx)\n", "C", base, 1.0);
+
+#if defined(__SSE2__)
+   if (cpu.simd & RARCH_SIMD_SSE2)
+      ok &= run_kernel("SSE2", find_change_sse2, a, b, words, iterations, base);
+#endif
+#ifdef REWIND_HAVE_AVX2
+   if (cpu.simd & RARCH_SIMD_AVX2)
+      ok &= run_kernel("AVX2", find_change_avx2, a, b, words, iterations, base);
+#endif
+#if defined(__ARM_NEON__)
+   ok &= run_kernel("NEON", find_change_neon, a, b, words, iterations, base);
+#endif
+
+   free(a);
+   free(b);
+   return ok ? 0 : 1;
+}
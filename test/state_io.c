@@ -0,0 +1,312 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Benchmarks how long saving a state stalls the caller, against serializing and writing it directly.
+// Verifies that compressed, raw and incompressible states read back exactly,
+// that reads see queued writes, that prefetched states load from memory,
+// and that failed writes are reported without leaving temporary files behind.
+
+#include "../state_io.c"
+#include <time.h>
+#include <unistd.h>
+
+struct global g_extern;
+struct settings g_settings;
+
+#define STATE_SIZE (16 * 1024 * 1024)
+
+static double get_time(void)
+{
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return tv.tv_sec + tv.tv_nsec / 1000000000.0;
+}
+
+static const uint8_t *serialize_src;
+
+static bool serialize(void *data, size_t size)
+{
+   memcpy(data, serialize_src, size);
+   return true;
+}
+
+// Mostly zeroes with some structure, like emulated RAM and VRAM tend to be.
+static void fill_state(uint8_t *state, size_t size, unsigned seed)
+{
+   srand(seed);
+   memset(state, 0, size);
+   for (size_t i = 0; i < size; i += 64)
+   {
+      if (rand() % 4 == 0)
+      {
+         for (size_t j = 0; j < 16 && i + j < size; j++)
+            state[i + j] = (uint8_t)(rand() & 0x0f);
+      }
+   }
+}
+
+static void fill_random(uint8_t *state, size_t size, unsigned seed)
+{
+   srand(seed);
+   for (size_t i = 0; i < size; i++)
+      state[i] = (uint8_t)rand();
+}
+
+static long file_size(const char *path, uint8_t *magic)
+{
+   FILE *file = fopen(path, "rb");
+   if (!file)
+      return -1;
+
+   if (magic && fread(magic, 1, STATE_MAGIC_SIZE, file) != STATE_MAGIC_SIZE)
+      memset(magic, 0, STATE_MAGIC_SIZE);
+
+   fseek(file, 0, SEEK_END);
+   long size = ftell(file);
+   fclose(file);
+   return size;
+}
+
+static bool read_matches(state_io_t *io, const char *path, const uint8_t *expected, size_t expected_size,
+      double *read_time)
+{
+   size_t size = 0;
+   double start = get_time();
+   const uint8_t *data = (const uint8_t*)state_io_read(io, path, &size);
+   if (read_time)
+      *read_time = get_time() - start;
+   return data && size == expected_size && memcmp(data, expected, size) == 0;
+}
+
+// Writes a state with a fresh io, then reads it back from disk with another.
+static bool round_trip(const char *path, bool compress, const uint8_t *state, size_t size, bool expect_compressed)
+{
+   state_io_t *io = state_io_new(compress);
+   if (!io)
+      return false;
+
+   serialize_src = state;
+   bool ret = state_io_write(io, path, size, serialize);
+   state_io_free(io);
+   if (!ret)
+      return false;
+
+   uint8_t magic[STATE_MAGIC_SIZE];
+   long written = file_size(path, magic);
+   bool compressed = memcmp(magic, STATE_MAGIC, STATE_MAGIC_SIZE) == 0;
+   if (written < 0 || compressed != expect_compressed ||
+         (!compressed && written != (long)size) || (compressed && written >= (long)size))
+   {
+      fprintf(stderr, "Unexpected file for \"%s\": %ld bytes, %scompressed.\n",
+            path, written, compressed ? "" : "un");
+      return false;
+   }
+
+   io = state_io_new(compress);
+   if (!io)
+      return false;
+   ret = read_matches(io, path, state, size, NULL);
+   state_io_free(io);
+
+   char tmp_path[PATH_MAX];
+   snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+   if (access(tmp_path, F_OK) == 0)
+   {
+      fprintf(stderr, "Temporary file was left behind.\n");
+      return false;
+   }
+
+   return ret;
+}
+
+int main(void)
+{
+   char dir[] = "/tmp/rarch-state-XXXXXX";
+   if (!mkdtemp(dir))
+   {
+      fprintf(stderr, "Failed to create temporary directory.\n");
+      return 1;
+   }
+
+   char path[PATH_MAX], raw_path[PATH_MAX], random_path[PATH_MAX], bad_path[PATH_MAX];
+   snprintf(path, sizeof(path), "%s/game.state", dir);
+   snprintf(raw_path, sizeof(raw_path), "%s/game.state1", dir);
+   snprintf(random_path, sizeof(random_path), "%s/game.state2", dir);
+   snprintf(bad_path, sizeof(bad_path), "%s/missing/game.state", dir);
+
+   bool ret = false;
+   state_io_t *io = NULL;
+   uint8_t *states[4] = {NULL};
+   for (unsigned i = 0; i < 4; i++)
+   {
+      states[i] = (uint8_t*)malloc(STATE_SIZE);
+      if (!states[i])
+         goto end;
+      fill_state(states[i], STATE_SIZE, i + 1);
+   }
+
+   if (!round_trip(path, true, states[0], STATE_SIZE, true))
+   {
+      fprintf(stderr, "Compressed state does not round trip.\n");
+      goto end;
+   }
+
+   if (!round_trip(raw_path, false, states[1], STATE_SIZE, false))
+   {
+      fprintf(stderr, "Raw state does not round trip.\n");
+      goto end;
+   }
+
+   fill_random(states[3], STATE_SIZE, 4);
+   if (!round_trip(random_path, true, states[3], STATE_SIZE, false))
+   {
+      fprintf(stderr, "Incompressible state does not round trip.\n");
+      goto end;
+   }
+   fill_state(states[3], STATE_SIZE, 4);
+
+   if (!round_trip(path, true, states[0], 1, false))
+   {
+      fprintf(stderr, "Tiny state does not round trip.\n");
+      goto end;
+   }
+
+   // Reads must see the newest queued state, whether or not it hit the disk yet.
+   io = state_io_new(true);
+   if (!io)
+      goto end;
+
+   for (unsigned i = 0; i < 8; i++)
+   {
+      serialize_src = states[i & 3];
+      if (!state_io_write(io, path, STATE_SIZE, serialize) ||
+            !read_matches(io, path, states[i & 3], STATE_SIZE, NULL))
+      {
+         fprintf(stderr, "Read of queued state #%u gives wrong data.\n", i);
+         goto end;
+      }
+   }
+   state_io_flush(io);
+
+   // Interleave slots, which pushes states out of memory and back in from disk.
+   serialize_src = states[2];
+   if (!state_io_write(io, raw_path, STATE_SIZE, serialize) ||
+         !read_matches(io, path, states[3], STATE_SIZE, NULL) ||
+         !read_matches(io, raw_path, states[2], STATE_SIZE, NULL))
+   {
+      fprintf(stderr, "Interleaved slots give wrong data.\n");
+      goto end;
+   }
+
+   // Failed writes get reported once.
+   char error_path[PATH_MAX];
+   serialize_src = states[0];
+   if (!state_io_write(io, bad_path, STATE_SIZE, serialize))
+      goto end;
+   state_io_flush(io);
+   if (!state_io_get_error(io, error_path, sizeof(error_path)) || strcmp(error_path, bad_path) != 0 ||
+         state_io_get_error(io, error_path, sizeof(error_path)))
+   {
+      fprintf(stderr, "Failed write was not reported.\n");
+      goto end;
+   }
+   state_io_free(io);
+   io = NULL;
+
+   // Cold load from disk, against loading a prefetched slot.
+   io = state_io_new(true);
+   if (!io)
+      goto end;
+
+   double cold_time, prefetch_time;
+   if (!read_matches(io, path, states[3], STATE_SIZE, &cold_time))
+      goto end;
+
+   state_io_prefetch(io, raw_path);
+   usleep(200000);
+   if (!read_matches(io, raw_path, states[2], STATE_SIZE, &prefetch_time))
+   {
+      fprintf(stderr, "Prefetched state gives wrong data.\n");
+      goto end;
+   }
+
+   // Loading right after asking for a prefetch waits for it instead of reading twice.
+   state_io_prefetch(io, path);
+   if (!read_matches(io, path, states[3], STATE_SIZE, NULL))
+   {
+      fprintf(stderr, "State being prefetched gives wrong data.\n");
+      goto end;
+   }
+
+   printf("Load: %.3f ms from disk, %.3f ms prefetched.\n", 1000.0 * cold_time, 1000.0 * prefetch_time);
+
+   // What saving used to cost the main thread: serialize, then write it all out.
+   double start = get_time();
+   FILE *file = fopen(raw_path, "wb");
+   if (!file)
+      goto end;
+   uint8_t *tmp = (uint8_t*)malloc(STATE_SIZE);
+   if (tmp)
+   {
+      serialize(tmp, STATE_SIZE);
+      fwrite(tmp, 1, STATE_SIZE, file);
+   }
+   fclose(file);
+   free(tmp);
+   double sync_time = get_time() - start;
+
+   double stall_time = 0.0;
+   for (unsigned i = 0; i < 4; i++)
+   {
+      serialize_src = states[i];
+      start = get_time();
+      if (!state_io_write(io, path, STATE_SIZE, serialize))
+         goto end;
+      stall_time += get_time() - start;
+      state_io_flush(io);
+   }
+
+   start = get_time();
+   for (unsigned i = 0; i < 4; i++)
+   {
+      serialize_src = states[i];
+      if (!state_io_write(io, path, STATE_SIZE, serialize))
+         goto end;
+   }
+   state_io_flush(io);
+   double total_time = (get_time() - start) / 4;
+
+   printf("Save: %.3f ms stall, %.3f ms serializing and writing directly, %.3f ms to disk with compression.\n",
+         1000.0 * stall_time / 4, 1000.0 * sync_time, 1000.0 * total_time);
+
+   uint8_t magic[STATE_MAGIC_SIZE];
+   printf("Size: %ld bytes compressed, %u bytes raw.\n", file_size(path, magic), (unsigned)STATE_SIZE);
+
+   ret = true;
+
+end:
+   printf("%s\n", ret ? "OK" : "FAILED");
+
+   state_io_free(io);
+   for (unsigned i = 0; i < 4; i++)
+      free(states[i]);
+
+   unlink(path);
+   unlink(raw_path);
+   unlink(random_path);
+   rmdir(dir);
+
+   return ret ? 0 : 1;
+}
@@ -304,7 +304,7 @@ bool scond_wait_timeout(scond_t *cond, slock_t *lock, unsigned timeout_ms)
 #endif
 
    now.tv_sec += timeout_ms / 1000;
-   now.tv_nsec += timeout_ms * 1000000L;
+   now.tv_nsec += (timeout_ms % 1000) * 1000000L;
 
    now.tv_sec += now.tv_nsec / 1000000000L;
    now.tv_nsec = now.tv_nsec % 1000000000L;
@@ -0,0 +1,60 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "zlib_util.h"
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+#ifdef WANT_RZLIB
+#include "deps/rzlib/zlib.h"
+#else
+#include <zlib.h>
+#endif
+
+bool zlib_inflate_buffer(void *dst, size_t dst_size, const void *src, size_t src_size)
+{
+   z_stream stream;
+   memset(&stream, 0, sizeof(stream));
+   if (inflateInit(&stream) != Z_OK)
+      return false;
+
+   stream.next_in   = (Bytef*)src;
+   stream.avail_in  = src_size;
+   stream.next_out  = (Bytef*)dst;
+   stream.avail_out = dst_size;
+
+   bool ret = inflate(&stream, Z_FINISH) == Z_STREAM_END && stream.total_out == dst_size;
+   inflateEnd(&stream);
+   return ret;
+}
+
+#ifdef HAVE_ZLIB_DEFLATE
+size_t zlib_deflate_bound(size_t size)
+{
+   return compressBound(size);
+}
+
+bool zlib_deflate_buffer(void *dst, size_t *dst_size, const void *src, size_t src_size)
+{
+   uLongf size = *dst_size;
+   if (compress2((Bytef*)dst, &size, (const Bytef*)src, src_size, Z_BEST_SPEED) != Z_OK)
+      return false;
+
+   *dst_size = size;
+   return true;
+}
+#endif
+
+#endif
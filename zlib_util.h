@@ -0,0 +1,48 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2012 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RARCH_ZLIB_UTIL_H
+#define __RARCH_ZLIB_UTIL_H
+
+#include <stddef.h>
+#include "boolean.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+// One-shot compression of whole buffers, such as save states.
+#ifdef HAVE_ZLIB
+
+// The bundled rzlib used on consoles can only inflate.
+#ifndef WANT_RZLIB
+#define HAVE_ZLIB_DEFLATE
+#endif
+
+// Inflates a zlib stream which must decompress to exactly dst_size bytes.
+bool zlib_inflate_buffer(void *dst, size_t dst_size, const void *src, size_t src_size);
+
+#ifdef HAVE_ZLIB_DEFLATE
+// Largest possible output of zlib_deflate_buffer() for size bytes.
+size_t zlib_deflate_bound(size_t size);
+
+// Deflates at the fastest level, as callers compress while something waits on it.
+// dst_size is the size of dst, and is set to the compressed size.
+bool zlib_deflate_buffer(void *dst, size_t *dst_size, const void *src, size_t src_size);
+#endif
+
+#endif
+
+#endif